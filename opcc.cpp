@@ -1,6 +1,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,9 +12,15 @@
 #include <math.h>
 
 #include <algorithm>
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
+#include <array>
+#include <deque>
 #include <stack>
 #include <list>
 #include <map>
@@ -222,6 +229,30 @@ enum tokentype_t {
     TOK_AMD3DNOWPLUS,           // 200
     TOK_EMMI,
     TOK_VEX,
+    TOK_BRANCH,
+    TOK_JMP,
+    TOK_JCC,                    // 205
+    TOK_CALL,
+    TOK_RET,
+    TOK_WORD_INT,               // "int"
+    TOK_IRET,
+    TOK_LOOP,                   // 210
+    TOK_CYCLES,
+    TOK_TAKEN,
+    TOK_PAIR,
+    TOK_UV,                     // 215
+    TOK_PU,
+    TOK_PV,
+    TOK_NP,
+    TOK_UOPS,
+    TOK_TRAPS,                  // 220
+    TOK_GP,
+    TOK_CPL0,
+    TOK_SERIALIZING,
+    TOK_SHADOW,
+    TOK_OPSIZE,                 // 225
+    TOK_ADDRSIZE,
+    TOK_ADDRESSONLY,
 
     TOK_MAX
 };
@@ -429,7 +460,31 @@ const char *tokentype_str[TOK_MAX] = {
     "AMD3DNOW",
     "AMD3DNOWPLUS",             // 200
     "EMMI",
-    "VEX"
+    "VEX",
+    "BRANCH",
+    "JMP",
+    "JCC",                      // 205
+    "CALL",
+    "RET",
+    "INT",
+    "IRET",
+    "LOOP",                     // 210
+    "CYCLES",
+    "TAKEN",
+    "PAIR",
+    "UV",                       // 215
+    "PU",
+    "PV",
+    "NP",
+    "UOPS",
+    "TRAPS",                    // 220
+    "GP",
+    "CPL0",
+    "SERIALIZING",
+    "SHADOW",
+    "OPSIZE",                   // 225
+    "ADDRSIZE",
+    "ADDRESSONLY"
 };
 
 bool list_op = false;
@@ -1799,6 +1854,102 @@ bool toke(tokenstate_t &tok) {
             tok.type = TOK_VEX;
             return true;
         }
+        if (tok.string == "BRANCH") {
+            tok.type = TOK_BRANCH;
+            return true;
+        }
+        if (tok.string == "JMP") {
+            tok.type = TOK_JMP;
+            return true;
+        }
+        if (tok.string == "JCC") {
+            tok.type = TOK_JCC;
+            return true;
+        }
+        if (tok.string == "CALL") {
+            tok.type = TOK_CALL;
+            return true;
+        }
+        if (tok.string == "RET") {
+            tok.type = TOK_RET;
+            return true;
+        }
+        if (tok.string == "INT") {
+            tok.type = TOK_WORD_INT;
+            return true;
+        }
+        if (tok.string == "IRET") {
+            tok.type = TOK_IRET;
+            return true;
+        }
+        if (tok.string == "LOOP") {
+            tok.type = TOK_LOOP;
+            return true;
+        }
+        if (tok.string == "CYCLES") {
+            tok.type = TOK_CYCLES;
+            return true;
+        }
+        if (tok.string == "TAKEN") {
+            tok.type = TOK_TAKEN;
+            return true;
+        }
+        if (tok.string == "PAIR") {
+            tok.type = TOK_PAIR;
+            return true;
+        }
+        if (tok.string == "UV") {
+            tok.type = TOK_UV;
+            return true;
+        }
+        if (tok.string == "PU") {
+            tok.type = TOK_PU;
+            return true;
+        }
+        if (tok.string == "PV") {
+            tok.type = TOK_PV;
+            return true;
+        }
+        if (tok.string == "NP") {
+            tok.type = TOK_NP;
+            return true;
+        }
+        if (tok.string == "UOPS") {
+            tok.type = TOK_UOPS;
+            return true;
+        }
+        if (tok.string == "TRAPS") {
+            tok.type = TOK_TRAPS;
+            return true;
+        }
+        if (tok.string == "GP") {
+            tok.type = TOK_GP;
+            return true;
+        }
+        if (tok.string == "CPL0") {
+            tok.type = TOK_CPL0;
+            return true;
+        }
+        if (tok.string == "SERIALIZING") {
+            tok.type = TOK_SERIALIZING;
+            return true;
+        }
+        if (tok.string == "SHADOW") {
+            tok.type = TOK_SHADOW;
+            return true;
+        }
+        if (tok.string == "OPSIZE") {
+            tok.type = TOK_OPSIZE;
+            return true;
+        }
+        if (tok.string == "ADDRSIZE") {
+            tok.type = TOK_ADDRSIZE;
+            return true;
+        }
+        if (tok.string == "ADDRESSONLY") {
+            tok.type = TOK_ADDRESSONLY;
+            return true;
+        }
     }
 
     tok.type = TOK_ERROR;
@@ -1807,6 +1958,21 @@ bool toke(tokenstate_t &tok) {
 
 std::string march = "";
 std::string fpuarch = "";
+std::string outfile = "";
+std::string combine = "";               // -combine: comma separated -march list for one multi-CPU table
+std::string blobfile = "";              // -blob: binary table file, see opcc_blob.h
+std::string profilefile = "";           // -profile: opcode histogram from an OPCC_DECODE_PROFILE build
+std::string interpfile = "";            // -interp: threaded interpreter skeleton to go with the -o header
+std::string recompfile = "";            // -recomp: static recompiler C templates to go with the -o header
+std::string disasmfile = "";            // -disasm: flat binary to disassemble to stdout
+unsigned int disasm_mode = 16;          // -mode: code segment size for -disasm
+unsigned int disasm_threads = 0;        // -threads: -disasm and -discover workers, 0 = one per CPU
+std::string discoverfile = "";          // -discover: image to trace from the entry points, control flow graph to stdout
+std::string discover_entry = "";        // -entry: comma separated CS:IP offsets, default the image start or the MZ entry
+unsigned long long discover_org = 0;    // -org: offset of the first byte of a flat image (100h for .COM)
+std::string cfg_format = "csv";         // -cfg: csv or bin
+std::string assemblefile = "";          // -assemble: NASM style source, flat binary to stdout
+std::string emitfile = "";              // -emit: C++ instruction emitter header for -mode
 
 int parse_argv(int argc,char **argv) {
     char *a;
@@ -1833,6 +1999,81 @@ int parse_argv(int argc,char **argv) {
                 if (a == NULL) return 1;
                 fpuarch = a;
             }
+            else if (!strcmp(a,"o")) {
+                a = argv[i++];
+                if (a == NULL) return 1;
+                outfile = a;
+            }
+            else if (!strcmp(a,"profile")) {
+                a = argv[i++];
+                if (a == NULL) return 1;
+                profilefile = a;
+            }
+            else if (!strcmp(a,"blob")) {
+                a = argv[i++];
+                if (a == NULL) return 1;
+                blobfile = a;
+            }
+            else if (!strcmp(a,"interp")) {
+                a = argv[i++];
+                if (a == NULL) return 1;
+                interpfile = a;
+            }
+            else if (!strcmp(a,"recomp")) {
+                a = argv[i++];
+                if (a == NULL) return 1;
+                recompfile = a;
+            }
+            else if (!strcmp(a,"disasm")) {
+                a = argv[i++];
+                if (a == NULL) return 1;
+                disasmfile = a;
+            }
+            else if (!strcmp(a,"mode")) {
+                a = argv[i++];
+                if (a == NULL) return 1;
+                disasm_mode = (unsigned int)strtoul(a,NULL,0);
+            }
+            else if (!strcmp(a,"threads")) {
+                a = argv[i++];
+                if (a == NULL) return 1;
+                disasm_threads = (unsigned int)strtoul(a,NULL,0);
+            }
+            else if (!strcmp(a,"discover")) {
+                a = argv[i++];
+                if (a == NULL) return 1;
+                discoverfile = a;
+            }
+            else if (!strcmp(a,"entry")) {
+                a = argv[i++];
+                if (a == NULL) return 1;
+                discover_entry = a;
+            }
+            else if (!strcmp(a,"org")) {
+                a = argv[i++];
+                if (a == NULL) return 1;
+                discover_org = strtoull(a,NULL,0);
+            }
+            else if (!strcmp(a,"cfg")) {
+                a = argv[i++];
+                if (a == NULL) return 1;
+                cfg_format = a;
+            }
+            else if (!strcmp(a,"assemble")) {
+                a = argv[i++];
+                if (a == NULL) return 1;
+                assemblefile = a;
+            }
+            else if (!strcmp(a,"emit")) {
+                a = argv[i++];
+                if (a == NULL) return 1;
+                emitfile = a;
+            }
+            else if (!strcmp(a,"combine")) {
+                a = argv[i++];
+                if (a == NULL) return 1;
+                combine = a;
+            }
             else if (!strcmp(a,"dop")) {
                 debug_op = true;
             }
@@ -1918,6 +2159,8 @@ public:
     unsigned int                rep_condition = 0;      // 0 or TOK_Z
     bool                        wait = false;
     bool                        lock = false;
+    bool                        opsize = false;         // operand size override (PREFIX)
+    bool                        addrsize = false;       // address size override (PREFIX)
     bool                        rep_condition_negate = false;
     bool                        fpu = false;
     bool                        sse = false;
@@ -1927,6 +2170,20 @@ public:
     bool                        amd3dnowplus = false;
     std::vector<SingleByteSpec> fpu_stack_ops;              // push or pop
     unsigned int                fpu_stack_op_dir = 0;       // TOK_PUSH or TOK_POP
+    unsigned int                branch_type = 0;            // TOK_JMP, TOK_JCC, TOK_CALL, TOK_RET, TOK_WORD_INT, TOK_IRET, TOK_LOOP
+    bool                        branch_far = false;         // (branch ... far) changes CS
+    bool                        address_only = false;       // (addressonly) r/m is an address, memory is not accessed through it
+    int                         cycles_level = -1;          // cpulevel of the (cycles ...) entry in effect, -1 if none
+    bool                        cycles_march = false;       // entry in effect names the -march exactly
+    unsigned char               cycles_reg[2] = {0,0};      // mod == 3 or no mod/reg/rm, [0] = 16-bit [1] = 32-bit operand size
+    unsigned char               cycles_mem[2] = {0,0};      // mod != 3, not including 8086 effective address time
+    unsigned char               cycles_taken = 0;           // conditional branch when taken
+    unsigned int                pairing = 0;                // TOK_UV, TOK_PU, TOK_PV, TOK_NP (Pentium U/V pipe pairing)
+    unsigned char               uops_reg = 0;               // P6 micro-ops, mod == 3 or no mod/reg/rm
+    unsigned char               uops_mem = 0;               // P6 micro-ops, mod != 3
+    std::vector<unsigned int>   traps;                      // TOK_UD, TOK_GP, TOK_CPL0, TOK_IOPL, TOK_SERIALIZING, TOK_SHADOW
+    unsigned long long          profile_count = 0;          // hits from -profile
+    size_t                      profile_id = 0;             // index before -profile reorders the opcodes, what the histogram uses
 public:
     void                        add_reg_constraint(const unsigned char reg);
     void                        add_rm_constraint(const unsigned char reg);
@@ -2650,6 +2907,16 @@ std::string OpcodeSpec::to_string(void) {
         res += "lock=1";
     }
 
+    if (opsize) {
+        if (!res.empty()) res += ",";
+        res += "opsize=1";
+    }
+
+    if (addrsize) {
+        if (!res.empty()) res += ",";
+        res += "addrsize=1";
+    }
+
     if (prefix_seg_assign != 0) {
         if (!res.empty()) res += ",";
         res += "seg=";
@@ -2816,6 +3083,52 @@ std::string OpcodeSpec::to_string(void) {
         res += "]";
     }
 
+    if (branch_type != 0) {
+        if (!res.empty()) res += ",";
+        res += "branch=";
+        res += tokentype_str[branch_type];
+        if (branch_far) res += "(far)";
+    }
+
+    if (cycles_level >= 0) {
+        char tmp[96];
+
+        if (!res.empty()) res += ",";
+        sprintf(tmp,"cycles(%d)=[reg=%u/%u mem=%u/%u taken=%u]",cycles_level,
+            cycles_reg[0],cycles_reg[1],cycles_mem[0],cycles_mem[1],cycles_taken);
+        res += tmp;
+    }
+
+    if (pairing != 0) {
+        if (!res.empty()) res += ",";
+        res += "pair=";
+        res += tokentype_str[pairing];
+    }
+
+    if (!traps.empty()) {
+        if (!res.empty()) res += ",";
+        res += "traps=[";
+        for (auto i=traps.begin();i!=traps.end();) {
+            res += tokentype_str[*i];
+            i++;
+            if (i!=traps.end()) res += " ";
+        }
+        res += "]";
+    }
+
+    if (address_only) {
+        if (!res.empty()) res += ",";
+        res += "addressonly";
+    }
+
+    if (uops_reg != 0 || uops_mem != 0) {
+        char tmp[64];
+
+        if (!res.empty()) res += ",";
+        sprintf(tmp,"uops=[reg=%u mem=%u]",uops_reg,uops_mem);
+        res += tmp;
+    }
+
     if (fpu_stack_ops.size() != 0) {
         if (!res.empty()) res += ",";
         res += "fpu_stack_ops(";
@@ -2889,6 +3202,8 @@ std::vector<OpcodeSpec>         opcodes;
 
 int                             unknown_opcode = -1;
 int                             opcode_limit = -1;
+bool                            profile_loaded = false;        // -profile, see apply_profile()
+unsigned long long              profile_total = 0;
 
 class tokenlist : public std::vector<tokenstate_t> {
 public:
@@ -3945,6 +4260,53 @@ bool code_subexpr(tokenstate_t &subtoken,tokenlist &tokens) {
     return true;
 }
 
+int cpulevel_value(void) {
+    auto i = defines.find("cpulevel");
+    if (i != defines.end() && i->second.is_number())
+        return (int)i->second.to_intval_u();
+
+    return 0;
+}
+
+/* cycle count, optionally followed by ",n" for 32-bit operand size */
+bool read_cycles_pair(tokenlist &tokens,unsigned char c[2]) {
+    for (unsigned int i=0;i < 2;i++) {
+        if (i != 0) {
+            if (tokens.peek().type != TOK_COMMA) {
+                c[1] = c[0];
+                break;
+            }
+            tokens.discard();
+        }
+
+        auto &n = tokens.next();
+        if (n.type != TOK_UINT || n.intval.u == 0ull || n.intval.u > 255ull) {
+            fprintf(stderr,"Cycle count must be a number 1-255\n");
+            return false;
+        }
+
+        c[i] = (unsigned char)n.intval.u;
+    }
+
+    return true;
+}
+
+/* micro-op count, a single number. there is no per operand size form */
+bool read_uops_count(tokenlist &tokens,unsigned char &c) {
+    auto &n = tokens.next();
+    if (n.type != TOK_UINT || n.intval.u == 0ull || n.intval.u > 255ull) {
+        fprintf(stderr,"Micro-op count must be a number 1-255\n");
+        return false;
+    }
+    if (tokens.peek().type == TOK_COMMA) {
+        fprintf(stderr,"Micro-op count takes one number, not n,n\n");
+        return false;
+    }
+
+    c = (unsigned char)n.intval.u;
+    return true;
+}
+
 bool read_opcode_spec_opcode_parens(tokenlist &parent_tokens,OpcodeSpec &spec) {
     /* caller already read '(' */
     tokenlist tokens;
@@ -4076,6 +4438,37 @@ bool read_opcode_spec_opcode_parens(tokenlist &parent_tokens,OpcodeSpec &spec) {
         return true;
     }
 
+    /* opsize=val or addrsize=val */
+    if ((tokens.peek(0).type == TOK_OPSIZE || tokens.peek(0).type == TOK_ADDRSIZE) && tokens.peek(1).type == TOK_EQUAL) {
+        const unsigned int what = tokens.peek(0).type;
+
+        tokens.discard(2);
+
+        if (spec.type != TOK_PREFIX) {
+            fprintf(stderr,"Size override specifications only allowed for prefixes\n");
+            return false;
+        }
+
+        auto &n = tokens.next();
+        if (n.type == TOK_UINT) {
+            if (what == TOK_OPSIZE)
+                spec.opsize = n.intval.u > 0ull;
+            else
+                spec.addrsize = n.intval.u > 0ull;
+        }
+        else {
+            fprintf(stderr,"Unexpected token past equals\n");
+            return false;
+        }
+
+        if (!tokens.eof()) {
+            fprintf(stderr,"Size override unexpected tokens\n");
+            return false;
+        }
+
+        return true;
+    }
+
     /* rep=z or rep=!z */
     if (tokens.peek(0).type == TOK_REP && tokens.peek(1).type == TOK_EQUAL) {
         tokens.discard(2);
@@ -4232,65 +4625,342 @@ bool read_opcode_spec_opcode_parens(tokenlist &parent_tokens,OpcodeSpec &spec) {
         return true;
     }
 
-    /* dest=register/mem/etc */
-    if (tokens.peek(0).type == TOK_DEST && tokens.peek(1).type == TOK_EQUAL) {
-        tokens.discard(2);
+    /* branch jmp|jcc|call|ret|int|iret|loop [far] */
+    if (tokens.peek().type == TOK_BRANCH) {
+        tokens.discard();
 
-        if (spec.destination.meaning != TOK_NONE) {
-            fprintf(stderr,"Destination already specified\n");
+        if (spec.branch_type != TOK_NONE) {
+            fprintf(stderr,"Branch type already specified\n");
             return false;
         }
 
-        SingleByteSpec bs;
-
         auto &n = tokens.next();
-        bs.meaning = n.type;
+        switch (n.type) {
+            case TOK_JMP:
+            case TOK_JCC:
+            case TOK_CALL:
+            case TOK_RET:
+            case TOK_WORD_INT:
+            case TOK_IRET:
+            case TOK_LOOP:
+                spec.branch_type = n.type;
+                break;
+            default:
+                fprintf(stderr,"Unexpected branch type %s\n",n.type_str());
+                return false;
+        };
 
-        if (bs.meaning == TOK_IMMEDIATE) {
-            /* come on now.... in what way is it valid to assign to an immediate? */
-            fprintf(stderr,"Immediate in dest not supported\n");
+        if (tokens.peek().type == TOK_FAR) {
+            tokens.discard();
+            spec.branch_far = true;
+        }
+
+        if (!tokens.eof()) {
+            fprintf(stderr,"Unexpected tokens\n");
             return false;
         }
-        else if (bs.meaning == TOK_UINT) {
-            bs.intval = n.intval.u;
+
+        return true;
+    }
+
+    /* cycles (cpulevel|"march") [n[,n]] [reg n[,n]] [memory n[,n]] [taken n].
+     * the entry for the highest cpulevel <= the current one wins, unless an entry names the -march exactly. */
+    if (tokens.peek().type == TOK_CYCLES) {
+        bool apply = false;
+        int level = -1;
+
+        tokens.discard();
+
+        if (spec.type != TOK_OPCODE) {
+            fprintf(stderr,"Cycle counts only allowed for opcodes\n");
+            return false;
         }
-        else if (bs.meaning == TOK_REG || bs.meaning == TOK_SREG || bs.meaning == TOK_CR || bs.meaning == TOK_DR || bs.meaning == TOK_TR) {
-            if ((bs.reg_type=parse_code_immediate_spec(/*&*/tokens)) == TOK_NONE) {
-                fprintf(stderr,"Invalid reg spec\n");
-                return false;
+
+        auto &l = tokens.next();
+        if (l.type == TOK_STRING) {
+            if (l.string == march) {
+                if (spec.cycles_march) {
+                    fprintf(stderr,"Cycles for march '%s' already specified\n",march.c_str());
+                    return false;
+                }
+
+                level = cpulevel_value();
+                apply = true;
             }
         }
-        else if (bs.meaning == TOK_RM) {
-            if ((bs.rm_type=parse_code_immediate_spec(/*&*/tokens)) == TOK_NONE) {
-                fprintf(stderr,"Invalid reg spec\n");
-                return false;
+        else if (l.type == TOK_UINT) {
+            level = (int)l.intval.u;
+            if (!spec.cycles_march && level <= cpulevel_value()) {
+                if (level == spec.cycles_level) {
+                    fprintf(stderr,"Cycles for cpulevel %d already specified\n",level);
+                    return false;
+                }
+
+                apply = level > spec.cycles_level;
             }
         }
-        else if (bs.meaning == TOK_MEMORY) {
-            if (!parse_mem_spec(bs,/*&*/tokens)) {
-                fprintf(stderr,"Invalid reg spec\n");
+        else {
+            fprintf(stderr,"Cycles must start with a cpulevel or march name\n");
+            return false;
+        }
+
+        unsigned char reg[2] = {0,0},mem[2] = {0,0},taken = 0;
+
+        if (tokens.peek().type == TOK_UINT) {
+            if (!read_cycles_pair(tokens,reg))
                 return false;
-            }
+
+            mem[0] = reg[0];
+            mem[1] = reg[1];
         }
-        else if (bs.meaning == TOK_FAR) {
-            n = tokens.next();
-            if (n.type == TOK_MEMORY) {
-                bs.meaning = n.type;
-                if (!parse_far_mem_spec(bs,/*&*/tokens)) {
-                    fprintf(stderr,"Invalid reg spec\n");
+
+        while (!tokens.eof()) {
+            auto &n = tokens.next();
+
+            if (n.type == TOK_REG) {
+                if (!read_cycles_pair(tokens,reg))
                     return false;
-                }
+            }
+            else if (n.type == TOK_MEMORY) {
+                if (!read_cycles_pair(tokens,mem))
+                    return false;
+            }
+            else if (n.type == TOK_TAKEN) {
+                unsigned char t[2];
+
+                if (!read_cycles_pair(tokens,t))
+                    return false;
+
+                taken = t[0];
             }
             else {
-                fprintf(stderr,"far... unexpected tokens\n");
+                fprintf(stderr,"Unexpected cycles token %s\n",n.type_str());
                 return false;
             }
         }
-        else if (bs.meaning == TOK_ST || bs.meaning == TOK_MM || bs.meaning == TOK_XMM) {
-            if (!parse_code_st_spec(bs.fpu_st,/*&*/tokens)) {
-                fprintf(stderr,"Invalid st() spec\n");
-                return false;
-            }
+
+        if (!tokens.eof()) {
+            fprintf(stderr,"Unexpected tokens\n");
+            return false;
+        }
+
+        if (apply) {
+            spec.cycles_level = level;
+            spec.cycles_march = (l.type == TOK_STRING);
+            spec.cycles_reg[0] = reg[0];
+            spec.cycles_reg[1] = reg[1];
+            spec.cycles_mem[0] = mem[0];
+            spec.cycles_mem[1] = mem[1];
+            spec.cycles_taken = taken;
+        }
+
+        return true;
+    }
+
+    /* pair uv|pu|pv|np, or the same as a string so that macros can pass it as a parameter */
+    if (tokens.peek().type == TOK_PAIR) {
+        tokens.discard();
+
+        if (spec.type != TOK_OPCODE) {
+            fprintf(stderr,"Pairing only allowed for opcodes\n");
+            return false;
+        }
+        if (spec.pairing != 0) {
+            fprintf(stderr,"Pairing already specified\n");
+            return false;
+        }
+
+        auto &n = tokens.next();
+        if (n.type == TOK_UV || n.type == TOK_PU || n.type == TOK_PV || n.type == TOK_NP) {
+            spec.pairing = n.type;
+        }
+        else if (n.type == TOK_STRING) {
+            if (n.string == "uv")
+                spec.pairing = TOK_UV;
+            else if (n.string == "pu")
+                spec.pairing = TOK_PU;
+            else if (n.string == "pv")
+                spec.pairing = TOK_PV;
+            else if (n.string == "np")
+                spec.pairing = TOK_NP;
+        }
+
+        if (spec.pairing == 0) {
+            fprintf(stderr,"Unexpected pairing %s\n",n.type_str());
+            return false;
+        }
+
+        if (!tokens.eof()) {
+            fprintf(stderr,"Unexpected tokens\n");
+            return false;
+        }
+
+        return true;
+    }
+
+    /* traps ud|gp|cpl0|iopl|serializing|shadow, ... */
+    if (tokens.peek().type == TOK_TRAPS) {
+        tokens.discard();
+
+        if (spec.type != TOK_OPCODE) {
+            fprintf(stderr,"Traps only allowed for opcodes\n");
+            return false;
+        }
+
+        do {
+            auto &n = tokens.next();
+
+            switch (n.type) {
+                case TOK_UD:
+                case TOK_GP:
+                case TOK_CPL0:
+                case TOK_IOPL:
+                case TOK_SERIALIZING:
+                case TOK_SHADOW:
+                    spec.traps.push_back(n.type);
+                    break;
+                default:
+                    fprintf(stderr,"Unexpected trap %s\n",n.type_str());
+                    return false;
+            };
+
+            if (tokens.peek().type == TOK_COMMA)
+                tokens.discard();
+            else
+                break;
+        } while (1);
+
+        if (!tokens.eof()) {
+            fprintf(stderr,"Unexpected tokens\n");
+            return false;
+        }
+
+        return true;
+    }
+
+    /* addressonly */
+    if (tokens.peek().type == TOK_ADDRESSONLY) {
+        tokens.discard();
+
+        if (spec.type != TOK_OPCODE) {
+            fprintf(stderr,"Address only allowed for opcodes\n");
+            return false;
+        }
+
+        if (!tokens.eof()) {
+            fprintf(stderr,"Unexpected tokens\n");
+            return false;
+        }
+
+        spec.address_only = true;
+        return true;
+    }
+
+    /* uops [n] [reg n] [memory n] */
+    if (tokens.peek().type == TOK_UOPS) {
+        unsigned char c;
+
+        tokens.discard();
+
+        if (spec.type != TOK_OPCODE) {
+            fprintf(stderr,"Micro-op counts only allowed for opcodes\n");
+            return false;
+        }
+        if (spec.uops_reg != 0 || spec.uops_mem != 0) {
+            fprintf(stderr,"Micro-op count already specified\n");
+            return false;
+        }
+
+        if (tokens.peek().type == TOK_UINT) {
+            if (!read_uops_count(tokens,c))
+                return false;
+
+            spec.uops_reg = spec.uops_mem = c;
+        }
+
+        while (!tokens.eof()) {
+            auto &n = tokens.next();
+
+            if (n.type == TOK_REG) {
+                if (!read_uops_count(tokens,c))
+                    return false;
+
+                spec.uops_reg = c;
+            }
+            else if (n.type == TOK_MEMORY) {
+                if (!read_uops_count(tokens,c))
+                    return false;
+
+                spec.uops_mem = c;
+            }
+            else {
+                fprintf(stderr,"Unexpected uops token %s\n",n.type_str());
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /* dest=register/mem/etc */
+    if (tokens.peek(0).type == TOK_DEST && tokens.peek(1).type == TOK_EQUAL) {
+        tokens.discard(2);
+
+        if (spec.destination.meaning != TOK_NONE) {
+            fprintf(stderr,"Destination already specified\n");
+            return false;
+        }
+
+        SingleByteSpec bs;
+
+        auto &n = tokens.next();
+        bs.meaning = n.type;
+
+        if (bs.meaning == TOK_IMMEDIATE) {
+            /* come on now.... in what way is it valid to assign to an immediate? */
+            fprintf(stderr,"Immediate in dest not supported\n");
+            return false;
+        }
+        else if (bs.meaning == TOK_UINT) {
+            bs.intval = n.intval.u;
+        }
+        else if (bs.meaning == TOK_REG || bs.meaning == TOK_SREG || bs.meaning == TOK_CR || bs.meaning == TOK_DR || bs.meaning == TOK_TR) {
+            if ((bs.reg_type=parse_code_immediate_spec(/*&*/tokens)) == TOK_NONE) {
+                fprintf(stderr,"Invalid reg spec\n");
+                return false;
+            }
+        }
+        else if (bs.meaning == TOK_RM) {
+            if ((bs.rm_type=parse_code_immediate_spec(/*&*/tokens)) == TOK_NONE) {
+                fprintf(stderr,"Invalid reg spec\n");
+                return false;
+            }
+        }
+        else if (bs.meaning == TOK_MEMORY) {
+            if (!parse_mem_spec(bs,/*&*/tokens)) {
+                fprintf(stderr,"Invalid reg spec\n");
+                return false;
+            }
+        }
+        else if (bs.meaning == TOK_FAR) {
+            n = tokens.next();
+            if (n.type == TOK_MEMORY) {
+                bs.meaning = n.type;
+                if (!parse_far_mem_spec(bs,/*&*/tokens)) {
+                    fprintf(stderr,"Invalid reg spec\n");
+                    return false;
+                }
+            }
+            else {
+                fprintf(stderr,"far... unexpected tokens\n");
+                return false;
+            }
+        }
+        else if (bs.meaning == TOK_ST || bs.meaning == TOK_MM || bs.meaning == TOK_XMM) {
+            if (!parse_code_st_spec(bs.fpu_st,/*&*/tokens)) {
+                fprintf(stderr,"Invalid st() spec\n");
+                return false;
+            }
         }
         else if (bs.meaning == TOK_CONSTANT) {
             if (!parse_code_constant_spec(bs.constant,/*&*/tokens)) {
@@ -4391,11 +5061,11 @@ bool read_opcode_spec_opcode_parens(tokenlist &parent_tokens,OpcodeSpec &spec) {
     if (tokens.peek(0).type == TOK_PARAM && tokens.peek(1).type == TOK_OPEN_PARENS &&
         tokens.peek(2).type == TOK_UINT && tokens.peek(3).type == TOK_CLOSE_PARENS &&
         tokens.peek(4).type == TOK_EQUAL) {
-        if (tokens.peek(3).intval.u > 8) {
+        if (tokens.peek(2).intval.u > 8) {
             fprintf(stderr,"Out of range parens\n");
             return false;
         }
-        size_t i = (size_t)tokens.peek(3).intval.u;
+        size_t i = (size_t)tokens.peek(2).intval.u;
         tokens.discard(5);
 
         SingleByteSpec bs;
@@ -5457,8 +6127,10 @@ bool process_block(tokenlist &tokens) {
         return true;
     }
 
-    if (!do_opcode_spec(/*&*/tokens))
+    if (!do_opcode_spec(/*&*/tokens)) {
+        read_error = true;
         return false;
+    }
 
     return true;
 }
@@ -5540,9 +6212,16 @@ public:
         LINEAR,                 // map[byte]
         MRMLINEAR,              // mod/reg/rm map[byte]
         MODREGRM,               // map[modregrm(mod,reg,rm)]
-        PREFIX                  // prefix (no map)
+        PREFIX,                 // prefix (no map)
+        MANDATORY_PREFIX        // map[mandatory_prefix] selects the none/66/F3/F2 variant of an opcode
+    };
+    enum mandatory_prefix {
+        MP_NONE=0,              // no mandatory prefix, or no variant for the prefix given
+        MP_66,
+        MP_F3,
+        MP_F2,
 
-        // future plan: MANDATORY_PREFIX (for weird Pentium III SSE encodings)
+        MP_MAX
     };
     enum mapping_type maptype = NONE;
 public:
@@ -5716,6 +6395,7 @@ bool enter_opcode_byte_spec(const OpcodeSpec &opcode,size_t opcode_index,std::sh
                     return false;
                 }
 
+                gs.opcode_index = opcode_index;
                 return true;
             }
 
@@ -5774,287 +6454,8321 @@ bool enter_opcode_bytes(const OpcodeSpec &opcode,size_t opcode_index,std::shared
     return true;
 }
 
-int main(int argc,char **argv) {
-    /* setup predefined values */
-    defines["dialect"] = "intel-x86";
-
-    if (parse_argv(argc,argv))
-        return 1;
+/* SSE encodings are described as 66/F2/F3 followed by the opcode, which enters them under the PREFIX
+ * node of that byte. Move them next to the unprefixed opcode as a MANDATORY_PREFIX node so that a
+ * decoder picks the variant with one lookup once it knows which prefixes it has seen. */
+bool merge_mandatory_prefix(std::shared_ptr<OpcodeGroupBlock> &node,std::shared_ptr<OpcodeGroupBlock> pfx,const unsigned int slot) {
+    if (pfx.get() == nullptr)
+        return true;
 
-    if (march.empty())
-        march = "everything";
+    /* same byte table on both sides (0F, 0F 38, 0F 3A), go one byte deeper */
+    if (node.get() != nullptr && (*node).maptype == OpcodeGroupBlock::LINEAR && (*pfx).maptype == OpcodeGroupBlock::LINEAR) {
+        for (size_t b=0;b < (*pfx).map.size();b++) {
+            if ((*pfx).map[b].get() == nullptr) continue;
 
-    if (march == "8086") {
-        if (fpuarch.empty())
-            fpuarch = "8087";
+            (*node).map_get(b);
+            if (!merge_mandatory_prefix((*node).map[b],(*pfx).map[b],slot))
+                return false;
+        }
 
-        defines["cpulevel"] = 86;
+        return true;
     }
-    else if (march == "80186") {
-        if (fpuarch.empty())
-            fpuarch = "8087";
 
-        defines["cpulevel"] = 186;
-    }
-    else if (march == "necv20") {
-        if (fpuarch.empty())
-            fpuarch = "8087";
+    if (node.get() == nullptr || (*node).maptype != OpcodeGroupBlock::MANDATORY_PREFIX) {
+        auto mp = std::make_shared<OpcodeGroupBlock>();
 
-        defines["cpulevel"] = 186;
-        defines["necv20"] = 1;
+        (*mp).maptype = OpcodeGroupBlock::MANDATORY_PREFIX;
+        (*mp).map.resize(OpcodeGroupBlock::MP_MAX);
+        (*mp).map[OpcodeGroupBlock::MP_NONE] = node;
+        node = mp;
     }
-    else if (march == "80286" || march == "286") {
-        if (fpuarch.empty())
-            fpuarch = "80287";
 
-        defines["cpulevel"] = 286;
+    if ((*node).map[slot].get() != nullptr) {
+        (*node).overlap_error = true;
+        fprintf(stderr,"mandatory prefix map overlap error\n");
+        return false;
     }
-    else if (march == "80386" || march == "386") {
-        if (fpuarch.empty())
-            fpuarch = "80387";
 
-        defines["cpulevel"] = 386;
-    }
-    else if (march == "80486" || march == "486" || march == "486new") {
-        if (fpuarch.empty())
-            fpuarch = "80387";
+    (*node).map[slot] = pfx;
+    return true;
+}
 
-        defines["cpulevel"] = 486;
-        defines["cpuyear"] = 1992;
-        defines["cpuid"] = 1;
-    }
-    else if (march == "80486old" || march == "486old") {
-        if (fpuarch.empty())
-            fpuarch = "80387";
+bool build_mandatory_prefix_maps(std::shared_ptr<OpcodeGroupBlock> root) {
+    static const unsigned char slot_byte[OpcodeGroupBlock::MP_MAX] = { 0x00, 0x66, 0xF3, 0xF2 };
 
-        defines["cpulevel"] = 486;
-        defines["cpuyear"] = 1988;
-    }
-    else if (march == "80586" || march == "586") {
-        if (fpuarch.empty())
-            fpuarch = "80587";
+    for (unsigned int slot=OpcodeGroupBlock::MP_66;slot < OpcodeGroupBlock::MP_MAX;slot++) {
+        auto pg = (*root).map_get(slot_byte[slot]);
+        if (pg.get() == nullptr || (*pg).maptype != OpcodeGroupBlock::PREFIX)
+            continue;
 
-        defines["cpulevel"] = 586;
-        defines["cpuid"] = 1;
-    }
-    else if (march == "pentium") {
-        if (fpuarch.empty())
-            fpuarch = "80587";
+        for (size_t b=0;b < (*pg).map.size();b++) {
+            if ((*pg).map[b].get() == nullptr) continue;
 
-        defines["cpulevel"] = 586;
-        defines["cpuid"] = 1;
-    }
-    else if (march == "pentium-mmx") {
-        if (fpuarch.empty())
-            fpuarch = "80587";
+            (*root).map_get(b);
+            if (!merge_mandatory_prefix((*root).map[b],(*pg).map[b],slot))
+                return false;
+        }
 
-        defines["cpulevel"] = 586;
-        defines["cpuid"] = 1;
-        defines["mmx"] = 1;
+        /* it's an ordinary prefix now */
+        (*pg).map.clear();
     }
-    else if (march == "amd-k6") {
-        if (fpuarch.empty())
-            fpuarch = "80587";
 
-        defines["vendor"] = "amd";
-        defines["cpulevel"] = 586;
-        defines["syscall"] = 1;
-        defines["cpuid"] = 1;
-        defines["mmx"] = 1;
-    }
-    else if (march == "amd-k6-2") {
-        if (fpuarch.empty())
-            fpuarch = "80587";
+    return true;
+}
 
-        defines["vendor"] = "amd";
-        defines["cpulevel"] = 586;
-        defines["syscall"] = 1;
-        defines["3dnow"] = 1;
-        defines["cpuid"] = 1;
-        defines["mmx"] = 1;
-    }
-    else if (march == "amd-k6-2+") {
-        if (fpuarch.empty())
-            fpuarch = "80587";
+/* control flow classification, one byte per opcode.
+ * bits 0-3 are the branch kind, bits 4-6 say where the target comes from, bit 7 is set if the transfer is far (changes CS). */
+enum branch_kind_t {
+    BRANCH_NONE=0,                  // not a control transfer
+    BRANCH_JMP,
+    BRANCH_JCC,
+    BRANCH_CALL,
+    BRANCH_RET,
+    BRANCH_INT,                     // software interrupt, trap, or entry to a more privileged mode
+    BRANCH_IRET,
+    BRANCH_LOOP,                    // LOOP, LOOPZ, LOOPNZ (decrement CX and jump)
+
+    BRANCH_MAX
+};
 
-        defines["vendor"] = "amd";
-        defines["cpulevel"] = 586;
-        defines["syscall"] = 1;
-        defines["3dnow+"] = 1;
+enum branch_target_t {
+    BRANCH_TARGET_NONE=0,           // implied (stack, interrupt vector, MSR) or not a branch
+    BRANCH_TARGET_REL8,             // IP + signed 8-bit immediate
+    BRANCH_TARGET_RELV,             // IP + signed 16 or 32-bit immediate (by operand size)
+    BRANCH_TARGET_RM,               // near indirect through r/m
+    BRANCH_TARGET_FARPTR,           // immediate seg:offset
+    BRANCH_TARGET_FARMEM,           // indirect through m16:16 or m16:32
+
+    BRANCH_TARGET_MAX
+};
+
+const unsigned char branch_far_bit = 0x80;
+
+const char *branch_kind_str[BRANCH_MAX] = {
+    "NONE",
+    "JMP",
+    "JCC",
+    "CALL",
+    "RET",
+    "INT",
+    "IRET",
+    "LOOP"
+};
+
+const char *branch_target_str[BRANCH_TARGET_MAX] = {
+    "NONE",
+    "REL8",
+    "RELV",
+    "RM",
+    "FARPTR",
+    "FARMEM"
+};
+
+bool is_far_pointer_type(const unsigned int t) {
+    return (t == TOK_FPV || t == TOK_FPW || t == TOK_FPDW);
+}
+
+unsigned char branch_kind_byte(const OpcodeSpec &op) {
+    unsigned char kind,target = BRANCH_TARGET_NONE;
+
+    switch (op.branch_type) {
+        case TOK_JMP:       kind = BRANCH_JMP;  break;
+        case TOK_JCC:       kind = BRANCH_JCC;  break;
+        case TOK_CALL:      kind = BRANCH_CALL; break;
+        case TOK_RET:       kind = BRANCH_RET;  break;
+        case TOK_WORD_INT:  kind = BRANCH_INT;  break;
+        case TOK_IRET:      kind = BRANCH_IRET; break;
+        case TOK_LOOP:      kind = BRANCH_LOOP; break;
+        default:            return 0;
+    };
+
+    /* RET imm16 and INT imm8 have immediates that are not branch targets */
+    if (kind == BRANCH_JMP || kind == BRANCH_JCC || kind == BRANCH_CALL || kind == BRANCH_LOOP) {
+        for (const auto &b : op.bytes) {
+            if (b.meaning != TOK_IMMEDIATE) continue;
+
+            if (b.immediate_type == TOK_SB)
+                target = BRANCH_TARGET_REL8;
+            else if (b.immediate_type == TOK_SV || b.immediate_type == TOK_SW || b.immediate_type == TOK_SDW)
+                target = BRANCH_TARGET_RELV;
+            else if (is_far_pointer_type(b.immediate_type))
+                target = BRANCH_TARGET_FARPTR;
+        }
+
+        if (target == BRANCH_TARGET_NONE) {
+            const SingleByteSpec *rm = NULL;
+
+            if (op.destination.meaning == TOK_RM)
+                rm = &op.destination;
+            for (const auto &p : op.param) {
+                if (p.meaning == TOK_RM)
+                    rm = &p;
+            }
+
+            if (rm != NULL)
+                target = is_far_pointer_type(rm->rm_type) ? BRANCH_TARGET_FARMEM : BRANCH_TARGET_RM;
+        }
+    }
+
+    unsigned char r = kind + (target << 4);
+    if (op.branch_far || target == BRANCH_TARGET_FARPTR || target == BRANCH_TARGET_FARMEM)
+        r |= branch_far_bit;
+
+    return r;
+}
+
+void emit_c_string(FILE *fp,const std::string &str) {
+    fputc('\"',fp);
+    for (const auto &c : str) {
+        if (c == '\"' || c == '\\') fputc('\\',fp);
+        fputc(c,fp);
+    }
+    fputc('\"',fp);
+}
+
+void emit_output_header(FILE *fp) {
+    fprintf(fp,"/* generated by opcc from '%s' for -march %s -fpuarch %s. do not edit. */\n",srcfile.c_str(),march.c_str(),fpuarch.c_str());
+    fprintf(fp,"#ifndef OPCC_GENERATED_H\n");
+    fprintf(fp,"#define OPCC_GENERATED_H\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"#include <stdint.h>\n");
+    fprintf(fp,"#include <stddef.h>\n");
+    fprintf(fp,"#include <stdlib.h>\n");
+    fprintf(fp,"#include <string.h>\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* tables are indexed by opcode index */\n");
+    fprintf(fp,"#define OPCC_OPCODE_COUNT %zu\n",opcodes.size());
+    fprintf(fp,"\n");
+}
+
+void emit_output_footer(FILE *fp) {
+    fprintf(fp,"#endif /* OPCC_GENERATED_H */\n");
+}
+
+void emit_opcode_names(FILE *fp) {
+    fprintf(fp,"static const char *const opcc_opcode_name[OPCC_OPCODE_COUNT] = {\n");
+    for (size_t i=0;i < opcodes.size();i++) {
+        fprintf(fp,"    ");
+        emit_c_string(fp,opcodes[i].name);
+        fprintf(fp,"%s /* %4zu %s */\n",(i+1) < opcodes.size() ? "," : " ",i,tokentype_str[opcodes[i].type]);
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+}
+
+void emit_branch_table(FILE *fp) {
+    fprintf(fp,"/* control flow classification: bits 0-3 kind, bits 4-6 target, bit 7 far */\n");
+    for (unsigned int i=0;i < BRANCH_MAX;i++)
+        fprintf(fp,"#define OPCC_BRANCH_%-16s 0x%02xu\n",branch_kind_str[i],i);
+    for (unsigned int i=0;i < BRANCH_TARGET_MAX;i++)
+        fprintf(fp,"#define OPCC_BRANCH_TARGET_%-9s 0x%02xu\n",branch_target_str[i],i << 4);
+    fprintf(fp,"#define OPCC_BRANCH_FAR              0x%02xu\n",branch_far_bit);
+    fprintf(fp,"#define OPCC_BRANCH_KIND(x)          ((x) & 0x0Fu)\n");
+    fprintf(fp,"#define OPCC_BRANCH_TARGET(x)        ((x) & 0x70u)\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const uint8_t opcc_branch_kind[OPCC_OPCODE_COUNT] = {\n");
+    for (size_t i=0;i < opcodes.size();i++) {
+        const unsigned char b = branch_kind_byte(opcodes[i]);
+
+        fprintf(fp,"    0x%02x%s /* %4zu %s",b,(i+1) < opcodes.size() ? "," : " ",i,opcodes[i].name.c_str());
+        if (b != 0) {
+            fprintf(fp," %s %s",branch_kind_str[b & 0xF],branch_target_str[(b >> 4) & 7]);
+            if (b & branch_far_bit) fprintf(fp," FAR");
+        }
+        fprintf(fp," */\n");
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+}
+
+/* memory access descriptor, derived from the reads/writes/modifies lists and stack ops.
+ * implicit accesses the description does not list (INT pushing FLAGS/CS/IP, XLAT) are not included. */
+enum mem_source_t {
+    MEM_SRC_NONE=0,
+    MEM_SRC_MODRM,                  // effective address from mod/reg/rm, only if mod != 3
+    MEM_SRC_STACK,                  // SS:SP
+    MEM_SRC_SI,                     // seg:SI (string source, segment can be overridden)
+    MEM_SRC_DI,                     // ES:DI (string destination)
+    MEM_SRC_OFFSET,                 // seg:immediate offset (MOV AL,[moffs])
+    MEM_SRC_OTHER,                  // some other address expression
+
+    MEM_SRC_MAX
+};
+
+enum mem_size_t {
+    MEM_SIZE_NONE=0,
+    MEM_SIZE_B,
+    MEM_SIZE_W,
+    MEM_SIZE_DW,
+    MEM_SIZE_QW,
+    MEM_SIZE_TW,
+    MEM_SIZE_DQW,
+    MEM_SIZE_V,
+    MEM_SIZE_DV,
+    MEM_SIZE_FPV,
+    MEM_SIZE_F80,
+    MEM_SIZE_F87ENV,
+    MEM_SIZE_F87STATE,
+
+    MEM_SIZE_MAX
+};
+
+enum mem_align_t {
+    MEM_ALIGN_BYTE=0,               // single byte, never misaligned
+    MEM_ALIGN_NATURAL,              // natural alignment of the size, misalignment only matters for #AC
+    MEM_ALIGN_VECTOR,               // MMX/SSE register width. scalar forms access less, aligned forms #GP if misaligned
+
+    MEM_ALIGN_MAX
+};
+
+const unsigned char mem_dir_read = 0x01;
+const unsigned char mem_dir_write = 0x02;
+const unsigned char mem_dir_implicit = 0x04;    // also touches memory the access list does not describe
+
+const char *mem_source_str[MEM_SRC_MAX] = {
+    "NONE",
+    "MODRM",
+    "STACK",
+    "SI",
+    "DI",
+    "OFFSET",
+    "OTHER"
+};
+
+const char *mem_size_str[MEM_SIZE_MAX] = {
+    "NONE",
+    "B",
+    "W",
+    "DW",
+    "QW",
+    "TW",
+    "DQW",
+    "V",
+    "DV",
+    "FPV",
+    "F80",
+    "F87ENV",
+    "F87STATE"
+};
+
+/* size in bytes, [0] = 16-bit operand size [1] = 32-bit operand size */
+const unsigned char mem_size_bytes[MEM_SIZE_MAX][2] = {
+    {  0,  0 },
+    {  1,  1 },
+    {  2,  2 },
+    {  4,  4 },
+    {  8,  8 },
+    {  6,  6 },
+    { 16, 16 },
+    {  2,  4 },
+    {  4,  8 },
+    {  4,  6 },
+    { 10, 10 },
+    { 14, 28 },
+    { 94,108 }
+};
+
+const char *mem_align_str[MEM_ALIGN_MAX] = {
+    "BYTE",
+    "NATURAL",
+    "VECTOR"
+};
+
+class MemAccess {
+public:
+    unsigned char               dir = 0;                // mem_dir_read | mem_dir_write
+    unsigned char               source = MEM_SRC_NONE;
+    unsigned char               size = MEM_SIZE_NONE;
+    unsigned char               count = 1;              // consecutive items (stack push/pop of several values)
+    unsigned char               align = MEM_ALIGN_BYTE;
+public:
+    bool operator<(const MemAccess &o) const {
+        if (dir    != o.dir)    return dir    < o.dir;
+        if (source != o.source) return source < o.source;
+        if (size   != o.size)   return size   < o.size;
+        if (count  != o.count)  return count  < o.count;
+        return align < o.align;
+    }
+};
+
+unsigned char mem_size_code(const unsigned int t) {
+    switch (t) {
+        case TOK_B:
+        case TOK_SB:        return MEM_SIZE_B;
+        case TOK_W:
+        case TOK_SW:        return MEM_SIZE_W;
+        case TOK_DW:
+        case TOK_SDW:
+        case TOK_F32:       return MEM_SIZE_DW;
+        case TOK_QW:
+        case TOK_SQW:
+        case TOK_F64:       return MEM_SIZE_QW;
+        case TOK_TW:        return MEM_SIZE_TW;
+        case TOK_DQW:       return MEM_SIZE_DQW;
+        case TOK_V:
+        case TOK_SV:        return MEM_SIZE_V;
+        case TOK_DV:        return MEM_SIZE_DV;
+        case TOK_FPV:       return MEM_SIZE_FPV;
+        case TOK_FPW:       return MEM_SIZE_DW;
+        case TOK_FPDW:      return MEM_SIZE_TW;
+        case TOK_F80:
+        case TOK_F80BCD:    return MEM_SIZE_F80;
+        case TOK_F87ENV:    return MEM_SIZE_F87ENV;
+        case TOK_F87STATE:  return MEM_SIZE_F87STATE;
+        default:            break;
+    };
+
+    return MEM_SIZE_NONE;
+}
+
+unsigned char mem_source_code(const SingleByteSpec &sb) {
+    for (const auto &t : sb.var_expr) {
+        if (t.type == TOK_SIV || t.type == TOK_SI || t.type == TOK_ESI) return MEM_SRC_SI;
+        if (t.type == TOK_DIV || t.type == TOK_DI || t.type == TOK_EDI) return MEM_SRC_DI;
+        if (t.type == TOK_SPV || t.type == TOK_SP || t.type == TOK_ESP) return MEM_SRC_STACK;
+    }
+
+    if (sb.var_expr.size() == 1 && is_valid_immediate_assign_var(sb.var_expr[0].type) && sb.var_expr[0].type != TOK_REG)
+        return MEM_SRC_OFFSET;
+
+    return MEM_SRC_OTHER;
+}
+
+void add_mem_access(std::vector<MemAccess> &l,const MemAccess &ma) {
+    /* the same operand listed in reads and writes is one read-modify-write access */
+    for (auto &a : l) {
+        if (a.source == ma.source) {
+            a.dir |= ma.dir;
+            if (mem_size_bytes[ma.size][1] > mem_size_bytes[a.size][1]) {
+                a.size = ma.size;
+                a.align = ma.align;
+            }
+            if (ma.count > a.count)
+                a.count = ma.count;
+
+            return;
+        }
+    }
+
+    l.push_back(ma);
+}
+
+void add_mem_access_list(std::vector<MemAccess> &l,const OpcodeSpec &op,const std::vector<SingleByteSpec> &sbl,const unsigned char dir) {
+    for (const auto &sb : sbl) {
+        MemAccess ma;
+
+        ma.dir = dir;
+        if (sb.meaning == TOK_RM) {
+            if (op.mod3 == 3) continue;
+            ma.source = MEM_SRC_MODRM;
+            ma.size = mem_size_code(sb.rm_type);
+        }
+        else if ((sb.meaning == TOK_MM || sb.meaning == TOK_XMM) && sb.fpu_st.type == TOK_RM) {
+            if (op.mod3 == 3) continue;
+            ma.source = MEM_SRC_MODRM;
+            ma.size = (sb.meaning == TOK_XMM) ? MEM_SIZE_DQW : MEM_SIZE_QW;
+            ma.align = MEM_ALIGN_VECTOR;
+        }
+        else if (sb.meaning == TOK_MEMORY) {
+            ma.source = mem_source_code(sb);
+            ma.size = mem_size_code(sb.memory_type);
+        }
+        else {
+            continue;
+        }
+
+        if (ma.size == MEM_SIZE_NONE) continue;
+        if (ma.align != MEM_ALIGN_VECTOR)
+            ma.align = (ma.size == MEM_SIZE_B) ? MEM_ALIGN_BYTE : MEM_ALIGN_NATURAL;
+
+        add_mem_access(l,ma);
+    }
+}
+
+/* the memory operand is an address, nothing is read or written through it (addressonly) */
+bool opcode_address_only(const OpcodeSpec &op) {
+    return op.address_only;
+}
+
+std::vector<MemAccess> opcode_memory_accesses(const OpcodeSpec &op) {
+    std::vector<MemAccess> l;
+
+    if (op.type != TOK_OPCODE)
+        return l;
+
+    add_mem_access_list(l,op,op.reads,mem_dir_read);
+    add_mem_access_list(l,op,op.writes,mem_dir_write);
+    add_mem_access_list(l,op,op.modifies,mem_dir_write);
+
+    /* many opcodes (SGDT, LMSW, LAR) only name their operands. a memory operand that reads/writes/modifies do not
+     * mention is written if it is the destination, read if it is a parameter. LEA and the like only compute the
+     * address */
+    if (!opcode_address_only(op)) {
+        std::vector<MemAccess> more;
+
+        if (op.destination.meaning != 0)
+            add_mem_access_list(more,op,std::vector<SingleByteSpec>(1,op.destination),mem_dir_write);
+        add_mem_access_list(more,op,op.param,mem_dir_read);
+        for (const auto &ma : more) {
+            bool seen = false;
+
+            for (const auto &a : l) seen = seen || a.source == ma.source;
+            if (!seen) add_mem_access(l,ma);
+        }
+    }
+
+    /* each pushed or popped item is operand sized, all of them contiguous */
+    if (!op.stack_ops.empty()) {
+        MemAccess ma;
+
+        ma.dir = (op.stack_op_dir == TOK_PUSH) ? mem_dir_write : mem_dir_read;
+        ma.source = MEM_SRC_STACK;
+        ma.size = MEM_SIZE_V;
+        ma.count = (unsigned char)op.stack_ops.size();
+        ma.align = MEM_ALIGN_NATURAL;
+        add_mem_access(l,ma);
+    }
+
+    return l;
+}
+
+/* software interrupts read the vector table (real mode) or the IDT and GDT, and may switch stacks through the TSS.
+ * VMCALL and VMMCALL exit to the hypervisor through the VMCS. none of that has an address the description can name */
+bool opcode_memory_implicit(const OpcodeSpec &op) {
+    return op.type == TOK_OPCODE && op.branch_type == TOK_WORD_INT;
+}
+
+void emit_memory_table(FILE *fp) {
+    std::map< std::vector<MemAccess>, size_t > list_index;
+    std::vector< std::vector<MemAccess> > lists;
+    std::vector<size_t> opcode_list;
+    size_t total = 0;
+
+    /* opcodes with the same access pattern share one run of opcc_mem_access[] */
+    for (const auto &op : opcodes) {
+        std::vector<MemAccess> l = opcode_memory_accesses(op);
+
+        auto i = list_index.find(l);
+        if (i == list_index.end()) {
+            list_index[l] = total;
+            opcode_list.push_back(total);
+            total += l.size();
+            lists.push_back(l);
+        }
+        else {
+            opcode_list.push_back(i->second);
+        }
+    }
+
+    fprintf(fp,"/* memory access descriptors, from the reads/writes/modifies and stack ops of each opcode */\n");
+    fprintf(fp,"#define OPCC_MEM_READ                0x01u\n");
+    fprintf(fp,"#define OPCC_MEM_WRITE               0x02u\n");
+    fprintf(fp,"#define OPCC_MEM_RMW                 0x03u\n");
+    fprintf(fp,"#define OPCC_MEM_IMPLICIT            0x%02xu /* opcc_mem_desc.dir: also accesses memory not in the list */\n",mem_dir_implicit);
+    for (unsigned int i=0;i < MEM_SRC_MAX;i++)
+        fprintf(fp,"#define OPCC_MEM_SRC_%-15s 0x%02xu\n",mem_source_str[i],i);
+    for (unsigned int i=0;i < MEM_SIZE_MAX;i++)
+        fprintf(fp,"#define OPCC_MEM_SIZE_%-14s 0x%02xu\n",mem_size_str[i],i);
+    for (unsigned int i=0;i < MEM_ALIGN_MAX;i++)
+        fprintf(fp,"#define OPCC_MEM_ALIGN_%-13s 0x%02xu\n",mem_align_str[i],i);
+    fprintf(fp,"#define OPCC_MEM_SIZE_COUNT          %u\n",(unsigned int)MEM_SIZE_MAX);
+    fprintf(fp,"\n");
+
+    fprintf(fp,"typedef struct opcc_mem_access {\n");
+    fprintf(fp,"    uint8_t     dir;        /* OPCC_MEM_READ, OPCC_MEM_WRITE or OPCC_MEM_RMW */\n");
+    fprintf(fp,"    uint8_t     source;     /* OPCC_MEM_SRC_* where the address comes from */\n");
+    fprintf(fp,"    uint8_t     size;       /* OPCC_MEM_SIZE_* of one item */\n");
+    fprintf(fp,"    uint8_t     count;      /* contiguous items (stack push/pop of several values) */\n");
+    fprintf(fp,"    uint8_t     align;      /* OPCC_MEM_ALIGN_* */\n");
+    fprintf(fp,"} opcc_mem_access;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"typedef struct opcc_mem_desc {\n");
+    fprintf(fp,"    uint8_t     count;      /* number of accesses in the list, 0 if none */\n");
+    fprintf(fp,"    uint8_t     dir;        /* union of the access directions, OPCC_MEM_IMPLICIT if the list is incomplete */\n");
+    fprintf(fp,"    uint16_t    first;      /* index of the first access in opcc_mem_access_list[] */\n");
+    fprintf(fp,"} opcc_mem_desc;\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* size in bytes by [size][operand size is 32-bit] */\n");
+    fprintf(fp,"static const uint8_t opcc_mem_size_bytes[OPCC_MEM_SIZE_COUNT][2] = {\n");
+    for (unsigned int i=0;i < MEM_SIZE_MAX;i++)
+        fprintf(fp,"    { %3u, %3u }%s /* %s */\n",mem_size_bytes[i][0],mem_size_bytes[i][1],(i+1) < MEM_SIZE_MAX ? "," : " ",mem_size_str[i]);
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const opcc_mem_access opcc_mem_access_list[%zu] = {\n",std::max(total,(size_t)1));
+    {
+        size_t idx = 0;
+
+        for (const auto &l : lists) {
+            for (const auto &a : l) {
+                idx++;
+                fprintf(fp,"    { 0x%02x, OPCC_MEM_SRC_%s, OPCC_MEM_SIZE_%s, %u, OPCC_MEM_ALIGN_%s }%s\n",
+                    a.dir,mem_source_str[a.source],mem_size_str[a.size],a.count,mem_align_str[a.align],idx < total ? "," : "");
+            }
+        }
+
+        if (total == 0)
+            fprintf(fp,"    { 0, 0, 0, 0, 0 }\n");
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const opcc_mem_desc opcc_mem_desc_table[OPCC_OPCODE_COUNT] = {\n");
+    for (size_t i=0;i < opcodes.size();i++) {
+        std::vector<MemAccess> l = opcode_memory_accesses(opcodes[i]);
+        unsigned char dir = 0;
+
+        for (const auto &a : l) dir |= a.dir;
+        if (opcode_memory_implicit(opcodes[i])) dir |= mem_dir_implicit;
+
+        fprintf(fp,"    { %zu, 0x%02x, %4zu }%s /* %4zu %s",l.size(),dir,opcode_list[i],(i+1) < opcodes.size() ? "," : " ",i,opcodes[i].name.c_str());
+        for (const auto &a : l) {
+            fprintf(fp," %s%s:%s",(a.dir & mem_dir_read) ? "r" : "",(a.dir & mem_dir_write) ? "w" : "",mem_source_str[a.source]);
+            fprintf(fp,"(%s",mem_size_str[a.size]);
+            if (a.count > 1) fprintf(fp,"*%u",a.count);
+            fprintf(fp,")");
+        }
+        if (dir & mem_dir_implicit) fprintf(fp," implicit");
+        fprintf(fp," */\n");
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+}
+
+void emit_cycles_table(FILE *fp) {
+    size_t known = 0;
+
+    for (const auto &op : opcodes)
+        if (op.cycles_level >= 0) known++;
+
+    fprintf(fp,"/* cycle counts for -march %s, %zu of %zu opcodes known. 0 = unknown.\n",march.c_str(),known,opcodes.size());
+    fprintf(fp," * each opcode uses its (cycles ...) entry naming -march %s, else the one with the highest cpulevel <= %d.\n",march.c_str(),cpulevel_value());
+    fprintf(fp," * a cpulevel without entries of its own (e.g. 686) gets the nearest lower one (586), noted after each entry.\n");
+    fprintf(fp," * mem does not include the 8086/8088 effective address calculation. */\n");
+    fprintf(fp,"typedef struct opcc_cycles {\n");
+    fprintf(fp,"    uint8_t     reg16;      /* register form (mod == 3 or no mod/reg/rm), 16-bit operand size */\n");
+    fprintf(fp,"    uint8_t     reg32;      /* register form, 32-bit operand size */\n");
+    fprintf(fp,"    uint8_t     mem16;      /* memory form (mod != 3), 16-bit operand size */\n");
+    fprintf(fp,"    uint8_t     mem32;      /* memory form, 32-bit operand size */\n");
+    fprintf(fp,"    uint8_t     taken;      /* conditional branch taken, 0 if the same as not taken */\n");
+    fprintf(fp,"} opcc_cycles;\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const opcc_cycles opcc_cycle_table[OPCC_OPCODE_COUNT] = {\n");
+    for (size_t i=0;i < opcodes.size();i++) {
+        const OpcodeSpec &op = opcodes[i];
+
+        fprintf(fp,"    { %3u, %3u, %3u, %3u, %3u }%s /* %4zu %s",
+            op.cycles_reg[0],op.cycles_reg[1],op.cycles_mem[0],op.cycles_mem[1],op.cycles_taken,
+            (i+1) < opcodes.size() ? "," : " ",i,op.name.c_str());
+        if (op.cycles_march)
+            fprintf(fp," (%s)",march.c_str());
+        else if (op.cycles_level >= 0)
+            fprintf(fp," (%d)",op.cycles_level);
+        fprintf(fp," */\n");
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+}
+
+/* exception and privilege bits. most are derived from what the opcode reads and writes,
+ * (traps ...) adds what the description cannot express (port I/O, MSRs, VMX/SVM, ...) */
+const unsigned char trap_ud = 0x01;             // can #UD beyond the unknown opcode case (mod == 3 of a memory-only form, mode or feature checks)
+const unsigned char trap_gp = 0x02;             // can #GP (memory or segment access, privilege, far transfer)
+const unsigned char trap_cpl0 = 0x04;           // privileged, #GP unless CPL == 0
+const unsigned char trap_iopl = 0x08;           // IOPL-sensitive (and I/O permission bitmap for port I/O)
+const unsigned char trap_serializing = 0x10;    // serializing
+const unsigned char trap_shadow = 0x20;         // may block interrupts for one instruction (MOV SS, POP SS, STI)
+
+bool is_control_reg_spec(const SingleByteSpec &sb) {
+    return sb.meaning == TOK_CR || sb.meaning == TOK_DR || sb.meaning == TOK_TR;
+}
+
+bool writes_interrupt_flags(const SingleByteSpec &sb) {
+    if (sb.meaning == TOK_FLAGS) {
+        for (const auto &f : sb.flags) {
+            if (f == TOK_IF || f == TOK_IOPL || f == TOK_ALL)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+unsigned char opcode_trap_bits(const OpcodeSpec &op) {
+    unsigned char r = 0;
+    bool far_ptr_src = false;
+
+    if (op.type != TOK_OPCODE)
+        return 0;
+
+    for (const auto &t : op.traps) {
+        switch (t) {
+            case TOK_UD:            r |= trap_ud; break;
+            case TOK_GP:            r |= trap_gp; break;
+            case TOK_CPL0:          r |= trap_cpl0 | trap_gp; break;
+            case TOK_IOPL:          r |= trap_iopl | trap_gp; break;
+            case TOK_SERIALIZING:   r |= trap_serializing; break;
+            case TOK_SHADOW:        r |= trap_shadow; break;
+            default:                break;
+        };
+    }
+
+    if (op.mod3 == -3)
+        r |= trap_ud;
+    if (op.branch_type != 0)
+        r |= trap_gp;
+    if (op.branch_type == TOK_IRET)
+        r |= trap_serializing;
+    if (!opcode_memory_accesses(op).empty() || opcode_memory_implicit(op))
+        r |= trap_gp;
+
+    if (is_control_reg_spec(op.destination))
+        r |= trap_cpl0 | trap_gp;
+    for (const auto &sb : op.param)
+        if (is_control_reg_spec(sb)) r |= trap_cpl0 | trap_gp;
+    for (const auto &sb : op.reads) {
+        if (is_control_reg_spec(sb)) r |= trap_cpl0 | trap_gp;
+        if (sb.meaning == TOK_RM && is_far_pointer_type(sb.rm_type)) far_ptr_src = true;
+    }
+
+    for (const auto *l : { &op.writes, &op.modifies }) {
+        for (const auto &sb : *l) {
+            /* MOV to CR/DR */
+            if (sb.meaning == TOK_CR || sb.meaning == TOK_DR)
+                r |= trap_cpl0 | trap_gp | trap_serializing;
+            else if (sb.meaning == TOK_TR)
+                r |= trap_cpl0 | trap_gp;
+
+            /* CLI, STI, POPF, IRET */
+            if (writes_interrupt_flags(sb))
+                r |= trap_iopl | trap_gp;
+
+            /* loading a segment register checks the selector in protected mode.
+             * MOV SS and POP SS also inhibit interrupts, LSS does not. */
+            if (sb.meaning == TOK_SS || sb.meaning == TOK_SREG) {
+                r |= trap_gp;
+                if (!far_ptr_src) r |= trap_shadow;
+            }
+            else if (sb.meaning == TOK_DS || sb.meaning == TOK_ES || sb.meaning == TOK_FS || sb.meaning == TOK_GS) {
+                r |= trap_gp;
+            }
+        }
+    }
+
+    return r;
+}
+
+void emit_traps_table(FILE *fp) {
+    static const char *trap_str[8] = { "UD", "GP", "CPL0", "IOPL", "SERIALIZING", "SHADOW", NULL, NULL };
+
+    fprintf(fp,"/* exception and privilege bits, for routing instructions to a slow path with one test */\n");
+    fprintf(fp,"#define OPCC_TRAP_UD                 0x%02xu /* can #UD (besides being an unknown opcode) */\n",trap_ud);
+    fprintf(fp,"#define OPCC_TRAP_GP                 0x%02xu /* can #GP */\n",trap_gp);
+    fprintf(fp,"#define OPCC_TRAP_CPL0               0x%02xu /* privileged, CPL 0 only */\n",trap_cpl0);
+    fprintf(fp,"#define OPCC_TRAP_IOPL               0x%02xu /* IOPL-sensitive */\n",trap_iopl);
+    fprintf(fp,"#define OPCC_TRAP_SERIALIZING        0x%02xu /* serializing */\n",trap_serializing);
+    fprintf(fp,"#define OPCC_TRAP_SHADOW             0x%02xu /* may inhibit interrupts for one instruction */\n",trap_shadow);
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const uint8_t opcc_traps[OPCC_OPCODE_COUNT] = {\n");
+    for (size_t i=0;i < opcodes.size();i++) {
+        const unsigned char r = opcode_trap_bits(opcodes[i]);
+
+        fprintf(fp,"    0x%02x%s /* %4zu %s",r,(i+1) < opcodes.size() ? "," : " ",i,opcodes[i].name.c_str());
+        for (unsigned int b=0;b < 8;b++) {
+            if ((r & (1u << b)) && trap_str[b] != NULL)
+                fprintf(fp," %s",trap_str[b]);
+        }
+        fprintf(fp," */\n");
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+}
+
+/* decode tables. every LINEAR, MODREGRM, MRMLINEAR and MANDATORY_PREFIX node becomes a table,
+ * entries are 0 (unknown opcode), 0x8000 + opcode index, or the number of another table. */
+const uint16_t decode_entry_opcode = 0x8000;
+
+enum decode_table_kind_t {
+    DT_NONE=0,
+    DT_LINEAR,                      // indexed by the next byte, which is consumed
+    DT_MODREGRM,                    // indexed by the mod/reg/rm byte, which is not consumed
+    DT_MRMLINEAR,                   // indexed by the byte after mod/reg/rm, SIB and displacement (AMD 3DNow!)
+    DT_MANDATORY_PREFIX,            // indexed by OPCC_MP_*, falls back to OPCC_MP_NONE
+
+    DT_MAX
+};
+
+const char *decode_table_kind_str[DT_MAX] = {
+    "NONE",
+    "LINEAR",
+    "MODREGRM",
+    "MRMLINEAR",
+    "MANDATORY_PREFIX"
+};
+
+class DecodeTable {
+public:
+    unsigned int                kind = DT_NONE;
+    std::vector<uint8_t>        path;               // bytes leading here, for comments
+    std::vector<uint16_t>       entries;
+};
+
+unsigned int decode_table_kind(const OpcodeGroupBlock &g) {
+    switch (g.maptype) {
+        case OpcodeGroupBlock::LINEAR:              return DT_LINEAR;
+        case OpcodeGroupBlock::MODREGRM:            return DT_MODREGRM;
+        case OpcodeGroupBlock::MRMLINEAR:           return DT_MRMLINEAR;
+        case OpcodeGroupBlock::MANDATORY_PREFIX:    return DT_MANDATORY_PREFIX;
+        default:                                    break;
+    };
+
+    return DT_NONE;
+}
+
+/* hottest tables first, after the root. a table never has more hits than its parent and the sort is
+ * stable, so children still come after their parent */
+void order_decode_tables_by_profile(std::vector<DecodeTable> &tables) {
+    std::vector<unsigned long long> heat(tables.size(),0);
+    std::vector<size_t> order,newpos(tables.size(),0);
+    std::vector<DecodeTable> nt;
+
+    for (size_t t=tables.size();t-- > 1;) {
+        for (const auto e : tables[t].entries) {
+            if (e >= decode_entry_opcode)
+                heat[t] += opcodes[e - decode_entry_opcode].profile_count;
+            else if (e != 0)
+                heat[t] += heat[e];
+        }
+    }
+
+    for (size_t t=2;t < tables.size();t++)
+        order.push_back(t);
+    std::stable_sort(order.begin(),order.end(),[&heat](const size_t a,const size_t b) {
+        return heat[a] > heat[b];
+    });
+    order.insert(order.begin(),(size_t)1);
+    order.insert(order.begin(),(size_t)0);
+
+    for (size_t i=0;i < order.size();i++)
+        newpos[order[i]] = i;
+
+    for (const auto t : order) {
+        nt.push_back(tables[t]);
+        for (auto &e : nt.back().entries) {
+            if (e != 0 && e < decode_entry_opcode)
+                e = (uint16_t)newpos[e];
+        }
+    }
+
+    tables = nt;
+}
+
+/* table 0 is unused so that entry value 0 can mean "unknown opcode". the root is table 1 */
+bool build_decode_tables(std::vector<DecodeTable> &tables) {
+    std::list< std::pair< size_t, std::shared_ptr<OpcodeGroupBlock> > > todo;
+
+    tables.clear();
+    tables.resize(2);
+    todo.push_back(std::pair< size_t, std::shared_ptr<OpcodeGroupBlock> >(1,opcode_groups));
+
+    for (auto ti=todo.begin();ti!=todo.end();ti++) {
+        auto &g = *((*ti).second);
+        const size_t tn = (*ti).first;
+
+        tables[tn].kind = decode_table_kind(g);
+        tables[tn].entries.resize(tables[tn].kind == DT_MANDATORY_PREFIX ? (size_t)OpcodeGroupBlock::MP_MAX : (size_t)256,0);
+
+        for (size_t i=0;i < g.map.size() && i < tables[tn].entries.size();i++) {
+            auto c = g.map[i];
+
+            if (c.get() == nullptr || (*c).maptype == OpcodeGroupBlock::NONE)
+                continue;
+
+            /* a PREFIX node left with a map (9B WAIT + FPU opcode) decodes as the prefix, the map is not reachable */
+            if ((*c).maptype == OpcodeGroupBlock::LEAF || (*c).maptype == OpcodeGroupBlock::PREFIX) {
+                if ((*c).opcode_index >= (size_t)decode_entry_opcode)
+                    return false;
+
+                tables[tn].entries[i] = decode_entry_opcode + (uint16_t)(*c).opcode_index;
+                continue;
+            }
+
+            if (tables.size() >= (size_t)decode_entry_opcode)
+                return false;
+
+            const size_t nt = tables.size();
+            tables.resize(nt+1);
+            tables[nt].path = tables[tn].path;
+            if (tables[tn].kind != DT_MANDATORY_PREFIX)
+                tables[nt].path.push_back((uint8_t)i);
+
+            tables[tn].entries[i] = (uint16_t)nt;
+            todo.push_back(std::pair< size_t, std::shared_ptr<OpcodeGroupBlock> >(nt,c));
+        }
+    }
+
+    if (profile_loaded)
+        order_decode_tables_by_profile(tables);
+
+    return true;
+}
+
+/* page-deduplicated decode tables. tables are grouped into levels by depth from the root, each level
+ * cuts its tables into 16 or 32 entry pages (whichever is smaller), shares identical pages, and indexes
+ * them with uint8_t when there are few enough pages. */
+class DecodePageLevel {
+public:
+    unsigned int                page_shift = 4;
+    std::vector< std::vector<uint16_t> >    pages;
+    std::vector<unsigned int>   index;              // page per table page slot
+    std::vector<size_t>         tables;             // tables in this level
+
+    size_t                      page_entries(void) const {
+        return (size_t)1u << page_shift;
+    }
+    size_t                      index_width(void) const {
+        return pages.size() <= 256 ? 1 : 2;
+    }
+    size_t                      page_bytes(void) const {
+        return pages.size() * page_entries() * sizeof(uint16_t);
+    }
+    size_t                      index_bytes(void) const {
+        return index.size() * index_width();
+    }
+    size_t                      bytes(void) const {
+        return page_bytes() + index_bytes();
+    }
+};
+
+void build_page_level(DecodePageLevel &lv,const std::vector<DecodeTable> &tables,std::vector<size_t> &first) {
+    std::map< std::vector<uint16_t>, unsigned int > memo;
+    const size_t pe = lv.page_entries();
+
+    lv.pages.clear();
+    lv.index.clear();
+    for (const auto t : lv.tables) {
+        const auto &e = tables[t].entries;
+
+        first[t] = lv.index.size();
+        for (size_t i=0;i < e.size();i += pe) {
+            std::vector<uint16_t> pg(pe,0);
+
+            for (size_t j=0;j < pe && (i+j) < e.size();j++)
+                pg[j] = e[i+j];
+
+            auto mi = memo.find(pg);
+            if (mi == memo.end()) {
+                memo[pg] = (unsigned int)lv.pages.size();
+                lv.index.push_back((unsigned int)lv.pages.size());
+                lv.pages.push_back(pg);
+            }
+            else {
+                lv.index.push_back(mi->second);
+            }
+        }
+    }
+}
+
+void emit_paged_decode_tables(FILE *fp,const std::vector<DecodeTable> &tables) {
+    std::vector<DecodePageLevel> levels;
+    std::vector<unsigned int> depth(tables.size(),0);
+    std::vector<size_t> first(tables.size(),0);
+    size_t flat = 0,paged = 0;
+
+    /* build_decode_tables() numbers children after their parent */
+    for (size_t t=1;t < tables.size();t++) {
+        for (const auto e : tables[t].entries) {
+            if (e != 0 && e < decode_entry_opcode && (size_t)e < tables.size())
+                depth[e] = depth[t] + 1;
+        }
+    }
+
+    for (size_t t=1;t < tables.size();t++) {
+        if (levels.size() <= depth[t]) levels.resize(depth[t]+1);
+        levels[depth[t]].tables.push_back(t);
+        flat += tables[t].entries.size() * sizeof(uint16_t);
+    }
+
+    for (auto &lv : levels) {
+        std::vector<size_t> f16(tables.size(),0);
+        DecodePageLevel l16 = lv;
+
+        l16.page_shift = 4;
+        build_page_level(l16,tables,f16);
+        lv.page_shift = 5;
+        build_page_level(lv,tables,first);
+
+        if (l16.bytes() <= lv.bytes()) {
+            lv = l16;
+            for (const auto t : lv.tables) first[t] = f16[t];
+        }
+
+        paged += lv.bytes();
+    }
+    paged += tables.size() * 4;
+
+    printf("Decode tables: %zu bytes flat, %zu bytes paged\n",flat,paged);
+    for (size_t l=0;l < levels.size();l++) {
+        const auto &lv = levels[l];
+
+        printf("  level %zu: %zu tables, %zu pages of %zu entries (%zu bytes), uint%zu_t index of %zu (%zu bytes), %zu bytes\n",
+            l,lv.tables.size(),lv.pages.size(),lv.page_entries(),lv.page_bytes(),lv.index_width() * 8,lv.index.size(),lv.index_bytes(),lv.bytes());
+    }
+
+    fprintf(fp,"/* page-deduplicated copy of opcc_decode_entry[], used instead when OPCC_DECODE_PAGED is defined.\n");
+    fprintf(fp," * %zu bytes flat, %zu bytes paged including opcc_decode_paged_tables[] */\n",flat,paged);
+    fprintf(fp,"#define OPCC_DECODE_LEVEL_COUNT      %zuu\n",levels.size());
+    fprintf(fp,"\n");
+
+    for (size_t l=0;l < levels.size();l++) {
+        const auto &lv = levels[l];
+
+        fprintf(fp,"/* level %zu: %zu tables, %zu bytes of pages, %zu bytes of index */\n",l,lv.tables.size(),lv.page_bytes(),lv.index_bytes());
+        fprintf(fp,"static const uint16_t opcc_decode_pages_%zu[%zu][%zu] = {\n",l,lv.pages.size(),lv.page_entries());
+        for (size_t pi=0;pi < lv.pages.size();pi++) {
+            const auto &pg = lv.pages[pi];
+
+            fprintf(fp,"    {");
+            for (size_t j=0;j < pg.size();j++) {
+                if ((j & 7) == 0 && j != 0) fprintf(fp,"\n     ");
+                fprintf(fp," 0x%04x%s",pg[j],(j+1) < pg.size() ? "," : "");
+            }
+            fprintf(fp," }%s /* %zu */\n",(pi+1) < lv.pages.size() ? "," : "",pi);
+        }
+        fprintf(fp,"};\n");
+
+        fprintf(fp,"static const uint%zu_t opcc_decode_page_index_%zu[%zu] = {\n",lv.index_width() * 8,l,lv.index.size());
+        for (size_t i=0;i < lv.index.size();i += 16) {
+            fprintf(fp,"   ");
+            for (size_t j=i;j < (i+16) && j < lv.index.size();j++)
+                fprintf(fp," %u%s",lv.index[j],(j+1) < lv.index.size() ? "," : "");
+            fprintf(fp,"\n");
+        }
+        fprintf(fp,"};\n");
+        fprintf(fp,"\n");
+    }
+
+    fprintf(fp,"typedef struct opcc_decode_paged {\n");
+    fprintf(fp,"    uint16_t    first;      /* first slot in opcc_decode_page_index_<level>[] */\n");
+    fprintf(fp,"    uint8_t     level;\n");
+    fprintf(fp,"} opcc_decode_paged;\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const opcc_decode_paged opcc_decode_paged_tables[OPCC_DECODE_TABLE_COUNT] = {\n");
+    for (size_t t=0;t < tables.size();t++)
+        fprintf(fp,"    { %5zu, %u }%s /* %4zu */\n",first[t],depth[t],(t+1) < tables.size() ? "," : " ",t);
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static inline unsigned int opcc_decode_entry_at(unsigned int t,unsigned int i) {\n");
+    fprintf(fp,"#if defined(OPCC_DECODE_PAGED)\n");
+    fprintf(fp,"    const opcc_decode_paged *d = &opcc_decode_paged_tables[t];\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    switch (d->level) {\n");
+    for (size_t l=0;l < levels.size();l++) {
+        const unsigned int sh = levels[l].page_shift;
+
+        fprintf(fp,"        case %zu: return opcc_decode_pages_%zu[opcc_decode_page_index_%zu[d->first + (i >> %uu)]][i & %uu];\n",
+            l,l,l,sh,(1u << sh) - 1u);
+    }
+    fprintf(fp,"        default: break;\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    return 0;\n");
+    fprintf(fp,"#else\n");
+    fprintf(fp,"    return opcc_decode_entry[opcc_decode_tables[t].base + i];\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+}
+
+/* OPCC_DECODE_PROFILE: count hits per opcode and table level, opcc_profile_dump() writes the
+ * histogram that -profile reads back */
+void emit_decode_profile(FILE *fp) {
+    if (profile_loaded) {
+        size_t hot = 0;
+
+        while (hot < opcodes.size() && opcodes[hot].profile_count != 0) hot++;
+        fprintf(fp,"/* laid out from a profile. opcodes below OPCC_PROFILE_HOT_COUNT were hit, hottest first */\n");
+        fprintf(fp,"#define OPCC_PROFILE_HOT_COUNT       %zuu\n",hot);
+        fprintf(fp,"\n");
+    }
+
+    fprintf(fp,"#if defined(OPCC_DECODE_PROFILE)\n");
+    fprintf(fp,"#include <stdio.h>\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"static unsigned long long opcc_profile_opcode[OPCC_OPCODE_COUNT];\n");
+    fprintf(fp,"static unsigned long long opcc_profile_level[OPCC_DECODE_LEVEL_COUNT];\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"#define OPCC_PROFILE_OPCODE(x)       (opcc_profile_opcode[(x)]++)\n");
+    fprintf(fp,"#define OPCC_PROFILE_LEVEL(t)        (opcc_profile_level[opcc_decode_paged_tables[(t)].level]++)\n");
+    fprintf(fp,"\n");
+    if (profile_loaded) {
+        /* the histogram names opcodes by their place in a build without -profile, so that a
+         * profile taken from this build can be fed back in */
+        fprintf(fp,"/* opcode index in a build without -profile, per opcode */\n");
+        fprintf(fp,"static const uint16_t opcc_profile_id[OPCC_OPCODE_COUNT] = {\n");
+        for (size_t i=0;i < opcodes.size();i += 16) {
+            fprintf(fp,"   ");
+            for (size_t j=i;j < (i+16) && j < opcodes.size();j++)
+                fprintf(fp," %4zu%s",opcodes[j].profile_id,(j+1) < opcodes.size() ? "," : "");
+            fprintf(fp,"\n");
+        }
+        fprintf(fp,"};\n");
+        fprintf(fp,"\n");
+    }
+    fprintf(fp,"/* histogram for opcc -profile, by opcode index in a build without -profile */\n");
+    fprintf(fp,"static inline void opcc_profile_dump(FILE *fp) {\n");
+    fprintf(fp,"    size_t i;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    fprintf(fp,\"# opcc decode profile for -march %s\\n\");\n",march.c_str());
+    fprintf(fp,"    for (i=0;i < OPCC_DECODE_LEVEL_COUNT;i++)\n");
+    fprintf(fp,"        fprintf(fp,\"# level %%u %%llu\\n\",(unsigned int)i,opcc_profile_level[i]);\n");
+    fprintf(fp,"    for (i=0;i < OPCC_OPCODE_COUNT;i++) {\n");
+    fprintf(fp,"        if (opcc_profile_opcode[i] != 0)\n");
+    fprintf(fp,"            fprintf(fp,\"%%u %%llu %%s\\n\",(unsigned int)%s,opcc_profile_opcode[i],opcc_opcode_name[i]);\n",
+        profile_loaded ? "opcc_profile_id[i]" : "i");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"#else\n");
+    fprintf(fp,"#define OPCC_PROFILE_OPCODE(x)       do { } while (0)\n");
+    fprintf(fp,"#define OPCC_PROFILE_LEVEL(t)        do { } while (0)\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"\n");
+}
+
+/* switch on the first one or two bytes for the opcodes that make up most of the profile, when the
+ * path to them is plain bytes. the table walk handles everything else */
+const size_t profile_fast_path_max = 32;
+
+void emit_decode_fast_path(FILE *fp,const std::vector<DecodeTable> &tables) {
+    std::map< unsigned int, std::map<unsigned int,size_t> > two;    // first byte -> second byte -> opcode
+    std::map<unsigned int,size_t> one;                              // byte -> opcode
+    std::vector<size_t> hot;
+    unsigned long long sum = 0;
+
+    /* opcodes are already hottest first */
+    for (size_t i=0;i < opcodes.size() && hot.size() < profile_fast_path_max;i++) {
+        if (opcodes[i].profile_count == 0 || (sum * 100ull) >= (profile_total * 95ull)) break;
+        sum += opcodes[i].profile_count;
+        hot.push_back(i);
+    }
+
+    auto is_hot = [&hot](const size_t op) {
+        return std::find(hot.begin(),hot.end(),op) != hot.end();
+    };
+
+    const auto &root = tables[1].entries;
+    for (unsigned int b=0;b < root.size();b++) {
+        const uint16_t e = root[b];
+
+        if (e >= decode_entry_opcode) {
+            if (is_hot(e - decode_entry_opcode)) one[b] = e - decode_entry_opcode;
+        }
+        else if (e != 0 && tables[e].kind == DT_LINEAR) {
+            for (unsigned int b2=0;b2 < tables[e].entries.size();b2++) {
+                const uint16_t e2 = tables[e].entries[b2];
+
+                if (e2 >= decode_entry_opcode && is_hot(e2 - decode_entry_opcode))
+                    two[b][b2] = e2 - decode_entry_opcode;
+            }
+        }
+    }
+
+    if (one.empty() && two.empty())
+        return;
+
+    fprintf(fp,"#if !defined(OPCC_DECODE_PROFILE)\n");
+    fprintf(fp,"    /* profile guided fast path, %zu opcodes with %.1f%% of the hits */\n",hot.size(),
+        profile_total ? ((double)sum * 100.0) / (double)profile_total : 0.0);
+    fprintf(fp,"    if (avail != 0) {\n");
+    fprintf(fp,"        switch (p[0]) {\n");
+    for (const auto &o : one)
+        fprintf(fp,"            case 0x%02x: *len = 1; return %zu; /* %s */\n",o.first,o.second,opcodes[o.second].name.c_str());
+    for (const auto &tb : two) {
+        fprintf(fp,"            case 0x%02x:\n",tb.first);
+        fprintf(fp,"                if (avail < 2) break;\n");
+        fprintf(fp,"                switch (p[1]) {\n");
+        for (const auto &o : tb.second)
+            fprintf(fp,"                    case 0x%02x: *len = 2; return %zu; /* %s */\n",o.first,o.second,opcodes[o.second].name.c_str());
+        fprintf(fp,"                    default: break;\n");
+        fprintf(fp,"                }\n");
+        fprintf(fp,"                break;\n");
+    }
+    fprintf(fp,"            default:\n");
+    fprintf(fp,"                break;\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"\n");
+}
+
+bool emit_decode_tables(FILE *fp) {
+    std::vector<DecodeTable> tables;
+    size_t total = 0;
+
+    if (!build_decode_tables(tables)) {
+        fprintf(stderr,"Decode table build error\n");
+        return false;
+    }
+
+    fprintf(fp,"/* decode tables. an entry is 0 for unknown opcode, OPCC_DECODE_OPCODE + opcode index,\n");
+    fprintf(fp," * or the number of the table to continue in. decoding starts at OPCC_DECODE_ROOT. */\n");
+    fprintf(fp,"#define OPCC_DECODE_OPCODE           0x%04xu\n",decode_entry_opcode);
+    fprintf(fp,"#define OPCC_DECODE_ROOT             1u\n");
+    fprintf(fp,"#define OPCC_DECODE_TABLE_COUNT      %zuu\n",tables.size());
+    for (unsigned int i=1;i < DT_MAX;i++)
+        fprintf(fp,"#define OPCC_DT_%-21s %uu\n",decode_table_kind_str[i],i);
+    fprintf(fp,"\n");
+    fprintf(fp,"/* mandatory prefix slot. F2/F3 (the last one seen) take priority over 66 */\n");
+    fprintf(fp,"#define OPCC_MP_NONE                 %uu\n",(unsigned int)OpcodeGroupBlock::MP_NONE);
+    fprintf(fp,"#define OPCC_MP_66                   %uu\n",(unsigned int)OpcodeGroupBlock::MP_66);
+    fprintf(fp,"#define OPCC_MP_F3                   %uu\n",(unsigned int)OpcodeGroupBlock::MP_F3);
+    fprintf(fp,"#define OPCC_MP_F2                   %uu\n",(unsigned int)OpcodeGroupBlock::MP_F2);
+    fprintf(fp,"\n");
+    fprintf(fp,"typedef struct opcc_decode_table {\n");
+    fprintf(fp,"    uint32_t    base;       /* first entry in opcc_decode_entry[] */\n");
+    fprintf(fp,"    uint8_t     kind;       /* OPCC_DT_* */\n");
+    fprintf(fp,"} opcc_decode_table;\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const opcc_decode_table opcc_decode_tables[OPCC_DECODE_TABLE_COUNT] = {\n");
+    for (size_t t=0;t < tables.size();t++) {
+        fprintf(fp,"    { %6zu, OPCC_DT_%s }%s /* %4zu",total,t == 0 ? "LINEAR" : decode_table_kind_str[tables[t].kind],(t+1) < tables.size() ? "," : " ",t);
+        if (t == 0) fprintf(fp," unused");
+        else if (t == 1) fprintf(fp," root");
+        for (const auto &b : tables[t].path) fprintf(fp," %02x",b);
+        fprintf(fp," */\n");
+        total += tables[t].entries.size();
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const uint16_t opcc_decode_entry[%zu] = {\n",std::max(total,(size_t)1));
+    {
+        size_t idx = 0;
+
+        for (size_t t=0;t < tables.size();t++) {
+            const auto &e = tables[t].entries;
+
+            if (e.empty()) continue;
+            fprintf(fp,"    /* table %zu */\n",t);
+            for (size_t i=0;i < e.size();i += 8) {
+                fprintf(fp,"   ");
+                for (size_t j=i;j < (i+8) && j < e.size();j++) {
+                    idx++;
+                    fprintf(fp," 0x%04x%s",e[j],idx < total ? "," : "");
+                }
+                fprintf(fp,"\n");
+            }
+        }
+
+        if (total == 0)
+            fprintf(fp,"    0\n");
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    emit_paged_decode_tables(fp,tables);
+
+    emit_decode_profile(fp);
+
+    fprintf(fp,"/* look up the opcode starting at p, after the prefixes. mp is the OPCC_MP_* slot from the prefixes seen.\n");
+    fprintf(fp," * returns the opcode index and the number of opcode bytes before mod/reg/rm in *len,\n");
+    fprintf(fp," * -1 for an unknown opcode or -2 if more bytes are needed. */\n");
+
+    fprintf(fp,"static inline int opcc_decode_opcode(const uint8_t *p,size_t avail,unsigned int mp,unsigned int addr32,size_t *len) {\n");
+    fprintf(fp,"    unsigned int t = OPCC_DECODE_ROOT;\n");
+    fprintf(fp,"    size_t i = 0;\n");
+    fprintf(fp,"\n");
+    if (profile_loaded)
+        emit_decode_fast_path(fp,tables);
+    fprintf(fp,"    do {\n");
+    fprintf(fp,"        const opcc_decode_table *d = &opcc_decode_tables[t];\n");
+    fprintf(fp,"        unsigned int n;\n");
+    fprintf(fp,"        unsigned int e;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"        OPCC_PROFILE_LEVEL(t);\n");
+    fprintf(fp,"        switch (d->kind) {\n");
+    fprintf(fp,"            case OPCC_DT_LINEAR:\n");
+    fprintf(fp,"                if (i >= avail) return -2;\n");
+    fprintf(fp,"                e = opcc_decode_entry_at(t,p[i++]);\n");
+    fprintf(fp,"                break;\n");
+    fprintf(fp,"            case OPCC_DT_MODREGRM:\n");
+    fprintf(fp,"                if (i >= avail) return -2;\n");
+    fprintf(fp,"                e = opcc_decode_entry_at(t,p[i]);\n");
+    fprintf(fp,"                break;\n");
+    fprintf(fp,"            case OPCC_DT_MRMLINEAR:\n");
+    fprintf(fp,"                n = opcc_modrm_length(p+i,avail-i,addr32);\n");
+    fprintf(fp,"                if (n == 0 || (i+n) >= avail) return -2;\n");
+    fprintf(fp,"                e = opcc_decode_entry_at(t,p[i+n]);\n");
+    fprintf(fp,"                break;\n");
+    fprintf(fp,"            case OPCC_DT_MANDATORY_PREFIX:\n");
+    fprintf(fp,"                e = opcc_decode_entry_at(t,mp);\n");
+    fprintf(fp,"                if (e == 0) e = opcc_decode_entry_at(t,OPCC_MP_NONE);\n");
+    fprintf(fp,"                break;\n");
+    fprintf(fp,"            default:\n");
+    fprintf(fp,"                return -1;\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"        if (e >= OPCC_DECODE_OPCODE) {\n");
+    fprintf(fp,"            *len = i;\n");
+    fprintf(fp,"            OPCC_PROFILE_OPCODE(e - OPCC_DECODE_OPCODE);\n");
+    fprintf(fp,"            return (int)(e - OPCC_DECODE_OPCODE);\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"        t = e;\n");
+    fprintf(fp,"    } while (t != 0);\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    return -1;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+
+    return true;
+}
+
+/* prefix state machine. opcc_prefix_class[] maps each byte to a prefix class (0 = not a prefix),
+ * each class updates the packed state with an AND and an OR, and the prefix count is advanced
+ * through a table that also sets the over-limit bit once no opcode byte would fit in opcode_limit. */
+const uint32_t prefix_state_seg_mask = 0x00000007;      // OPCC_SEG_*
+const uint32_t prefix_state_opsize = 0x00000008;
+const uint32_t prefix_state_addrsize = 0x00000010;
+const uint32_t prefix_state_lock = 0x00000020;
+const uint32_t prefix_state_rep_shift = 6;              // OPCC_REP_*
+const uint32_t prefix_state_rep_mask = 0x000001C0;
+const uint32_t prefix_state_wait = 0x00000200;
+const uint32_t prefix_state_count_shift = 16;
+const uint32_t prefix_state_count_mask = 0x00FF0000;
+const uint32_t prefix_state_overlimit = 0x80000000;
+
+enum prefix_seg_t {
+    PREFIX_SEG_NONE=0,
+    PREFIX_SEG_ES,
+    PREFIX_SEG_CS,
+    PREFIX_SEG_SS,
+    PREFIX_SEG_DS,
+    PREFIX_SEG_FS,
+    PREFIX_SEG_GS,
+
+    PREFIX_SEG_MAX
+};
+
+const char *prefix_seg_str[PREFIX_SEG_MAX] = {
+    "NONE",
+    "ES",
+    "CS",
+    "SS",
+    "DS",
+    "FS",
+    "GS"
+};
+
+enum prefix_rep_t {
+    PREFIX_REP_NONE=0,
+    PREFIX_REP_NZ,                  // F2
+    PREFIX_REP_Z,                   // F3
+    PREFIX_REP_NC,                  // NEC V20
+    PREFIX_REP_C,                   // NEC V20
+
+    PREFIX_REP_MAX
+};
+
+const char *prefix_rep_str[PREFIX_REP_MAX] = {
+    "NONE",
+    "NZ",
+    "Z",
+    "NC",
+    "C"
+};
+
+unsigned int prefix_seg_code(const unsigned int t) {
+    switch (t) {
+        case TOK_ES:    return PREFIX_SEG_ES;
+        case TOK_CS:    return PREFIX_SEG_CS;
+        case TOK_SS:    return PREFIX_SEG_SS;
+        case TOK_DS:    return PREFIX_SEG_DS;
+        case TOK_FS:    return PREFIX_SEG_FS;
+        case TOK_GS:    return PREFIX_SEG_GS;
+        default:        break;
+    };
+
+    return PREFIX_SEG_NONE;
+}
+
+unsigned int prefix_rep_code(const OpcodeSpec &op) {
+    if (op.rep_condition == TOK_Z)
+        return op.rep_condition_negate ? PREFIX_REP_NZ : PREFIX_REP_Z;
+    else if (op.rep_condition == TOK_C)
+        return op.rep_condition_negate ? PREFIX_REP_NC : PREFIX_REP_C;
+
+    return PREFIX_REP_NONE;
+}
+
+/* class_opcode: prefix class -> opcode index, [0] unused */
+void build_prefix_classes(unsigned char byte_class[256],std::vector<size_t> &class_opcode) {
+    for (unsigned int i=0;i < 256;i++)
+        byte_class[i] = 0;
+
+    class_opcode.clear();
+    class_opcode.push_back(0);
+    for (size_t i=0;i < opcodes.size();i++) {
+        const OpcodeSpec &op = opcodes[i];
+
+        if (op.type != TOK_PREFIX || op.bytes.empty() || op.bytes[0].meaning != 0)
+            continue;
+
+        for (const auto &b : op.bytes[0]) {
+            if (byte_class[b] != 0) continue;
+            byte_class[b] = (unsigned char)class_opcode.size();
+            class_opcode.push_back(i);
+        }
+    }
+}
+
+void prefix_class_step(const std::vector<size_t> &class_opcode,const size_t c,uint32_t &keep,uint32_t &set) {
+    keep = 0xFFFFFFFFu;
+    set = 0;
+
+    if (c == 0) return;
+
+    const OpcodeSpec &op = opcodes[class_opcode[c]];
+
+    if (op.prefix_seg_assign != 0) {
+        keep &= ~prefix_state_seg_mask;
+        set |= prefix_seg_code(op.prefix_seg_assign);
+    }
+    if (op.rep_condition != 0) {
+        keep &= ~prefix_state_rep_mask;
+        set |= prefix_rep_code(op) << prefix_state_rep_shift;
+    }
+    if (op.opsize) set |= prefix_state_opsize;
+    if (op.addrsize) set |= prefix_state_addrsize;
+    if (op.lock) set |= prefix_state_lock;
+    if (op.wait) set |= prefix_state_wait;
+}
+
+void emit_prefix_state_machine(FILE *fp) {
+    std::vector<size_t> class_opcode;
+    unsigned char byte_class[256];
+
+    build_prefix_classes(byte_class,class_opcode);
+
+    fprintf(fp,"/* decode policy for -march %s */\n",march.c_str());
+    fprintf(fp,"#define OPCC_OPCODE_LIMIT            %uu /* maximum instruction length, 0 = no limit */\n",opcode_limit > 0 ? (unsigned int)opcode_limit : 0u);
+    if (unknown_opcode == TOK_UD)
+        fprintf(fp,"#define OPCC_UNKNOWN_OPCODE_UD       1 /* unknown opcodes and over-limit instructions raise #UD */\n");
+    else
+        fprintf(fp,"#define OPCC_UNKNOWN_OPCODE_SILENT   1 /* unknown opcodes do not fault */\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* packed prefix state */\n");
+    fprintf(fp,"#define OPCC_PS_SEG_MASK             0x%08xu /* OPCC_SEG_* */\n",prefix_state_seg_mask);
+    fprintf(fp,"#define OPCC_PS_OPSIZE               0x%08xu\n",prefix_state_opsize);
+    fprintf(fp,"#define OPCC_PS_ADDRSIZE             0x%08xu\n",prefix_state_addrsize);
+    fprintf(fp,"#define OPCC_PS_LOCK                 0x%08xu\n",prefix_state_lock);
+    fprintf(fp,"#define OPCC_PS_REP_SHIFT            %uu\n",prefix_state_rep_shift);
+    fprintf(fp,"#define OPCC_PS_REP_MASK             0x%08xu /* OPCC_REP_* << OPCC_PS_REP_SHIFT */\n",prefix_state_rep_mask);
+    fprintf(fp,"#define OPCC_PS_WAIT                 0x%08xu\n",prefix_state_wait);
+    fprintf(fp,"#define OPCC_PS_COUNT_SHIFT          %uu\n",prefix_state_count_shift);
+    fprintf(fp,"#define OPCC_PS_COUNT_MASK           0x%08xu /* number of prefix bytes, saturates at 255 */\n",prefix_state_count_mask);
+    fprintf(fp,"#define OPCC_PS_OVERLIMIT            0x%08xu /* no room left for the opcode within OPCC_OPCODE_LIMIT */\n",prefix_state_overlimit);
+    for (unsigned int i=0;i < PREFIX_REP_MAX;i++)
+        fprintf(fp,"#define OPCC_REP_%-19s %uu\n",prefix_rep_str[i],i);
+    fprintf(fp,"#define OPCC_PREFIX_CLASS_COUNT      %zuu\n",class_opcode.size());
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const uint8_t opcc_prefix_class[256] = {\n");
+    for (unsigned int i=0;i < 256;i += 16) {
+        fprintf(fp,"   ");
+        for (unsigned int j=i;j < (i+16);j++)
+            fprintf(fp," %2u%s",byte_class[j],j < 255 ? "," : "");
+        fprintf(fp," /* %02x-%02x */\n",i,i+15);
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"typedef struct opcc_prefix_step {\n");
+    fprintf(fp,"    uint32_t    keep;       /* state bits kept */\n");
+    fprintf(fp,"    uint32_t    set;        /* state bits set */\n");
+    fprintf(fp,"} opcc_prefix_step;\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const opcc_prefix_step opcc_prefix_steps[OPCC_PREFIX_CLASS_COUNT] = {\n");
+    for (size_t c=0;c < class_opcode.size();c++) {
+        uint32_t keep,set;
+
+        prefix_class_step(class_opcode,c,keep,set);
+
+        fprintf(fp,"    { 0x%08xu, 0x%08xu }%s /* %2zu %s */\n",keep,set,(c+1) < class_opcode.size() ? "," : " ",c,
+            c == 0 ? "not a prefix" : opcodes[class_opcode[c]].name.c_str());
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    /* the opcode needs at least one byte, so N prefixes are too many once N+1 > limit */
+    fprintf(fp,"/* prefix count n -> count field for n+1, with OPCC_PS_OVERLIMIT once nothing else fits */\n");
+    fprintf(fp,"static const uint32_t opcc_prefix_count_next[256] = {\n");
+    for (unsigned int i=0;i < 256;i += 4) {
+        fprintf(fp,"   ");
+        for (unsigned int j=i;j < (i+4);j++) {
+            const unsigned int n = j < 255 ? j+1 : 255;
+            uint32_t v = (uint32_t)n << prefix_state_count_shift;
+
+            if (opcode_limit > 0 && (n+1) > (unsigned int)opcode_limit)
+                v |= prefix_state_overlimit;
+
+            fprintf(fp," 0x%08xu%s",v,j < 255 ? "," : "");
+        }
+        fprintf(fp,"\n");
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* mandatory prefix slot from [rep][operand size override] */\n");
+    fprintf(fp,"static const uint8_t opcc_prefix_mp[%u][2] = {\n",(unsigned int)PREFIX_REP_MAX);
+    for (unsigned int r=0;r < PREFIX_REP_MAX;r++) {
+        const char *mp = r == PREFIX_REP_NZ ? "OPCC_MP_F2" : (r == PREFIX_REP_Z ? "OPCC_MP_F3" : NULL);
+        fprintf(fp,"    { %s, %s }%s /* REP %s */\n",mp ? mp : "OPCC_MP_NONE",mp ? mp : "OPCC_MP_66",(r+1) < PREFIX_REP_MAX ? "," : " ",prefix_rep_str[r]);
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"#define OPCC_PS_REP(st)              (((st) & OPCC_PS_REP_MASK) >> OPCC_PS_REP_SHIFT)\n");
+    fprintf(fp,"#define OPCC_PS_MP(st)               (opcc_prefix_mp[OPCC_PS_REP(st)][((st) & OPCC_PS_OPSIZE) ? 1 : 0])\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* consume prefixes, returns how many. the state is accumulated into *st, check OPCC_PS_OVERLIMIT after */\n");
+    fprintf(fp,"static inline size_t opcc_decode_prefixes(const uint8_t *p,size_t avail,uint32_t *st) {\n");
+    fprintf(fp,"    uint32_t s = *st;\n");
+    fprintf(fp,"    size_t i = 0;\n");
+    fprintf(fp,"    unsigned int c;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    while (i < avail && (c = opcc_prefix_class[p[i]]) != 0) {\n");
+    fprintf(fp,"        s = (s & opcc_prefix_steps[c].keep) | opcc_prefix_steps[c].set;\n");
+    fprintf(fp,"        s = (s & ~OPCC_PS_COUNT_MASK) | opcc_prefix_count_next[(s & OPCC_PS_COUNT_MASK) >> OPCC_PS_COUNT_SHIFT];\n");
+    fprintf(fp,"        i++;\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    *st = s;\n");
+    fprintf(fp,"    return i;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"#define OPCC_DECODE_UD               (-1) /* unknown opcode or over the length limit, raise #UD */\n");
+    fprintf(fp,"#define OPCC_DECODE_MORE             (-2) /* need more bytes */\n");
+    fprintf(fp,"#define OPCC_DECODE_UNKNOWN          (-3) /* unknown opcode, the CPU does not fault */\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* prefixes and opcode. addr32 is the default address size of the code segment.\n");
+    fprintf(fp," * returns the opcode index with *len = prefix and opcode bytes before mod/reg/rm, or OPCC_DECODE_* */\n");
+    fprintf(fp,"static inline int opcc_decode_head(const uint8_t *p,size_t avail,unsigned int addr32,uint32_t *st,size_t *len) {\n");
+    fprintf(fp,"    size_t np,no = 0;\n");
+    fprintf(fp,"    int r;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    *st = 0;\n");
+    fprintf(fp,"    np = opcc_decode_prefixes(p,avail,st);\n");
+    fprintf(fp,"    if (*st & OPCC_PS_OVERLIMIT) return OPCC_DECODE_UD;\n");
+    fprintf(fp,"    if (np >= avail) return OPCC_DECODE_MORE;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    r = opcc_decode_opcode(p+np,avail-np,OPCC_PS_MP(*st),addr32 ^ ((*st & OPCC_PS_ADDRSIZE) ? 1u : 0u),&no);\n");
+    fprintf(fp,"    *len = np + no;\n");
+    fprintf(fp,"#if defined(OPCC_UNKNOWN_OPCODE_SILENT)\n");
+    fprintf(fp,"    if (r == -1) return OPCC_DECODE_UNKNOWN;\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"    return r;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+}
+
+/* the bytes that follow mod/reg/rm, or the opcode if there is none. immediates and the
+ * trailing opcode byte of 3DNow! style encodings. [0] = 16-bit [1] = 32-bit, by operand size then address size */
+const unsigned char tail_length_modrm = 0x80;          // mod/reg/rm follows the opcode
+
+bool immediate_is_offset(const OpcodeSpec &op,const unsigned int var) {
+    /* MOV AL,[moffs] style: the immediate is a memory offset and follows the address size */
+    auto check = [var](const SingleByteSpec &sb) {
+        return sb.meaning == TOK_MEMORY && sb.var_expr.size() == 1 && sb.var_expr[0].type == var;
+    };
+
+    if (var == 0) return false;
+    if (check(op.destination)) return true;
+    for (const auto &sb : op.reads) if (check(sb)) return true;
+    for (const auto &sb : op.writes) if (check(sb)) return true;
+    for (const auto &sb : op.param) if (check(sb)) return true;
+    return false;
+}
+
+void opcode_tail_length(const OpcodeSpec &op,unsigned char len[2][2]) {
+    bool modrm = false;
+
+    for (unsigned int o=0;o < 2;o++)
+        for (unsigned int a=0;a < 2;a++)
+            len[o][a] = 0;
+
+    for (const auto &b : op.bytes) {
+        if (b.meaning == TOK_MRM) {
+            modrm = true;
+        }
+        else if (b.meaning == TOK_IMMEDIATE) {
+            const unsigned char sz = mem_size_code(b.immediate_type);
+
+            for (unsigned int o=0;o < 2;o++) {
+                for (unsigned int a=0;a < 2;a++) {
+                    if (immediate_is_offset(op,b.var_assign))
+                        len[o][a] += a ? 4 : 2;
+                    else
+                        len[o][a] += mem_size_bytes[sz][o];
+                }
+            }
+        }
+        else if (b.meaning == 0 && modrm && b.size() > 0) {
+            for (unsigned int o=0;o < 2;o++)
+                for (unsigned int a=0;a < 2;a++)
+                    len[o][a]++;
+        }
+    }
+
+    if (modrm) {
+        for (unsigned int o=0;o < 2;o++)
+            for (unsigned int a=0;a < 2;a++)
+                len[o][a] |= tail_length_modrm;
+    }
+}
+
+void emit_tail_length_table(FILE *fp) {
+    fprintf(fp,"/* instruction length past the opcode, by [opcode][OPCC_SIZE_INDEX(o32,a32)].\n");
+    fprintf(fp," * low bits are immediate and trailing opcode bytes, OPCC_TAIL_MODRM if mod/reg/rm comes first */\n");
+    fprintf(fp,"#define OPCC_TAIL_MODRM              0x%02xu\n",tail_length_modrm);
+    fprintf(fp,"#define OPCC_TAIL_LENGTH_MASK        0x%02xu\n",tail_length_modrm - 1u);
+    fprintf(fp,"#define OPCC_SIZE_INDEX(o32,a32)     ((((o32) & 1u) << 1u) | ((a32) & 1u))\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const uint8_t opcc_tail_length[OPCC_OPCODE_COUNT][4] = {\n");
+    for (size_t i=0;i < opcodes.size();i++) {
+        unsigned char len[2][2];
+
+        opcode_tail_length(opcodes[i],len);
+        fprintf(fp,"    { 0x%02x, 0x%02x, 0x%02x, 0x%02x }%s /* %4zu %s */\n",
+            len[0][0],len[0][1],len[1][0],len[1][1],(i+1) < opcodes.size() ? "," : " ",i,opcodes[i].name.c_str());
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+}
+
+void emit_size_specialized_decoders(FILE *fp) {
+    /* one function per default operand/address size so that the code segment size is a compile time
+     * constant. only the 66h/67h overrides are tested at run time, and each side calls the mod/reg/rm
+     * length function for a fixed address size */
+    fprintf(fp,"/* whole instruction decode specialised on the default operand (o) and address (a) size of the code segment.\n");
+    fprintf(fp," * returns the opcode index with *len = instruction length, or OPCC_DECODE_* */\n");
+    for (unsigned int o=0;o < 2;o++) {
+        for (unsigned int a=0;a < 2;a++) {
+            const unsigned int ob = o ? 32 : 16,ab = a ? 32 : 16,nab = a ? 16 : 32;
+
+            fprintf(fp,"static inline int opcc_decode_o%ua%u(const uint8_t *p,size_t avail,uint32_t *st,size_t *len) {\n",ob,ab);
+            fprintf(fp,"    size_t i,no = 0;\n");
+            fprintf(fp,"    unsigned int t,n = 0;\n");
+            fprintf(fp,"    int r;\n");
+            fprintf(fp,"\n");
+            fprintf(fp,"    r = opcc_decode_head(p,avail,%uu,st,&i);\n",a);
+            fprintf(fp,"    if (r < 0) return r;\n");
+            fprintf(fp,"\n");
+            fprintf(fp,"    if (*st & OPCC_PS_OPSIZE)\n");
+            fprintf(fp,"        t = opcc_tail_length[r][(*st & OPCC_PS_ADDRSIZE) ? %u : %u];\n",(o^1u)*2u+(a^1u),(o^1u)*2u+a);
+            fprintf(fp,"    else\n");
+            fprintf(fp,"        t = opcc_tail_length[r][(*st & OPCC_PS_ADDRSIZE) ? %u : %u];\n",o*2u+(a^1u),o*2u+a);
+            fprintf(fp,"\n");
+            fprintf(fp,"    if (t & OPCC_TAIL_MODRM) {\n");
+            fprintf(fp,"        if (*st & OPCC_PS_ADDRSIZE)\n");
+            fprintf(fp,"            n = opcc_modrm_length%u(p+i,avail-i);\n",nab);
+            fprintf(fp,"        else\n");
+            fprintf(fp,"            n = opcc_modrm_length%u(p+i,avail-i);\n",ab);
+            fprintf(fp,"        if (n == 0) return OPCC_DECODE_MORE;\n");
+            fprintf(fp,"    }\n");
+            fprintf(fp,"\n");
+            fprintf(fp,"    no = i + n + (t & OPCC_TAIL_LENGTH_MASK);\n");
+            fprintf(fp,"    if (no > avail) return OPCC_DECODE_MORE;\n");
+            fprintf(fp,"#if OPCC_OPCODE_LIMIT > 0\n");
+            fprintf(fp,"    if (no > OPCC_OPCODE_LIMIT) return OPCC_DECODE_UD;\n");
+            fprintf(fp,"#endif\n");
+            fprintf(fp,"    *len = no;\n");
+            fprintf(fp,"    return r;\n");
+            fprintf(fp,"}\n");
+            fprintf(fp,"\n");
+        }
+    }
+
+    fprintf(fp,"typedef int (*opcc_decode_sized_fn)(const uint8_t *p,size_t avail,uint32_t *st,size_t *len);\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* pick by OPCC_SIZE_INDEX(CS.D,CS.D) when the code segment changes */\n");
+    fprintf(fp,"static const opcc_decode_sized_fn opcc_decode_sized[4] = {\n");
+    fprintf(fp,"    opcc_decode_o16a16,\n");
+    fprintf(fp,"    opcc_decode_o16a32,\n");
+    fprintf(fp,"    opcc_decode_o32a16,\n");
+    fprintf(fp,"    opcc_decode_o32a32\n");
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+}
+
+/* mod/reg/rm effective address components. registers are numbered as in the reg field
+ * (BX=3 BP=5 SI=6 DI=7, EAX-EDI 0-7), ea_reg_none if absent */
+const unsigned char ea_reg_none = 8;
+const unsigned char ea_flag_register = 0x01;           // mod == 3, rm is a register
+const unsigned char ea_flag_sib = 0x02;                // SIB byte follows, see opcc_ea_sib[mod][sib]
+const unsigned char ea_flag_disp_only = 0x04;          // no base or index, displacement is the address
+
+class EffectiveAddress {
+public:
+    unsigned char               length = 1;             // mod/reg/rm, SIB and displacement
+    unsigned char               disp = 0;               // displacement bytes
+    unsigned char               base = ea_reg_none;
+    unsigned char               index = ea_reg_none;
+    unsigned char               scale = 0;              // index shift count
+    unsigned char               seg = PREFIX_SEG_DS;    // default segment
+    unsigned char               flags = 0;
+};
+
+EffectiveAddress effective_address16(const unsigned int modrm) {
+    static const unsigned char base[8] = { 3, 3, 5, 5, ea_reg_none, ea_reg_none, 5, 3 };
+    static const unsigned char index[8] = { 6, 7, 6, 7, 6, 7, ea_reg_none, ea_reg_none };
+    const unsigned int mod = modrm >> 6,rm = modrm & 7;
+    EffectiveAddress ea;
+
+    if (mod == 3) {
+        ea.base = rm;
+        ea.seg = PREFIX_SEG_NONE;
+        ea.flags = ea_flag_register;
+        return ea;
+    }
+
+    ea.base = base[rm];
+    ea.index = index[rm];
+    ea.disp = mod == 1 ? 1 : (mod == 2 ? 2 : 0);
+    if (mod == 0 && rm == 6) {
+        ea.base = ea_reg_none;
+        ea.disp = 2;
+        ea.flags = ea_flag_disp_only;
+    }
+    if (ea.base == 5) ea.seg = PREFIX_SEG_SS;
+    ea.length = 1 + ea.disp;
+    return ea;
+}
+
+EffectiveAddress effective_address32(const unsigned int modrm) {
+    const unsigned int mod = modrm >> 6,rm = modrm & 7;
+    EffectiveAddress ea;
+
+    if (mod == 3) {
+        ea.base = rm;
+        ea.seg = PREFIX_SEG_NONE;
+        ea.flags = ea_flag_register;
+        return ea;
+    }
+
+    if (rm == 4) {
+        /* base, index, scale and displacement come from opcc_ea_sib[mod][sib] */
+        ea.base = ea_reg_none;
+        ea.length = 2;
+        ea.flags = ea_flag_sib;
+        return ea;
+    }
+
+    ea.base = rm;
+    ea.disp = mod == 1 ? 1 : (mod == 2 ? 4 : 0);
+    if (mod == 0 && rm == 5) {
+        ea.base = ea_reg_none;
+        ea.disp = 4;
+        ea.flags = ea_flag_disp_only;
+    }
+    if (ea.base == 4 || ea.base == 5) ea.seg = PREFIX_SEG_SS;
+    ea.length = 1 + ea.disp;
+    return ea;
+}
+
+EffectiveAddress effective_address_sib(const unsigned int mod,const unsigned int sib) {
+    const unsigned int base = sib & 7,index = (sib >> 3) & 7;
+    EffectiveAddress ea;
+
+    ea.base = base;
+    ea.index = index == 4 ? ea_reg_none : index;    // no index
+    ea.scale = index == 4 ? 0 : (sib >> 6);
+    ea.disp = mod == 1 ? 1 : (mod == 2 ? 4 : 0);
+    if (mod == 0 && base == 5) {
+        ea.base = ea_reg_none;
+        ea.disp = 4;
+        if (ea.index == ea_reg_none) ea.flags = ea_flag_disp_only;
+    }
+    if (ea.base == 4 || ea.base == 5) ea.seg = PREFIX_SEG_SS;
+    ea.length = 2 + ea.disp;
+    return ea;
+}
+
+void emit_ea_entry(FILE *fp,const EffectiveAddress &ea,const bool last,const unsigned int i) {
+    fprintf(fp,"    { %u, %u, %u, %u, %u, %u, 0x%02x }%s",ea.length,ea.disp,ea.base,ea.index,ea.scale,ea.seg,ea.flags,last ? " " : ",");
+    if ((i & 7) == 0) fprintf(fp," /* %02x */",i);
+    fprintf(fp,"\n");
+}
+
+void emit_ea_tables(FILE *fp) {
+    for (unsigned int i=0;i < PREFIX_SEG_MAX;i++)
+        fprintf(fp,"#define OPCC_SEG_%-19s %uu\n",prefix_seg_str[i],i);
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* effective address components of mod/reg/rm. registers are numbered as in the reg field\n");
+    fprintf(fp," * (BX=3 BP=5 SI=6 DI=7, EAX-EDI 0-7). rm is the register itself when OPCC_EA_REGISTER */\n");
+    fprintf(fp,"#define OPCC_EA_REG_NONE             %uu\n",ea_reg_none);
+    fprintf(fp,"#define OPCC_EA_REGISTER             0x%02xu /* mod == 3 */\n",ea_flag_register);
+    fprintf(fp,"#define OPCC_EA_SIB                  0x%02xu /* look up opcc_ea_sib[mod][sib] */\n",ea_flag_sib);
+    fprintf(fp,"#define OPCC_EA_DISP_ONLY            0x%02xu /* no base or index */\n",ea_flag_disp_only);
+    fprintf(fp,"\n");
+    fprintf(fp,"typedef struct opcc_ea {\n");
+    fprintf(fp,"    uint8_t     length;     /* mod/reg/rm, SIB and displacement bytes */\n");
+    fprintf(fp,"    uint8_t     disp;       /* displacement bytes, sign extended if 1 */\n");
+    fprintf(fp,"    uint8_t     base;       /* base register or OPCC_EA_REG_NONE */\n");
+    fprintf(fp,"    uint8_t     index;      /* index register or OPCC_EA_REG_NONE */\n");
+    fprintf(fp,"    uint8_t     scale;      /* index shift count */\n");
+    fprintf(fp,"    uint8_t     seg;        /* default segment OPCC_SEG_* */\n");
+    fprintf(fp,"    uint8_t     flags;      /* OPCC_EA_* */\n");
+    fprintf(fp,"} opcc_ea;\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const opcc_ea opcc_ea16[256] = {\n");
+    for (unsigned int i=0;i < 256;i++)
+        emit_ea_entry(fp,effective_address16(i),i == 255,i);
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const opcc_ea opcc_ea32[256] = {\n");
+    for (unsigned int i=0;i < 256;i++)
+        emit_ea_entry(fp,effective_address32(i),i == 255,i);
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* [mod][sib], length includes mod/reg/rm and SIB */\n");
+    fprintf(fp,"static const opcc_ea opcc_ea_sib[3][256] = {\n");
+    for (unsigned int mod=0;mod < 3;mod++) {
+        fprintf(fp,"  { /* mod %u */\n",mod);
+        for (unsigned int i=0;i < 256;i++)
+            emit_ea_entry(fp,effective_address_sib(mod,i),i == 255,i);
+        fprintf(fp,"  }%s\n",mod < 2 ? "," : "");
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* length of mod/reg/rm, SIB and displacement, 0 if more bytes are needed */\n");
+    fprintf(fp,"static inline unsigned int opcc_modrm_length16(const uint8_t *p,size_t avail) {\n");
+    fprintf(fp,"    unsigned int n;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    if (avail < 1) return 0;\n");
+    fprintf(fp,"    n = opcc_ea16[p[0]].length;\n");
+    fprintf(fp,"    return (n <= avail) ? n : 0;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"static inline unsigned int opcc_modrm_length32(const uint8_t *p,size_t avail) {\n");
+    fprintf(fp,"    unsigned int n;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    if (avail < 1) return 0;\n");
+    fprintf(fp,"    n = opcc_ea32[p[0]].length;\n");
+    fprintf(fp,"    if (opcc_ea32[p[0]].flags & OPCC_EA_SIB) {\n");
+    fprintf(fp,"        if (avail < 2) return 0;\n");
+    fprintf(fp,"        n = opcc_ea_sib[p[0] >> 6][p[1]].length;\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"    return (n <= avail) ? n : 0;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"static inline unsigned int opcc_modrm_length(const uint8_t *p,size_t avail,unsigned int addr32) {\n");
+    fprintf(fp,"    return addr32 ? opcc_modrm_length32(p,avail) : opcc_modrm_length16(p,avail);\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* effective address components of the mod/reg/rm at p with the displacement read in.\n");
+    fprintf(fp," * returns the length as opcc_modrm_length() does, 0 if more bytes are needed */\n");
+    fprintf(fp,"static inline unsigned int opcc_decode_ea(const uint8_t *p,size_t avail,unsigned int addr32,opcc_ea *ea,int32_t *disp) {\n");
+    fprintf(fp,"    const uint8_t *d;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    if (avail < 1) return 0;\n");
+    fprintf(fp,"    *ea = addr32 ? opcc_ea32[p[0]] : opcc_ea16[p[0]];\n");
+    fprintf(fp,"    if (ea->flags & OPCC_EA_SIB) {\n");
+    fprintf(fp,"        if (avail < 2) return 0;\n");
+    fprintf(fp,"        *ea = opcc_ea_sib[p[0] >> 6][p[1]];\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"    if (ea->length > avail) return 0;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    d = p + ea->length - ea->disp;\n");
+    fprintf(fp,"    switch (ea->disp) {\n");
+    fprintf(fp,"        case 1:  *disp = (int8_t)d[0]; break;\n");
+    fprintf(fp,"        case 2:  *disp = (int32_t)(int16_t)((uint16_t)d[0] | ((uint16_t)d[1] << 8u)); break;\n");
+    fprintf(fp,"        case 4:  *disp = (int32_t)((uint32_t)d[0] | ((uint32_t)d[1] << 8u) | ((uint32_t)d[2] << 16u) | ((uint32_t)d[3] << 24u)); break;\n");
+    fprintf(fp,"        default: *disp = 0; break;\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    return ea->length;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+}
+
+/* 16 byte window decode. the prefixes and opcode go through the usual table walk, then the mod/reg/rm,
+ * displacement and immediate positions are worked out from the tables without branching on the
+ * instruction, and the fields are pulled out of the window with one PSHUFB (SSSE3) or with masked
+ * loads on other CPUs. opcc_window_init() makes the choice once at run time, before anything decodes,
+ * so the decoders only ever read it. */
+const unsigned int window_imm_max = 8;
+
+bool emit_window_kernel(FILE *fp) {
+    for (const auto &op : opcodes) {
+        unsigned char len[2][2];
+
+        opcode_tail_length(op,len);
+        for (unsigned int o=0;o < 2;o++) {
+            for (unsigned int a=0;a < 2;a++) {
+                if ((len[o][a] & (tail_length_modrm - 1u)) > window_imm_max) {
+                    fprintf(stderr,"Opcode '%s' immediate too long for the window decoder\n",op.name.c_str());
+                    return false;
+                }
+            }
+        }
+    }
+
+    fprintf(fp,"/* 16 byte window decode */\n");
+    fprintf(fp,"typedef struct opcc_window_insn {\n");
+    fprintf(fp,"    int         opcode;     /* opcode index or OPCC_DECODE_* */\n");
+    fprintf(fp,"    uint32_t    prefix;     /* prefix state, OPCC_PS_* */\n");
+    fprintf(fp,"    uint8_t     length;\n");
+    fprintf(fp,"    uint8_t     modrm_ofs;  /* offset of mod/reg/rm, SIB, displacement and immediate */\n");
+    fprintf(fp,"    uint8_t     disp_ofs;\n");
+    fprintf(fp,"    uint8_t     imm_ofs;\n");
+    fprintf(fp,"    uint8_t     modrm;      /* 0 if none, check modrm_len */\n");
+    fprintf(fp,"    uint8_t     sib;\n");
+    fprintf(fp,"    uint8_t     modrm_len;  /* mod/reg/rm, SIB and displacement bytes */\n");
+    fprintf(fp,"    uint8_t     disp_len;\n");
+    fprintf(fp,"    uint8_t     imm_len;    /* immediate bytes, including a 3DNow! suffix opcode */\n");
+    fprintf(fp,"    uint8_t     opbyte;     /* last opcode byte, holds the register of 50+r style encodings */\n");
+    fprintf(fp,"    int32_t     disp;       /* sign extended */\n");
+    fprintf(fp,"    uint64_t    imm;        /* zero extended, little endian order */\n");
+    fprintf(fp,"} opcc_window_insn;\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"#define OPCC_WINDOW_IMM_MAX          %uu\n",window_imm_max);
+    fprintf(fp,"\n");
+    fprintf(fp,"/* PSHUFB controls: displacement to bytes 0-3, immediate to bytes 8-15. add the offset and take the\n");
+    fprintf(fp," * unsigned minimum of the two, 0x80 and above selects zero */\n");
+    fprintf(fp,"static const uint8_t opcc_window_disp_shuffle[5][16] = {\n");
+    for (unsigned int n=0;n <= 4;n++) {
+        fprintf(fp,"    {");
+        for (unsigned int l=0;l < 16;l++) fprintf(fp," 0x%02x%s",l < n ? l : 0x80,l < 15 ? "," : "");
+        fprintf(fp," }%s\n",n < 4 ? "," : "");
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"static const uint8_t opcc_window_imm_shuffle[OPCC_WINDOW_IMM_MAX+1][16] = {\n");
+    for (unsigned int n=0;n <= window_imm_max;n++) {
+        fprintf(fp,"    {");
+        for (unsigned int l=0;l < 16;l++) fprintf(fp," 0x%02x%s",(l >= 8 && (l-8) < n) ? (l-8) : 0x80,l < 15 ? "," : "");
+        fprintf(fp," }%s\n",n < window_imm_max ? "," : "");
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"static const uint32_t opcc_window_disp_mask[5] = { 0x00000000u, 0x000000FFu, 0x0000FFFFu, 0x00FFFFFFu, 0xFFFFFFFFu };\n");
+    fprintf(fp,"static const uint32_t opcc_window_disp_sign[5] = { 0x00000000u, 0x00000080u, 0x00008000u, 0x00800000u, 0x80000000u };\n");
+    fprintf(fp,"static const uint64_t opcc_window_imm_mask[OPCC_WINDOW_IMM_MAX+1] = {\n");
+    for (unsigned int n=0;n <= window_imm_max;n++)
+        fprintf(fp,"    0x%016llxull%s\n",n == 8 ? ~0ull : ((1ull << (n * 8u)) - 1ull),n < window_imm_max ? "," : "");
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static inline void opcc_window_fields_scalar(const uint8_t *b,opcc_window_insn *d) {\n");
+    fprintf(fp,"    const uint8_t *p = b + d->disp_ofs,*q = b + d->imm_ofs;\n");
+    fprintf(fp,"    uint32_t x;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    x = ((uint32_t)p[0] | ((uint32_t)p[1] << 8u) | ((uint32_t)p[2] << 16u) | ((uint32_t)p[3] << 24u)) & opcc_window_disp_mask[d->disp_len];\n");
+    fprintf(fp,"    d->disp = (int32_t)((x ^ opcc_window_disp_sign[d->disp_len]) - opcc_window_disp_sign[d->disp_len]);\n");
+    fprintf(fp,"    d->imm = ((uint64_t)q[0] | ((uint64_t)q[1] << 8u) | ((uint64_t)q[2] << 16u) | ((uint64_t)q[3] << 24u) |\n");
+    fprintf(fp,"        ((uint64_t)q[4] << 32u) | ((uint64_t)q[5] << 40u) | ((uint64_t)q[6] << 48u) | ((uint64_t)q[7] << 56u)) & opcc_window_imm_mask[d->imm_len];\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))\n");
+    fprintf(fp,"#define OPCC_WINDOW_SSSE3 1\n");
+    fprintf(fp,"#include <tmmintrin.h>\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"__attribute__((target(\"ssse3\")))\n");
+    fprintf(fp,"static inline void opcc_window_fields_ssse3(const uint8_t *b,opcc_window_insn *d) {\n");
+    fprintf(fp,"    const __m128i w = _mm_loadu_si128((const __m128i*)b);\n");
+    fprintf(fp,"    const __m128i dm = _mm_add_epi8(_mm_loadu_si128((const __m128i*)opcc_window_disp_shuffle[d->disp_len]),_mm_set1_epi8((char)d->disp_ofs));\n");
+    fprintf(fp,"    const __m128i im = _mm_add_epi8(_mm_loadu_si128((const __m128i*)opcc_window_imm_shuffle[d->imm_len]),_mm_set1_epi8((char)d->imm_ofs));\n");
+    fprintf(fp,"    const __m128i x = _mm_shuffle_epi8(w,_mm_min_epu8(dm,im));\n");
+    fprintf(fp,"    uint32_t dx;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    dx = (uint32_t)_mm_cvtsi128_si32(x);\n");
+    fprintf(fp,"    d->disp = (int32_t)((dx ^ opcc_window_disp_sign[d->disp_len]) - opcc_window_disp_sign[d->disp_len]);\n");
+    fprintf(fp,"    _mm_storel_epi64((__m128i*)&d->imm,_mm_srli_si128(x,8));\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* nonzero to pull the fields out with PSHUFB. only opcc_window_init() writes it */\n");
+    fprintf(fp,"static int opcc_window_ssse3 = 0;\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* pick the field extraction for this CPU. call it once before any thread decodes, the decoders only read\n");
+    fprintf(fp," * the choice. every file that includes this header has its own copy. without it the scalar one is used */\n");
+    fprintf(fp,"static inline void opcc_window_init(void) {\n");
+    fprintf(fp,"#if defined(OPCC_WINDOW_SSSE3)\n");
+    fprintf(fp,"    __builtin_cpu_init();\n");
+    fprintf(fp,"    opcc_window_ssse3 = __builtin_cpu_supports(\"ssse3\") ? 1 : 0;\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* decode the instruction at the start of b, which must have 32 readable bytes. only the first 16 are\n");
+    fprintf(fp," * decoded, the rest is read and masked off by the field extraction */\n");
+    fprintf(fp,"static inline int opcc_decode_window32(const uint8_t *b,unsigned int size_index,opcc_window_insn *d) {\n");
+    fprintf(fp,"    const opcc_ea *e16,*e32,*es,*ea;\n");
+    fprintf(fp,"    unsigned int o32,a32,t,hm,mod;\n");
+    fprintf(fp,"    size_t i = 0;\n");
+    fprintf(fp,"    int r;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    d->opcode = r = opcc_decode_head(b,16,size_index & 1u,&d->prefix,&i);\n");
+    fprintf(fp,"    if (r < 0) return r;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    o32 = ((size_index >> 1u) ^ (d->prefix / OPCC_PS_OPSIZE)) & 1u;\n");
+    fprintf(fp,"    a32 = (size_index ^ (d->prefix / OPCC_PS_ADDRSIZE)) & 1u;\n");
+    fprintf(fp,"    t = opcc_tail_length[r][OPCC_SIZE_INDEX(o32,a32)];\n");
+    fprintf(fp,"    hm = 0u - (t >> 7u);                /* all ones if mod/reg/rm follows */\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    d->modrm = b[i] & hm;\n");
+    fprintf(fp,"    d->sib = b[i+1];\n");
+    fprintf(fp,"    mod = d->modrm >> 6u;\n");
+    fprintf(fp,"    e16 = &opcc_ea16[d->modrm];\n");
+    fprintf(fp,"    e32 = &opcc_ea32[d->modrm];\n");
+    fprintf(fp,"    es = &opcc_ea_sib[mod < 3u ? mod : 2u][d->sib];    /* mod 3 never has a SIB */\n");
+    fprintf(fp,"    ea = (e32->flags & OPCC_EA_SIB) ? es : e32;\n");
+    fprintf(fp,"    ea = a32 ? ea : e16;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    d->modrm_ofs = (uint8_t)i;\n");
+    fprintf(fp,"    d->opbyte = b[i-1];\n");
+    fprintf(fp,"    d->modrm_len = (uint8_t)(ea->length & hm);\n");
+    fprintf(fp,"    d->disp_len = (uint8_t)(ea->disp & hm);\n");
+    fprintf(fp,"    d->imm_len = (uint8_t)(t & OPCC_TAIL_LENGTH_MASK);\n");
+    fprintf(fp,"    d->imm_ofs = (uint8_t)(i + d->modrm_len);\n");
+    fprintf(fp,"    d->disp_ofs = (uint8_t)(d->imm_ofs - d->disp_len);\n");
+    fprintf(fp,"    d->length = (uint8_t)(d->imm_ofs + d->imm_len);\n");
+    fprintf(fp,"    if (d->length > 16u) return d->opcode = OPCC_DECODE_MORE;\n");
+    fprintf(fp,"#if OPCC_OPCODE_LIMIT > 0\n");
+    fprintf(fp,"    if (d->length > OPCC_OPCODE_LIMIT) return d->opcode = OPCC_DECODE_UD;\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"#if defined(OPCC_WINDOW_SSSE3)\n");
+    fprintf(fp,"    if (opcc_window_ssse3) {\n");
+    fprintf(fp,"        opcc_window_fields_ssse3(b,d);\n");
+    fprintf(fp,"        return r;\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"    opcc_window_fields_scalar(b,d);\n");
+    fprintf(fp,"    return r;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* decode the instruction at the start of a 16 byte window (pad with anything past the end of the code).\n");
+    fprintf(fp," * size_index is OPCC_SIZE_INDEX() of the code segment. returns the opcode index or OPCC_DECODE_* */\n");
+    fprintf(fp,"static inline int opcc_decode_window(const uint8_t *w,unsigned int size_index,opcc_window_insn *d) {\n");
+    fprintf(fp,"    uint8_t b[32];\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    memcpy(b,w,16);\n");
+    fprintf(fp,"    memset(b+16,0,16);\n");
+    fprintf(fp,"    return opcc_decode_window32(b,size_index,d);\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+
+    return true;
+}
+
+std::string define_string(const char *name) {
+    auto i = defines.find(name);
+    if (i != defines.end() && i->second.type == TOK_STRING)
+        return i->second.string;
+
+    return std::string();
+}
+
+enum p6_decoder_t {
+    P6_DECODER_UNKNOWN=0,
+    P6_DECODER_SIMPLE,              // 1 uop, any of the three decoders
+    P6_DECODER_COMPLEX,             // 2-4 uops, decoder 0 only
+    P6_DECODER_MSROM,               // more than 4 uops, microcode sequencer
+
+    P6_DECODER_MAX
+};
+
+const char *p6_decoder_str[P6_DECODER_MAX] = {
+    "UNKNOWN",
+    "SIMPLE",
+    "COMPLEX",
+    "MSROM"
+};
+
+unsigned int p6_decoder(const unsigned char uops) {
+    if (uops == 0)
+        return P6_DECODER_UNKNOWN;
+    else if (uops == 1)
+        return P6_DECODER_SIMPLE;
+    else if (uops <= 4)
+        return P6_DECODER_COMPLEX;
+
+    return P6_DECODER_MSROM;
+}
+
+unsigned int pairing_code(const unsigned int t) {
+    switch (t) {
+        case TOK_UV:    return 1;
+        case TOK_PU:    return 2;
+        case TOK_PV:    return 3;
+        case TOK_NP:    return 0;
+        default:        break;
+    };
+
+    return 4;                       // no (pair ...), unknown
+}
+
+/* -march presets set "pipeline" to p5 or p6 for the CPUs these tables describe */
+/* batch decode into parallel arrays, one per field. the record is kept in a local so that the compiler
+ * can hold it in registers, and each field is stored once to its own array for later passes to vectorise over. */
+void emit_batch_decoder(FILE *fp) {
+    fprintf(fp,"/* batch decode, structure of arrays */\n");
+    if (opcodes.size() < 0x8000u)
+        fprintf(fp,"typedef int16_t opcc_batch_opcode_t;\n");
+    else
+        fprintf(fp,"typedef int32_t opcc_batch_opcode_t;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* arrays are owned by the caller and hold at least max entries. modrm, sib, disp, imm and prefix may be NULL */\n");
+    fprintf(fp,"typedef struct opcc_batch {\n");
+    fprintf(fp,"    size_t                  max;\n");
+    fprintf(fp,"    uint32_t               *offset;     /* from the start of the code buffer */\n");
+    fprintf(fp,"    uint8_t                *length;\n");
+    fprintf(fp,"    opcc_batch_opcode_t    *opcode;     /* opcode index or OPCC_DECODE_UD/UNKNOWN */\n");
+    fprintf(fp,"    uint8_t                *modrm;\n");
+    fprintf(fp,"    uint8_t                *sib;\n");
+    fprintf(fp,"    int32_t                *disp;\n");
+    fprintf(fp,"    uint64_t               *imm;\n");
+    fprintf(fp,"    uint32_t               *prefix;     /* OPCC_PS_* */\n");
+    fprintf(fp,"} opcc_batch;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* decode code[start] up to size into the arrays of b, until b->max entries or the end of the code. bytes that\n");
+    fprintf(fp," * do not decode are stored as one byte entries with opcode OPCC_DECODE_UD or OPCC_DECODE_UNKNOWN. an instruction\n");
+    fprintf(fp," * cut off by the end of the code stops the batch. returns the entry count, *next = offset to continue from.\n");
+    fprintf(fp," * offsets are 32-bit, decode larger buffers in pieces */\n");
+    fprintf(fp,"static inline size_t opcc_decode_batch(const uint8_t *code,size_t size,size_t start,unsigned int size_index,const opcc_batch *b,size_t *next) {\n");
+    fprintf(fp,"    const size_t max = b->max;\n");
+    fprintf(fp,"    opcc_window_insn d;\n");
+    fprintf(fp,"    size_t n = 0,o = start;\n");
+    fprintf(fp,"    uint8_t tail[32];\n");
+    fprintf(fp,"    int r;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    while (n < max && o < size) {\n");
+    fprintf(fp,"        if ((size - o) >= 32u) {\n");
+    fprintf(fp,"            r = opcc_decode_window32(code+o,size_index,&d);\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"        else {\n");
+    fprintf(fp,"            uint32_t st;\n");
+    fprintf(fp,"            size_t hl;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"            /* the zero padding would decode as more code, check the head against the real end first */\n");
+    fprintf(fp,"            if (opcc_decode_head(code+o,size-o,size_index & 1u,&st,&hl) == OPCC_DECODE_MORE) break;\n");
+    fprintf(fp,"            memset(tail,0,sizeof(tail));\n");
+    fprintf(fp,"            memcpy(tail,code+o,size-o);\n");
+    fprintf(fp,"            r = opcc_decode_window32(tail,size_index,&d);\n");
+    fprintf(fp,"            if (r >= 0 && d.length > (size - o)) break;\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"        if (r < 0) {\n");
+    fprintf(fp,"            if (r == OPCC_DECODE_MORE) r = OPCC_DECODE_UD;   /* over 16 bytes */\n");
+    fprintf(fp,"            d.length = 1;\n");
+    fprintf(fp,"            d.modrm = d.sib = 0;\n");
+    fprintf(fp,"            d.disp = 0;\n");
+    fprintf(fp,"            d.imm = 0;\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"        b->offset[n] = (uint32_t)o;\n");
+    fprintf(fp,"        b->length[n] = d.length;\n");
+    fprintf(fp,"        b->opcode[n] = (opcc_batch_opcode_t)r;\n");
+    fprintf(fp,"        if (b->modrm) b->modrm[n] = d.modrm;\n");
+    fprintf(fp,"        if (b->sib) b->sib[n] = d.sib;\n");
+    fprintf(fp,"        if (b->disp) b->disp[n] = d.disp;\n");
+    fprintf(fp,"        if (b->imm) b->imm[n] = d.imm;\n");
+    fprintf(fp,"        if (b->prefix) b->prefix[n] = d.prefix;\n");
+    fprintf(fp,"        o += d.length;\n");
+    fprintf(fp,"        n++;\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    *next = o;\n");
+    fprintf(fp,"    return n;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+}
+
+/* instruction fetch across two spans of code, for emulators that fetch from separate host pages.
+ * only a window that starts near the end of the first span is stitched, once, into a 32 byte buffer. */
+void emit_span_decoder(FILE *fp) {
+    fprintf(fp,"/* decode across two code spans */\n");
+    fprintf(fp,"static inline size_t opcc_window_fill(uint8_t w[32],const uint8_t *a,size_t alen,const uint8_t *b,size_t blen) {\n");
+    fprintf(fp,"    size_t n;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    if (alen > 16u) alen = 16u;\n");
+    fprintf(fp,"    n = 16u - alen;\n");
+    fprintf(fp,"    if (blen > n) blen = n;\n");
+    fprintf(fp,"    memset(w,0,32);\n");
+    fprintf(fp,"    memcpy(w,a,alen);\n");
+    fprintf(fp,"    if (blen != 0) memcpy(w+alen,b,blen);\n");
+    fprintf(fp,"    return alen + blen;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* decode a stitched window holding n valid bytes. the zero padding past n decodes as more code, so an\n");
+    fprintf(fp," * instruction that runs into it, or a failure that might, is checked against the real end */\n");
+    fprintf(fp,"static inline int opcc_decode_window_n(const uint8_t w[32],size_t n,unsigned int size_index,opcc_window_insn *d) {\n");
+    fprintf(fp,"    uint32_t st;\n");
+    fprintf(fp,"    size_t hl;\n");
+    fprintf(fp,"    int r;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    r = opcc_decode_window32(w,size_index,d);\n");
+    fprintf(fp,"    if (n >= 16u) return r;\n");
+    fprintf(fp,"    if (r >= 0 && d->length > n) return d->opcode = OPCC_DECODE_MORE;\n");
+    fprintf(fp,"    if (r < 0 && opcc_decode_head(w,n,size_index & 1u,&st,&hl) == OPCC_DECODE_MORE) return d->opcode = OPCC_DECODE_MORE;\n");
+    fprintf(fp,"    return r;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* decode an instruction that starts at a and may continue at b (a scatter list of two spans).\n");
+    fprintf(fp," * returns the opcode index or OPCC_DECODE_*, OPCC_DECODE_MORE if both spans together are too short */\n");
+    fprintf(fp,"static inline int opcc_decode_span2(const uint8_t *a,size_t alen,const uint8_t *b,size_t blen,unsigned int size_index,opcc_window_insn *d) {\n");
+    fprintf(fp,"    uint8_t w[32];\n");
+    fprintf(fp,"    size_t n;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    if (alen >= 32u) return opcc_decode_window32(a,size_index,d);\n");
+    fprintf(fp,"    if (alen >= 16u) return opcc_decode_window(a,size_index,d);\n");
+    fprintf(fp,"    n = opcc_window_fill(w,a,alen,b,blen);\n");
+    fprintf(fp,"    return opcc_decode_window_n(w,n,size_index,d);\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* pull the span that follows the current one, e.g. the next guest page. sets *p and returns the length,\n");
+    fprintf(fp," * 0 if it can not be fetched */\n");
+    fprintf(fp,"typedef size_t (*opcc_fetch_next)(void *ctx,const uint8_t **p);\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* as opcc_decode_span2(), but the second span is only fetched if the instruction needs bytes from it, so a\n");
+    fprintf(fp," * fault on the next page is raised by the instructions that cross into it and no others. if fetch fails\n");
+    fprintf(fp," * the result is OPCC_DECODE_MORE */\n");
+    fprintf(fp,"static inline int opcc_decode_fetch(const uint8_t *a,size_t alen,opcc_fetch_next fetch,void *ctx,unsigned int size_index,opcc_window_insn *d) {\n");
+    fprintf(fp,"    const uint8_t *b = NULL;\n");
+    fprintf(fp,"    uint8_t w[32];\n");
+    fprintf(fp,"    size_t n,blen;\n");
+    fprintf(fp,"    int r;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    if (alen >= 32u) return opcc_decode_window32(a,size_index,d);\n");
+    fprintf(fp,"    if (alen >= 16u) return opcc_decode_window(a,size_index,d);\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    n = opcc_window_fill(w,a,alen,NULL,0);\n");
+    fprintf(fp,"    r = opcc_decode_window_n(w,n,size_index,d);\n");
+    fprintf(fp,"    if (r != OPCC_DECODE_MORE) return r;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    if ((blen=fetch(ctx,&b)) == 0) return r;\n");
+    fprintf(fp,"    if (blen > (16u - n)) blen = 16u - n;\n");
+    fprintf(fp,"    memcpy(w+n,b,blen);\n");
+    fprintf(fp,"    return opcc_decode_window_n(w,n+blen,size_index,d);\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+}
+
+/* decoded block cache. blocks run up to and including a branch (opcc_branch_kind), a serializing or
+ * interrupt shadow instruction (opcc_traps), or the instruction that crosses into the next page. blocks live
+ * in a bump arena that is flushed whole when full. writes to guest code are caught with one bit per page, and
+ * a page is invalidated by bumping its epoch, which every block checks on lookup. */
+const unsigned int block_max_insn = 64;
+
+void emit_block_cache(FILE *fp) {
+    fprintf(fp,"/* decoded block cache, keyed by linear address, code segment size and CPU mask */\n");
+    fprintf(fp,"#define OPCC_BLOCK_MAX_INSN          %uu\n",block_max_insn);
+    fprintf(fp,"#define OPCC_BLOCK_PAGE_SHIFT        12u\n");
+    fprintf(fp,"#define OPCC_BLOCK_EPOCH_BITS        12u  /* page epochs are hashed, a collision only costs a redecode */\n");
+    fprintf(fp,"#define OPCC_BLOCK_END_BRANCH        0x01u\n");
+    fprintf(fp,"#define OPCC_BLOCK_END_TRAP          0x02u /* serializing or interrupt shadow */\n");
+    fprintf(fp,"#define OPCC_BLOCK_END_FAULT         0x04u /* the last entry did not decode, opcode is OPCC_DECODE_* */\n");
+    fprintf(fp,"#define OPCC_BLOCK_END_PAGE          0x08u /* stopped at the end of the page */\n");
+    fprintf(fp,"#define OPCC_BLOCK_END_LIMIT         0x10u /* OPCC_BLOCK_MAX_INSN */\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"typedef struct opcc_block {\n");
+    fprintf(fp,"    struct opcc_block  *next;           /* hash chain */\n");
+    fprintf(fp,"    uint32_t            addr;\n");
+    fprintf(fp,"    uint32_t            cpu;\n");
+    fprintf(fp,"    uint32_t            epoch[2];       /* of the first and last page */\n");
+    fprintf(fp,"    uint32_t            length;         /* bytes */\n");
+    fprintf(fp,"    uint16_t            count;          /* instructions */\n");
+    fprintf(fp,"    uint8_t             size_index;\n");
+    fprintf(fp,"    uint8_t             end;            /* OPCC_BLOCK_END_* */\n");
+    fprintf(fp,"    opcc_window_insn    insn[];\n");
+    fprintf(fp,"} opcc_block;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"typedef struct opcc_block_cache {\n");
+    fprintf(fp,"    uint8_t            *arena;\n");
+    fprintf(fp,"    size_t              arena_size;\n");
+    fprintf(fp,"    size_t              arena_used;\n");
+    fprintf(fp,"    opcc_block        **hash;\n");
+    fprintf(fp,"    unsigned int        hash_bits;      /* 1-31 */\n");
+    fprintf(fp,"    uint32_t            flushes;        /* bumped when the arena is flushed, see opcc_block_cache_translate() */\n");
+    fprintf(fp,"    uint32_t           *code_pages;     /* bitmap, 1 = a cached block covers the page */\n");
+    fprintf(fp,"    uint32_t           *epoch;\n");
+    fprintf(fp,"} opcc_block_cache;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"#define OPCC_BLOCK_PAGE(a)           ((uint32_t)(a) >> OPCC_BLOCK_PAGE_SHIFT)\n");
+    fprintf(fp,"#define OPCC_BLOCK_EPOCH_SLOT(pg)    ((pg) & ((1u << OPCC_BLOCK_EPOCH_BITS) - 1u))\n");
+    fprintf(fp,"#define OPCC_BLOCK_SIZE(n)           ((sizeof(opcc_block) + ((n) * sizeof(opcc_window_insn)) + 7u) & ~((size_t)7u))\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"static inline void opcc_block_cache_flush(opcc_block_cache *c) {\n");
+    fprintf(fp,"    memset(c->hash,0,sizeof(opcc_block*) << c->hash_bits);\n");
+    fprintf(fp,"    memset(c->code_pages,0,sizeof(uint32_t) << (32u - OPCC_BLOCK_PAGE_SHIFT - 5u));\n");
+    fprintf(fp,"    c->arena_used = 0;\n");
+    fprintf(fp,"    c->flushes++;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"static inline void opcc_block_cache_free(opcc_block_cache *c) {\n");
+    fprintf(fp,"    free(c->arena);\n");
+    fprintf(fp,"    free(c->hash);\n");
+    fprintf(fp,"    free(c->code_pages);\n");
+    fprintf(fp,"    free(c->epoch);\n");
+    fprintf(fp,"    memset(c,0,sizeof(*c));\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* returns 0, or -1 if hash_bits is not 1-31 or out of memory. the arena is made to hold at least one block\n");
+    fprintf(fp," * of OPCC_BLOCK_MAX_INSN */\n");
+    fprintf(fp,"static inline int opcc_block_cache_init(opcc_block_cache *c,size_t arena_size,unsigned int hash_bits) {\n");
+    fprintf(fp,"    memset(c,0,sizeof(*c));\n");
+    fprintf(fp,"    if (hash_bits < 1u || hash_bits > 31u) return -1;\n");
+    fprintf(fp,"    if (arena_size < OPCC_BLOCK_SIZE(OPCC_BLOCK_MAX_INSN)) arena_size = OPCC_BLOCK_SIZE(OPCC_BLOCK_MAX_INSN);\n");
+    fprintf(fp,"    c->arena_size = arena_size;\n");
+    fprintf(fp,"    c->hash_bits = hash_bits;\n");
+    fprintf(fp,"    c->arena = (uint8_t*)malloc(arena_size);\n");
+    fprintf(fp,"    c->hash = (opcc_block**)calloc((size_t)1 << hash_bits,sizeof(opcc_block*));\n");
+    fprintf(fp,"    c->code_pages = (uint32_t*)calloc((size_t)1 << (32u - OPCC_BLOCK_PAGE_SHIFT - 5u),sizeof(uint32_t));\n");
+    fprintf(fp,"    c->epoch = (uint32_t*)calloc((size_t)1 << OPCC_BLOCK_EPOCH_BITS,sizeof(uint32_t));\n");
+    fprintf(fp,"    if (c->arena == NULL || c->hash == NULL || c->code_pages == NULL || c->epoch == NULL) {\n");
+    fprintf(fp,"        opcc_block_cache_free(c);\n");
+    fprintf(fp,"        return -1;\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"    return 0;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"static inline unsigned int opcc_block_hash(const opcc_block_cache *c,uint32_t addr,unsigned int size_index,uint32_t cpu) {\n");
+    fprintf(fp,"    return (unsigned int)(((addr ^ (cpu * 0x85EBCA6Bu) ^ (size_index << 30u)) * 0x9E3779B1u) >> (32u - c->hash_bits));\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* the write path of the emulator: test, and if set invalidate the page being written */\n");
+    fprintf(fp,"static inline int opcc_block_cache_is_code(const opcc_block_cache *c,uint32_t addr) {\n");
+    fprintf(fp,"    const uint32_t pg = OPCC_BLOCK_PAGE(addr);\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    return (c->code_pages[pg >> 5u] >> (pg & 31u)) & 1u;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"static inline void opcc_block_cache_invalidate_page(opcc_block_cache *c,uint32_t addr) {\n");
+    fprintf(fp,"    const uint32_t pg = OPCC_BLOCK_PAGE(addr);\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    c->code_pages[pg >> 5u] &= ~(1u << (pg & 31u));\n");
+    fprintf(fp,"    c->epoch[OPCC_BLOCK_EPOCH_SLOT(pg)]++;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"static inline int opcc_block_valid(const opcc_block_cache *c,const opcc_block *b) {\n");
+    fprintf(fp,"    const uint32_t pg = OPCC_BLOCK_PAGE(b->addr);\n");
+    fprintf(fp,"    const uint32_t pl = OPCC_BLOCK_PAGE(b->addr + b->length - 1u);\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    return b->epoch[0] == c->epoch[OPCC_BLOCK_EPOCH_SLOT(pg)] && b->epoch[1] == c->epoch[OPCC_BLOCK_EPOCH_SLOT(pl)];\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* returns the cached block or NULL. blocks found invalidated are unlinked on the way */\n");
+    fprintf(fp,"static inline const opcc_block *opcc_block_cache_lookup(opcc_block_cache *c,uint32_t addr,unsigned int size_index,uint32_t cpu) {\n");
+    fprintf(fp,"    opcc_block **pp = &c->hash[opcc_block_hash(c,addr,size_index,cpu)],*b;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    while ((b=*pp) != NULL) {\n");
+    fprintf(fp,"        if (!opcc_block_valid(c,b)) {\n");
+    fprintf(fp,"            *pp = b->next;\n");
+    fprintf(fp,"            continue;\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"        if (b->addr == addr && b->cpu == cpu && b->size_index == size_index) return b;\n");
+    fprintf(fp,"        pp = &b->next;\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    return NULL;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* decode and cache the block at addr. p holds the guest code at addr up to the end of its page, fetch pulls the\n");
+    fprintf(fp," * next page for an instruction that crosses into it. returns NULL if the first instruction could not be fetched.\n");
+    fprintf(fp," * when the arena has no room for another block the whole cache is flushed first, which frees every block\n");
+    fprintf(fp," * returned so far by this and opcc_block_cache_lookup(). only the returned block is valid after the call,\n");
+    fprintf(fp," * a caller that keeps block pointers (chaining) must drop them when c->flushes changes */\n");
+    fprintf(fp,"static inline const opcc_block *opcc_block_cache_translate(opcc_block_cache *c,uint32_t addr,unsigned int size_index,uint32_t cpu,\n");
+    fprintf(fp,"    const uint8_t *p,size_t avail,opcc_fetch_next fetch,void *ctx) {\n");
+    fprintf(fp,"    opcc_block *b;\n");
+    fprintf(fp,"    uint32_t pg,pl;\n");
+    fprintf(fp,"    size_t o = 0;\n");
+    fprintf(fp,"    unsigned int h,n = 0;\n");
+    fprintf(fp,"    int r;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    if ((c->arena_size - c->arena_used) < OPCC_BLOCK_SIZE(OPCC_BLOCK_MAX_INSN)) opcc_block_cache_flush(c);\n");
+    fprintf(fp,"    b = (opcc_block*)(c->arena + c->arena_used);\n");
+    fprintf(fp,"    b->end = OPCC_BLOCK_END_LIMIT;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    while (n < OPCC_BLOCK_MAX_INSN) {\n");
+    fprintf(fp,"        opcc_window_insn *d = &b->insn[n];\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"        if (o >= avail) {\n");
+    fprintf(fp,"            b->end = OPCC_BLOCK_END_PAGE;\n");
+    fprintf(fp,"            break;\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"        r = opcc_decode_fetch(p+o,avail-o,fetch,ctx,size_index,d);\n");
+    fprintf(fp,"        if (r == OPCC_DECODE_MORE && n != 0) {\n");
+    fprintf(fp,"            b->end = OPCC_BLOCK_END_PAGE;     /* the next page could not be fetched, end the block before it */\n");
+    fprintf(fp,"            break;\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"        if (r == OPCC_DECODE_MORE) return NULL;\n");
+    fprintf(fp,"        if (r < 0) {\n");
+    fprintf(fp,"            d->length = 0;\n");
+    fprintf(fp,"            n++;\n");
+    fprintf(fp,"            b->end = OPCC_BLOCK_END_FAULT;\n");
+    fprintf(fp,"            break;\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"        o += d->length;\n");
+    fprintf(fp,"        n++;\n");
+    fprintf(fp,"        if (opcc_branch_kind[r] != OPCC_BRANCH_NONE) {\n");
+    fprintf(fp,"            b->end = OPCC_BLOCK_END_BRANCH;\n");
+    fprintf(fp,"            break;\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"        if (opcc_traps[r] & (OPCC_TRAP_SERIALIZING | OPCC_TRAP_SHADOW)) {\n");
+    fprintf(fp,"            b->end = OPCC_BLOCK_END_TRAP;\n");
+    fprintf(fp,"            break;\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"        if (o > avail) {\n");
+    fprintf(fp,"            b->end = OPCC_BLOCK_END_PAGE;     /* crossed into the next page */\n");
+    fprintf(fp,"            break;\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    b->addr = addr;\n");
+    fprintf(fp,"    b->cpu = cpu;\n");
+    fprintf(fp,"    b->size_index = (uint8_t)size_index;\n");
+    fprintf(fp,"    b->count = (uint16_t)n;\n");
+    fprintf(fp,"    b->length = (uint32_t)(o != 0 ? o : 1u);\n");
+    fprintf(fp,"    pg = OPCC_BLOCK_PAGE(addr);\n");
+    fprintf(fp,"    pl = OPCC_BLOCK_PAGE(addr + b->length - 1u);\n");
+    fprintf(fp,"    b->epoch[0] = c->epoch[OPCC_BLOCK_EPOCH_SLOT(pg)];\n");
+    fprintf(fp,"    b->epoch[1] = c->epoch[OPCC_BLOCK_EPOCH_SLOT(pl)];\n");
+    fprintf(fp,"    c->code_pages[pg >> 5u] |= 1u << (pg & 31u);\n");
+    fprintf(fp,"    c->code_pages[pl >> 5u] |= 1u << (pl & 31u);\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    h = opcc_block_hash(c,addr,size_index,cpu);\n");
+    fprintf(fp,"    b->next = c->hash[h];\n");
+    fprintf(fp,"    c->hash[h] = b;\n");
+    fprintf(fp,"    c->arena_used += OPCC_BLOCK_SIZE(n);\n");
+    fprintf(fp,"    return b;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+}
+
+/* micro-op templates for a JIT front end. each opcode and mod/reg/rm form is lowered from its destination,
+ * param, reads, writes, modifies and stack lists into a fixed format sequence: sources into temporaries,
+ * stack pops and pushes, one EXEC for the operation itself, write back, implicit register effects, flags and
+ * control flow. templates that come out the same are stored once. */
+bool opcode_has_modrm(const OpcodeSpec &op) {
+    for (const auto &b : op.bytes)
+        if (b.meaning == TOK_MRM) return true;
+    return false;
+}
+
+/* r/m operand that is memory when mod != 3 */
+bool rm_operand_can_be_memory(const SingleByteSpec &sb) {
+    if (sb.meaning == TOK_RM) return true;
+    if ((sb.meaning == TOK_MM || sb.meaning == TOK_XMM) && sb.fpu_st.type == TOK_RM) return true;
+    return false;
+}
+
+enum uop_t {
+    UOP_NOP=0,
+    UOP_GET,                        // dst temp = src slot
+    UOP_PUT,                        // dst slot = src temp
+    UOP_LOAD,                       // dst temp = memory at src address slot
+    UOP_STORE,                      // memory at dst address slot = src temp
+    UOP_PUSH,                       // push src temp
+    UOP_POP,                        // pop into dst temp
+    UOP_EXEC,                       // the operation: dst temp = op(T0, T1, ...)
+    UOP_USE,                        // implicit read of src slot by EXEC
+    UOP_CLOBBER,                    // implicit write of dst slot by EXEC
+    UOP_RFLAGS,                     // EXEC reads the flags in aux
+    UOP_WFLAGS,                     // EXEC writes the flags in aux
+    UOP_FSTACK,                     // FPU stack push (aux = 1) or pop (aux = 2)
+    UOP_BRANCH,                     // control transfer to src, aux = opcc_branch_kind
+
+    UOP_MAX
+};
+
+const char *uop_str[UOP_MAX] = {
+    "NOP",
+    "GET",
+    "PUT",
+    "LOAD",
+    "STORE",
+    "PUSH",
+    "POP",
+    "EXEC",
+    "USE",
+    "CLOBBER",
+    "RFLAGS",
+    "WFLAGS",
+    "FSTACK",
+    "BRANCH"
+};
+
+enum uop_slot_t {
+    UOPR_NONE=0,
+    UOPR_T0,                        // temporaries, T0 is the destination
+    UOPR_T1,
+    UOPR_T2,
+    UOPR_T3,
+    UOPR_TS,                        // scratch for stack items
+    UOPR_REG,                       // general register, mod/reg/rm reg field
+    UOPR_RM,                        // general register, mod/reg/rm rm field (mod == 3)
+    UOPR_OPREG,                     // general register, low 3 bits of the opcode
+    UOPR_EA,                        // mod/reg/rm effective address (mod != 3)
+    UOPR_ADDR_SI,                   // seg:SI string source
+    UOPR_ADDR_DI,                   // ES:DI string destination
+    UOPR_ADDR_STACK,                // SS:SP
+    UOPR_ADDR_MOFFS,                // seg:immediate offset
+    UOPR_ADDR_OTHER,
+    UOPR_IMM0,                      // immediates in instruction order
+    UOPR_IMM1,
+    UOPR_TARGET,                    // end of instruction + IMM0, relative branch target
+    UOPR_CONST,                     // aux
+    UOPR_SREG,                      // mod/reg/rm reg field
+    UOPR_CR,
+    UOPR_DR,
+    UOPR_TR,
+    UOPR_ST,                        // ST(aux)
+    UOPR_ST_RM,                     // ST(rm)
+    UOPR_MM_REG,
+    UOPR_MM_RM,
+    UOPR_MM_IMPLIED,                // MM(reg ^ 1), Cyrix
+    UOPR_XMM_REG,
+    UOPR_XMM_RM,
+    UOPR_FLAGS,
+
+    UOPR_FIXED                      // fixed registers follow, OPCC_UOPR_<name>
+};
+
+const char *uop_slot_str[UOPR_FIXED] = {
+    "NONE",
+    "T0",
+    "T1",
+    "T2",
+    "T3",
+    "TS",
+    "REG",
+    "RM",
+    "OPREG",
+    "EA",
+    "ADDR_SI",
+    "ADDR_DI",
+    "ADDR_STACK",
+    "ADDR_MOFFS",
+    "ADDR_OTHER",
+    "IMM0",
+    "IMM1",
+    "TARGET",
+    "CONST",
+    "SREG",
+    "CR",
+    "DR",
+    "TR",
+    "ST",
+    "ST_RM",
+    "MM_REG",
+    "MM_RM",
+    "MM_IMPLIED",
+    "XMM_REG",
+    "XMM_RM",
+    "FLAGS"
+};
+
+class MicroOp {
+public:
+    unsigned char               op = UOP_NOP;
+    unsigned char               size = MEM_SIZE_NONE;
+    unsigned char               dst = UOPR_NONE;
+    unsigned char               src = UOPR_NONE;
+    uint16_t                    aux = 0;
+public:
+    MicroOp(const unsigned char o,const unsigned char s,const unsigned char d,const unsigned char r,const uint16_t a=0) : op(o), size(s), dst(d), src(r), aux(a) { }
+    bool operator<(const MicroOp &o) const {
+        if (op   != o.op)   return op   < o.op;
+        if (size != o.size) return size < o.size;
+        if (dst  != o.dst)  return dst  < o.dst;
+        if (src  != o.src)  return src  < o.src;
+        return aux < o.aux;
+    }
+};
+
+class UopOperand {
+public:
+    unsigned char               slot = UOPR_NONE;
+    unsigned char               size = MEM_SIZE_NONE;
+    uint16_t                    aux = 0;
+    bool                        memory = false;         // slot is an address
+};
+
+/* EFLAGS bits */
+uint16_t uop_flags_mask(const std::vector<SingleByteSpec> &l) {
+    uint16_t m = 0;
+
+    for (const auto &sb : l) {
+        if (sb.meaning != TOK_FLAGS) continue;
+        for (const auto f : sb.flags) {
+            switch (f) {
+                case TOK_CF:    m |= 0x0001; break;
+                case TOK_PF:    m |= 0x0004; break;
+                case TOK_AF:    m |= 0x0010; break;
+                case TOK_ZF:    m |= 0x0040; break;
+                case TOK_SF:    m |= 0x0080; break;
+                case TOK_TF:    m |= 0x0100; break;
+                case TOK_IF:    m |= 0x0200; break;
+                case TOK_DF:    m |= 0x0400; break;
+                case TOK_OF:    m |= 0x0800; break;
+                case TOK_IOPL:  m |= 0x3000; break;
+                case TOK_NT:    m |= 0x4000; break;
+                case TOK_ALL:   m |= 0x7FD5; break;
+                default:        break;
+            }
+        }
+    }
+
+    return m;
+}
+
+bool uop_same_operand(const SingleByteSpec &a,const SingleByteSpec &b) {
+    if (a.meaning != b.meaning || a.reg_type != b.reg_type || a.rm_type != b.rm_type) return false;
+    if (a.memory_type != b.memory_type || a.memseg_type != b.memseg_type) return false;
+    if (a.fpu_st.type != b.fpu_st.type || a.fpu_st.intval.u != b.fpu_st.intval.u) return false;
+    if (a.var_expr.size() != b.var_expr.size()) return false;
+    for (size_t i=0;i < a.var_expr.size();i++)
+        if (a.var_expr[i].type != b.var_expr[i].type) return false;
+    return true;
+}
+
+bool uop_in_list(const SingleByteSpec &sb,const std::vector<SingleByteSpec> &l) {
+    for (const auto &x : l)
+        if (uop_same_operand(sb,x)) return true;
+    return false;
+}
+
+class UopLowering {
+public:
+    std::map<std::string,unsigned char> fixed;          // fixed register name -> slot
+public:
+    unsigned char               fixed_slot(const unsigned int tok);
+    int                         immediate_index(const OpcodeSpec &op,const unsigned int var);
+    bool                        operand(const OpcodeSpec &op,const SingleByteSpec &sb,const bool mem,UopOperand &r);
+    bool                        lower(const OpcodeSpec &op,const bool mem,std::vector<MicroOp> &u);
+};
+
+unsigned char UopLowering::fixed_slot(const unsigned int tok) {
+    std::string name;
+
+    for (const char *s=tokentype_str[tok];*s;s++) name += isalnum((unsigned char)*s) ? (char)toupper((unsigned char)*s) : '_';
+
+    auto i = fixed.find(name);
+    if (i != fixed.end()) return i->second;
+    if ((UOPR_FIXED + fixed.size()) > 255u) return UOPR_NONE;
+
+    const unsigned char s = (unsigned char)(UOPR_FIXED + fixed.size());
+    fixed[name] = s;
+    return s;
+}
+
+int UopLowering::immediate_index(const OpcodeSpec &op,const unsigned int var) {
+    int n = 0;
+
+    if (var == 0) return -1;
+    for (const auto &b : op.bytes) {
+        if (b.meaning != TOK_IMMEDIATE) continue;
+        if (b.var_assign == var) return n;
+        n++;
+    }
+
+    return -1;
+}
+
+bool UopLowering::operand(const OpcodeSpec &op,const SingleByteSpec &sb,const bool mem,UopOperand &r) {
+    const bool modrm = opcode_has_modrm(op);
+
+    r = UopOperand();
+    switch (sb.meaning) {
+        case TOK_RM:
+            r.size = mem_size_code(sb.rm_type);
+            if (mem) {
+                r.slot = UOPR_EA;
+                r.memory = true;
+            }
+            else {
+                r.slot = modrm ? UOPR_RM : UOPR_OPREG;
+            }
+            return true;
+        case TOK_REG:
+            r.size = mem_size_code(sb.reg_type);
+            r.slot = modrm ? UOPR_REG : UOPR_OPREG;
+            return true;
+        case TOK_SREG:  r.slot = UOPR_SREG; return true;
+        case TOK_CR:    r.slot = UOPR_CR; return true;
+        case TOK_DR:    r.slot = UOPR_DR; return true;
+        case TOK_TR:    r.slot = UOPR_TR; return true;
+        case TOK_FLAGS: r.slot = UOPR_FLAGS; return true;
+        case TOK_UINT:
+            r.slot = UOPR_CONST;
+            r.aux = (uint16_t)sb.intval;
+            return true;
+        case TOK_ST:
+            if (sb.fpu_st.type == TOK_RM || sb.fpu_st.type == TOK_REG) {
+                r.slot = UOPR_ST_RM;
+            }
+            else {
+                r.slot = UOPR_ST;
+                r.aux = (sb.fpu_st.type == TOK_UINT) ? (uint16_t)sb.fpu_st.intval.u : 0u;
+            }
+            return true;
+        case TOK_MM:
+        case TOK_XMM: {
+            const bool xmm = (sb.meaning == TOK_XMM);
+
+            if (sb.fpu_st.type == TOK_RM && mem) {
+                r.slot = UOPR_EA;
+                r.size = xmm ? MEM_SIZE_DQW : MEM_SIZE_QW;
+                r.memory = true;
+            }
+            else if (sb.fpu_st.type == TOK_RM) {
+                r.slot = xmm ? UOPR_XMM_RM : UOPR_MM_RM;
+            }
+            else if (sb.fpu_st.type == TOK_IMPLIED) {
+                r.slot = UOPR_MM_IMPLIED;
+            }
+            else if (sb.fpu_st.type == TOK_UINT || sb.fpu_st.type == TOK_V) {
+                /* xmm(v) is the implied XMM0 of the blend instructions */
+                r.slot = fixed_slot(xmm ? TOK_XMM : TOK_MM);
+                r.aux = (sb.fpu_st.type == TOK_UINT) ? (uint16_t)sb.fpu_st.intval.u : 0u;
+            }
+            else {
+                r.slot = xmm ? UOPR_XMM_REG : UOPR_MM_REG;
+            }
+            return true;
+        }
+        case TOK_MEMORY: {
+            static const unsigned char src[MEM_SRC_MAX] = {
+                UOPR_ADDR_OTHER, UOPR_EA, UOPR_ADDR_STACK, UOPR_ADDR_SI, UOPR_ADDR_DI, UOPR_ADDR_MOFFS, UOPR_ADDR_OTHER };
+
+            r.slot = src[mem_source_code(sb)];
+            r.size = mem_size_code(sb.memory_type);
+            r.memory = true;
+            return true;
+        }
+        default:
+            break;
+    }
+
+    /* immediate variables, and relative targets assigned from IP plus an immediate */
+    int imm = immediate_index(op,sb.meaning);
+    if (imm >= 0) {
+        for (const auto &b : op.bytes)
+            if (b.meaning == TOK_IMMEDIATE && b.var_assign == sb.meaning) r.size = mem_size_code(b.immediate_type);
+        r.slot = (imm == 0) ? UOPR_IMM0 : UOPR_IMM1;
+        return imm < 2;
+    }
+    for (const auto &a : op.assign) {
+        if (a.var_assign != sb.meaning) continue;
+        for (const auto &t : a.var_expr) {
+            if (immediate_index(op,t.type) == 0) {
+                r.slot = UOPR_TARGET;
+                return true;
+            }
+        }
+    }
+
+    r.slot = fixed_slot(sb.meaning);
+    return r.slot != UOPR_NONE;
+}
+
+bool UopLowering::lower(const OpcodeSpec &op,const bool mem,std::vector<MicroOp> &u) {
+    std::vector<std::pair<const SingleByteSpec*,unsigned char> > temps;     // operand -> temp
+    const SingleByteSpec *dest = op.destination.meaning != 0 ? &op.destination : NULL;
+    std::vector<SingleByteSpec> written = op.writes;
+    unsigned char t = UOPR_T1,target = UOPR_NONE,dest_slot = UOPR_NONE;
+    UopOperand o;
+
+    written.insert(written.end(),op.modifies.begin(),op.modifies.end());
+    u.clear();
+
+    auto temp_of = [&temps](const SingleByteSpec &sb) {
+        for (const auto &p : temps)
+            if (uop_same_operand(*p.first,sb)) return p.second;
+        return (unsigned char)UOPR_NONE;
+    };
+
+    /* the same rule as opcode_memory_accesses(): reads/writes/modifies decide when they mention the operand (a
+     * memory operand by its address, whatever the width), otherwise the destination is written and a parameter is
+     * read. (addressonly) memory is neither, only its address is used */
+    std::vector<unsigned char> mem_read,mem_written;             // address slots
+    for (const auto &sb : op.reads)
+        if ((rm_operand_can_be_memory(sb) || sb.meaning == TOK_MEMORY) && operand(op,sb,mem,o) && o.memory) mem_read.push_back(o.slot);
+    for (const auto &sb : written)
+        if ((rm_operand_can_be_memory(sb) || sb.meaning == TOK_MEMORY) && operand(op,sb,mem,o) && o.memory) mem_written.push_back(o.slot);
+
+    /* role: what the operand does when reads/writes/modifies do not mention it */
+    auto role_dir = [&](const SingleByteSpec &sb,const UopOperand &so,const unsigned char role) {
+        unsigned char d = 0;
+
+        if (so.memory) {
+            if (op.address_only) return (unsigned char)0;
+            if (std::find(mem_read.begin(),mem_read.end(),so.slot) != mem_read.end()) d |= mem_dir_read;
+            if (std::find(mem_written.begin(),mem_written.end(),so.slot) != mem_written.end()) d |= mem_dir_write;
+        }
+        else {
+            if (uop_in_list(sb,op.reads)) d |= mem_dir_read;
+            if (uop_in_list(sb,written)) d |= mem_dir_write;
+        }
+
+        return d != 0 ? d : role;
+    };
+
+    /* sources: a destination that is also read, then the parameters */
+    if (dest != NULL) {
+        if (!operand(op,*dest,mem,o)) return false;
+        dest_slot = o.slot;
+        if (role_dir(*dest,o,mem_dir_write) & mem_dir_read)
+            u.push_back(MicroOp(o.memory ? UOP_LOAD : UOP_GET,o.size,UOPR_T0,o.slot,o.aux));
+        else if (o.memory && op.address_only)
+            u.push_back(MicroOp(UOP_GET,o.size,UOPR_T0,o.slot,o.aux));
+        temps.push_back(std::make_pair(dest,(unsigned char)UOPR_T0));
+    }
+    for (const auto &sb : op.param) {
+        if (t > UOPR_T3) return false;
+        if (!operand(op,sb,mem,o)) return false;
+        /* memory is loaded unless it is (addressonly), LEA and friends want the address */
+        u.push_back(MicroOp((o.memory && (role_dir(sb,o,mem_dir_read) & mem_dir_read)) ? UOP_LOAD : UOP_GET,o.size,t,o.slot,o.aux));
+        temps.push_back(std::make_pair(&sb,t));
+        if (o.slot == UOPR_TARGET || (op.branch_type != 0 && target == UOPR_NONE)) target = t;
+        t++;
+    }
+
+    /* implicit inputs. memory that is read but not named as a param (POP r/m, XLAT) is loaded as one more
+     * source, registers the stack pushes are picked up below */
+    for (const auto &sb : op.reads) {
+        if (sb.meaning == TOK_FLAGS) continue;
+        if (temp_of(sb) != UOPR_NONE) continue;
+        if (op.stack_op_dir == TOK_PUSH && uop_in_list(sb,op.stack_ops)) continue;
+        if (!operand(op,sb,mem,o)) return false;
+        if (o.memory) {
+            bool loaded = (o.slot == dest_slot);
+
+            for (const auto &m : u)
+                if ((m.op == UOP_LOAD || m.op == UOP_GET) && m.src == o.slot) loaded = true;
+            if (loaded) continue;                       // same address as a param, at another width
+            if (t > UOPR_T3) return false;
+            u.push_back(MicroOp(UOP_LOAD,o.size,t,o.slot,o.aux));
+            temps.push_back(std::make_pair(&sb,t));
+            t++;
+            continue;
+        }
+        u.push_back(MicroOp(UOP_USE,o.size,UOPR_NONE,o.slot,o.aux));
+    }
+    if (uop_flags_mask(op.reads) != 0)
+        u.push_back(MicroOp(UOP_RFLAGS,MEM_SIZE_NONE,UOPR_NONE,UOPR_FLAGS,uop_flags_mask(op.reads)));
+
+    /* stack */
+    for (const auto &sb : op.stack_ops) {
+        unsigned char st = temp_of(sb);
+
+        if (op.stack_op_dir == TOK_PUSH) {
+            if (st == UOPR_NONE) {
+                if (!operand(op,sb,mem,o)) return false;
+                u.push_back(MicroOp(o.memory ? UOP_LOAD : UOP_GET,o.size,UOPR_TS,o.slot,o.aux));
+                st = UOPR_TS;
+            }
+            u.push_back(MicroOp(UOP_PUSH,MEM_SIZE_V,UOPR_NONE,st));
+        }
+        else if (op.stack_op_dir == TOK_POP) {
+            if (st != UOPR_NONE) {
+                u.push_back(MicroOp(UOP_POP,MEM_SIZE_V,st,UOPR_NONE));
+            }
+            else {
+                if (!operand(op,sb,mem,o)) return false;
+                u.push_back(MicroOp(UOP_POP,MEM_SIZE_V,UOPR_TS,UOPR_NONE));
+                u.push_back(MicroOp(o.memory ? UOP_STORE : UOP_PUT,o.size,o.slot,UOPR_TS,o.aux));
+            }
+        }
+    }
+
+    u.push_back(MicroOp(UOP_EXEC,MEM_SIZE_NONE,dest != NULL ? UOPR_T0 : UOPR_NONE,t > UOPR_T1 ? UOPR_T1 : UOPR_NONE));
+
+    /* write back */
+    if (dest != NULL) {
+        if (!operand(op,*dest,mem,o)) return false;
+        if (role_dir(*dest,o,mem_dir_write) & mem_dir_write)
+            u.push_back(MicroOp(o.memory ? UOP_STORE : UOP_PUT,o.size,o.slot,UOPR_T0,o.aux));
+    }
+    for (const auto &sb : written) {
+        bool dup = false;
+
+        if (sb.meaning == TOK_FLAGS) continue;
+        if (dest != NULL && uop_same_operand(sb,*dest)) continue;
+        for (const auto *p=&written[0];p != &sb;p++)
+            if (uop_same_operand(*p,sb)) dup = true;
+        if (dup) continue;
+        if (!operand(op,sb,mem,o)) return false;
+        if (o.memory) continue;
+        u.push_back(MicroOp(UOP_CLOBBER,o.size,o.slot,UOPR_NONE,o.aux));
+    }
+    if (uop_flags_mask(written) != 0)
+        u.push_back(MicroOp(UOP_WFLAGS,MEM_SIZE_NONE,UOPR_FLAGS,UOPR_NONE,uop_flags_mask(written)));
+
+    if (op.fpu_stack_op_dir == TOK_PUSH || op.fpu_stack_op_dir == TOK_POP)
+        u.push_back(MicroOp(UOP_FSTACK,MEM_SIZE_NONE,UOPR_NONE,UOPR_NONE,op.fpu_stack_op_dir == TOK_PUSH ? 1u : 2u));
+
+    if (op.branch_type != 0)
+        u.push_back(MicroOp(UOP_BRANCH,MEM_SIZE_NONE,UOPR_NONE,target,branch_kind_byte(op)));
+
+    return true;
+}
+
+void emit_uop_templates(FILE *fp) {
+    std::map<std::vector<MicroOp>,size_t> seen;
+    std::vector<std::vector<MicroOp> > seq;
+    std::vector<size_t> first;                                  // per template in seq
+    std::vector<size_t> tmpl(opcodes.size() * 2u,0);           // [opcode][mod == 3] -> seq index
+    std::vector<MicroOp> u;
+    size_t total = 0;
+    UopLowering lw;
+
+    /* index 0 is the empty template, for prefixes and anything that does not lower */
+    seq.push_back(std::vector<MicroOp>());
+    seen[seq[0]] = 0;
+
+    for (size_t i=0;i < opcodes.size();i++) {
+        const auto &op = opcodes[i];
+        bool rm = false;
+
+        if (op.type == TOK_PREFIX) continue;
+        if (op.destination.meaning != 0 && rm_operand_can_be_memory(op.destination)) rm = true;
+        for (const auto &sb : op.param) if (rm_operand_can_be_memory(sb)) rm = true;
+
+        for (unsigned int form=0;form < 2;form++) {
+            /* form 0 is mod != 3 (memory), 1 is mod == 3. a form the opcode does not have takes the other */
+            bool mem = rm && (form == 0);
+            if (rm && op.mod3 == 3) mem = false;
+            if (rm && op.mod3 == -3) mem = true;
+
+            if (!lw.lower(op,mem,u)) {
+                fprintf(stderr,"Opcode '%s' does not lower to micro-ops, left empty\n",op.name.c_str());
+                u.clear();
+            }
+
+            auto s = seen.find(u);
+            if (s == seen.end()) {
+                seen[u] = seq.size();
+                tmpl[i*2u+form] = seq.size();
+                seq.push_back(u);
+            }
+            else {
+                tmpl[i*2u+form] = s->second;
+            }
+        }
+    }
+
+    for (const auto &s : seq) {
+        first.push_back(total);
+        total += s.size();
+    }
+    if (total > 0xFFFFu) {
+        fprintf(stderr,"Micro-op table too large (%zu)\n",total);
+        return;
+    }
+
+    fprintf(fp,"/* micro-op templates: sources into temporaries, stack, EXEC (the operation of the opcode, patched in by the\n");
+    fprintf(fp," * JIT), write back, implicit registers, flags and control flow. sizes are OPCC_MEM_SIZE_* */\n");
+    for (unsigned int i=0;i < UOP_MAX;i++)
+        fprintf(fp,"#define OPCC_UOP_%-20s %u\n",uop_str[i],i);
+    fprintf(fp,"\n");
+    for (unsigned int i=0;i < UOPR_FIXED;i++)
+        fprintf(fp,"#define OPCC_UOPR_%-19s %u\n",uop_slot_str[i],i);
+    {
+        std::vector<std::pair<unsigned char,std::string> > l;
+
+        for (const auto &f : lw.fixed) l.push_back(std::make_pair(f.second,f.first));
+        std::sort(l.begin(),l.end());
+        for (const auto &f : l)
+            fprintf(fp,"#define OPCC_UOPR_%-19s %u\n",f.second.c_str(),f.first);
+    }
+    fprintf(fp,"#define OPCC_UOP_TEMPLATE_COUNT      %zu\n",seq.size());
+    fprintf(fp,"\n");
+    fprintf(fp,"typedef struct opcc_uop {\n");
+    fprintf(fp,"    uint8_t     op;         /* OPCC_UOP_* */\n");
+    fprintf(fp,"    uint8_t     size;       /* OPCC_MEM_SIZE_* */\n");
+    fprintf(fp,"    uint8_t     dst;        /* OPCC_UOPR_* */\n");
+    fprintf(fp,"    uint8_t     src;\n");
+    fprintf(fp,"    uint16_t    aux;        /* constant or ST() index, flags mask, branch kind */\n");
+    fprintf(fp,"} opcc_uop;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"typedef struct opcc_uop_range {\n");
+    fprintf(fp,"    uint16_t    first;      /* in opcc_uops[] */\n");
+    fprintf(fp,"    uint16_t    count;\n");
+    fprintf(fp,"} opcc_uop_range;\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const opcc_uop opcc_uops[%zu] = {\n",total > 0 ? total : (size_t)1);
+    if (total == 0) fprintf(fp,"    { 0, 0, 0, 0, 0 }\n");
+    for (size_t s=0;s < seq.size();s++) {
+        if (seq[s].empty()) continue;
+        fprintf(fp,"    /* %zu */\n",s);
+        for (size_t j=0;j < seq[s].size();j++) {
+            const auto &m = seq[s][j];
+
+            fprintf(fp,"    { OPCC_UOP_%s, %u, %u, %u, 0x%04x }%s\n",uop_str[m.op],m.size,m.dst,m.src,m.aux,
+                (first[s]+j+1) < total ? "," : "");
+        }
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const opcc_uop_range opcc_uop_templates[OPCC_UOP_TEMPLATE_COUNT] = {\n");
+    for (size_t s=0;s < seq.size();s++)
+        fprintf(fp,"    { %zu, %zu }%s\n",first[s],seq[s].size(),(s+1) < seq.size() ? "," : "");
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* template by opcode, [0] mod != 3 (or no mod/reg/rm), [1] mod == 3 */\n");
+    fprintf(fp,"static const uint16_t opcc_uop_template[OPCC_OPCODE_COUNT][2] = {\n");
+    for (size_t i=0;i < opcodes.size();i++)
+        fprintf(fp,"    { %4zu, %4zu }%s /* %4zu %s */\n",tmpl[i*2u],tmpl[i*2u+1u],(i+1) < opcodes.size() ? "," : " ",i,opcodes[i].name.c_str());
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+}
+
+/* disassembly text. each opcode gets up to four operand descriptors (destination first, as pretty_string() lists
+ * them) and its immediate layout, worked out here once. the emitted formatter only walks the descriptors and
+ * writes NASM style text into the caller's buffer. */
+enum fmt_kind_t {
+    FMT_NONE=0,
+    FMT_REG,                        // general register, mod/reg/rm reg field
+    FMT_RM,                         // general register or memory, mod/reg/rm rm field
+    FMT_OPREG,                      // general register, low 3 bits of the opcode
+    FMT_GPR,                        // fixed general register, arg = number
+    FMT_SREG,                       // reg field
+    FMT_SREGN,                      // arg = number
+    FMT_CR,
+    FMT_DR,
+    FMT_TR,
+    FMT_CONST,                      // arg
+    FMT_ST,                         // st(arg)
+    FMT_ST_RM,
+    FMT_MM_REG,
+    FMT_MM_RM,                      // MM register or memory
+    FMT_MM_IMPLIED,                 // MM(reg ^ 1)
+    FMT_MMN,                        // arg
+    FMT_XMM_REG,
+    FMT_XMM_RM,                     // XMM register or memory
+    FMT_XMMN,                       // arg
+    FMT_IMM,                        // immediate arg
+    FMT_REL,                        // relative target from immediate arg
+    FMT_FARPTR,                     // seg:offset immediate arg
+    FMT_MOFFS,                      // memory at immediate arg
+    FMT_MEM,                        // other memory, arg = MEM_SRC_*
+    FMT_NAME,                       // anything else, arg = index in opcc_fmt_name
+
+    FMT_MAX
+};
+
+const char *fmt_kind_str[FMT_MAX] = {
+    "NONE",
+    "REG",
+    "RM",
+    "OPREG",
+    "GPR",
+    "SREG",
+    "SREGN",
+    "CR",
+    "DR",
+    "TR",
+    "CONST",
+    "ST",
+    "ST_RM",
+    "MM_REG",
+    "MM_RM",
+    "MM_IMPLIED",
+    "MMN",
+    "XMM_REG",
+    "XMM_RM",
+    "XMMN",
+    "IMM",
+    "REL",
+    "FARPTR",
+    "MOFFS",
+    "MEM",
+    "NAME"
+};
+
+const unsigned int fmt_max_operands = 4;
+
+const unsigned char fmt_imm_signed = 0x40;             // opcc_fmt_imm: sign extended
+const unsigned char fmt_imm_offset = 0x80;             // opcc_fmt_imm: memory offset, address size
+
+const unsigned char fmt_flag_string = 0x01;            // operands are implied, mnemonic takes a b/w/d suffix
+const unsigned char fmt_flag_repe = 0x02;              // REP reads as REPE (CMPS, SCAS)
+const unsigned char fmt_flag_far = 0x04;               // far branch through memory
+
+bool is_signed_type(const unsigned int t) {
+    return t == TOK_SB || t == TOK_SW || t == TOK_SDW || t == TOK_SV || t == TOK_SQW;
+}
+
+uint16_t fmt_desc(const unsigned int kind,const unsigned int size,const unsigned int arg) {
+    return (uint16_t)(kind | (size << 5u) | (arg << 9u));
+}
+
+/* general register number and size of a fixed register, false if it is not one */
+bool fmt_fixed_gpr(const unsigned int tok,unsigned int &num,unsigned int &size) {
+    static const unsigned int r8[8] = { TOK_AL, TOK_CL, TOK_DL, TOK_BL, TOK_AH, TOK_CH, TOK_DH, TOK_BH };
+    static const unsigned int r16[8] = { TOK_AX, TOK_CX, TOK_DX, TOK_BX, TOK_SP, TOK_BP, TOK_SI, TOK_DI };
+    static const unsigned int r32[8] = { TOK_EAX, TOK_ECX, TOK_EDX, TOK_EBX, TOK_ESP, TOK_EBP, TOK_ESI, TOK_EDI };
+    static const unsigned int rv[8] = { TOK_AV, TOK_CV, TOK_DV, TOK_BV, TOK_SPV, TOK_BPV, TOK_SIV, TOK_DIV };
+
+    for (unsigned int i=0;i < 8;i++) {
+        num = i;
+        if (tok == r8[i])  { size = MEM_SIZE_B;  return true; }
+        if (tok == r16[i]) { size = MEM_SIZE_W;  return true; }
+        if (tok == r32[i]) { size = MEM_SIZE_DW; return true; }
+        if (tok == rv[i])  { size = MEM_SIZE_V;  return true; }
+    }
+
+    return false;
+}
+
+bool fmt_fixed_sreg(const unsigned int tok,unsigned int &num) {
+    static const unsigned int sr[6] = { TOK_ES, TOK_CS, TOK_SS, TOK_DS, TOK_FS, TOK_GS };
+
+    for (unsigned int i=0;i < 6;i++) {
+        if (tok == sr[i]) {
+            num = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+class FormatTables {
+public:
+    std::vector< std::array<uint16_t,4> >   opnd;
+    std::vector< std::array<unsigned char,2> > imm;
+    std::vector<unsigned char>  flags;
+    std::vector<std::string>    names;
+public:
+    unsigned int                name_index(const std::string &s);
+    uint16_t                    operand(const OpcodeSpec &op,const SingleByteSpec &sb);
+    void                        build(void);
+};
+
+unsigned int FormatTables::name_index(const std::string &s) {
+    for (size_t i=0;i < names.size();i++)
+        if (names[i] == s) return (unsigned int)i;
+    names.push_back(s);
+    return (unsigned int)(names.size() - 1u);
+}
+
+uint16_t FormatTables::operand(const OpcodeSpec &op,const SingleByteSpec &sb) {
+    const bool modrm = opcode_has_modrm(op);
+    unsigned int num,size;
+
+    switch (sb.meaning) {
+        case TOK_RM:
+            /* no 64 or 128-bit general registers here, those r/m operands are MMX and SSE */
+            if (modrm && sb.rm_type == TOK_QW) return fmt_desc(FMT_MM_RM,MEM_SIZE_QW,0);
+            if (modrm && sb.rm_type == TOK_DQW) return fmt_desc(FMT_XMM_RM,MEM_SIZE_DQW,0);
+            return fmt_desc(modrm ? FMT_RM : FMT_OPREG,mem_size_code(sb.rm_type),0);
+        case TOK_REG:   return fmt_desc(modrm ? FMT_REG : FMT_OPREG,mem_size_code(sb.reg_type),0);
+        case TOK_SREG:  return fmt_desc(FMT_SREG,0,0);
+        case TOK_CR:    return fmt_desc(FMT_CR,0,0);
+        case TOK_DR:    return fmt_desc(FMT_DR,0,0);
+        case TOK_TR:    return fmt_desc(FMT_TR,0,0);
+        case TOK_UINT:
+            if (sb.intval < 128u) return fmt_desc(FMT_CONST,0,(unsigned int)sb.intval);
+            break;
+        case TOK_ST:
+            if (sb.fpu_st.type == TOK_RM || sb.fpu_st.type == TOK_REG) return fmt_desc(FMT_ST_RM,0,0);
+            return fmt_desc(FMT_ST,0,(sb.fpu_st.type == TOK_UINT) ? (unsigned int)(sb.fpu_st.intval.u & 7u) : 0u);
+        case TOK_MM:
+        case TOK_XMM: {
+            const bool xmm = (sb.meaning == TOK_XMM);
+
+            if (sb.fpu_st.type == TOK_RM) return fmt_desc(xmm ? FMT_XMM_RM : FMT_MM_RM,xmm ? MEM_SIZE_DQW : MEM_SIZE_QW,0);
+            if (sb.fpu_st.type == TOK_IMPLIED) return fmt_desc(FMT_MM_IMPLIED,0,0);
+            if (sb.fpu_st.type == TOK_UINT) return fmt_desc(xmm ? FMT_XMMN : FMT_MMN,0,(unsigned int)(sb.fpu_st.intval.u & 7u));
+            if (sb.fpu_st.type == TOK_V) return fmt_desc(FMT_XMMN,0,0);
+            return fmt_desc(xmm ? FMT_XMM_REG : FMT_MM_REG,0,0);
+        }
+        case TOK_MEMORY: {
+            const unsigned char src = mem_source_code(sb);
+
+            if (src == MEM_SRC_OFFSET) {
+                int n = 0;
+
+                for (const auto &b : op.bytes) {
+                    if (b.meaning != TOK_IMMEDIATE) continue;
+                    if (b.var_assign == sb.var_expr[0].type) return fmt_desc(FMT_MOFFS,mem_size_code(sb.memory_type),(unsigned int)n);
+                    n++;
+                }
+            }
+            return fmt_desc(FMT_MEM,mem_size_code(sb.memory_type),src);
+        }
+        default:
+            break;
+    }
+
+    if (fmt_fixed_gpr(sb.meaning,num,size)) return fmt_desc(FMT_GPR,size,num);
+    if (fmt_fixed_sreg(sb.meaning,num)) return fmt_desc(FMT_SREGN,0,num);
+
+    /* immediates, and targets assigned from IP plus an immediate */
+    {
+        int n = 0;
+
+        for (const auto &b : op.bytes) {
+            if (b.meaning != TOK_IMMEDIATE) continue;
+            if (b.var_assign == sb.meaning && sb.meaning != 0)
+                return fmt_desc(is_far_pointer_type(b.immediate_type) ? FMT_FARPTR : FMT_IMM,0,(unsigned int)n);
+            n++;
+        }
+    }
+    for (const auto &a : op.assign) {
+        if (a.var_assign != sb.meaning || sb.meaning == 0) continue;
+        for (const auto &t : a.var_expr) {
+            int n = 0;
+
+            for (const auto &b : op.bytes) {
+                if (b.meaning != TOK_IMMEDIATE) continue;
+                if (b.var_assign == t.type) return fmt_desc(FMT_REL,0,(unsigned int)n);
+                n++;
+            }
+        }
+    }
+
+    std::string s;
+    for (const char *p=tokentype_str[sb.meaning];*p;p++) s += (char)tolower((unsigned char)*p);
+    return fmt_desc(FMT_NAME,0,name_index(s) & 0x7Fu);
+}
+
+void FormatTables::build(void) {
+    for (const auto &op : opcodes) {
+        std::array<uint16_t,4> o = {{ 0, 0, 0, 0 }};
+        std::array<unsigned char,2> im = {{ 0, 0 }};
+        std::vector<const SingleByteSpec*> l;
+        unsigned char f = 0;
+        unsigned int n = 0;
+
+        if (op.type != TOK_PREFIX) {
+            if (op.destination.meaning != 0) l.push_back(&op.destination);
+            for (const auto &sb : op.param) if (sb.meaning != 0) l.push_back(&sb);
+        }
+
+        /* MOVS, STOS, LODS, CMPS, SCAS, INS, OUTS: string memory plus fixed registers only */
+        {
+            unsigned char ssize = MEM_SIZE_NONE;
+            bool other = false;
+            unsigned int num,size;
+
+            for (const auto *sb : l) {
+                if (sb->meaning == TOK_MEMORY && (mem_source_code(*sb) == MEM_SRC_SI || mem_source_code(*sb) == MEM_SRC_DI))
+                    ssize = mem_size_code(sb->memory_type);
+                else if (!fmt_fixed_gpr(sb->meaning,num,size))
+                    other = true;
+            }
+            if (ssize != MEM_SIZE_NONE && !other) {
+                f |= fmt_flag_string | (unsigned char)(ssize << 4u);
+                for (const auto &sb : op.writes)
+                    if (sb.meaning == TOK_FLAGS) f |= fmt_flag_repe;
+                l.clear();
+            }
+        }
+
+        if (op.branch_type != 0) {
+            for (const auto *sb : l)
+                if (sb->meaning == TOK_RM && is_far_pointer_type(sb->rm_type)) f |= fmt_flag_far;
+        }
+
+        /* x87: constants and fixed stack registers are implied (fld1, fcompp, f2xm1), ST0 also next to a memory
+         * operand and in loads (fld dword [bx], fld st1) */
+        if (op.fpu_stack_op_dir != 0 || std::any_of(l.begin(),l.end(),[](const SingleByteSpec *sb) { return sb->meaning == TOK_ST; })) {
+            bool rm = false,sti = false;
+
+            for (const auto *sb : l) {
+                if (sb->meaning == TOK_RM) rm = true;
+                if (sb->meaning == TOK_ST && (sb->fpu_st.type == TOK_RM || sb->fpu_st.type == TOK_REG)) sti = true;
+            }
+            for (auto i=l.begin();i!=l.end();) {
+                const SingleByteSpec &sb = **i;
+                const bool fixed = sb.meaning == TOK_ST && sb.fpu_st.type == TOK_UINT;
+
+                if (sb.meaning == TOK_UINT || sb.meaning == TOK_CONSTANT ||
+                    (fixed && !rm && !sti) ||
+                    (fixed && sb.fpu_st.intval.u == 0 && (rm || op.fpu_stack_op_dir == TOK_PUSH)))
+                    i = l.erase(i);
+                else
+                    i++;
+            }
+        }
+
+        for (const auto *sb : l) {
+            if (n >= fmt_max_operands) break;
+            o[n++] = operand(op,*sb);
+        }
+
+        n = 0;
+        for (const auto &b : op.bytes) {
+            if (b.meaning != TOK_IMMEDIATE) continue;
+            if (n >= 2) break;
+            if (immediate_is_offset(op,b.var_assign))
+                im[n] = fmt_imm_offset;
+            else
+                im[n] = mem_size_code(b.immediate_type) | (is_signed_type(b.immediate_type) ? fmt_imm_signed : 0u);
+            n++;
+        }
+
+        opnd.push_back(o);
+        imm.push_back(im);
+        flags.push_back(f);
+    }
+}
+
+/* opcc_format.h as text, made into string literals by the Makefile */
+const char opcc_format_text[] =
+#include "opcc_format.inc"
+;
+
+void emit_disasm_formatter(FILE *fp) {
+    FormatTables ft;
+
+    ft.build();
+
+    fprintf(fp,"/* disassembly text, NASM syntax. opcc_fmt_opnd[] is per opcode: kind (bits 0-4), OPCC_MEM_SIZE_* (bits 5-8)\n");
+    fprintf(fp," * and an argument (bits 9-15), destination first */\n");
+    for (unsigned int i=0;i < FMT_MAX;i++)
+        fprintf(fp,"#define OPCC_FMT_%-21s %u\n",fmt_kind_str[i],i);
+    fprintf(fp,"#define OPCC_FMT_KIND(x)              ((x) & 0x1Fu)\n");
+    fprintf(fp,"#define OPCC_FMT_SIZE(x)              (((x) >> 5u) & 0xFu)\n");
+    fprintf(fp,"#define OPCC_FMT_ARG(x)               ((x) >> 9u)\n");
+    fprintf(fp,"#define OPCC_FMT_IMM_SIGNED           0x%02xu\n",fmt_imm_signed);
+    fprintf(fp,"#define OPCC_FMT_IMM_OFFSET           0x%02xu\n",fmt_imm_offset);
+    fprintf(fp,"#define OPCC_FMT_STRING               0x%02xu /* bits 4-7: OPCC_MEM_SIZE_* of the string item */\n",fmt_flag_string);
+    fprintf(fp,"#define OPCC_FMT_REPE                 0x%02xu\n",fmt_flag_repe);
+    fprintf(fp,"#define OPCC_FMT_FAR                  0x%02xu\n",fmt_flag_far);
+    fprintf(fp,"#define OPCC_FMT_OPERANDS             %u\n",fmt_max_operands);
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const uint16_t opcc_fmt_opnd[OPCC_OPCODE_COUNT][%u] = {\n",fmt_max_operands);
+    for (size_t i=0;i < opcodes.size();i++) {
+        fprintf(fp,"    {");
+        for (unsigned int j=0;j < fmt_max_operands;j++) fprintf(fp," 0x%04x%s",ft.opnd[i][j],(j+1) < fmt_max_operands ? "," : "");
+        fprintf(fp," }%s /* %4zu %s */\n",(i+1) < opcodes.size() ? "," : " ",i,opcodes[i].name.c_str());
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* immediates in instruction order: OPCC_MEM_SIZE_* | OPCC_FMT_IMM_*, then flags */\n");
+    fprintf(fp,"static const uint8_t opcc_fmt_imm[OPCC_OPCODE_COUNT][3] = {\n");
+    for (size_t i=0;i < opcodes.size();i++)
+        fprintf(fp,"%s{ 0x%02x, 0x%02x, 0x%02x }%s%s",(i % 4) == 0 ? "    " : " ",ft.imm[i][0],ft.imm[i][1],ft.flags[i],(i+1) < opcodes.size() ? "," : "",((i % 4) == 3 || (i+1) == opcodes.size()) ? "\n" : "");
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const char *const opcc_fmt_name[%zu] = {\n",ft.names.empty() ? (size_t)1 : ft.names.size());
+    if (ft.names.empty()) fprintf(fp,"    \"?\"\n");
+    for (size_t i=0;i < ft.names.size();i++) {
+        fprintf(fp,"    ");
+        emit_c_string(fp,ft.names[i]);
+        fprintf(fp,"%s\n",(i+1) < ft.names.size() ? "," : "");
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fputs(opcc_format_text,fp);
+    fprintf(fp,"\n");
+}
+
+/* assembler tables. every opcode the formatter can print is a form of its lowercase mnemonic (string instructions
+ * under the b/w/d suffixed names), and a mnemonic finds its forms through an open addressed FNV-1a hash. the
+ * operand matchers are the opcc_fmt_opnd[] descriptors read the other way round. the encoding table adds what the
+ * descriptors leave out: the opcode bytes ahead of mod/reg/rm (mandatory prefix included) and the reg, rm and mod
+ * constraints. the DSL names of opcodes whose operand size follows the code segment (cbw, pusha, iret) take either
+ * size, with the NASM names that fix it (cwde, pushad, iretw) as extra forms. note that NASM's cbw and cwd are
+ * always 16-bit, here they are 98h and 99h at the size of the code segment like -disasm prints them. */
+const unsigned char asm_enc_modrm = 0x01;
+const unsigned char asm_enc_opreg = 0x02;              // low 3 bits of the last opcode byte are a register
+const unsigned char asm_enc_mod3 = 0x04;               // register forms only
+const unsigned char asm_enc_mem = 0x08;                // memory forms only
+const unsigned char asm_enc_suffix = 0x10;             // fixed byte after mod/reg/rm, SIB and displacement (3DNow!)
+const unsigned char asm_enc_none = 0x80;               // prefix, or a byte layout the encoder does not write
+
+const unsigned int asm_op_max = 4;
+const unsigned char asm_o32_any = 2;
+
+class AsmEncoding {
+public:
+    std::array<unsigned char,4> op = {{ 0, 0, 0, 0 }};
+    unsigned char               op_len = 0;
+    unsigned char               flags = 0;
+    unsigned char               reg_mask = 0;       // valid reg field (or opcode register) values, 0 = any
+    unsigned char               rm_mask = 0;        // valid rm field values, 0 = any
+    unsigned char               suffix = 0;
+};
+
+class AsmForm {
+public:
+    uint16_t                    opcode = 0;
+    unsigned char               o32 = asm_o32_any;  // operand size the name asks for (movsw, movsd)
+};
+
+class AsmSizedName {
+public:
+    const char                  *opcode;            // DSL name
+    const char                  *name[2];           // [o32], NULL if NASM has none
+};
+
+const AsmSizedName asm_sized_names[] = {
+    { "CBW",    { NULL,     "cwde"   } },
+    { "CWD",    { NULL,     "cdq"    } },
+    { "PUSHA",  { "pushaw", "pushad" } },
+    { "POPA",   { "popaw",  "popad"  } },
+    { "PUSHF",  { "pushfw", "pushfd" } },
+    { "POPF",   { "popfw",  "popfd"  } },
+    { "IRET",   { "iretw",  "iretd"  } }
+};
+
+class AsmMnemonic {
+public:
+    std::string                 name;
+    uint32_t                    first = 0,count = 0;    // in AsmTables::forms
+};
+
+class AsmTables {
+public:
+    FormatTables                ft;
+    std::vector<AsmEncoding>    enc;
+    std::vector<AsmMnemonic>    mnemonics;          // sorted by name
+    std::vector<AsmForm>        forms;
+    std::vector<uint16_t>       hash;               // mnemonic index + 1, 0 = empty
+public:
+    void                        build(void);
+    int                         lookup(const char *s,const size_t len) const;
+};
+
+uint32_t asm_hash(const char *s,const size_t len) {
+    uint32_t h = 0x811C9DC5u;
+
+    for (size_t i=0;i < len;i++) h = (h ^ (uint32_t)tolower((unsigned char)s[i])) * 0x01000193u;
+    return h;
+}
+
+AsmEncoding asm_encoding(const OpcodeSpec &op,const std::array<uint16_t,4> &opnd) {
+    AsmEncoding e,none;
+    bool modrm = false,opreg = false;
+    unsigned int imm = 0;
+    const ByteSpec *last = NULL;
+
+    none.flags = asm_enc_none;
+    if (op.type == TOK_PREFIX) return none;
+
+    for (const auto &b : op.bytes) {
+        if (b.meaning == TOK_MRM) {
+            if (modrm || imm != 0) return none;
+            modrm = true;
+        }
+        else if (b.meaning == TOK_IMMEDIATE) {
+            if (++imm > 2) return none;
+            if (mem_size_code(b.immediate_type) == MEM_SIZE_NONE && !immediate_is_offset(op,b.var_assign)) return none;
+        }
+        else if (b.meaning == 0 && !b.empty()) {
+            if (imm != 0 || (e.flags & asm_enc_suffix)) return none;
+            if (modrm) {
+                if (b.size() != 1) return none;
+                e.flags |= asm_enc_suffix;
+                e.suffix = b[0];
+            }
+            else {
+                if (e.op_len >= asm_op_max) return none;
+                e.op[e.op_len++] = *std::min_element(b.begin(),b.end());
+                last = &b;
+            }
+        }
+        else {
+            return none;
+        }
+    }
+    if (e.op_len == 0) return none;
+
+    for (const auto x : opnd)
+        if ((x & 0x1Fu) == FMT_OPREG) opreg = true;
+
+    if (modrm) {
+        e.flags |= asm_enc_modrm;
+        e.reg_mask = op.reg_constraint;
+        e.rm_mask = op.rm_constraint;
+        if (op.mod3 == 3) e.flags |= asm_enc_mod3;
+        else if (op.mod3 == -3) e.flags |= asm_enc_mem;
+    }
+    else if (opreg) {
+        /* 0x50-0x57, or 0x91-0x97 where 0x90 is something else */
+        const unsigned char base = e.op[e.op_len-1u] & 0xF8u;
+        unsigned char mask = 0;
+
+        for (const auto v : *last)
+            if ((v & 0xF8u) == base) mask |= (unsigned char)(1u << (v & 7u));
+        e.flags |= asm_enc_opreg;
+        e.op[e.op_len-1u] = base;
+        e.reg_mask = mask != 0xFFu ? mask : 0u;
+    }
+
+    return e;
+}
+
+void AsmTables::build(void) {
+    std::map< std::string,std::vector<AsmForm> > byname;
+    size_t hs = 16;
+
+    ft.build();
+    for (size_t i=0;i < opcodes.size();i++) {
+        const OpcodeSpec &op = opcodes[i];
+        std::string name;
+        AsmForm f;
+
+        enc.push_back(asm_encoding(op,ft.opnd[i]));
+        if (enc.back().flags & asm_enc_none) continue;
+
+        for (const auto c : op.name) name += (char)tolower((unsigned char)c);
+        f.opcode = (uint16_t)i;
+        if (ft.flags[i] & fmt_flag_string) {
+            const unsigned int size = (ft.flags[i] >> 4u) < MEM_SIZE_MAX ? (ft.flags[i] >> 4u) : 0u;
+
+            for (unsigned int o32=0;o32 < 2;o32++) {
+                const unsigned int bytes = mem_size_bytes[size][o32];
+
+                f.o32 = mem_size_bytes[size][0] == mem_size_bytes[size][1] ? asm_o32_any : (unsigned char)o32;
+                byname[name + (bytes == 1u ? 'b' : (bytes == 2u ? 'w' : 'd'))].push_back(f);
+                if (f.o32 == asm_o32_any) break;
+            }
+        }
+        else {
+            byname[name].push_back(f);
+            for (const auto &sn : asm_sized_names) {
+                if (op.name != sn.opcode) continue;
+                for (unsigned int o32=0;o32 < 2;o32++) {
+                    if (sn.name[o32] == NULL) continue;
+                    f.o32 = (unsigned char)o32;
+                    byname[sn.name[o32]].push_back(f);
+                }
+            }
+        }
+    }
+
+    for (const auto &m : byname) {
+        AsmMnemonic a;
+
+        a.name = m.first;
+        a.first = (uint32_t)forms.size();
+        a.count = (uint32_t)m.second.size();
+        forms.insert(forms.end(),m.second.begin(),m.second.end());
+        mnemonics.push_back(a);
+    }
+
+    while (hs < (mnemonics.size() * 2u)) hs *= 2u;
+    hash.assign(hs,0);
+    for (size_t i=0;i < mnemonics.size();i++) {
+        uint32_t h = asm_hash(mnemonics[i].name.data(),mnemonics[i].name.size()) & (uint32_t)(hs - 1u);
+
+        while (hash[h] != 0) h = (h + 1u) & (uint32_t)(hs - 1u);
+        hash[h] = (uint16_t)(i + 1u);
+    }
+}
+
+/* mnemonic index, -1 if there is no such instruction. not case sensitive */
+int AsmTables::lookup(const char *s,const size_t len) const {
+    const uint32_t mask = (uint32_t)(hash.size() - 1u);
+    uint32_t h = asm_hash(s,len) & mask;
+
+    while (hash[h] != 0) {
+        const std::string &n = mnemonics[hash[h] - 1u].name;
+        size_t i = 0;
+
+        if (n.size() == len)
+            while (i < len && tolower((unsigned char)s[i]) == n[i]) i++;
+        if (n.size() == len && i == len) return (int)(hash[h] - 1u);
+        h = (h + 1u) & mask;
+    }
+
+    return -1;
+}
+
+void emit_asm_tables(FILE *fp) {
+    AsmTables at;
+
+    at.build();
+
+    fprintf(fp,"/* assembler tables. opcc_asm_lookup() finds a mnemonic (lowercase, string instructions with the b/w/d\n");
+    fprintf(fp," * suffix, cwde, cdq, pushad and the like fix the operand size through opcc_asm_form.o32),\n");
+    fprintf(fp," * its forms are opcodes whose opcc_fmt_opnd[] descriptors are the operands to match, and\n");
+    fprintf(fp," * opcc_asm_enc[] gives the bytes: op[] then mod/reg/rm, SIB and displacement, the suffix byte, then the\n");
+    fprintf(fp," * immediates as opcc_fmt_imm[] lays them out. OPCC_ASM_OPREG forms put the register in the low bits of\n");
+    fprintf(fp," * the last op[] byte. masks are the reg (or opcode register) and rm values allowed, 0 = any */\n");
+    fprintf(fp,"#define OPCC_ASM_MODRM                0x%02xu\n",asm_enc_modrm);
+    fprintf(fp,"#define OPCC_ASM_OPREG                0x%02xu\n",asm_enc_opreg);
+    fprintf(fp,"#define OPCC_ASM_MOD3                 0x%02xu /* register forms only */\n",asm_enc_mod3);
+    fprintf(fp,"#define OPCC_ASM_MEM                  0x%02xu /* memory forms only */\n",asm_enc_mem);
+    fprintf(fp,"#define OPCC_ASM_SUFFIX               0x%02xu\n",asm_enc_suffix);
+    fprintf(fp,"#define OPCC_ASM_NONE                 0x%02xu /* not assembled (prefixes) */\n",asm_enc_none);
+    fprintf(fp,"#define OPCC_ASM_O32_ANY              %uu\n",asm_o32_any);
+    fprintf(fp,"#define OPCC_ASM_MNEMONIC_COUNT       %zuu\n",at.mnemonics.size());
+    fprintf(fp,"#define OPCC_ASM_FORM_COUNT           %zuu\n",at.forms.size());
+    fprintf(fp,"#define OPCC_ASM_HASH_SIZE            %zuu\n",at.hash.size());
+    fprintf(fp,"\n");
+
+    fprintf(fp,"typedef struct opcc_asm_encoding {\n");
+    fprintf(fp,"    uint8_t     op[%u];\n",asm_op_max);
+    fprintf(fp,"    uint8_t     op_len;\n");
+    fprintf(fp,"    uint8_t     flags;          /* OPCC_ASM_* */\n");
+    fprintf(fp,"    uint8_t     reg_mask;\n");
+    fprintf(fp,"    uint8_t     rm_mask;\n");
+    fprintf(fp,"    uint8_t     suffix;\n");
+    fprintf(fp,"} opcc_asm_encoding;\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"typedef struct opcc_asm_mnemonic {\n");
+    fprintf(fp,"    const char  *name;\n");
+    fprintf(fp,"    uint16_t    first;          /* in opcc_asm_forms[] */\n");
+    fprintf(fp,"    uint16_t    count;\n");
+    fprintf(fp,"} opcc_asm_mnemonic;\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"typedef struct opcc_asm_form {\n");
+    fprintf(fp,"    uint16_t    opcode;\n");
+    fprintf(fp,"    uint8_t     o32;            /* operand size the name asks for, or OPCC_ASM_O32_ANY */\n");
+    fprintf(fp,"} opcc_asm_form;\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const opcc_asm_encoding opcc_asm_enc[OPCC_OPCODE_COUNT] = {\n");
+    for (size_t i=0;i < opcodes.size();i++) {
+        const AsmEncoding &e = at.enc[i];
+
+        fprintf(fp,"    { { 0x%02x, 0x%02x, 0x%02x, 0x%02x }, %u, 0x%02x, 0x%02x, 0x%02x, 0x%02x }%s /* %4zu %s */\n",
+            e.op[0],e.op[1],e.op[2],e.op[3],e.op_len,e.flags,e.reg_mask,e.rm_mask,e.suffix,
+            (i+1) < opcodes.size() ? "," : " ",i,opcodes[i].name.c_str());
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const opcc_asm_mnemonic opcc_asm_mnemonics[%zu] = {\n",std::max(at.mnemonics.size(),(size_t)1));
+    if (at.mnemonics.empty()) fprintf(fp,"    { \"\", 0, 0 }\n");
+    for (size_t i=0;i < at.mnemonics.size();i++) {
+        fprintf(fp,"    { ");
+        emit_c_string(fp,at.mnemonics[i].name);
+        fprintf(fp,", %u, %u }%s\n",at.mnemonics[i].first,at.mnemonics[i].count,(i+1) < at.mnemonics.size() ? "," : "");
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const opcc_asm_form opcc_asm_forms[%zu] = {\n",std::max(at.forms.size(),(size_t)1));
+    if (at.forms.empty()) fprintf(fp,"    { 0, 0 }\n");
+    for (size_t i=0;i < at.forms.size();i++)
+        fprintf(fp,"%s{ %4u, %u }%s%s",(i % 6) == 0 ? "    " : " ",at.forms[i].opcode,at.forms[i].o32,(i+1) < at.forms.size() ? "," : "",((i % 6) == 5 || (i+1) == at.forms.size()) ? "\n" : "");
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* mnemonic index + 1, 0 = empty. FNV-1a of the lowercase name, linear probing */\n");
+    fprintf(fp,"static const uint16_t opcc_asm_hash[OPCC_ASM_HASH_SIZE] = {\n");
+    for (size_t i=0;i < at.hash.size();i++)
+        fprintf(fp,"%s%4u%s%s",(i % 16) == 0 ? "    " : " ",at.hash[i],(i+1) < at.hash.size() ? "," : "",((i % 16) == 15 || (i+1) == at.hash.size()) ? "\n" : "");
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static inline unsigned int opcc_asm_lower(unsigned int c) {\n");
+    fprintf(fp,"    return (c >= 'A' && c <= 'Z') ? (c + 0x20u) : c;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* mnemonic index of the len characters at s, -1 if there is no such instruction. not case sensitive */\n");
+    fprintf(fp,"static inline int opcc_asm_lookup(const char *s,size_t len) {\n");
+    fprintf(fp,"    uint32_t h = 0x811C9DC5u;\n");
+    fprintf(fp,"    unsigned int m;\n");
+    fprintf(fp,"    size_t i;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    for (i=0;i < len;i++) h = (h ^ opcc_asm_lower((unsigned char)s[i])) * 0x01000193u;\n");
+    fprintf(fp,"    h &= OPCC_ASM_HASH_SIZE - 1u;\n");
+    fprintf(fp,"    while ((m=opcc_asm_hash[h]) != 0u) {\n");
+    fprintf(fp,"        const char *n = opcc_asm_mnemonics[m - 1u].name;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"        for (i=0;i < len && n[i] != 0 && opcc_asm_lower((unsigned char)s[i]) == (unsigned char)n[i];i++);\n");
+    fprintf(fp,"        if (i == len && n[i] == 0) return (int)(m - 1u);\n");
+    fprintf(fp,"        h = (h + 1u) & (OPCC_ASM_HASH_SIZE - 1u);\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    return -1;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+}
+
+void emit_pipeline_tables(FILE *fp) {
+    const std::string pipeline = define_string("pipeline");
+
+    if (pipeline == "p5") {
+        size_t known = 0;
+
+        for (const auto &op : opcodes)
+            if (op.pairing != 0) known++;
+
+        fprintf(fp,"/* Pentium U/V pipe pairing, %zu of %zu opcodes known.\n",known,opcodes.size());
+        fprintf(fp," * opcodes without a pairing class are OPCC_PAIR_UNKNOWN, schedule them as NP */\n");
+        fprintf(fp,"#define OPCC_PIPELINE_P5             1\n");
+        fprintf(fp,"#define OPCC_PAIR_NP                 0x00u /* not pairable, U pipe alone */\n");
+        fprintf(fp,"#define OPCC_PAIR_UV                 0x01u /* pairs in either pipe */\n");
+        fprintf(fp,"#define OPCC_PAIR_PU                 0x02u /* pairs only when issued to the U pipe */\n");
+        fprintf(fp,"#define OPCC_PAIR_PV                 0x03u /* pairs only when issued to the V pipe */\n");
+        fprintf(fp,"#define OPCC_PAIR_UNKNOWN            0x04u /* no pairing data */\n");
+        fprintf(fp,"\n");
+
+        fprintf(fp,"static const uint8_t opcc_pairing[OPCC_OPCODE_COUNT] = {\n");
+        for (size_t i=0;i < opcodes.size();i++) {
+            const unsigned int p = pairing_code(opcodes[i].pairing);
+            fprintf(fp,"    OPCC_PAIR_%s%s /* %4zu %s */\n",
+                p == 1 ? "UV" : (p == 2 ? "PU" : (p == 3 ? "PV" : (p == 4 ? "UNKNOWN" : "NP"))),
+                (i+1) < opcodes.size() ? "," : " ",i,opcodes[i].name.c_str());
+        }
+        fprintf(fp,"};\n");
+        fprintf(fp,"\n");
+    }
+    else if (pipeline == "p6") {
+        size_t known = 0;
+
+        for (const auto &op : opcodes)
+            if (op.uops_reg != 0 || op.uops_mem != 0) known++;
+
+        fprintf(fp,"/* P6 decode: micro-op count and which decoder can take the instruction, %zu of %zu opcodes known. 0 = unknown */\n",known,opcodes.size());
+        fprintf(fp,"#define OPCC_PIPELINE_P6             1\n");
+        for (unsigned int i=0;i < P6_DECODER_MAX;i++)
+            fprintf(fp,"#define OPCC_DECODER_%-16s 0x%02xu\n",p6_decoder_str[i],i);
+        fprintf(fp,"\n");
+        fprintf(fp,"typedef struct opcc_p6_decode {\n");
+        fprintf(fp,"    uint8_t     uops_reg;       /* register form (mod == 3 or no mod/reg/rm) */\n");
+        fprintf(fp,"    uint8_t     uops_mem;       /* memory form (mod != 3) */\n");
+        fprintf(fp,"    uint8_t     decoder_reg;    /* OPCC_DECODER_* */\n");
+        fprintf(fp,"    uint8_t     decoder_mem;\n");
+        fprintf(fp,"} opcc_p6_decode;\n");
+        fprintf(fp,"\n");
+
+        fprintf(fp,"static const opcc_p6_decode opcc_p6_decode_table[OPCC_OPCODE_COUNT] = {\n");
+        for (size_t i=0;i < opcodes.size();i++) {
+            const OpcodeSpec &op = opcodes[i];
+
+            fprintf(fp,"    { %2u, %2u, OPCC_DECODER_%s, OPCC_DECODER_%s }%s /* %4zu %s */\n",
+                op.uops_reg,op.uops_mem,p6_decoder_str[p6_decoder(op.uops_reg)],p6_decoder_str[p6_decoder(op.uops_mem)],
+                (i+1) < opcodes.size() ? "," : " ",i,op.name.c_str());
+        }
+        fprintf(fp,"};\n");
+        fprintf(fp,"\n");
+    }
+}
+
+bool write_output_file(void) {
+    FILE *fp;
+
+    if ((fp=fopen(outfile.c_str(),"w")) == NULL) {
+        fprintf(stderr,"Unable to write file '%s', %s\n",outfile.c_str(),strerror(errno));
+        return false;
+    }
+
+    emit_output_header(fp);
+    emit_opcode_names(fp);
+    emit_branch_table(fp);
+    emit_memory_table(fp);
+    emit_cycles_table(fp);
+    emit_pipeline_tables(fp);
+    emit_traps_table(fp);
+    emit_ea_tables(fp);
+    if (!emit_decode_tables(fp)) {
+        fclose(fp);
+        return false;
+    }
+    emit_prefix_state_machine(fp);
+    emit_tail_length_table(fp);
+    emit_size_specialized_decoders(fp);
+    if (!emit_window_kernel(fp)) {
+        fclose(fp);
+        return false;
+    }
+    emit_batch_decoder(fp);
+    emit_span_decoder(fp);
+    emit_block_cache(fp);
+    emit_uop_templates(fp);
+    emit_disasm_formatter(fp);
+    emit_asm_tables(fp);
+    emit_output_footer(fp);
+
+    if (ferror(fp)) {
+        fprintf(stderr,"Error writing file '%s'\n",outfile.c_str());
+        fclose(fp);
+        return false;
+    }
+
+    fclose(fp);
+    return true;
+}
+
+/* -profile: histogram written by opcc_profile_dump() from a build of the same -march with
+ * OPCC_DECODE_PROFILE defined, with or without -profile itself. lines are "<opcode index> <count> <name>",
+ * where the index is the one the opcode has without -profile. '#' starts a comment.
+ * opcodes are renumbered hottest first so that their rows in every per-opcode table share the first
+ * cache lines, and decode tables are ordered by the hits below them. */
+bool apply_profile(void) {
+    char line[256],name[128];
+    unsigned long long count;
+    size_t index;
+    FILE *fp;
+
+    if ((fp=fopen(profilefile.c_str(),"r")) == NULL) {
+        fprintf(stderr,"Unable to open file '%s', %s\n",profilefile.c_str(),strerror(errno));
+        return false;
+    }
+
+    while (fgets(line,sizeof(line),fp) != NULL) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+
+        if (sscanf(line,"%zu %llu %127s",&index,&count,name) != 3) {
+            fprintf(stderr,"Profile '%s': bad line '%s'\n",profilefile.c_str(),line);
+            fclose(fp);
+            return false;
+        }
+
+        if (index >= opcodes.size() || opcodes[index].name != name) {
+            fprintf(stderr,"Profile '%s': opcode %zu is not %s, profile is for another -march\n",profilefile.c_str(),index,name);
+            fclose(fp);
+            return false;
+        }
+
+        opcodes[index].profile_count += count;
+        profile_total += count;
+    }
+
+    fclose(fp);
+
+    std::stable_sort(opcodes.begin(),opcodes.end(),[](const OpcodeSpec &a,const OpcodeSpec &b) {
+        return a.profile_count > b.profile_count;
+    });
+
+    profile_loaded = true;
+    return true;
+}
+
+/* set the defines for -march and -fpuarch */
+bool set_march_defines(void) {
+    if (march.empty())
+        march = "everything";
+
+    if (march == "8086") {
+        if (fpuarch.empty())
+            fpuarch = "8087";
+
+        defines["cpulevel"] = 86;
+    }
+    else if (march == "80186") {
+        if (fpuarch.empty())
+            fpuarch = "8087";
+
+        defines["cpulevel"] = 186;
+    }
+    else if (march == "necv20") {
+        if (fpuarch.empty())
+            fpuarch = "8087";
+
+        defines["cpulevel"] = 186;
+        defines["necv20"] = 1;
+    }
+    else if (march == "80286" || march == "286") {
+        if (fpuarch.empty())
+            fpuarch = "80287";
+
+        defines["cpulevel"] = 286;
+    }
+    else if (march == "80386" || march == "386") {
+        if (fpuarch.empty())
+            fpuarch = "80387";
+
+        defines["cpulevel"] = 386;
+    }
+    else if (march == "80486" || march == "486" || march == "486new") {
+        if (fpuarch.empty())
+            fpuarch = "80387";
+
+        defines["cpulevel"] = 486;
+        defines["cpuyear"] = 1992;
+        defines["cpuid"] = 1;
+    }
+    else if (march == "80486old" || march == "486old") {
+        if (fpuarch.empty())
+            fpuarch = "80387";
+
+        defines["cpulevel"] = 486;
+        defines["cpuyear"] = 1988;
+    }
+    else if (march == "80586" || march == "586") {
+        if (fpuarch.empty())
+            fpuarch = "80587";
+
+        defines["cpulevel"] = 586;
+        defines["cpuid"] = 1;
+    }
+    else if (march == "pentium") {
+        if (fpuarch.empty())
+            fpuarch = "80587";
+
+        defines["cpulevel"] = 586;
+        defines["cpuid"] = 1;
+        defines["pipeline"] = "p5";
+    }
+    else if (march == "pentium-mmx") {
+        if (fpuarch.empty())
+            fpuarch = "80587";
+
+        defines["cpulevel"] = 586;
+        defines["cpuid"] = 1;
+        defines["mmx"] = 1;
+        defines["pipeline"] = "p5";
+    }
+    else if (march == "amd-k6") {
+        if (fpuarch.empty())
+            fpuarch = "80587";
+
+        defines["vendor"] = "amd";
+        defines["cpulevel"] = 586;
+        defines["syscall"] = 1;
+        defines["cpuid"] = 1;
+        defines["mmx"] = 1;
+    }
+    else if (march == "amd-k6-2") {
+        if (fpuarch.empty())
+            fpuarch = "80587";
+
+        defines["vendor"] = "amd";
+        defines["cpulevel"] = 586;
+        defines["syscall"] = 1;
+        defines["3dnow"] = 1;
+        defines["cpuid"] = 1;
+        defines["mmx"] = 1;
+    }
+    else if (march == "amd-k6-2+") {
+        if (fpuarch.empty())
+            fpuarch = "80587";
+
+        defines["vendor"] = "amd";
+        defines["cpulevel"] = 586;
+        defines["syscall"] = 1;
+        defines["3dnow+"] = 1;
         defines["3dnow"] = 1;
         defines["cpuid"] = 1;
         defines["mmx"] = 1;
     }
-    else if (march == "80686" || march == "686") {
-        if (fpuarch.empty())
-            fpuarch = "80687";
+    else if (march == "80686" || march == "686") {
+        if (fpuarch.empty())
+            fpuarch = "80687";
+
+        defines["cpulevel"] = 686;
+        defines["cpuid"] = 1;
+    }
+    else if (march == "pentium-pro") {
+        if (fpuarch.empty())
+            fpuarch = "80687";
+
+        defines["cpulevel"] = 686;
+        defines["cpuid"] = 1;
+        defines["cmov"] = 1;
+        defines["pipeline"] = "p6";
+    }
+    else if (march == "pentium-pro-mmx") {
+        if (fpuarch.empty())
+            fpuarch = "80687";
+
+        defines["cpulevel"] = 686;
+        defines["cpuid"] = 1;
+        defines["cmov"] = 1;
+        defines["mmx"] = 1;
+        defines["pipeline"] = "p6";
+    }
+    else if (march == "pentium-2") {
+        if (fpuarch.empty())
+            fpuarch = "80687";
+
+        defines["cpulevel"] = 686;
+        defines["sysenter"] = 1;
+        defines["pentium"] = 2;
+        defines["cpuid"] = 1;
+        defines["cmov"] = 1;
+        defines["mmx"] = 1;
+        defines["pipeline"] = "p6";
+    }
+    else if (march == "pentium-3") {
+        if (fpuarch.empty())
+            fpuarch = "80687";
+
+        defines["cpulevel"] = 686;
+        defines["sysenter"] = 1;
+        defines["pentium"] = 3;
+        defines["cpuid"] = 1;
+        defines["cmov"] = 1;
+        defines["mmx"] = 1;
+        defines["sse"] = 1;
+        defines["pipeline"] = "p6";
+    }
+    else if (march == "cyrix-6x86-mmx") {
+        if (fpuarch.empty())
+            fpuarch = "80687";
+
+        defines["cpulevel"] = 686;
+        defines["sysenter"] = 1;
+        defines["cpuid"] = 1;
+        defines["emmi"] = 1;
+        defines["cmov"] = 1;
+        defines["mmx"] = 1;
+    }
+    else if (march == "everything") { /* catch-all for generic decompilers. cover as much as possible without overlapping opcodes. */
+        if (fpuarch.empty())
+            fpuarch = "80687";
+
+        defines["everything"] = 1;
+        defines["cpulevel"] = 686;
+        defines["sysenter"] = 1;
+        defines["syscall"] = 1;
+        defines["3dnow+"] = 1;
+        defines["cpuid"] = 1;
+        defines["3dnow"] = 1;
+        defines["ssse3"] = 1;
+        defines["sse3"] = 1;
+        defines["sse2"] = 1;
+        defines["cmov"] = 1;
+        defines["mmx+"] = 1;
+        defines["sse"] = 1;
+        defines["mmx"] = 1;
+    }
+    else {
+        fprintf(stderr,"Unknown march '%s'\n",march.c_str());
+        return false;
+    }
+
+    if (fpuarch == "8087" || fpuarch == "80187") {
+        defines["fpulevel"] = 87;
+    }
+    else if (fpuarch == "80287" || fpuarch == "287") {
+        defines["fpulevel"] = 287;
+    }
+    else if (fpuarch == "80387" || fpuarch == "387" ||
+             fpuarch == "80487" || fpuarch == "487" ||
+             fpuarch == "80587") {
+        defines["fpulevel"] = 387;
+    }
+    else if (fpuarch == "80687" ) {
+        defines["fpulevel"] = 687;
+    }
+    else {
+        fprintf(stderr,"Unknown fpuarch '%s'\n",fpuarch.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/* parse the source file and build the opcode group map */
+bool load_opcodes(void) {
+    if ((srcfp=fopen(srcfile.c_str(),"r")) == NULL) {
+        fprintf(stderr,"Unable to open file '%s', %s\n",srcfile.c_str(),strerror(errno));
+        return false;
+    }
+
+    while (read_opcode_block());
+
+    if (read_error) {
+        fprintf(stderr,"Parse error, exiting\n");
+        return false;
+    }
+
+    std::sort(opcodes.begin(),opcodes.end(),opcode_sort_func);
+    for (size_t i=0;i < opcodes.size();i++)
+        opcodes[i].profile_id = i;
+
+    if (!profilefile.empty()) {
+        if (!apply_profile())
+            return false;
+    }
+
+    /* build opcodes into the group table */
+    opcode_groups = std::make_shared<OpcodeGroupBlock>();
+    {
+        auto grref = *opcode_groups;
+        grref.map.resize(256);
+        grref.maptype = OpcodeGroupBlock::LINEAR;
+    }
+    for (auto op_i=opcodes.begin();op_i!=opcodes.end();op_i++) {
+        const auto &opcode = *op_i;
+
+        if (opcode.bytes.size() == 0) {
+            fprintf(stderr,"WARNING: opcode '%s' without bytes\n",opcode.name.c_str());
+            continue;
+        }
+
+        /* bytes[0] must be actual bytes */
+        if (opcode.bytes[0].meaning != 0) {
+            fprintf(stderr,"ERROR: opcode '%s' first entry not a byte value\n",opcode.name.c_str());
+            continue;
+        }
+        {
+            auto i = opcode.bytes.begin();
+
+            /* must be <byte-range> [<byte-range>] [mrm] [immediate]
+             * exception: AMD 3DNow! 0x0F 0x0F mrm <byte-range> */
+            while (i != opcode.bytes.end() && (*i).meaning == 0) i++;
+            if ((i+0) != opcode.bytes.end() &&
+                    (i+1) != opcode.bytes.end() &&
+                    (*(i+0)).meaning == TOK_MRM &&      // mrm
+                    opcode.mod3 == 0 &&                 // no constraints on mrm
+                    opcode.reg_constraint == 0 &&
+                    opcode.rm_constraint == 0 &&
+                    (*(i+1)).meaning == 0) {            // then byte
+                /* allow */
+                assert((i+0) != opcode.bytes.end());
+                assert((i+1) != opcode.bytes.end());
+                i += 2;
+            }
+            else {
+                if (i != opcode.bytes.end() && (*i).meaning == TOK_MRM) i++;
+                while (i != opcode.bytes.end() && (*i).meaning == TOK_IMMEDIATE) i++;
+            }
+
+            if (i != opcode.bytes.end()) {
+                fprintf(stderr,"ERROR: opcode '%s' unexpected byte entries\n",opcode.name.c_str());
+                continue;
+            }
+        }
+
+        if (!enter_opcode_bytes(opcode,(size_t)(op_i-opcodes.begin()),opcode_groups)) {
+            fprintf(stderr,"Opcode byte to map error\n");
+            continue;
+        }
+    }
+
+    return true;
+}
+
+/* binary table file for loading with mmap() and use in place, the layout is described in opcc_blob.h.
+ * everything is little endian, sections are 8 byte aligned and located through an index of
+ * { id, offset, size, checksum } so a reader can verify and touch only the sections it needs. */
+const char blob_magic[8] = { 'O','P','C','C','B','L','O','B' };
+const uint16_t blob_version = 1;
+const uint16_t blob_header_size = 64;
+const uint32_t blob_flag_unknown_ud = 0x00000001;      // unknown opcodes raise #UD
+const size_t blob_march_len = 24;
+
+enum blob_section_t {
+    BLOB_SEC_NONE=0,
+    BLOB_SEC_DECODE_TABLE,          // { uint32 base, uint8 kind, uint8 pad[3] } per table
+    BLOB_SEC_DECODE_ENTRY,          // uint16 per entry, as opcc_decode_entry[]
+    BLOB_SEC_NAME_INDEX,            // uint32 per opcode, offset of the name in BLOB_SEC_STRINGS
+    BLOB_SEC_STRINGS,               // NUL terminated strings
+    BLOB_SEC_TAIL_LENGTH,           // uint8[4] per opcode, as opcc_tail_length[]
+    BLOB_SEC_BRANCH_KIND,           // uint8 per opcode, as opcc_branch_kind[]
+    BLOB_SEC_TRAPS,                 // uint8 per opcode, as opcc_traps[]
+    BLOB_SEC_EA16,                  // opcc_ea (7 bytes) per mod/reg/rm
+    BLOB_SEC_EA32,
+    BLOB_SEC_EA_SIB,                // opcc_ea (7 bytes) per [mod][sib]
+    BLOB_SEC_PREFIX_CLASS,          // uint8[256], as opcc_prefix_class[]
+    BLOB_SEC_PREFIX_STEP,           // { uint32 keep, uint32 set } per prefix class
+
+    BLOB_SEC_MAX
+};
+
+class BlobWriter : public std::vector<uint8_t> {
+public:
+    void                        put8(const unsigned int v) {
+        push_back((uint8_t)v);
+    }
+    void                        put16(const unsigned int v) {
+        put8(v & 0xFFu); put8((v >> 8u) & 0xFFu);
+    }
+    void                        put32(const uint32_t v) {
+        put16(v & 0xFFFFu); put16((v >> 16u) & 0xFFFFu);
+    }
+    void                        set32(const size_t o,const uint32_t v) {
+        for (unsigned int i=0;i < 4;i++) (*this)[o+i] = (uint8_t)(v >> (i * 8u));
+    }
+    void                        align(const size_t a) {
+        while ((size() % a) != 0) put8(0);
+    }
+};
+
+/* FNV-1a */
+uint32_t blob_checksum(const uint8_t *p,const size_t len) {
+    uint32_t h = 0x811C9DC5u;
+
+    for (size_t i=0;i < len;i++) {
+        h ^= p[i];
+        h *= 0x01000193u;
+    }
+
+    return h;
+}
+
+void blob_put_ea(BlobWriter &b,const EffectiveAddress &ea) {
+    b.put8(ea.length);
+    b.put8(ea.disp);
+    b.put8(ea.base);
+    b.put8(ea.index);
+    b.put8(ea.scale);
+    b.put8(ea.seg);
+    b.put8(ea.flags);
+}
+
+bool blob_section(BlobWriter &b,const unsigned int id) {
+    std::vector<DecodeTable> tables;
+
+    switch (id) {
+        case BLOB_SEC_DECODE_TABLE:
+        case BLOB_SEC_DECODE_ENTRY:
+            if (!build_decode_tables(tables))
+                return false;
+
+            if (id == BLOB_SEC_DECODE_TABLE) {
+                uint32_t base = 0;
+
+                for (size_t t=0;t < tables.size();t++) {
+                    b.put32(base);
+                    b.put8(t == 0 ? (unsigned int)DT_LINEAR : tables[t].kind);
+                    b.put8(0); b.put16(0);
+                    base += (uint32_t)tables[t].entries.size();
+                }
+            }
+            else {
+                for (const auto &t : tables)
+                    for (const auto &e : t.entries)
+                        b.put16(e);
+            }
+            break;
+        case BLOB_SEC_NAME_INDEX: {
+            uint32_t o = 0;
+
+            for (const auto &op : opcodes) {
+                b.put32(o);
+                o += (uint32_t)op.name.size() + 1u;
+            }
+            } break;
+        case BLOB_SEC_STRINGS:
+            for (const auto &op : opcodes) {
+                for (const auto c : op.name) b.put8((unsigned char)c);
+                b.put8(0);
+            }
+            break;
+        case BLOB_SEC_TAIL_LENGTH:
+            for (const auto &op : opcodes) {
+                unsigned char len[2][2];
+
+                opcode_tail_length(op,len);
+                b.put8(len[0][0]); b.put8(len[0][1]); b.put8(len[1][0]); b.put8(len[1][1]);
+            }
+            break;
+        case BLOB_SEC_BRANCH_KIND:
+            for (const auto &op : opcodes) b.put8(branch_kind_byte(op));
+            break;
+        case BLOB_SEC_TRAPS:
+            for (const auto &op : opcodes) b.put8(opcode_trap_bits(op));
+            break;
+        case BLOB_SEC_EA16:
+            for (unsigned int i=0;i < 256;i++) blob_put_ea(b,effective_address16(i));
+            break;
+        case BLOB_SEC_EA32:
+            for (unsigned int i=0;i < 256;i++) blob_put_ea(b,effective_address32(i));
+            break;
+        case BLOB_SEC_EA_SIB:
+            for (unsigned int mod=0;mod < 3;mod++)
+                for (unsigned int i=0;i < 256;i++) blob_put_ea(b,effective_address_sib(mod,i));
+            break;
+        case BLOB_SEC_PREFIX_CLASS:
+        case BLOB_SEC_PREFIX_STEP: {
+            std::vector<size_t> class_opcode;
+            unsigned char byte_class[256];
+
+            build_prefix_classes(byte_class,class_opcode);
+            if (id == BLOB_SEC_PREFIX_CLASS) {
+                for (unsigned int i=0;i < 256;i++) b.put8(byte_class[i]);
+            }
+            else {
+                for (size_t c=0;c < class_opcode.size();c++) {
+                    uint32_t keep,set;
+
+                    prefix_class_step(class_opcode,c,keep,set);
+                    b.put32(keep);
+                    b.put32(set);
+                }
+            }
+            } break;
+        default:
+            return false;
+    };
+
+    return true;
+}
+
+/* the whole file image, header, index and sections. -disasm decodes from it in memory with opcc_blob.h */
+bool build_blob_image(BlobWriter &b) {
+    const size_t index_ofs = blob_header_size;
+    const unsigned int sections = BLOB_SEC_MAX - 1;
+
+    for (unsigned int i=0;i < 8;i++) b.put8((unsigned char)blob_magic[i]);
+    b.put16(blob_version);
+    b.put16(blob_header_size);
+    b.put32(unknown_opcode == TOK_UD ? blob_flag_unknown_ud : 0u);
+    b.put32(0);                             // total size, filled in below
+    b.put32(0);                             // checksum of everything past the header
+    b.put32(sections);
+    b.put32((uint32_t)index_ofs);
+    b.put32((uint32_t)opcodes.size());
+    b.put16(opcode_limit > 0 ? (unsigned int)opcode_limit : 0u);
+    b.put16((unsigned int)cpulevel_value());
+    for (size_t i=0;i < blob_march_len;i++) b.put8(i < march.size() && i < (blob_march_len-1) ? (unsigned char)march[i] : 0u);
+    assert(b.size() == blob_header_size);
+
+    b.resize(index_ofs + (sections * 16),0);
+    for (unsigned int id=1;id < BLOB_SEC_MAX;id++) {
+        const size_t ie = index_ofs + ((id - 1) * 16);
+        size_t start;
+
+        b.align(8);
+        start = b.size();
+        if (!blob_section(b,id)) {
+            fprintf(stderr,"Blob section %u build error\n",id);
+            return false;
+        }
+
+        b.set32(ie+0,id);
+        b.set32(ie+4,(uint32_t)start);
+        b.set32(ie+8,(uint32_t)(b.size() - start));
+        b.set32(ie+12,blob_checksum(b.data()+start,b.size() - start));
+    }
+    b.align(8);
+
+    b.set32(16,(uint32_t)b.size());
+    b.set32(20,blob_checksum(b.data()+blob_header_size,b.size()-blob_header_size));
+    return true;
+}
+
+bool write_blob_file(void) {
+    BlobWriter b;
+    FILE *fp;
+
+    if (!build_blob_image(b))
+        return false;
+
+    if ((fp=fopen(blobfile.c_str(),"wb")) == NULL) {
+        fprintf(stderr,"Unable to write file '%s', %s\n",blobfile.c_str(),strerror(errno));
+        return false;
+    }
+
+    if (fwrite(b.data(),b.size(),1,fp) != 1 || ferror(fp)) {
+        fprintf(stderr,"Error writing file '%s'\n",blobfile.c_str());
+        fclose(fp);
+        return false;
+    }
+
+    fclose(fp);
+    return true;
+}
+
+/* -combine: the source is read once per -march and the results merged into one opcode list and one
+ * set of decode tables. every decode entry refers to a list of alternatives, each with the mask of
+ * CPUs (bit = position in the -combine list) it applies to, so encodings that differ between CPUs
+ * (NEC V20 vs 386 on 64h/65h, Cyrix EMMI vs SSE) stay apart. */
+/* -interp: threaded interpreter skeleton. one handler per opcode and mod/reg/rm form (register or memory),
+ * operands already decoded from the destination and parameter list and passed to the user's OPCC_SEM_<name>()
+ * macro as OPCC_OPND_*() descriptors. dispatch is computed goto, or a plain switch with OPCC_INTERP_SWITCH. */
+std::string interp_ident(const std::string &s) {
+    std::string r;
+
+    for (const auto c : s) r += isalnum((unsigned char)c) ? (char)c : '_';
+    while (!r.empty() && r.back() == '_') r.pop_back();
+    return r;
+}
+
+std::string interp_type(const unsigned int type) {
+    const std::string r = interp_ident(regrmtype_str(type));
+
+    return r.empty() ? "none" : r;
+}
+
+/* shift of an immediate within opcc_window_insn.imm, by operand size then address size */
+std::string interp_imm_shift(const OpcodeSpec &op,const unsigned int var) {
+    unsigned int ofs[2][2] = {{0,0},{0,0}};
+    char tmp[128];
+
+    for (const auto &b : op.bytes) {
+        if (b.meaning != TOK_IMMEDIATE) continue;
+        if (b.var_assign == var) break;
+
+        const unsigned char sz = mem_size_code(b.immediate_type);
+
+        for (unsigned int o=0;o < 2;o++)
+            for (unsigned int a=0;a < 2;a++)
+                ofs[o][a] += immediate_is_offset(op,b.var_assign) ? (a ? 4u : 2u) : mem_size_bytes[sz][o];
+    }
+
+    if (ofs[0][0] == ofs[0][1] && ofs[0][0] == ofs[1][0] && ofs[0][0] == ofs[1][1])
+        sprintf(tmp,"%uu",ofs[0][0] * 8u);
+    else
+        sprintf(tmp,"(o32 ? (a32 ? %uu : %uu) : (a32 ? %uu : %uu))",ofs[1][1] * 8u,ofs[1][0] * 8u,ofs[0][1] * 8u,ofs[0][0] * 8u);
+
+    return tmp;
+}
+
+bool interp_is_immediate(const OpcodeSpec &op,const unsigned int var) {
+    if (var == 0) return false;
+    for (const auto &b : op.bytes)
+        if (b.meaning == TOK_IMMEDIATE && b.var_assign == var) return true;
+    return false;
+}
+
+std::string interp_operand(const OpcodeSpec &op,const SingleByteSpec &sb,const bool mem) {
+    const bool modrm = opcode_has_modrm(op);
+    const char *reg = modrm ? "(d.modrm >> 3u) & 7u" : "d.opbyte & 7u";
+    const char *rm = modrm ? "d.modrm & 7u" : "d.opbyte & 7u";
+    char tmp[256];
+
+    switch (sb.meaning) {
+        case TOK_RM:
+            if (mem) return "OPCC_OPND_MEM(" + interp_type(sb.rm_type) + ",ea)";
+            return "OPCC_OPND_REG(" + interp_type(sb.rm_type) + "," + rm + ")";
+        case TOK_REG:
+            return "OPCC_OPND_REG(" + interp_type(sb.reg_type) + "," + reg + ")";
+        case TOK_SREG:
+            return std::string("OPCC_OPND_SREG(") + reg + ")";
+        case TOK_CR:
+            return std::string("OPCC_OPND_CR(") + reg + ")";
+        case TOK_DR:
+            return std::string("OPCC_OPND_DR(") + reg + ")";
+        case TOK_TR:
+            return std::string("OPCC_OPND_TR(") + reg + ")";
+        case TOK_UINT:
+            sprintf(tmp,"OPCC_OPND_CONST(%lluu)",(unsigned long long)sb.intval);
+            return tmp;
+        case TOK_ST:
+        case TOK_MM:
+        case TOK_XMM: {
+            const std::string kind = sb.meaning == TOK_ST ? "ST" : (sb.meaning == TOK_MM ? "MM" : "XMM");
+
+            if (sb.fpu_st.type == TOK_RM && mem)
+                return "OPCC_OPND_MEM(" + std::string(sb.meaning == TOK_XMM ? "u128" : "u64") + ",ea)";
+            if (sb.fpu_st.type == TOK_RM)
+                return "OPCC_OPND_" + kind + "(" + rm + ")";
+            if (sb.fpu_st.type == TOK_REG)
+                return "OPCC_OPND_" + kind + "(" + reg + ")";
+            if (sb.fpu_st.type == TOK_IMPLIED)
+                return "OPCC_OPND_" + kind + "((" + reg + ") ^ 1u)";
+            if (sb.fpu_st.type == TOK_UINT) {
+                sprintf(tmp,"OPCC_OPND_%s(%lluu)",kind.c_str(),(unsigned long long)sb.fpu_st.intval.u);
+                return tmp;
+            }
+            return "OPCC_OPND_" + kind + "(0u)";
+        }
+        case TOK_MEMORY: {
+            static const char *src[MEM_SRC_MAX] = { "NONE", "MODRM", "STACK", "SI", "DI", "OFFSET", "OTHER" };
+
+            return "OPCC_OPND_MEMX(" + interp_type(sb.memory_type) + "," + src[mem_source_code(sb)] + ",d.imm)";
+        }
+        default:
+            break;
+    }
+
+    if (interp_is_immediate(op,sb.meaning)) {
+        for (const auto &b : op.bytes) {
+            if (b.meaning == TOK_IMMEDIATE && b.var_assign == sb.meaning)
+                return "OPCC_OPND_IMM(" + interp_type(b.immediate_type) + ",d.imm >> " + interp_imm_shift(op,sb.meaning) + ")";
+        }
+    }
+
+    return "OPCC_OPND_FIXED(" + interp_ident(tokentype_str[sb.meaning]) + ")";
+}
+
+void emit_interp_handler(FILE *fp,const OpcodeSpec &op,const size_t idx,const char form,const std::vector<unsigned int> &slots) {
+    const std::string sem = "OPCC_SEM_" + interp_ident(op.name);
+    std::vector<std::string> opnd;
+
+    if (op.destination.meaning != 0) opnd.push_back(interp_operand(op,op.destination,form == 'm'));
+    for (const auto &sb : op.param) opnd.push_back(interp_operand(op,sb,form == 'm'));
+
+    std::string desc;
+    for (const auto c : ((OpcodeSpec&)op).pretty_string())
+        if (c != ' ' || desc.empty() || desc.back() != ' ') desc += c;
+
+    fprintf(fp,"    /* %s %s%s */\n",op.name.c_str(),desc.c_str(),form == 'm' ? " (memory)" : (form == 'r' ? " (register)" : ""));
+    if (!op.reads.empty() || !op.writes.empty()) {
+        fprintf(fp,"    /*");
+        if (!op.reads.empty()) {
+            fprintf(fp," reads");
+            for (auto sb : op.reads) fprintf(fp," %s",sb.pretty_string().c_str());
+        }
+        if (!op.writes.empty()) {
+            fprintf(fp," writes");
+            for (auto sb : op.writes) fprintf(fp," %s",sb.pretty_string().c_str());
+        }
+        fprintf(fp," */\n");
+    }
+    fprintf(fp,"    OPCC_HANDLER(opcc_h_%zu_%c)",idx,form);
+    for (const auto s : slots) fprintf(fp," OPCC_CASE(%u)",s);
+    fprintf(fp," {\n");
+    if (form == 'm') {
+        fprintf(fp,"        const uint32_t ea = OPCC_INTERP_EA(s,&d,a32);\n");
+        fprintf(fp,"        (void)ea;\n");
+    }
+    fprintf(fp,"#if defined(%s)\n",sem.c_str());
+    fprintf(fp,"        %s(s,%zu",sem.c_str(),idx);
+    for (const auto &o : opnd) fprintf(fp,",%s",o.c_str());
+    fprintf(fp,");\n");
+    fprintf(fp,"#else\n");
+    fprintf(fp,"        OPCC_INTERP_UNIMPLEMENTED(s,%zu);\n",idx);
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"    OPCC_INTERP_NEXT();\n");
+    fprintf(fp,"\n");
+}
+
+bool write_interp_file(void) {
+    std::vector<std::string> label(opcodes.size() * 2u + 1u,"opcc_h_fault");
+    const unsigned int fault_slot = (unsigned int)(opcodes.size() * 2u);
+    FILE *fp;
+
+    if ((fp=fopen(interpfile.c_str(),"w")) == NULL) {
+        fprintf(stderr,"Unable to write file '%s', %s\n",interpfile.c_str(),strerror(errno));
+        return false;
+    }
+
+    fprintf(fp,"/* generated by opcc from '%s' for -march %s -fpuarch %s. do not edit. */\n",srcfile.c_str(),march.c_str(),fpuarch.c_str());
+    fprintf(fp,"/* threaded interpreter skeleton. include after the -o header of the same run, with OPCC_INTERP_SEMANTICS naming\n");
+    fprintf(fp," * the file that defines OPCC_INTERP_STATE, the hooks below and an OPCC_SEM_<name>(s,opcode,operands...) macro per\n");
+    fprintf(fp," * instruction. handlers without one call OPCC_INTERP_UNIMPLEMENTED. operands arrive as OPCC_OPND_*() descriptors,\n");
+    fprintf(fp," * destination first, and s, d (opcc_window_insn), o32 and a32 are in scope in every handler.\n");
+    fprintf(fp," *\n");
+    fprintf(fp," * hooks: OPCC_INTERP_DECODE(s,d) or OPCC_INTERP_FETCH(s) (16 readable bytes at the instruction pointer),\n");
+    fprintf(fp," *        OPCC_INTERP_SIZE_INDEX(s), OPCC_INTERP_ADVANCE(s,n), OPCC_INTERP_EA(s,d,a32), OPCC_INTERP_FAULT(s,d) */\n");
+    fprintf(fp,"#ifndef OPCC_INTERP_H\n");
+    fprintf(fp,"#define OPCC_INTERP_H\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"#if !defined(OPCC_GENERATED_H) || OPCC_OPCODE_COUNT != %zu\n",opcodes.size());
+    fprintf(fp,"#error include the opcc header generated with this skeleton first\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"#include OPCC_INTERP_SEMANTICS\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"#define OPCC_INTERP_NOT_IMPLEMENTED  (-4)\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"#if !defined(OPCC_INTERP_DECODE)\n");
+    fprintf(fp,"#define OPCC_INTERP_DECODE(s,d)      opcc_decode_window(OPCC_INTERP_FETCH(s),OPCC_INTERP_SIZE_INDEX(s),(d))\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"#if !defined(OPCC_INTERP_SIZE_INDEX)\n");
+    fprintf(fp,"#define OPCC_INTERP_SIZE_INDEX(s)    3u\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"#if !defined(OPCC_INTERP_ADVANCE)\n");
+    fprintf(fp,"#define OPCC_INTERP_ADVANCE(s,n)     ((void)0)\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"#if !defined(OPCC_INTERP_EA)\n");
+    fprintf(fp,"#define OPCC_INTERP_EA(s,d,a32)      ((uint32_t)(d)->disp)\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"#if !defined(OPCC_INTERP_FAULT)\n");
+    fprintf(fp,"#define OPCC_INTERP_FAULT(s,d)       return (d)->opcode\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"#if !defined(OPCC_INTERP_UNIMPLEMENTED)\n");
+    fprintf(fp,"#define OPCC_INTERP_UNIMPLEMENTED(s,op) return OPCC_INTERP_NOT_IMPLEMENTED\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"#if !defined(OPCC_INTERP_SWITCH) && !defined(__GNUC__)\n");
+    fprintf(fp,"#define OPCC_INTERP_SWITCH 1\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"#if defined(__GNUC__)\n");
+    fprintf(fp,"#define OPCC_INTERP_INLINE           inline __attribute__((always_inline))\n");
+    fprintf(fp,"#else\n");
+    fprintf(fp,"#define OPCC_INTERP_INLINE           inline\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* decode the next instruction and return its handler slot: opcode * 2 + 1 for mod == 3.\n");
+    fprintf(fp," * inlined into the tail of every handler so that each has its own indirect jump */\n");
+    fprintf(fp,"static OPCC_INTERP_INLINE unsigned int opcc_interp_fetch(OPCC_INTERP_STATE *s,opcc_window_insn *d,unsigned int *o32,unsigned int *a32) {\n");
+    fprintf(fp,"    const unsigned int size_index = OPCC_INTERP_SIZE_INDEX(s);\n");
+    fprintf(fp,"    const int r = OPCC_INTERP_DECODE(s,d);\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    (void)s;\n");
+    fprintf(fp,"    if (r < 0) return %uu;\n",fault_slot);
+    fprintf(fp,"    OPCC_INTERP_ADVANCE(s,d->length);\n");
+    fprintf(fp,"    *o32 = ((size_index >> 1u) ^ (d->prefix / OPCC_PS_OPSIZE)) & 1u;\n");
+    fprintf(fp,"    *a32 = (size_index ^ (d->prefix / OPCC_PS_ADDRSIZE)) & 1u;\n");
+    fprintf(fp,"    return ((unsigned int)r << 1u) | ((d->modrm >> 6u) == 3u ? 1u : 0u);\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"#if defined(OPCC_INTERP_SWITCH)\n");
+    fprintf(fp,"#define OPCC_HANDLER(l)\n");
+    fprintf(fp,"#define OPCC_CASE(n)                 case n:\n");
+    fprintf(fp,"#define OPCC_INTERP_NEXT()           { if (--steps == 0) return 0; continue; }\n");
+    fprintf(fp,"#else\n");
+    fprintf(fp,"#define OPCC_HANDLER(l)              l:\n");
+    fprintf(fp,"#define OPCC_CASE(n)\n");
+    fprintf(fp,"#define OPCC_INTERP_NEXT()           { if (--steps == 0) return 0; goto *opcc_interp_label[opcc_interp_fetch(s,&d,&o32,&a32)]; }\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* run steps instructions (at least one). returns 0, or whatever a fault or semantics macro returns */\n");
+    fprintf(fp,"static int opcc_interp_run(OPCC_INTERP_STATE *s,unsigned long steps) {\n");
+    fprintf(fp,"    opcc_window_insn d;\n");
+    fprintf(fp,"    unsigned int o32 = 0,a32 = 0;\n");
+
+    /* slot assignment */
+    std::vector< std::vector<unsigned int> > slots_r(opcodes.size()),slots_m(opcodes.size()),slots_x(opcodes.size());
+    for (size_t i=0;i < opcodes.size();i++) {
+        const auto &op = opcodes[i];
+        bool rm = false;
+
+        if (op.type == TOK_PREFIX) continue;
+        if (rm_operand_can_be_memory(op.destination)) rm = true;
+        for (const auto &sb : op.param) if (rm_operand_can_be_memory(sb)) rm = true;
+
+        if (rm && op.mod3 == 0) {
+            slots_m[i].push_back((unsigned int)(i * 2u));
+            slots_r[i].push_back((unsigned int)(i * 2u + 1u));
+        }
+        else if (rm && op.mod3 == 3) {
+            slots_r[i].push_back((unsigned int)(i * 2u));
+            slots_r[i].push_back((unsigned int)(i * 2u + 1u));
+        }
+        else if (rm) {
+            slots_m[i].push_back((unsigned int)(i * 2u));
+            slots_m[i].push_back((unsigned int)(i * 2u + 1u));
+        }
+        else {
+            slots_x[i].push_back((unsigned int)(i * 2u));
+            slots_x[i].push_back((unsigned int)(i * 2u + 1u));
+        }
+
+        for (const auto s : slots_m[i]) label[s] = "opcc_h_" + std::to_string(i) + "_m";
+        for (const auto s : slots_r[i]) label[s] = "opcc_h_" + std::to_string(i) + "_r";
+        for (const auto s : slots_x[i]) label[s] = "opcc_h_" + std::to_string(i) + "_x";
+    }
+
+    fprintf(fp,"#if !defined(OPCC_INTERP_SWITCH)\n");
+    fprintf(fp,"    static const void *const opcc_interp_label[%zu] = {\n",label.size());
+    for (size_t i=0;i < label.size();i++)
+        fprintf(fp,"%s&&%s%s%s",(i % 4) == 0 ? "        " : " ",label[i].c_str(),(i+1) < label.size() ? "," : "",((i % 4) == 3 || (i+1) == label.size()) ? "\n" : "");
+    fprintf(fp,"    };\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    if (steps == 0) return 0;\n");
+    fprintf(fp,"    goto *opcc_interp_label[opcc_interp_fetch(s,&d,&o32,&a32)];\n");
+    fprintf(fp,"#else\n");
+    fprintf(fp,"    if (steps == 0) return 0;\n");
+    fprintf(fp,"    for (;;) {\n");
+    fprintf(fp,"    switch (opcc_interp_fetch(s,&d,&o32,&a32)) {\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"\n");
+
+    for (size_t i=0;i < opcodes.size();i++) {
+        if (!slots_m[i].empty()) emit_interp_handler(fp,opcodes[i],i,'m',slots_m[i]);
+        if (!slots_r[i].empty()) emit_interp_handler(fp,opcodes[i],i,'r',slots_r[i]);
+        if (!slots_x[i].empty()) emit_interp_handler(fp,opcodes[i],i,'x',slots_x[i]);
+    }
+
+    fprintf(fp,"    /* did not decode, and prefixes which never reach dispatch */\n");
+    fprintf(fp,"    OPCC_HANDLER(opcc_h_fault)\n");
+    fprintf(fp,"#if defined(OPCC_INTERP_SWITCH)\n");
+    fprintf(fp,"    default:\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"    {\n");
+    fprintf(fp,"        OPCC_INTERP_FAULT(s,&d);\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"    OPCC_INTERP_NEXT();\n");
+    fprintf(fp,"#if defined(OPCC_INTERP_SWITCH)\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"#undef OPCC_HANDLER\n");
+    fprintf(fp,"#undef OPCC_CASE\n");
+    fprintf(fp,"#undef OPCC_INTERP_NEXT\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"#endif /* OPCC_INTERP_H */\n");
+
+    if (ferror(fp)) {
+        fprintf(stderr,"Error writing file '%s'\n",interpfile.c_str());
+        fclose(fp);
+        return false;
+    }
+
+    fclose(fp);
+    return true;
+}
+
+/* -recomp: C templates for a static recompiler. every opcode, mod/reg/rm form and operand/address size is
+ * lowered through the micro-op templates into a C block that a recompiler fills in with the decoded fields
+ * (opcc_recomp_insn()) and pastes into its output, one block per instruction, with OPCC_RC_* macros supplied
+ * by the runtime it compiles against. */
+class RecompVariant {
+public:
+    unsigned int                o32 = 0,a32 = 0;
+    std::vector<unsigned char>  imm_ofs,imm_len;        // immediates in instruction order
+    std::vector<bool>           imm_signed;
+    int                         moffs = -1;             // immediate that is the memory offset
+    std::map<unsigned char,std::string> fixed;          // fixed register slot -> name
+};
+
+unsigned int recomp_bits(const RecompVariant &v,const unsigned char size) {
+    return (unsigned int)mem_size_bytes[size][v.o32] * 8u;
+}
+
+/* fixed registers the recompiler keeps in the general, segment or flags registers */
+std::string recomp_fixed(const RecompVariant &v,const std::string &name,const bool lvalue) {
+    static const char *r8[8] = { "AL", "CL", "DL", "BL", "AH", "CH", "DH", "BH" };
+    static const char *r16[8] = { "AX", "CX", "DX", "BX", "SP", "BP", "SI", "DI" };
+    static const char *r32[8] = { "EAX", "ECX", "EDX", "EBX", "ESP", "EBP", "ESI", "EDI" };
+    static const char *rv[8] = { "AV", "CV", "DV", "BV", "SPV", "BPV", "SIV", "DIV" };
+    static const char *sr[6] = { "ES", "CS", "SS", "DS", "FS", "GS" };
+    char tmp[64];
+
+    for (unsigned int i=0;i < 8;i++) {
+        if (name == r8[i])  { sprintf(tmp,"OPCC_RC_REG8(%u)",i); return tmp; }
+        if (name == r16[i]) { sprintf(tmp,"OPCC_RC_REG16(%u)",i); return tmp; }
+        if (name == r32[i]) { sprintf(tmp,"OPCC_RC_REG32(%u)",i); return tmp; }
+        /* string and stack pointers follow the address size, the rest the operand size */
+        if (name == rv[i])  { sprintf(tmp,"OPCC_RC_REG%u(%u)",((i >= 4) ? v.a32 : v.o32) ? 32u : 16u,i); return tmp; }
+    }
+    for (unsigned int i=0;i < 6;i++)
+        if (name == sr[i]) { sprintf(tmp,"OPCC_RC_SREG(%u)",i); return tmp; }
+    if (name == "IPV" && !lvalue) return v.o32 ? "$N" : "$n";
+
+    return "OPCC_RC_" + name;
+}
+
+/* value of a slot, or the address of a memory slot */
+std::string recomp_slot(const RecompVariant &v,const unsigned char slot,const unsigned char size,const uint16_t aux,const bool lvalue) {
+    const unsigned int bits = recomp_bits(v,size);
+    char tmp[128];
+
+    switch (slot) {
+        case UOPR_T0: return "t0";
+        case UOPR_T1: return "t1";
+        case UOPR_T2: return "t2";
+        case UOPR_T3: return "t3";
+        case UOPR_TS: return "ts";
+        case UOPR_REG:   sprintf(tmp,"OPCC_RC_REG%u($R)",bits); return tmp;
+        case UOPR_RM:    sprintf(tmp,"OPCC_RC_REG%u($M)",bits); return tmp;
+        case UOPR_OPREG: sprintf(tmp,"OPCC_RC_REG%u($O)",bits); return tmp;
+        case UOPR_EA:    return v.a32 ? "$E" : "$e";
+        case UOPR_ADDR_SI:      return v.a32 ? "OPCC_RC_ADDR_SI32($S)" : "OPCC_RC_ADDR_SI16($S)";
+        case UOPR_ADDR_DI:      return v.a32 ? "OPCC_RC_ADDR_DI32()" : "OPCC_RC_ADDR_DI16()";
+        case UOPR_ADDR_STACK:   return v.a32 ? "OPCC_RC_ADDR_SP32()" : "OPCC_RC_ADDR_SP16()";
+        case UOPR_ADDR_OTHER:   return "OPCC_RC_ADDR_OTHER($S)";
+        case UOPR_ADDR_MOFFS:
+            if (v.moffs < 0) return "OPCC_RC_ADDR_OTHER($S)";
+            sprintf(tmp,"OPCC_RC_ADDR_MOFFS($S,$I%u%u)",v.imm_ofs[(size_t)v.moffs],v.imm_len[(size_t)v.moffs]);
+            return tmp;
+        case UOPR_IMM0:
+        case UOPR_IMM1: {
+            const size_t i = slot - UOPR_IMM0;
+
+            if (i >= v.imm_ofs.size()) return "0u";
+            if (v.imm_signed[i] && v.imm_len[i] < 4u)
+                sprintf(tmp,"(uint32_t)(int32_t)(int%u_t)$I%u%u",v.imm_len[i] * 8u,v.imm_ofs[i],v.imm_len[i]);
+            else
+                sprintf(tmp,"$I%u%u",v.imm_ofs[i],v.imm_len[i]);
+            return tmp;
+        }
+        case UOPR_TARGET:
+            if (v.imm_ofs.empty()) return "0u";
+            sprintf(tmp,"$%c%u",v.o32 ? 'T' : 't',v.imm_len[0]);
+            return tmp;
+        case UOPR_CONST:    sprintf(tmp,"%uu",aux); return tmp;
+        case UOPR_SREG:     return "OPCC_RC_SREG($R)";
+        case UOPR_CR:       return "OPCC_RC_CR($R)";
+        case UOPR_DR:       return "OPCC_RC_DR($R)";
+        case UOPR_TR:       return "OPCC_RC_TR($R)";
+        case UOPR_MM_REG:   return "OPCC_RC_MM($R)";
+        case UOPR_MM_RM:    return "OPCC_RC_MM($M)";
+        case UOPR_MM_IMPLIED: return "OPCC_RC_MM($R ^ 1u)";
+        /* x87 and XMM registers are passed by number, the operation macro reaches them itself */
+        case UOPR_ST:       sprintf(tmp,"%uu",aux); return tmp;
+        case UOPR_ST_RM:    return "$M";
+        case UOPR_XMM_REG:  return "$R";
+        case UOPR_XMM_RM:   return "$M";
+        case UOPR_FLAGS:    return "OPCC_RC_FLAGS";
+        default:
+            break;
+    }
+
+    auto f = v.fixed.find(slot);
+    if (f != v.fixed.end()) {
+        if (f->second == "XMM" || f->second == "MM") {
+            sprintf(tmp,"%uu",aux);
+            return tmp;
+        }
+        return recomp_fixed(v,f->second,lvalue);
+    }
+
+    return "0u";
+}
+
+bool recomp_by_number(const unsigned char slot) {
+    return slot == UOPR_ST || slot == UOPR_ST_RM || slot == UOPR_XMM_REG || slot == UOPR_XMM_RM;
+}
+
+bool recomp_is_address(const unsigned char slot) {
+    return slot == UOPR_EA || (slot >= UOPR_ADDR_SI && slot <= UOPR_ADDR_OTHER);
+}
+
+std::string recomp_block(const OpcodeSpec &op,const size_t idx,const std::vector<MicroOp> &u,const RecompVariant &v) {
+    const std::string name = interp_ident(op.name);
+    std::vector<unsigned char> addr;                    // address slots, computed once ahead of everything
+    std::string decl,body,target = "0u";
+    bool wide = false,ip = false,temp[UOPR_TS+1] = { false };
+    unsigned int exec_bits = v.o32 ? 32u : 16u;
+    char tmp[256];
+
+    if (u.empty()) {
+        sprintf(tmp,"OPCC_RC_UNIMPLEMENTED(%zu,$N);",idx);
+        return tmp;
+    }
+
+    auto addr_var = [&addr](const unsigned char slot) {
+        for (size_t i=0;i < addr.size();i++)
+            if (addr[i] == slot) return "a" + std::to_string(i);
+        addr.push_back(slot);
+        return "a" + std::to_string(addr.size() - 1u);
+    };
+
+    /* operand size of the operation: destination, else the first sized source, else what the result is stored
+     * as (STOS, INS). branches go by operand size */
+    {
+        bool sized = false;
+
+        for (const auto &m : u) {
+            if (op.branch_type != 0) break;
+            if ((m.op == UOP_GET || m.op == UOP_LOAD) && m.size != MEM_SIZE_NONE && mem_size_bytes[m.size][v.o32] <= 8u) {
+                exec_bits = recomp_bits(v,m.size);
+                sized = true;
+                if (m.dst == UOPR_T0) break;
+            }
+        }
+        for (const auto &m : u) {
+            if (sized || op.branch_type != 0) break;
+            if ((m.op == UOP_PUT || m.op == UOP_STORE) && m.src == UOPR_T0 && m.size != MEM_SIZE_NONE && mem_size_bytes[m.size][v.o32] <= 8u) {
+                exec_bits = recomp_bits(v,m.size);
+                break;
+            }
+        }
+    }
+
+    for (const auto &m : u) {
+        const unsigned int bits = recomp_bits(v,m.size);
+
+        if (m.dst <= UOPR_TS) temp[m.dst] = true;
+        if (m.src <= UOPR_TS) temp[m.src] = true;
+        if (bits > 32u && bits <= 64u) wide = true;
+
+        switch (m.op) {
+            case UOP_GET:
+                if (recomp_is_address(m.src))
+                    body += " " + recomp_slot(v,m.dst,0,0,true) + " = " + addr_var(m.src) + ";";
+                else
+                    body += " " + recomp_slot(v,m.dst,0,0,true) + " = " + recomp_slot(v,m.src,m.size,m.aux,false) + ";";
+                break;
+            case UOP_PUT:
+                if (recomp_by_number(m.dst)) break;
+                if (op.branch_type != 0 && v.fixed.count(m.dst) && v.fixed.find(m.dst)->second == "IPV") {
+                    /* RET and IRET: the popped instruction pointer is the branch target */
+                    body += " ip = " + recomp_slot(v,m.src,0,0,false) + ";";
+                    target = "ip";
+                    ip = true;
+                    break;
+                }
+                body += " " + recomp_slot(v,m.dst,m.size,m.aux,true) + " = " + recomp_slot(v,m.src,0,0,false) + ";";
+                break;
+            case UOP_LOAD:
+                if (bits != 8u && bits != 16u && bits != 32u && bits != 64u) {
+                    body += " " + recomp_slot(v,m.dst,0,0,true) + " = " + addr_var(m.src) + ";";
+                }
+                else {
+                    sprintf(tmp," %s = OPCC_RC_RD%u(%s);",recomp_slot(v,m.dst,0,0,true).c_str(),bits,addr_var(m.src).c_str());
+                    body += tmp;
+                }
+                break;
+            case UOP_STORE:
+                if (bits != 8u && bits != 16u && bits != 32u && bits != 64u) break;
+                sprintf(tmp," OPCC_RC_WR%u(%s,%s);",bits,addr_var(m.dst).c_str(),recomp_slot(v,m.src,0,0,false).c_str());
+                body += tmp;
+                break;
+            case UOP_PUSH:
+                sprintf(tmp," OPCC_RC_PUSH%u(%s);",v.o32 ? 32u : 16u,recomp_slot(v,m.src,0,0,false).c_str());
+                body += tmp;
+                break;
+            case UOP_POP:
+                sprintf(tmp," %s = OPCC_RC_POP%u();",recomp_slot(v,m.dst,0,0,true).c_str(),v.o32 ? 32u : 16u);
+                body += tmp;
+                break;
+            case UOP_EXEC: {
+                unsigned int last = UOPR_NONE;
+
+                for (unsigned int t=UOPR_T1;t <= UOPR_T3;t++)
+                    if (temp[t]) last = t;
+
+                /* a result stored as something other than 8/16/32/64 bits (SGDT, FXSAVE) is written by the
+                 * operation itself, through the address it gets in the destination */
+                for (const auto &s : u) {
+                    const unsigned int sbits = recomp_bits(v,s.size);
+
+                    if (s.op == UOP_STORE && sbits != 8u && sbits != 16u && sbits != 32u && sbits != 64u)
+                        body += " " + recomp_slot(v,s.src,0,0,true) + " = " + addr_var(s.dst) + ";";
+                }
+
+                sprintf(tmp," OPCC_RC_OP_%s(%u",name.c_str(),exec_bits);
+                body += tmp;
+                if (op.branch_type != 0) {
+                    for (const auto &b : u) {
+                        if (b.op != UOP_BRANCH || b.src == UOPR_NONE) continue;
+                        target = recomp_slot(v,b.src,0,0,false);
+                        /* relative targets as the constant itself */
+                        for (const auto &g : u)
+                            if (g.op == UOP_GET && g.dst == b.src && g.src == UOPR_TARGET) target = recomp_slot(v,g.src,0,0,false);
+                    }
+                    body += std::string(",") + (v.o32 ? "$N" : "$n") + "," + target;
+                }
+                if (m.dst == UOPR_T0) body += ",t0";
+                for (unsigned int t=UOPR_T1;t <= last;t++) body += ",t" + std::to_string(t - UOPR_T0);
+                body += ");";
+                break;
+            }
+            case UOP_FSTACK:
+                body += (m.aux == 1u) ? " OPCC_RC_FPUSH();" : " OPCC_RC_FPOP();";
+                break;
+            default:
+                /* USE, CLOBBER and the flags are the operation macro's business, BRANCH is the target
+                 * (already a source) and next instruction pointer passed to it */
+                break;
+        }
+    }
+
+    /* string operations step SI and DI by the element size, down if DF is set */
+    for (const unsigned char slot : { UOPR_ADDR_SI, UOPR_ADDR_DI }) {
+        unsigned int bytes = 0;
+
+        for (const auto &m : u) {
+            if ((m.op == UOP_LOAD && m.src == slot) || (m.op == UOP_STORE && m.dst == slot))
+                bytes = recomp_bits(v,m.size) / 8u;
+        }
+        if (bytes == 0u) continue;
+
+        sprintf(tmp," OPCC_RC_REG%u(%u) += (OPCC_RC_FLAGS & 0x400u) ? -%u : %u;",v.a32 ? 32u : 16u,slot == UOPR_ADDR_SI ? 6u : 7u,bytes,bytes);
+        body += tmp;
+    }
+
+    for (size_t i=0;i < addr.size();i++) {
+        decl += " const uint32_t a" + std::to_string(i) + " = " + recomp_slot(v,addr[i],0,0,false) + ";";
+    }
+    {
+        std::string t;
+
+        for (unsigned int i=UOPR_T0;i <= UOPR_TS;i++) {
+            if (!temp[i]) continue;
+            t += t.empty() ? " " : ",";
+            t += recomp_slot(v,(unsigned char)i,0,0,true);
+        }
+        if (!t.empty()) decl += std::string(wide ? " uint64_t" : " uint32_t") + t + ";";
+        if (ip) decl += " uint32_t ip;";
+    }
+
+    return "{" + decl + body + " }";
+}
+
+/* REP loop around a string operation's block, counting CX or ECX down explicitly. the compares (CMPS, SCAS) also
+ * stop on ZF, $Z being the value REPZ (1) or REPNZ (0) keeps going on. empty if the block is no string operation */
+std::string recomp_rep_block(const std::string &block,const std::vector<MicroOp> &u,const RecompVariant &v) {
+    const std::string cx = v.a32 ? "OPCC_RC_REG32(1)" : "OPCC_RC_REG16(1)";
+    bool str = false,cmp = false;
+
+    for (const auto &m : u) {
+        if (m.op == UOP_LOAD && (m.src == UOPR_ADDR_SI || m.src == UOPR_ADDR_DI)) str = true;
+        if (m.op == UOP_STORE && (m.dst == UOPR_ADDR_SI || m.dst == UOPR_ADDR_DI)) str = true;
+        if (m.op == UOP_WFLAGS && (m.aux & 0x0040u)) cmp = true;
+    }
+    if (!str) return std::string();
+
+    return "while (" + cx + " != 0u) { " + block + " " + cx + "--;" +
+        (cmp ? " if (((OPCC_RC_FLAGS >> 6u) & 1u) != $Z) break;" : "") + " }";
+}
+
+bool write_recomp_file(void) {
+    std::map<std::string,uint32_t> text_ofs;
+    std::vector<uint32_t> tmpl(opcodes.size() * 8u,0);
+    std::vector<uint32_t> rep_tmpl(opcodes.size() * 4u,0);
+    std::string text;
+    std::vector<MicroOp> u;
+    UopLowering lw;
+    FILE *fp;
+
+    text.push_back((char)0);                            // offset 0 is the empty template
+    text_ofs[""] = 0;
+
+    auto intern = [&text,&text_ofs](const std::string &s) {
+        auto t = text_ofs.find(s);
+
+        if (t != text_ofs.end()) return t->second;
+        text_ofs[s] = (uint32_t)text.size();
+        text += s;
+        text.push_back((char)0);
+        return text_ofs[s];
+    };
+
+    for (size_t i=0;i < opcodes.size();i++) {
+        const auto &op = opcodes[i];
+        bool rm = false;
+
+        if (op.type == TOK_PREFIX) continue;
+        if (op.destination.meaning != 0 && rm_operand_can_be_memory(op.destination)) rm = true;
+        for (const auto &sb : op.param) if (rm_operand_can_be_memory(sb)) rm = true;
+
+        for (unsigned int form=0;form < 2;form++) {
+            bool mem = rm && (form == 0);
+            if (rm && op.mod3 == 3) mem = false;
+            if (rm && op.mod3 == -3) mem = true;
+
+            if (!lw.lower(op,mem,u)) u.clear();
+
+            for (unsigned int si=0;si < 4;si++) {
+                RecompVariant v;
+                unsigned int ofs = 0;
+
+                v.o32 = (si >> 1u) & 1u;
+                v.a32 = si & 1u;
+                for (const auto &f : lw.fixed) v.fixed[f.second] = f.first;
+                for (const auto &b : op.bytes) {
+                    if (b.meaning != TOK_IMMEDIATE) continue;
+
+                    const unsigned int len = immediate_is_offset(op,b.var_assign) ? (v.a32 ? 4u : 2u) : mem_size_bytes[mem_size_code(b.immediate_type)][v.o32];
+
+                    if (immediate_is_offset(op,b.var_assign)) v.moffs = (int)v.imm_ofs.size();
+                    v.imm_ofs.push_back((unsigned char)ofs);
+                    v.imm_len.push_back((unsigned char)len);
+                    v.imm_signed.push_back(is_signed_type(b.immediate_type));
+                    ofs += len;
+                }
+
+                const std::string s = recomp_block(op,i,u,v);
+
+                tmpl[(i * 8u) + (form * 4u) + si] = intern(s);
+                if (form == 0) rep_tmpl[(i * 4u) + si] = intern(recomp_rep_block(s,u,v));
+            }
+        }
+    }
+
+    if ((fp=fopen(recompfile.c_str(),"w")) == NULL) {
+        fprintf(stderr,"Unable to write file '%s', %s\n",recompfile.c_str(),strerror(errno));
+        return false;
+    }
+
+    fprintf(fp,"/* generated by opcc from '%s' for -march %s -fpuarch %s. do not edit. */\n",srcfile.c_str(),march.c_str(),fpuarch.c_str());
+    fprintf(fp,"/* static recompiler templates. include after the -o header of the same run. opcc_recomp_insn() turns one decoded\n");
+    fprintf(fp," * instruction into a C block for the recompiler's output, written against these macros of its runtime:\n");
+    fprintf(fp," *\n");
+    fprintf(fp," *   OPCC_RC_REG8/16/32/64(n), OPCC_RC_SREG(n), OPCC_RC_CR/DR/TR(n), OPCC_RC_MM(n), OPCC_RC_FLAGS   registers, as lvalues\n");
+    fprintf(fp," *   OPCC_RC_RD8/16/32/64(a), OPCC_RC_WR8/16/32/64(a,v)                                        memory\n");
+    fprintf(fp," *   OPCC_RC_EA16(seg,mod,rm,disp), OPCC_RC_EA32(seg,modrm,sib,disp)                            mod/reg/rm address\n");
+    fprintf(fp," *   OPCC_RC_ADDR_SI16/32(seg), OPCC_RC_ADDR_DI16/32(), OPCC_RC_ADDR_SP16/32(),\n");
+    fprintf(fp," *   OPCC_RC_ADDR_MOFFS(seg,ofs), OPCC_RC_ADDR_OTHER(seg)                                       implied addresses\n");
+    fprintf(fp," *   OPCC_RC_PUSH16/32(v), OPCC_RC_POP16/32(), OPCC_RC_FPUSH(), OPCC_RC_FPOP()                  stacks\n");
+    fprintf(fp," *   OPCC_RC_OP_<name>(bits,[next,target,]dest,sources...)  the operation. branches also get the next instruction\n");
+    fprintf(fp," *                                       pointer and the target: a constant for relative branches, ready for a\n");
+    fprintf(fp," *                                       goto, else the r/m operand or popped return address (0 if neither)\n");
+    fprintf(fp," *   OPCC_RC_UNIMPLEMENTED(opcode,next)                  anything that does not lower\n");
+    fprintf(fp," *\n");
+    fprintf(fp," * seg is an OPCC_SEG_* override, OPCC_SEG_NONE for the default. x87 and XMM registers, and memory operands that\n");
+    fprintf(fp," * are not 8, 16, 32 or 64 bits wide, reach the operation macro as register numbers and addresses. string operations step SI/DI themselves\n");
+    fprintf(fp," * and their REP loops count CX/ECX down, reading DF and ZF from OPCC_RC_FLAGS, which must be current there. */\n");
+    fprintf(fp,"#ifndef OPCC_RECOMP_H\n");
+    fprintf(fp,"#define OPCC_RECOMP_H\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"#if !defined(OPCC_GENERATED_H) || OPCC_OPCODE_COUNT != %zu\n",opcodes.size());
+    fprintf(fp,"#error include the opcc header generated with these templates first\n");
+    fprintf(fp,"#endif\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* templates, NUL separated. $R $M $O: reg, rm and opcode register fields, $e $E: 16 and 32-bit mod/reg/rm\n");
+    fprintf(fp," * address, $S: segment override, $Iol: immediate bytes o..o+l-1, $n $N: next instruction pointer (16 and 32-bit),\n");
+    fprintf(fp," * $tl $Tl: relative branch target from the l byte immediate, $Z: 1 for REPZ, 0 for REPNZ */\n");
+    fprintf(fp,"static const char opcc_recomp_text[%zu] =\n",text.size());
+    {
+        size_t i = 0;
+
+        while (i < text.size()) {
+            const size_t e = text.find((char)0,i);
+
+            fprintf(fp,"    ");
+            emit_c_string(fp,text.substr(i,e - i));
+            fprintf(fp,"%s\n",(e + 1u) < text.size() ? " \"\\0\"" : ";");
+            i = e + 1u;
+        }
+    }
+    fprintf(fp,"\n");
+    fprintf(fp,"/* [opcode][mod == 3][OPCC_SIZE_INDEX(o32,a32)] -> offset in opcc_recomp_text */\n");
+    fprintf(fp,"static const %s opcc_recomp_template[OPCC_OPCODE_COUNT][2][4] = {\n",text.size() > 0xFFFFu ? "uint32_t" : "uint16_t");
+    for (size_t i=0;i < opcodes.size();i++) {
+        fprintf(fp,"    {");
+        for (unsigned int f=0;f < 2;f++) {
+            fprintf(fp," {");
+            for (unsigned int s=0;s < 4;s++) fprintf(fp," %6u%s",tmpl[(i * 8u) + (f * 4u) + s],s < 3 ? "," : "");
+            fprintf(fp," }%s",f == 0 ? "," : "");
+        }
+        fprintf(fp," }%s /* %4zu %s */\n",(i+1) < opcodes.size() ? "," : " ",i,opcodes[i].name.c_str());
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* [opcode][OPCC_SIZE_INDEX(o32,a32)] -> offset of the REP loop of a string operation, 0 for the rest */\n");
+    fprintf(fp,"static const %s opcc_recomp_rep_template[OPCC_OPCODE_COUNT][4] = {\n",text.size() > 0xFFFFu ? "uint32_t" : "uint16_t");
+    for (size_t i=0;i < opcodes.size();i++) {
+        fprintf(fp,"    {");
+        for (unsigned int s=0;s < 4;s++) fprintf(fp," %6u%s",rep_tmpl[(i * 4u) + s],s < 3 ? "," : "");
+        fprintf(fp," }%s /* %4zu %s */\n",(i+1) < opcodes.size() ? "," : " ",i,opcodes[i].name.c_str());
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"static inline size_t opcc_recomp_put(char *buf,size_t size,size_t n,const char *s) {\n");
+    fprintf(fp,"    for (;*s;s++,n++)\n");
+    fprintf(fp,"        if ((n + 1u) < size) buf[n] = *s;\n");
+    fprintf(fp,"    return n;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* C hex constant, unsigned unless negative */\n");
+    fprintf(fp,"static inline size_t opcc_recomp_put_num(char *buf,size_t size,size_t n,int64_t v) {\n");
+    fprintf(fp,"    char tmp[24];\n");
+    fprintf(fp,"    uint64_t u = (v < 0) ? (0u - (uint64_t)v) : (uint64_t)v;\n");
+    fprintf(fp,"    unsigned int i = sizeof(tmp);\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    tmp[--i] = 0;\n");
+    fprintf(fp,"    if (v >= 0) tmp[--i] = 'u';\n");
+    fprintf(fp,"    do { tmp[--i] = \"0123456789abcdef\"[u & 0xFu]; u >>= 4u; } while (u != 0u);\n");
+    fprintf(fp,"    tmp[--i] = 'x';\n");
+    fprintf(fp,"    tmp[--i] = '0';\n");
+    fprintf(fp,"    if (v < 0) tmp[--i] = '-';\n");
+    fprintf(fp,"    return opcc_recomp_put(buf,size,n,tmp + i);\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"static inline int64_t opcc_recomp_sext(uint64_t v,unsigned int len) {\n");
+    fprintf(fp,"    const unsigned int s = 64u - (len * 8u);\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    return (len == 0u || len >= 8u) ? (int64_t)v : (int64_t)(v << s) >> s;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* fill in a template for the instruction at ip. writes at most size bytes including the NUL and, like snprintf,\n");
+    fprintf(fp," * returns the length the whole block needs. no allocation */\n");
+    fprintf(fp,"static inline size_t opcc_recomp_expand(char *buf,size_t size,const char *t,const opcc_window_insn *d,uint32_t ip) {\n");
+    fprintf(fp,"    const uint32_t next = ip + d->length;\n");
+    fprintf(fp,"    const unsigned int seg = d->prefix & OPCC_PS_SEG_MASK;\n");
+    fprintf(fp,"    size_t n = 0;\n");
+    fprintf(fp,"    char tmp[64];\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    for (;*t;t++) {\n");
+    fprintf(fp,"        if (*t != '$') {\n");
+    fprintf(fp,"            if ((n + 1u) < size) buf[n] = *t;\n");
+    fprintf(fp,"            n++;\n");
+    fprintf(fp,"            continue;\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"        switch (*++t) {\n");
+    fprintf(fp,"            case 'R': n = opcc_recomp_put_num(buf,size,n,(d->modrm >> 3u) & 7u); break;\n");
+    fprintf(fp,"            case 'M': n = opcc_recomp_put_num(buf,size,n,d->modrm & 7u); break;\n");
+    fprintf(fp,"            case 'O': n = opcc_recomp_put_num(buf,size,n,d->opbyte & 7u); break;\n");
+    fprintf(fp,"            case 'S': n = opcc_recomp_put_num(buf,size,n,seg); break;\n");
+    fprintf(fp,"            case 'Z': n = opcc_recomp_put_num(buf,size,n,OPCC_PS_REP(d->prefix) == OPCC_REP_Z ? 1 : 0); break;\n");
+    fprintf(fp,"            case 'n': n = opcc_recomp_put_num(buf,size,n,next & 0xFFFFu); break;\n");
+    fprintf(fp,"            case 'N': n = opcc_recomp_put_num(buf,size,n,next); break;\n");
+    fprintf(fp,"            case 'e':\n");
+    fprintf(fp,"            case 'E':\n");
+    fprintf(fp,"                n = opcc_recomp_put(buf,size,n,*t == 'e' ? \"OPCC_RC_EA16(\" : \"OPCC_RC_EA32(\");\n");
+    fprintf(fp,"                n = opcc_recomp_put_num(buf,size,n,seg);\n");
+    fprintf(fp,"                n = opcc_recomp_put(buf,size,n,\",\");\n");
+    fprintf(fp,"                if (*t == 'e') {\n");
+    fprintf(fp,"                    n = opcc_recomp_put_num(buf,size,n,d->modrm >> 6u);\n");
+    fprintf(fp,"                    n = opcc_recomp_put(buf,size,n,\",\");\n");
+    fprintf(fp,"                    n = opcc_recomp_put_num(buf,size,n,d->modrm & 7u);\n");
+    fprintf(fp,"                }\n");
+    fprintf(fp,"                else {\n");
+    fprintf(fp,"                    n = opcc_recomp_put_num(buf,size,n,d->modrm);\n");
+    fprintf(fp,"                    n = opcc_recomp_put(buf,size,n,\",\");\n");
+    fprintf(fp,"                    n = opcc_recomp_put_num(buf,size,n,d->sib);\n");
+    fprintf(fp,"                }\n");
+    fprintf(fp,"                n = opcc_recomp_put(buf,size,n,\",\");\n");
+    fprintf(fp,"                n = opcc_recomp_put_num(buf,size,n,d->disp);\n");
+    fprintf(fp,"                n = opcc_recomp_put(buf,size,n,\")\");\n");
+    fprintf(fp,"                break;\n");
+    fprintf(fp,"            case 'I': {\n");
+    fprintf(fp,"                const unsigned int o = (unsigned int)(t[1] - '0'),l = (unsigned int)(t[2] - '0');\n");
+    fprintf(fp,"                uint64_t v = d->imm >> (o * 8u);\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"                if (l < 8u) v &= (((uint64_t)1u) << (l * 8u)) - 1u;\n");
+    fprintf(fp,"                n = opcc_recomp_put_num(buf,size,n,(int64_t)v);\n");
+    fprintf(fp,"                t += 2;\n");
+    fprintf(fp,"                break;\n");
+    fprintf(fp,"            }\n");
+    fprintf(fp,"            case 't':\n");
+    fprintf(fp,"            case 'T': {\n");
+    fprintf(fp,"                uint32_t v = next + (uint32_t)opcc_recomp_sext(d->imm,(unsigned int)(t[1] - '0'));\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"                if (*t == 't') v &= 0xFFFFu;\n");
+    fprintf(fp,"                n = opcc_recomp_put_num(buf,size,n,v);\n");
+    fprintf(fp,"                t++;\n");
+    fprintf(fp,"                break;\n");
+    fprintf(fp,"            }\n");
+    fprintf(fp,"            default:\n");
+    fprintf(fp,"                tmp[0] = *t;\n");
+    fprintf(fp,"                tmp[1] = 0;\n");
+    fprintf(fp,"                n = opcc_recomp_put(buf,size,n,tmp);\n");
+    fprintf(fp,"                if (*t == 0) t--;\n");
+    fprintf(fp,"                break;\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    if (size != 0u) buf[(n < size) ? n : (size - 1u)] = 0;\n");
+    fprintf(fp,"    return n;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* C block for an instruction decoded at ip with the code segment's default size (OPCC_SIZE_INDEX). string\n");
+    fprintf(fp," * operations under REPZ or REPNZ get their REP loop, both prefixes repeating those that do not compare */\n");
+    fprintf(fp,"static inline size_t opcc_recomp_insn(char *buf,size_t size,const opcc_window_insn *d,uint32_t ip,unsigned int size_index) {\n");
+    fprintf(fp,"    const unsigned int o32 = ((size_index >> 1u) ^ (d->prefix / OPCC_PS_OPSIZE)) & 1u;\n");
+    fprintf(fp,"    const unsigned int a32 = (size_index ^ (d->prefix / OPCC_PS_ADDRSIZE)) & 1u;\n");
+    fprintf(fp,"    const unsigned int rep = OPCC_PS_REP(d->prefix);\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    if (d->opcode < 0 || d->opcode >= OPCC_OPCODE_COUNT) {\n");
+    fprintf(fp,"        if (size != 0u) buf[0] = 0;\n");
+    fprintf(fp,"        return 0;\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    if ((rep == OPCC_REP_Z || rep == OPCC_REP_NZ) && opcc_recomp_rep_template[d->opcode][OPCC_SIZE_INDEX(o32,a32)] != 0u)\n");
+    fprintf(fp,"        return opcc_recomp_expand(buf,size,opcc_recomp_text + opcc_recomp_rep_template[d->opcode][OPCC_SIZE_INDEX(o32,a32)],d,ip);\n");
+    fprintf(fp,"    return opcc_recomp_expand(buf,size,opcc_recomp_text +\n");
+    fprintf(fp,"        opcc_recomp_template[d->opcode][(d->modrm >> 6u) == 3u ? 1 : 0][OPCC_SIZE_INDEX(o32,a32)],d,ip);\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"#endif /* OPCC_RECOMP_H */\n");
+
+    if (ferror(fp)) {
+        fprintf(stderr,"Error writing file '%s'\n",recompfile.c_str());
+        fclose(fp);
+        return false;
+    }
+
+    fclose(fp);
+    return true;
+}
+
+/* -disasm: linear sweep disassembly of a flat binary, run on the tables built for this -march. decoding follows
+ * opcc_decode_window32() and the text is opcc_format_insn() of opcc_format.h itself, so the output is what a
+ * program using the -o header would print. the file is mapped and cut into one chunk per thread. a worker starts at the first byte of its
+ * chunk, which may be inside an instruction, decodes to the end and then on into the following chunk until it
+ * lands on an instruction start of that chunk's worker. from there on both streams agree, so the output is each
+ * worker's lines from where the previous one converged, written in chunk order. */
+const size_t disasm_chunk_min = 64 * 1024;          // no point in a thread for less
+const unsigned int disasm_hex_bytes = 8;            // bytes column width, longer instructions push the text right
+
+class DisasmInsn {
+public:
+    int                         opcode = -1;
+    uint32_t                    prefix = 0;         // prefix_state_*
+    unsigned char               length = 0;
+    unsigned char               modrm = 0;          // 0 if none, check modrm_len
+    unsigned char               sib = 0;
+    unsigned char               modrm_len = 0;      // mod/reg/rm, SIB and displacement bytes
+    unsigned char               imm_len = 0;
+    unsigned char               opbyte = 0;         // last opcode byte
+    int32_t                     disp = 0;
+    uint64_t                    imm = 0;
+};
+
+/* the formatter of the -o header (opcc_format.h), compiled here against the tables of this run under the names
+ * the header gives them */
+namespace disasm_fmt {
+    typedef DisasmInsn opcc_window_insn;
+
+    const unsigned int OPCC_FMT_REG = FMT_REG, OPCC_FMT_RM = FMT_RM, OPCC_FMT_OPREG = FMT_OPREG, OPCC_FMT_GPR = FMT_GPR,
+        OPCC_FMT_SREG = FMT_SREG, OPCC_FMT_SREGN = FMT_SREGN, OPCC_FMT_CR = FMT_CR, OPCC_FMT_DR = FMT_DR,
+        OPCC_FMT_TR = FMT_TR, OPCC_FMT_CONST = FMT_CONST, OPCC_FMT_ST = FMT_ST, OPCC_FMT_ST_RM = FMT_ST_RM,
+        OPCC_FMT_MM_REG = FMT_MM_REG, OPCC_FMT_MM_RM = FMT_MM_RM, OPCC_FMT_MM_IMPLIED = FMT_MM_IMPLIED,
+        OPCC_FMT_MMN = FMT_MMN, OPCC_FMT_XMM_REG = FMT_XMM_REG, OPCC_FMT_XMM_RM = FMT_XMM_RM, OPCC_FMT_XMMN = FMT_XMMN,
+        OPCC_FMT_IMM = FMT_IMM, OPCC_FMT_REL = FMT_REL, OPCC_FMT_FARPTR = FMT_FARPTR, OPCC_FMT_MOFFS = FMT_MOFFS,
+        OPCC_FMT_MEM = FMT_MEM, OPCC_FMT_NAME = FMT_NAME;
+    const unsigned int OPCC_FMT_OPERANDS = fmt_max_operands;
+    const unsigned int OPCC_FMT_IMM_SIGNED = fmt_imm_signed, OPCC_FMT_IMM_OFFSET = fmt_imm_offset;
+    const unsigned int OPCC_FMT_STRING = fmt_flag_string, OPCC_FMT_REPE = fmt_flag_repe, OPCC_FMT_FAR = fmt_flag_far;
+    const uint32_t OPCC_PS_SEG_MASK = prefix_state_seg_mask, OPCC_PS_OPSIZE = prefix_state_opsize;
+    const uint32_t OPCC_PS_ADDRSIZE = prefix_state_addrsize, OPCC_PS_LOCK = prefix_state_lock, OPCC_PS_WAIT = prefix_state_wait;
+    const unsigned int OPCC_SEG_NONE = PREFIX_SEG_NONE, OPCC_REP_Z = PREFIX_REP_Z, OPCC_REP_NZ = PREFIX_REP_NZ;
+    const unsigned int OPCC_MEM_SRC_STACK = MEM_SRC_STACK, OPCC_MEM_SRC_SI = MEM_SRC_SI, OPCC_MEM_SRC_DI = MEM_SRC_DI;
+    const unsigned int OPCC_MEM_SIZE_W = MEM_SIZE_W, OPCC_MEM_SIZE_DW = MEM_SIZE_DW, OPCC_MEM_SIZE_FPV = MEM_SIZE_FPV;
+    const auto &opcc_mem_size_bytes = mem_size_bytes;
+
+    int                                             OPCC_OPCODE_COUNT = 0;
+    std::vector< std::array<uint16_t,4> >           opcc_fmt_opnd;
+    std::vector< std::array<uint8_t,3> >            opcc_fmt_imm;
+    std::vector<const char*>                        opcc_fmt_name,opcc_opcode_name;
+    FormatTables                                    ft;
+
+    inline unsigned int OPCC_FMT_KIND(const unsigned int x) { return x & 0x1Fu; }
+    inline unsigned int OPCC_FMT_SIZE(const unsigned int x) { return (x >> 5u) & 0xFu; }
+    inline unsigned int OPCC_FMT_ARG(const unsigned int x) { return x >> 9u; }
+    inline unsigned int OPCC_PS_REP(const uint32_t st) { return (st & prefix_state_rep_mask) >> prefix_state_rep_shift; }
+
+#include "opcc_format.h"
+
+    void build(void) {
+        ft.build();
+        OPCC_OPCODE_COUNT = (int)opcodes.size();
+        for (size_t i=0;i < opcodes.size();i++) {
+            opcc_fmt_opnd.push_back(ft.opnd[i]);
+            opcc_fmt_imm.push_back(std::array<uint8_t,3>{{ ft.imm[i][0], ft.imm[i][1], ft.flags[i] }});
+            opcc_opcode_name.push_back(opcodes[i].name.c_str());
+        }
+        for (const auto &n : ft.names) opcc_fmt_name.push_back(n.c_str());
+    }
+}
+
+#include "opcc_blob.h"
+
+/* -disasm and -discover decode through the same blob image "-blob" writes, built in memory and read with
+ * opcc_blob.h, so there is one table walk for the file and the disassembler */
+class Disassembler {
+public:
+    std::vector<uint64_t>       image;              // the blob, 8 byte aligned for opcc_blob_open()
+    opcc_blob                   blob;
+    unsigned int                size_index = 0;     // OPCC_SIZE_INDEX() of the code segment
+public:
+                                Disassembler() { memset(&blob,0,sizeof(blob)); }
+                                Disassembler(const Disassembler &) = delete;
+    Disassembler &              operator=(const Disassembler &) = delete;
+public:
+    bool                        build(const unsigned int mode);
+    bool                        decode(const uint8_t *p,const size_t avail,DisasmInsn &d) const;
+    void                        format(std::string &s,const DisasmInsn &d,const uint32_t ip) const;
+    size_t                      line(std::string &s,const uint8_t *p,const size_t avail,const uint32_t ip) const;
+};
+
+bool Disassembler::build(const unsigned int mode) {
+    BlobWriter b;
+
+    if (!build_blob_image(b))
+        return false;
+
+    image.assign((b.size() + 7u) / 8u,0);
+    memcpy(image.data(),b.data(),b.size());
+    if (opcc_blob_open(&blob,image.data(),image.size() * 8u,0) < 0) {
+        fprintf(stderr,"Blob image is not readable\n");
+        return false;
+    }
+
+    for (size_t i=0;i < (opcodes.size() * 4u);i++) {
+        if ((blob.tail_length[i] & (tail_length_modrm - 1u)) > window_imm_max) {
+            fprintf(stderr,"Opcode '%s' immediate too long to disassemble\n",opcodes[i / 4u].name.c_str());
+            return false;
+        }
+    }
+
+    disasm_fmt::build();
+    size_index = mode == 32 ? 3u : 0u;
+    return true;
+}
+
+/* false for unknown opcodes and anything that does not fit in avail or the length limit */
+bool Disassembler::decode(const uint8_t *p,const size_t avail,DisasmInsn &d) const {
+    unsigned int c,n,o32,a32,mp,rep,tl;
+    uint32_t st = 0;
+    size_t i = 0,k;
+    int op;
+
+    d = DisasmInsn();
+
+    while (i < avail && (c = blob.prefix_class[p[i]]) != 0) {
+        st = (st & blob.prefix_step[c * 2u]) | blob.prefix_step[(c * 2u) + 1u];
+        i++;
+    }
+    if (opcode_limit > 0 && (i + 1u) > (size_t)opcode_limit) return false;
+
+    o32 = ((size_index >> 1u) ^ ((st & prefix_state_opsize) ? 1u : 0u)) & 1u;
+    a32 = (size_index ^ ((st & prefix_state_addrsize) ? 1u : 0u)) & 1u;
+    rep = (st & prefix_state_rep_mask) >> prefix_state_rep_shift;
+    if (rep == PREFIX_REP_NZ) mp = OpcodeGroupBlock::MP_F2;
+    else if (rep == PREFIX_REP_Z) mp = OpcodeGroupBlock::MP_F3;
+    else mp = (st & prefix_state_opsize) ? OpcodeGroupBlock::MP_66 : OpcodeGroupBlock::MP_NONE;
+
+    if ((op=opcc_blob_decode_opcode(&blob,p+i,avail-i,mp,a32,&k)) < 0) return false;
+    i += k;
+
+    d.opcode = op;
+    d.prefix = st;
+    d.opbyte = p[i-1];
+    tl = blob.tail_length[((size_t)op * 4u) + ((o32 << 1u) | a32)];
+    if (tl & tail_length_modrm) {
+        if ((n=opcc_blob_modrm_length(&blob,p+i,avail-i,a32)) == 0) return false;
+        d.modrm = p[i];
+        d.sib = n > 1 ? p[i+1] : 0;
+        d.modrm_len = (unsigned char)n;
+    }
+    d.imm_len = (unsigned char)(tl & (tail_length_modrm - 1u));
+    k = i + d.modrm_len + d.imm_len;
+    if (k > avail || k > 255u) return false;
+    if (opcode_limit > 0 && k > (size_t)opcode_limit) return false;
+    d.length = (unsigned char)k;
+
+    if (d.modrm_len != 0) {
+        const opcc_blob_ea &ea = (a32 && (blob.ea32[d.modrm].flags & OPCC_BLOB_EA_SIB)) ?
+            blob.ea_sib[((d.modrm >> 6u) * 256u) + d.sib] : (a32 ? blob.ea32[d.modrm] : blob.ea16[d.modrm]);
+        const uint8_t *q = p + i + d.modrm_len - ea.disp;
+        uint32_t x = 0;
+
+        for (k=0;k < ea.disp;k++) x |= (uint32_t)q[k] << (8u * k);
+        if (ea.disp != 0 && ea.disp < 4) {
+            const uint32_t sign = 1u << ((8u * ea.disp) - 1u);
+
+            x = (x ^ sign) - sign;
+        }
+        d.disp = (int32_t)x;
+    }
+    for (k=0;k < d.imm_len;k++)
+        d.imm |= (uint64_t)p[i + d.modrm_len + k] << (8u * k);
+
+    return true;
+}
+
+void disasm_hex(std::string &s,uint64_t v) {
+    char tmp[16];
+    unsigned int i = 0;
+
+    s += "0x";
+    do { tmp[i++] = "0123456789abcdef"[v & 0xFu]; v >>= 4u; } while (v != 0u);
+    while (i != 0u) s += tmp[--i];
+}
+
+void Disassembler::format(std::string &s,const DisasmInsn &d,const uint32_t ip) const {
+    const size_t o = s.size();
+    char tmp[128];
+    size_t n;
+
+    n = disasm_fmt::opcc_format_insn(tmp,sizeof(tmp),&d,ip,size_index);
+    if (n < sizeof(tmp)) {
+        s += tmp;
+        return;
+    }
+
+    s.resize(o + n + 1u);
+    disasm_fmt::opcc_format_insn(&s[o],n + 1u,&d,ip,size_index);
+    s.resize(o + n);
+}
+
+/* one line of output for the instruction at p: offset, bytes, text. returns the bytes consumed, anything that
+ * does not decode is taken one byte at a time as DB */
+size_t Disassembler::line(std::string &s,const uint8_t *p,const size_t avail,const uint32_t ip) const {
+    static const char hex[] = "0123456789abcdef";
+    DisasmInsn d;
+    size_t len,col;
+
+    if (!decode(p,avail,d)) d.length = 0;
+    len = d.length != 0 ? d.length : 1;
+
+    for (unsigned int b=32;b != 0;) {
+        b -= 4;
+        s += hex[(ip >> b) & 0xFu];
+    }
+    s += "  ";
+    col = s.size();
+    for (size_t i=0;i < len;i++) {
+        s += hex[p[i] >> 4u];
+        s += hex[p[i] & 0xFu];
+    }
+    col = s.size() - col;
+    s.append(col < (disasm_hex_bytes * 2u) ? ((disasm_hex_bytes * 2u) + 2u - col) : 2u,' ');
+
+    if (d.length != 0) {
+        format(s,d,ip);
+    }
+    else {
+        s += "db ";
+        disasm_hex(s,p[0]);
+    }
+    s += '\n';
+    return len;
+}
+
+class DisasmChunk {
+public:
+    size_t                      begin = 0,end = 0;  // bytes this worker is responsible for
+    size_t                      next = 0;           // where its own decode stopped, at or past end
+    size_t                      converge = 0;       // where it met the instruction stream of a later chunk
+    std::vector<uint32_t>       starts;             // instruction offsets, ascending
+    std::vector<size_t>         text_ofs;           // start of each instruction's line in text
+    std::string                 text;
+};
+
+void disasm_sweep(const Disassembler &dis,const uint8_t *p,const size_t size,DisasmChunk &c) {
+    size_t o = c.begin;
+
+    while (o < c.end) {
+        c.starts.push_back((uint32_t)o);
+        c.text_ofs.push_back(c.text.size());
+        o += dis.line(c.text,p+o,size-o,(uint32_t)o);
+    }
+
+    c.next = o;
+}
+
+/* keep decoding past the end of chunk k until an instruction starts where the worker of the chunk it is in
+ * also had one */
+void disasm_converge(const Disassembler &dis,const uint8_t *p,const size_t size,std::vector<DisasmChunk> &chunks,const size_t k) {
+    DisasmChunk &c = chunks[k];
+    size_t o = c.next,j = k + 1;
+
+    while (o < size) {
+        while (j < chunks.size() && o >= chunks[j].end) j++;
+        if (j >= chunks.size() || std::binary_search(chunks[j].starts.begin(),chunks[j].starts.end(),(uint32_t)o))
+            break;
+
+        o += dis.line(c.text,p+o,size-o,(uint32_t)o);
+    }
+
+    c.converge = o;
+}
+
+/* read-only mapping of an input image, p = NULL for an empty file. unmap with munmap(p,size) */
+bool map_input_file(const std::string &path,const uint8_t *&p,size_t &size) {
+    struct stat st;
+    void *m;
+    int fd;
+
+    p = NULL;
+    size = 0;
+
+    if ((fd=open(path.c_str(),O_RDONLY)) < 0) {
+        fprintf(stderr,"Unable to open file '%s', %s\n",path.c_str(),strerror(errno));
+        return false;
+    }
+    if (fstat(fd,&st) != 0 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr,"'%s' is not a regular file\n",path.c_str());
+        close(fd);
+        return false;
+    }
+    if ((unsigned long long)st.st_size > 0xFFFFFFFFull) {
+        fprintf(stderr,"'%s' is larger than 4GB\n",path.c_str());
+        close(fd);
+        return false;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    m = mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        fprintf(stderr,"Unable to map file '%s', %s\n",path.c_str(),strerror(errno));
+        return false;
+    }
+
+    p = (const uint8_t*)m;
+    size = (size_t)st.st_size;
+    return true;
+}
+
+bool disasm_file(void) {
+    const uint8_t *p = NULL;
+    std::vector<DisasmChunk> chunks;
+    std::vector<std::thread> workers;
+    Disassembler dis;
+    size_t size,n,k,o;
+
+    if (disasm_mode != 16 && disasm_mode != 32) {
+        fprintf(stderr,"-mode must be 16 or 32\n");
+        return false;
+    }
+    if (!dis.build(disasm_mode))
+        return false;
+
+    if (!map_input_file(disasmfile,p,size))
+        return false;
+    if (p == NULL)
+        return true;
+    madvise((void*)p,size,MADV_SEQUENTIAL);
+
+    n = disasm_threads != 0 ? disasm_threads : std::max(std::thread::hardware_concurrency(),1u);
+    n = std::max((size_t)1,std::min(n,(size + disasm_chunk_min - 1) / disasm_chunk_min));
+    chunks.resize(n);
+    for (k=0;k < n;k++) {
+        chunks[k].begin = (size * k) / n;
+        chunks[k].end = (size * (k + 1)) / n;
+    }
+
+    for (k=1;k < n;k++)
+        workers.push_back(std::thread(disasm_sweep,std::cref(dis),p,size,std::ref(chunks[k])));
+    disasm_sweep(dis,p,size,chunks[0]);
+    for (auto &w : workers) w.join();
+    workers.clear();
+
+    for (k=1;k < n;k++)
+        workers.push_back(std::thread(disasm_converge,std::cref(dis),p,size,std::ref(chunks),k-1));
+    disasm_converge(dis,p,size,chunks,n-1);
+    for (auto &w : workers) w.join();
+
+    /* chunk 0 is right from the start, every other chunk from where the one before converged with it */
+    for (k=0,o=0;k < n;) {
+        const DisasmChunk &c = chunks[k];
+        const auto i = std::lower_bound(c.starts.begin(),c.starts.end(),(uint32_t)o);
+        const size_t t = i != c.starts.end() ? c.text_ofs[(size_t)(i - c.starts.begin())] : c.text.size();
+
+        assert(i == c.starts.end() || *i == o);
+        fwrite(c.text.data()+t,c.text.size()-t,1,stdout);
+
+        for (o=c.converge,k++;k < n && o >= chunks[k].end;) k++;
+    }
+
+    munmap((void*)p,size);
+    fflush(stdout);
+    if (ferror(stdout)) {
+        fprintf(stderr,"Error writing disassembly\n");
+        return false;
+    }
+
+    return true;
+}
+
+/* -discover: recursive descent from the entry points, following direct branch targets as classified by
+ * branch_kind_byte(). workers share a bitmap of claimed instruction starts over the image and each has a deque of
+ * addresses to visit, taking from the back of its own and stealing from the front of another's when it runs dry.
+ * a worker decodes from an address it claimed until a control transfer, an address another run already claimed,
+ * or a byte that does not decode, and records that run. targets and fall-through addresses are marked in a second
+ * bitmap, and once everything is visited each run is cut into basic blocks at those marks, since a run may have
+ * passed over an address before anything was known to branch there.
+ *
+ * -cfg bin writes, little endian: "OPCCCFG\0", uint32 version, uint32 block count, uint32 edge count, uint32 bad
+ * count, blocks { uint32 start, uint32 end, uint32 instructions, uint8 exit, uint8 pad[3] } sorted by start, then
+ * edges { uint32 from (block start), uint32 to, uint8 kind, uint8 pad[3] } sorted by from and to, then uint32 per
+ * address where decoding stopped on a byte that does not decode, sorted. addresses are offsets in the image (the
+ * load module of an MZ executable). exit and kind are BRANCH_*, with BRANCH_NONE for falling through to the next
+ * block, and exits past BRANCH_MAX for a byte that does not decode or the end of the image. a branch or fall
+ * through to a byte that does not decode has its edge but no block, the target is only in the bad list. edges
+ * are direct targets only, indirect jumps and calls show in the exit kind. csv has the same as block, edge and
+ * bad records. */
+const char cfg_magic[8] = { 'O','P','C','C','C','F','G',0 };
+const uint32_t cfg_version = 2;
+const uint32_t discover_none = 0xFFFFFFFFu;
+
+enum discover_exit_t {
+    DISCOVER_EXIT_BAD=BRANCH_MAX,   // the next byte does not decode
+    DISCOVER_EXIT_END,              // the next instruction is outside the image or wraps the segment
+
+    DISCOVER_EXIT_MAX
+};
+
+const char *discover_exit_str(const unsigned int e) {
+    if (e == BRANCH_NONE) return "FALL";
+    if (e < BRANCH_MAX) return branch_kind_str[e];
+    if (e == DISCOVER_EXIT_BAD) return "BAD";
+    return "END";
+}
+
+class DiscoverItem {
+public:
+    uint32_t                    ofs = 0;
+    int64_t                     csb = 0;            // image offset of CS:0, can be negative (org 100h)
+public:
+                                DiscoverItem() { }
+                                DiscoverItem(const uint32_t o,const int64_t c) : ofs(o), csb(c) { }
+};
+
+class DiscoverRun {
+public:
+    uint32_t                    start = 0,end = 0;
+    uint32_t                    insns = 0;
+    unsigned char               exit = BRANCH_NONE;
+    uint32_t                    target = discover_none;
+    bool                        falls = false;      // continues at end
+};
+
+class DiscoverBlock {
+public:
+    uint32_t                    start,end,insns;
+    unsigned char               exit;
+};
+
+class DiscoverEdge {
+public:
+    uint32_t                    from,to;
+    unsigned char               kind;
+};
+
+class DiscoverWorker {
+public:
+    std::mutex                  lock;               // guards work, taken by the owner and by thieves
+    std::deque<DiscoverItem>    work;
+    std::vector<DiscoverRun>    runs;
+    std::vector<DiscoverBlock>  blocks;
+    std::vector<DiscoverEdge>   edges;
+    std::vector<uint32_t>       bad;                // where a run met a byte that does not decode
+};
+
+class CodeDiscovery {
+public:
+    const Disassembler          &dis;
+    const uint8_t               *image = NULL;
+    size_t                      size = 0;
+    bool                        far_targets = false;    // seg:offset maps to seg*16+offset (MZ)
+    std::vector<unsigned char>  branch;
+    std::vector< std::atomic<uint32_t> > claimed,leader;
+    std::atomic<size_t>         pending;            // queued or being walked
+    std::vector< std::unique_ptr<DiscoverWorker> > workers;
+public:
+                                CodeDiscovery(const Disassembler &d,const uint8_t *p,const size_t n,const size_t threads);
+    bool                        test(const std::vector< std::atomic<uint32_t> > &m,const uint32_t o) const;
+    bool                        set(std::vector< std::atomic<uint32_t> > &m,const uint32_t o);
+    void                        visit(DiscoverWorker &w,const DiscoverItem &it);
+    bool                        take(const size_t wi,DiscoverItem &it);
+    void                        walk(DiscoverWorker &w,const DiscoverItem &it);
+    void                        run(const size_t wi);
+    void                        split(DiscoverWorker &w);
+};
+
+CodeDiscovery::CodeDiscovery(const Disassembler &d,const uint8_t *p,const size_t n,const size_t threads) : dis(d), image(p), size(n),
+    claimed((n + 31) / 32), leader((n + 31) / 32), pending(0) {
+    for (auto &a : claimed) a.store(0,std::memory_order_relaxed);
+    for (auto &a : leader) a.store(0,std::memory_order_relaxed);
+    for (const auto &op : opcodes) branch.push_back(branch_kind_byte(op));
+    for (size_t i=0;i < threads;i++) workers.push_back(std::unique_ptr<DiscoverWorker>(new DiscoverWorker()));
+}
+
+bool CodeDiscovery::test(const std::vector< std::atomic<uint32_t> > &m,const uint32_t o) const {
+    return (m[o >> 5u].load(std::memory_order_relaxed) >> (o & 31u)) & 1u;
+}
+
+/* true if this call set the bit */
+bool CodeDiscovery::set(std::vector< std::atomic<uint32_t> > &m,const uint32_t o) {
+    const uint32_t b = 1u << (o & 31u);
+
+    if (m[o >> 5u].load(std::memory_order_relaxed) & b) return false;
+    return (m[o >> 5u].fetch_or(b,std::memory_order_relaxed) & b) == 0;
+}
+
+void CodeDiscovery::visit(DiscoverWorker &w,const DiscoverItem &it) {
+    set(leader,it.ofs);
+    if (test(claimed,it.ofs)) return;
+
+    pending.fetch_add(1);
+    std::lock_guard<std::mutex> g(w.lock);
+    w.work.push_back(it);
+}
+
+bool CodeDiscovery::take(const size_t wi,DiscoverItem &it) {
+    {
+        DiscoverWorker &w = *workers[wi];
+        std::lock_guard<std::mutex> g(w.lock);
+
+        if (!w.work.empty()) {
+            it = w.work.back();
+            w.work.pop_back();
+            return true;
+        }
+    }
+
+    for (size_t i=1;i < workers.size();i++) {
+        DiscoverWorker &v = *workers[(wi + i) % workers.size()];
+        std::lock_guard<std::mutex> g(v.lock);
+
+        if (!v.work.empty()) {
+            it = v.work.front();
+            v.work.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void CodeDiscovery::walk(DiscoverWorker &w,const DiscoverItem &it) {
+    const uint32_t seg_mask = (dis.size_index & 1u) ? 0xFFFFFFFFu : 0xFFFFu;
+    DiscoverRun r;
+    uint32_t o = it.ofs;
+
+    r.start = o;
+    for (;;) {
+        const uint32_t ip = (uint32_t)((int64_t)o - it.csb) & seg_mask;
+        unsigned int b,kind,o32;
+        int64_t next;
+        DisasmInsn d;
+
+        if (!dis.decode(image+o,size-o,d)) {
+            r.exit = DISCOVER_EXIT_BAD;
+            r.end = o;
+            break;
+        }
+
+        r.insns++;
+        r.end = o + d.length;
+        next = it.csb + (int64_t)((ip + d.length) & seg_mask);
+        b = branch[(size_t)d.opcode];
+        kind = b & 0xFu;
+        o32 = ((dis.size_index >> 1u) ^ ((d.prefix & prefix_state_opsize) ? 1u : 0u)) & 1u;
+
+        if (kind != BRANCH_NONE) {
+            const unsigned int target = (b >> 4u) & 7u;
+
+            r.exit = (unsigned char)kind;
+            if (target == BRANCH_TARGET_REL8 || target == BRANCH_TARGET_RELV) {
+                const unsigned int bits = 8u * d.imm_len;
+                uint64_t rel = d.imm;
+                int64_t t;
+
+                if (bits != 0 && bits < 64 && ((rel >> (bits - 1u)) & 1u)) rel |= ~((((uint64_t)1u) << bits) - 1u);
+                t = it.csb + (int64_t)((ip + d.length + (uint32_t)rel) & (o32 ? 0xFFFFFFFFu : 0xFFFFu));
+                if (t >= 0 && t < (int64_t)size) {
+                    r.target = (uint32_t)t;
+                    visit(w,DiscoverItem(r.target,it.csb));
+                }
+            }
+            else if (target == BRANCH_TARGET_FARPTR && far_targets && d.imm_len > 2) {
+                const unsigned int obits = 8u * (d.imm_len - 2u);
+                const int64_t seg = (int64_t)((d.imm >> obits) & 0xFFFFu) * 16;
+                const int64_t t = seg + (int64_t)(d.imm & ((((uint64_t)1u) << obits) - 1u));
+
+                if (t >= 0 && t < (int64_t)size) {
+                    r.target = (uint32_t)t;
+                    visit(w,DiscoverItem(r.target,seg));
+                }
+            }
+
+            if (kind == BRANCH_JCC || kind == BRANCH_CALL || kind == BRANCH_LOOP || kind == BRANCH_INT) {
+                if (next == (int64_t)r.end && next < (int64_t)size) {
+                    r.falls = true;
+                    visit(w,DiscoverItem(r.end,it.csb));
+                }
+            }
+            break;
+        }
+
+        if (next != (int64_t)r.end || next >= (int64_t)size) {
+            r.exit = DISCOVER_EXIT_END;
+            break;
+        }
+
+        o = (uint32_t)next;
+        if (!set(claimed,o)) {
+            /* someone else's run, which now has to start a block here */
+            set(leader,o);
+            r.exit = BRANCH_NONE;
+            r.falls = true;
+            break;
+        }
+    }
+
+    w.runs.push_back(r);
+}
+
+void CodeDiscovery::run(const size_t wi) {
+    DiscoverWorker &w = *workers[wi];
+    DiscoverItem it;
+
+    for (;;) {
+        if (take(wi,it)) {
+            if (set(claimed,it.ofs)) walk(w,it);
+            pending.fetch_sub(1);
+        }
+        else if (pending.load() == 0) {
+            break;
+        }
+        else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+/* cut runs into blocks at the leader marks. the run is decoded again, it is known to decode up to end */
+void CodeDiscovery::split(DiscoverWorker &w) {
+    for (const auto &r : w.runs) {
+        DiscoverBlock b;
+        uint32_t o = r.start;
+        DisasmInsn d;
+
+        if (r.exit == DISCOVER_EXIT_BAD)
+            w.bad.push_back(r.end);
+        if (r.insns == 0)
+            continue;
+
+        b.start = r.start;
+        b.insns = 0;
+        for (uint32_t i=0;i < r.insns;i++) {
+            if (o != b.start && test(leader,o)) {
+                b.end = o;
+                b.exit = BRANCH_NONE;
+                w.blocks.push_back(b);
+                w.edges.push_back(DiscoverEdge{ b.start, o, (unsigned char)BRANCH_NONE });
+                b.start = o;
+                b.insns = 0;
+            }
+
+            dis.decode(image+o,size-o,d);
+            o += d.length;
+            b.insns++;
+        }
+
+        b.end = r.end;
+        b.exit = r.exit;
+        w.blocks.push_back(b);
+        if (r.target != discover_none)
+            w.edges.push_back(DiscoverEdge{ b.start, r.target, r.exit });
+        if (r.falls)
+            w.edges.push_back(DiscoverEdge{ b.start, r.end, (unsigned char)BRANCH_NONE });
+    }
+}
+
+/* DOS MZ: the load module follows the header paragraphs, entry at CS:IP relative to its start */
+bool discover_mz(const uint8_t *&p,size_t &size,uint32_t &entry,int64_t &csb) {
+    auto rd16 = [p](const size_t o) { return (unsigned int)p[o] | ((unsigned int)p[o+1] << 8u); };
+    size_t hdr,end;
+
+    if (size < 0x1C || !((p[0] == 'M' && p[1] == 'Z') || (p[0] == 'Z' && p[1] == 'M')))
+        return false;
+
+    hdr = (size_t)rd16(8) * 16u;
+    end = rd16(4) != 0 ? ((size_t)(rd16(4) - 1u) * 512u) + (rd16(2) != 0 ? rd16(2) : 512u) : size;
+    if (end > size) end = size;
+    if (hdr >= end) return false;
+
+    csb = (int64_t)rd16(0x16) * 16;
+    entry = (uint32_t)(csb + rd16(0x14));
+    p += hdr;
+    size = end - hdr;
+    return true;
+}
+
+bool discover_file(void) {
+    const uint8_t *map = NULL,*p;
+    std::vector<std::thread> threads;
+    std::vector<DiscoverBlock> blocks;
+    std::vector<DiscoverEdge> edges;
+    std::vector<DiscoverItem> entries;
+    std::vector<uint32_t> bad;
+    Disassembler dis;
+    size_t map_size = 0,size,n;
+    unsigned int mode = disasm_mode;
+    uint32_t mz_entry = 0;
+    int64_t mz_csb = 0;
+    bool mz;
+
+    if (disasm_mode != 16 && disasm_mode != 32) {
+        fprintf(stderr,"-mode must be 16 or 32\n");
+        return false;
+    }
+    if (cfg_format != "csv" && cfg_format != "bin") {
+        fprintf(stderr,"-cfg must be csv or bin\n");
+        return false;
+    }
+
+    if (!map_input_file(discoverfile,map,map_size))
+        return false;
+    p = map;
+    size = map_size;
+
+    if ((mz=(p != NULL && discover_mz(p,size,mz_entry,mz_csb))))
+        mode = 16;
+    if (!dis.build(mode)) {
+        if (map) munmap((void*)map,map_size);
+        return false;
+    }
+
+    /* -entry addresses are CS:IP offsets, which is the image offset plus -org for a flat image */
+    for (const char *s=discover_entry.c_str();*s;) {
+        char *e;
+        const unsigned long long v = strtoull(s,&e,0);
+
+        if (e == s) {
+            fprintf(stderr,"Bad -entry list '%s'\n",discover_entry.c_str());
+            if (map) munmap((void*)map,map_size);
+            return false;
+        }
+        s = e;
+        if (mz) entries.push_back(DiscoverItem((uint32_t)(mz_csb + (int64_t)v),mz_csb));
+        else entries.push_back(DiscoverItem((uint32_t)(v - discover_org),-(int64_t)discover_org));
+        while (*s == ',' || *s == ' ') s++;
+    }
+    if (entries.empty())
+        entries.push_back(mz ? DiscoverItem(mz_entry,mz_csb) : DiscoverItem(0,-(int64_t)discover_org));
+
+    n = disasm_threads != 0 ? disasm_threads : std::max(std::thread::hardware_concurrency(),1u);
+    {
+        CodeDiscovery cd(dis,p,size,n);
+
+        cd.far_targets = mz;
+        for (size_t i=0;i < entries.size();i++) {
+            if (entries[i].ofs >= size) {
+                fprintf(stderr,"Entry point 0x%llx is outside the image\n",(unsigned long long)entries[i].ofs);
+                continue;
+            }
+            cd.visit(*cd.workers[i % n],entries[i]);
+        }
+
+        for (size_t i=1;i < n;i++) threads.push_back(std::thread(&CodeDiscovery::run,&cd,i));
+        cd.run(0);
+        for (auto &t : threads) t.join();
+        threads.clear();
+
+        for (size_t i=1;i < n;i++) threads.push_back(std::thread(&CodeDiscovery::split,&cd,std::ref(*cd.workers[i])));
+        cd.split(*cd.workers[0]);
+        for (auto &t : threads) t.join();
+
+        for (const auto &w : cd.workers) {
+            blocks.insert(blocks.end(),w->blocks.begin(),w->blocks.end());
+            edges.insert(edges.end(),w->edges.begin(),w->edges.end());
+            bad.insert(bad.end(),w->bad.begin(),w->bad.end());
+        }
+    }
+    if (map) munmap((void*)map,map_size);
+
+    std::sort(blocks.begin(),blocks.end(),[](const DiscoverBlock &a,const DiscoverBlock &b) { return a.start < b.start; });
+    std::sort(edges.begin(),edges.end(),[](const DiscoverEdge &a,const DiscoverEdge &b) {
+        if (a.from != b.from) return a.from < b.from;
+        if (a.to != b.to) return a.to < b.to;
+        return a.kind < b.kind;
+    });
+    std::sort(bad.begin(),bad.end());
+
+    if (cfg_format == "bin") {
+        BlobWriter b;
+
+        for (unsigned int i=0;i < 8;i++) b.put8((unsigned char)cfg_magic[i]);
+        b.put32(cfg_version);
+        b.put32((uint32_t)blocks.size());
+        b.put32((uint32_t)edges.size());
+        b.put32((uint32_t)bad.size());
+        for (const auto &k : blocks) {
+            b.put32(k.start); b.put32(k.end); b.put32(k.insns);
+            b.put8(k.exit); b.put8(0); b.put16(0);
+        }
+        for (const auto &e : edges) {
+            b.put32(e.from); b.put32(e.to);
+            b.put8(e.kind); b.put8(0); b.put16(0);
+        }
+        for (const auto o : bad)
+            b.put32(o);
+        fwrite(b.data(),b.size(),1,stdout);
+    }
+    else {
+        printf("record,from,to,count,kind\n");
+        for (const auto &k : blocks)
+            printf("block,0x%x,0x%x,%u,%s\n",k.start,k.end,k.insns,discover_exit_str(k.exit));
+        for (const auto &e : edges)
+            printf("edge,0x%x,0x%x,,%s\n",e.from,e.to,discover_exit_str(e.kind));
+        for (const auto o : bad)
+            printf("bad,0x%x,,,\n",o);
+    }
+
+    fflush(stdout);
+    if (ferror(stdout)) {
+        fprintf(stderr,"Error writing control flow graph\n");
+        return false;
+    }
+
+    {
+        size_t bytes = 0;
+
+        for (const auto &k : blocks) bytes += k.end - k.start;
+        fprintf(stderr,"%zu blocks, %zu edges, %zu bad, %zu of %zu bytes\n",blocks.size(),edges.size(),bad.size(),bytes,size);
+    }
+
+    return true;
+}
+
+/* -assemble: NASM style source to a flat binary on stdout, through AsmTables. lines are parsed once, then each
+ * pass matches every instruction against the forms of its mnemonic and keeps the shortest encoding whose
+ * immediates fit and whose branch targets are in reach, until label addresses stop moving. forward references
+ * start out as the shortest reach and grow. forms at the operand size of the code segment win over everything
+ * else, the 66h prefix is only used when nothing matches without it, and 67h when a memory operand is written
+ * with the other size of registers. takes BITS 16/32, ORG, labels (.name is local to the last plain label),
+ * DB/DW/DD, $ and $$, and reads back anything -disasm prints. */
+enum asm_opnd_t {
+    ASM_OPND_NONE=0,
+    ASM_OPND_REG,
+    ASM_OPND_MEM,
+    ASM_OPND_IMM,
+    ASM_OPND_FARPTR                 // seg:offset
+};
+
+enum asm_reg_t {
+    ASM_REG_GPR=0,
+    ASM_REG_SREG,
+    ASM_REG_CR,
+    ASM_REG_DR,
+    ASM_REG_TR,
+    ASM_REG_ST,
+    ASM_REG_MM,
+    ASM_REG_XMM
+};
+
+enum asm_jump_t {
+    ASM_JUMP_ANY=0,
+    ASM_JUMP_SHORT,
+    ASM_JUMP_NEAR
+};
+
+const uint32_t asm_label_here = 0xFFFFFFFEu;           // $
+const uint32_t asm_label_start = 0xFFFFFFFDu;          // $$
+const uint32_t asm_no_label = 0xFFFFFFFFu;
+const unsigned int asm_max_passes = 32;
+const unsigned int asm_insn_max = 32;
+
+class AsmExpr {
+public:
+    int64_t                     value = 0;
+    std::vector< std::pair<int64_t,uint32_t> > labels;  // coefficient, label index
+};
+
+class AsmOperand {
+public:
+    unsigned char               type = ASM_OPND_NONE;
+    unsigned char               reg_class = ASM_REG_GPR;
+    unsigned char               reg = 0;
+    unsigned char               reg_bytes = 0;      // general registers
+    unsigned char               size = 0;           // BYTE, WORD ... in bytes, 0 if not given
+    unsigned char               jump = ASM_JUMP_ANY;
+    bool                        far = false;
+    bool                        empty = false;      // "[]"
+    unsigned int                seg = PREFIX_SEG_NONE;
+    int                         base = -1,index = -1;
+    unsigned int                scale = 0;          // shift
+    unsigned char               addr_bytes = 0;     // 2 or 4 from the registers, 0 for a displacement only
+    AsmExpr                     expr;               // immediate, displacement, offset of a far pointer
+    AsmExpr                     seg_expr;           // segment of a far pointer
+    std::string                 name;               // a lone word, lowercase, for FMT_NAME operands
+};
+
+class AsmLine {
+public:
+    unsigned int                lineno = 0;
+    unsigned int                bits = 16;
+    uint32_t                    label = asm_no_label;   // defined here
+    int                         mnemonic = -1;
+    std::vector<unsigned char>  prefixes;           // LOCK, REP, WAIT and segment words, as written
+    std::vector<AsmOperand>     opnd;
+    unsigned char               data_size = 0;      // DB DW DD
+    std::vector<AsmExpr>        data;
+    uint64_t                    addr = 0;
+    unsigned int                len = 0;
+};
+
+class Assembler {
+public:
+    AsmTables                   at;
+    unsigned char               seg_byte[PREFIX_SEG_MAX] = {0};
+    unsigned char               rep_byte[PREFIX_REP_MAX] = {0};
+    unsigned char               opsize_byte = 0,addrsize_byte = 0,lock_byte = 0,wait_byte = 0;
+    std::string                 path;
+    std::vector<AsmLine>        lines;
+    std::map<std::string,uint32_t> label_index;
+    std::vector<std::string>    label_name;
+    std::vector<int64_t>        label_addr;
+    std::vector<bool>           label_known;
+    std::vector<unsigned int>   label_line;         // defined on, 0 if not (yet)
+    std::vector<unsigned int>   label_ref;          // first used on
+    std::vector<std::string>    errors;             // this pass
+    std::vector<unsigned char>  out;
+    std::string                 global;             // last plain label
+    uint64_t                    org = 0;
+    unsigned int                bits = 16;
+    unsigned int                parse_errors = 0;
+    size_t                      insns = 0;
+public:
+    void                        build(const unsigned int mode);
+    void                        error(const unsigned int lineno,const std::string &msg);
+    uint32_t                    label(const std::string &name,const unsigned int lineno);
+    bool                        eval(const AsmExpr &x,const uint64_t here,int64_t &v) const;
+    bool                        parse_expr(const char *&p,const char *e,AsmExpr &x,AsmOperand *mem,const unsigned int lineno);
+    bool                        parse_operand(const char *p,const char *e,AsmOperand &o,const unsigned int lineno);
+    bool                        parse_line(const char *p,const char *e,const unsigned int lineno);
+    bool                        ea(const AsmOperand &o,const unsigned int a32,const unsigned int reg,const uint64_t here,unsigned char *b,unsigned int &n,unsigned int &rm) const;
+    bool                        encode(const AsmLine &l,const AsmForm &f,const unsigned int o32,unsigned char *b,unsigned int &n,bool &wraps) const;
+    bool                        assemble(const char *p,const size_t size);
+};
+
+void Assembler::build(const unsigned int mode) {
+    at.build();
+    bits = mode;
+
+    for (const auto &op : opcodes) {
+        if (op.type != TOK_PREFIX || op.bytes.empty() || op.bytes[0].meaning != 0 || op.bytes[0].empty())
+            continue;
+
+        const unsigned char b = op.bytes[0][0];
+
+        if (op.prefix_seg_assign != 0) seg_byte[prefix_seg_code(op.prefix_seg_assign)] = b;
+        if (op.rep_condition != 0) rep_byte[prefix_rep_code(op)] = b;
+        if (op.opsize) opsize_byte = b;
+        if (op.addrsize) addrsize_byte = b;
+        if (op.lock) lock_byte = b;
+        if (op.wait) wait_byte = b;
+    }
+}
+
+void Assembler::error(const unsigned int lineno,const std::string &msg) {
+    errors.push_back(path + ":" + std::to_string(lineno) + ": " + msg);
+}
+
+uint32_t Assembler::label(const std::string &name,const unsigned int lineno) {
+    const std::string full = (name[0] == '.' && name.size() > 1 && name[1] != '.') ? global + name : name;
+    const auto i = label_index.find(full);
+
+    if (i != label_index.end()) return i->second;
+
+    label_index[full] = (uint32_t)label_name.size();
+    label_name.push_back(full);
+    label_addr.push_back(0);
+    label_known.push_back(false);
+    label_line.push_back(0);
+    label_ref.push_back(lineno);
+    return (uint32_t)(label_name.size() - 1u);
+}
+
+/* false if a label in x has no address yet */
+bool Assembler::eval(const AsmExpr &x,const uint64_t here,int64_t &v) const {
+    bool known = true;
+
+    v = x.value;
+    for (const auto &t : x.labels) {
+        if (t.second == asm_label_here) v += t.first * (int64_t)here;
+        else if (t.second == asm_label_start) v += t.first * (int64_t)org;
+        else if (label_known[t.second]) v += t.first * label_addr[t.second];
+        else known = false;
+    }
+
+    return known;
+}
+
+bool asm_word_char(const char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '$' || c == '?' || c == '@' || c == '#' || c == '~';
+}
+
+const char *asm_skip(const char *p,const char *e) {
+    while (p < e && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+std::string asm_lower(const char *p,const char *e) {
+    std::string s;
+
+    for (;p < e;p++) s += (char)tolower((unsigned char)*p);
+    return s;
+}
+
+/* register name, lowercase */
+bool asm_register(const std::string &w,AsmOperand &o) {
+    static const char *const r8[8] = { "al", "cl", "dl", "bl", "ah", "ch", "dh", "bh" };
+    static const char *const r16[8] = { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di" };
+    static const char *const sr[8] = { "es", "cs", "ss", "ds", "fs", "gs", "s6", "s7" };
+    static const struct { const char *p; unsigned char c; } numbered[] = {
+        { "cr", ASM_REG_CR }, { "dr", ASM_REG_DR }, { "tr", ASM_REG_TR }, { "st", ASM_REG_ST }, { "mm", ASM_REG_MM }, { "xmm", ASM_REG_XMM }
+    };
+
+    if (w.empty()) return false;
+    o.type = ASM_OPND_REG;
+    for (unsigned int i=0;i < 8;i++) {
+        o.reg = (unsigned char)i;
+        o.reg_class = ASM_REG_GPR;
+        if (w == r8[i])             { o.reg_bytes = 1; return true; }
+        if (w == r16[i])            { o.reg_bytes = 2; return true; }
+        if (w[0] == 'e' && w.compare(1,std::string::npos,r16[i]) == 0) { o.reg_bytes = 4; return true; }
+        o.reg_class = ASM_REG_SREG;
+        if (w == sr[i])             return true;
+    }
+    for (const auto &n : numbered) {
+        const size_t l = strlen(n.p);
+
+        o.reg_class = n.c;
+        if (w.size() == (l + 1u) && w.compare(0,l,n.p) == 0 && w[l] >= '0' && w[l] <= '7') {
+            o.reg = (unsigned char)(w[l] - '0');
+            return true;
+        }
+    }
+    if (w == "st") {
+        o.reg_class = ASM_REG_ST;
+        o.reg = 0;
+        return true;
+    }
+
+    o.type = ASM_OPND_NONE;
+    return false;
+}
+
+bool asm_segment(const std::string &w,unsigned int &seg) {
+    AsmOperand o;
+
+    if (!asm_register(w,o) || o.reg_class != ASM_REG_SREG || o.reg > 5) return false;
+    seg = PREFIX_SEG_ES + o.reg;
+    return true;
+}
+
+/* 0x1F, 1Fh, 0b101, 101b, 17o, 17q, 31, 'a' */
+bool asm_number(const char *&p,const char *e,int64_t &v) {
+    const char *s = p;
+    unsigned int radix = 10;
+    uint64_t r = 0;
+
+    if (*p == '\'' || *p == '"') {
+        const char q = *p++;
+        unsigned int sh = 0;
+
+        while (p < e && *p != q) {
+            r |= (uint64_t)(unsigned char)*p++ << sh;
+            sh += 8u;
+        }
+        if (p >= e) return false;
+        p++;
+        v = (int64_t)r;
+        return true;
+    }
+
+    while (p < e && isalnum((unsigned char)*p)) p++;
+    std::string t = asm_lower(s,p);
+
+    if (t.size() > 2 && t[0] == '0' && (t[1] == 'x' || t[1] == 'h')) { radix = 16; t = t.substr(2); }
+    else if (t.size() > 2 && t[0] == '0' && (t[1] == 'b' || t[1] == 'y')) { radix = 2; t = t.substr(2); }
+    else if (t.size() > 1 && t.back() == 'h') { radix = 16; t.pop_back(); }
+    else if (t.size() > 1 && (t.back() == 'b' || t.back() == 'y')) { radix = 2; t.pop_back(); }
+    else if (t.size() > 1 && (t.back() == 'o' || t.back() == 'q')) { radix = 8; t.pop_back(); }
+    else if (t.size() > 1 && t.back() == 'd') { t.pop_back(); }
+    if (t.empty()) return false;
+
+    for (const auto c : t) {
+        const unsigned int d = isdigit((unsigned char)c) ? (unsigned int)(c - '0') : (isxdigit((unsigned char)c) ? (unsigned int)(c - 'a' + 10) : 99u);
+
+        if (d >= radix) return false;
+        r = (r * radix) + d;
+    }
+
+    v = (int64_t)r;
+    return true;
+}
+
+/* sum of terms, each a product of numbers, labels, $ or $$. registers (and register * scale) only if mem */
+bool Assembler::parse_expr(const char *&p,const char *e,AsmExpr &x,AsmOperand *mem,const unsigned int lineno) {
+    std::vector< std::pair<int,unsigned int> > regs;    // number | bytes << 3, scale
+    int64_t sign = 1;
+
+    for (;;) {
+        int64_t coef = sign;
+        uint32_t lab = asm_no_label;
+        int reg = -1;
+        bool any = false;
+
+        p = asm_skip(p,e);
+        while (p < e && (*p == '+' || *p == '-')) {
+            if (*p == '-') coef = -coef;
+            p = asm_skip(p+1,e);
+        }
+
+        for (;;) {
+            int64_t v;
+
+            p = asm_skip(p,e);
+            if (p >= e) break;
+            if (isdigit((unsigned char)*p) || *p == '\'' || *p == '"') {
+                if (!asm_number(p,e,v)) {
+                    error(lineno,"bad number");
+                    return false;
+                }
+                coef *= v;
+            }
+            else if (*p == '(') {
+                AsmExpr sub;
+
+                p++;
+                if (!parse_expr(p,e,sub,NULL,lineno)) return false;
+                p = asm_skip(p,e);
+                if (p >= e || *p != ')' || !sub.labels.empty()) {
+                    error(lineno,"bad expression");
+                    return false;
+                }
+                p++;
+                coef *= sub.value;
+            }
+            else if (asm_word_char(*p)) {
+                const char *s = p;
+                AsmOperand r;
+
+                while (p < e && asm_word_char(*p)) p++;
+                const std::string w = std::string(s,(size_t)(p - s));
+                const std::string lw = asm_lower(s,p);
+
+                if (lab != asm_no_label || reg >= 0) {
+                    error(lineno,"bad expression");
+                    return false;
+                }
+                if (w == "$") lab = asm_label_here;
+                else if (w == "$$") lab = asm_label_start;
+                else if (asm_register(lw,r)) {
+                    if (mem == NULL || r.reg_class != ASM_REG_GPR || r.reg_bytes == 1) {
+                        error(lineno,"register '" + lw + "' in an expression");
+                        return false;
+                    }
+                    reg = (int)(r.reg | ((unsigned int)r.reg_bytes << 3u));
+                }
+                else lab = label(w[0] == '$' ? w.substr(1) : w,lineno);
+            }
+            else {
+                break;
+            }
+            any = true;
+
+            p = asm_skip(p,e);
+            if (p < e && *p == '*') p++;
+            else break;
+        }
+        if (!any) {
+            error(lineno,"expected a value");
+            return false;
+        }
+
+        if (reg >= 0) {
+            unsigned int sh = 0;
+
+            while (sh < 4 && coef != ((int64_t)1 << sh)) sh++;
+            if (sh > 3) {
+                error(lineno,"bad index scale");
+                return false;
+            }
+            regs.push_back(std::pair<int,unsigned int>(reg,sh));
+        }
+        else if (lab != asm_no_label) x.labels.push_back(std::pair<int64_t,uint32_t>(coef,lab));
+        else x.value += coef;
+
+        p = asm_skip(p,e);
+        if (p < e && *p == '+') { sign = 1; p++; }
+        else if (p < e && *p == '-') { sign = -1; p++; }
+        else break;
+    }
+
+    if (mem != NULL && !regs.empty()) {
+        /* base is a register without a scale, [eax*2] has an index only */
+        const unsigned int bytes = (unsigned int)regs[0].first >> 3u;
+
+        if (regs.size() > 2) {
+            error(lineno,"too many registers in the address");
+            return false;
+        }
+        if (regs.size() == 2 && regs[0].second != 0 && regs[1].second == 0) std::swap(regs[0],regs[1]);
+        for (size_t i=0;i < regs.size();i++) {
+            if (((unsigned int)regs[i].first >> 3u) != bytes || (i == 0 && regs.size() == 2 && regs[0].second != 0)) {
+                error(lineno,"bad address registers");
+                return false;
+            }
+        }
+        mem->addr_bytes = (unsigned char)bytes;
+        if (regs.size() == 1 && regs[0].second != 0) {
+            mem->index = regs[0].first & 7;
+            mem->scale = regs[0].second;
+        }
+        else {
+            mem->base = regs[0].first & 7;
+            if (regs.size() == 2) {
+                mem->index = regs[1].first & 7;
+                mem->scale = regs[1].second;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool Assembler::parse_operand(const char *p,const char *e,AsmOperand &o,const unsigned int lineno) {
+    static const struct { const char *w; unsigned char bytes; } sizes[] = {
+        { "byte", 1 }, { "word", 2 }, { "dword", 4 }, { "fword", 6 }, { "qword", 8 }, { "tword", 10 }, { "oword", 16 }
+    };
+
+    /* size and distance keywords */
+    for (;;) {
+        const char *s = p = asm_skip(p,e);
+        bool kw = false;
+
+        while (p < e && isalpha((unsigned char)*p)) p++;
+        if (p < e && asm_word_char(*p)) { p = s; break; }
+        const std::string w = asm_lower(s,p);
+
+        for (const auto &z : sizes)
+            if (w == z.w) { o.size = z.bytes; kw = true; }
+        if (w == "far")   { o.far = true; kw = true; }
+        if (w == "near")  { o.jump = ASM_JUMP_NEAR; kw = true; }
+        if (w == "short") { o.jump = ASM_JUMP_SHORT; kw = true; }
+        if (w == "ptr")   kw = true;
+        if (!kw || asm_skip(p,e) >= e) { p = s; break; }
+    }
+
+    p = asm_skip(p,e);
+    while (e > p && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r')) e--;
+    if (p >= e) {
+        error(lineno,"missing operand");
+        return false;
+    }
+
+    /* es:[bx] */
+    if ((e - p) > 3 && p[2] == ':' && asm_segment(asm_lower(p,p+2),o.seg)) {
+        const char *q = asm_skip(p+3,e);
+
+        if (q < e && *q == '[') p = q;
+        else o.seg = PREFIX_SEG_NONE;
+    }
+
+    if (*p == '[') {
+        const char *q;
+
+        if (e[-1] != ']') {
+            error(lineno,"missing ]");
+            return false;
+        }
+        o.type = ASM_OPND_MEM;
+        p = asm_skip(p+1,e-1);
+        e--;
+        if ((e - p) > 3 && p[2] == ':' && asm_segment(asm_lower(p,p+2),o.seg))
+            p = asm_skip(p+3,e);
+        if (p >= e) {
+            o.empty = true;
+            return true;
+        }
+        q = p;
+        if (!parse_expr(q,e,o.expr,&o,lineno)) return false;
+        if (asm_skip(q,e) != e) {
+            error(lineno,"junk in address");
+            return false;
+        }
+        return true;
+    }
+
+    {
+        const char *q = p;
+
+        while (q < e && asm_word_char(*q)) q++;
+        const std::string w = asm_lower(p,q);
+
+        /* st(1) */
+        if (w == "st" && asm_skip(q,e) < e && *asm_skip(q,e) == '(') {
+            const char *r = asm_skip(asm_skip(q,e)+1,e);
+
+            if ((e - r) >= 2 && *r >= '0' && *r <= '7' && *asm_skip(r+1,e) == ')' && asm_skip(r+1,e) == e-1) {
+                o.type = ASM_OPND_REG;
+                o.reg_class = ASM_REG_ST;
+                o.reg = (unsigned char)(*r - '0');
+                return true;
+            }
+        }
+        if (q == e && asm_register(w,o)) return true;
+        if (q == e && !w.empty() && !isdigit((unsigned char)w[0])) o.name = w;
+    }
+
+    o.type = ASM_OPND_IMM;
+    if (!parse_expr(p,e,o.expr,NULL,lineno)) return false;
+    p = asm_skip(p,e);
+    if (p < e && *p == ':') {
+        o.type = ASM_OPND_FARPTR;
+        o.seg_expr = o.expr;
+        o.expr = AsmExpr();
+        p++;
+        if (!parse_expr(p,e,o.expr,NULL,lineno)) return false;
+        p = asm_skip(p,e);
+    }
+    if (p != e) {
+        error(lineno,"junk after operand");
+        return false;
+    }
+
+    return true;
+}
+
+bool Assembler::parse_line(const char *p,const char *e,const unsigned int lineno) {
+    AsmLine l;
+    const char *s;
+    char q = 0;
+
+    l.lineno = lineno;
+
+    /* comment, outside quotes */
+    for (s=p;s < e;s++) {
+        if (q != 0) { if (*s == q) q = 0; }
+        else if (*s == '\'' || *s == '"') q = *s;
+        else if (*s == ';') break;
+    }
+    e = s;
+    p = asm_skip(p,e);
+    while (e > p && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r')) e--;
+    if (p >= e) return true;
+
+    /* [bits 32] */
+    if (*p == '[' && e[-1] == ']') {
+        p = asm_skip(p+1,e-1);
+        e--;
+    }
+
+    s = p;
+    while (p < e && asm_word_char(*p)) p++;
+    if (p == s) {
+        error(lineno,"syntax error");
+        return false;
+    }
+    {
+        const char *c = asm_skip(p,e);
+
+        if (c < e && *c == ':') {
+            const std::string name = std::string(s,(size_t)(p - s));
+            uint32_t i;
+
+            if (name[0] != '.') global = name;
+            i = label(name,lineno);
+            if (label_line[i] != 0) {
+                error(lineno,"label '" + label_name[i] + "' already defined on line " + std::to_string(label_line[i]));
+                return false;
+            }
+            label_line[i] = lineno;
+            l.label = i;
+
+            p = s = asm_skip(c+1,e);
+            while (p < e && asm_word_char(*p)) p++;
+            if (p == s) {
+                l.bits = bits;
+                lines.push_back(std::move(l));
+                return true;
+            }
+        }
+    }
+
+    std::string w = asm_lower(s,p);
+
+    if (w == "bits" || w == "use16" || w == "use32") {
+        AsmExpr x;
+        int64_t v = w == "use16" ? 16 : 32;
+
+        if (w == "bits") {
+            if (!parse_expr(p,e,x,NULL,lineno)) return false;
+            v = x.labels.empty() ? x.value : 0;
+        }
+        if (v != 16 && v != 32) {
+            error(lineno,"bits must be 16 or 32");
+            return false;
+        }
+        bits = (unsigned int)v;
+        return true;
+    }
+    if (w == "org") {
+        AsmExpr x;
+
+        if (!parse_expr(p,e,x,NULL,lineno)) return false;
+        if (!x.labels.empty() || std::any_of(lines.begin(),lines.end(),[](const AsmLine &k) { return k.mnemonic >= 0 || k.data_size != 0; })) {
+            error(lineno,"org must be a number, ahead of any code");
+            return false;
+        }
+        org = (uint64_t)x.value;
+        return true;
+    }
+    if (w == "cpu" || w == "section" || w == "segment" || w == "global" || w == "extern")
+        return true;
+
+    l.bits = bits;
+    if (w == "db" || w == "dw" || w == "dd") {
+        l.data_size = w == "db" ? 1 : (w == "dw" ? 2 : 4);
+        for (;;) {
+            p = asm_skip(p,e);
+            if (p < e && (*p == '\'' || *p == '"') && l.data_size == 1) {
+                const char *c = p + 1;
+
+                while (c < e && *c != *p) c++;
+                if (c >= e) {
+                    error(lineno,"unterminated string");
+                    return false;
+                }
+                for (const char *k=p+1;k < c;k++) {
+                    AsmExpr x;
+
+                    x.value = (unsigned char)*k;
+                    l.data.push_back(x);
+                }
+                p = c + 1;
+            }
+            else {
+                AsmExpr x;
+
+                if (!parse_expr(p,e,x,NULL,lineno)) return false;
+                l.data.push_back(x);
+            }
+            p = asm_skip(p,e);
+            if (p >= e) break;
+            if (*p != ',') {
+                error(lineno,"expected ,");
+                return false;
+            }
+            p++;
+        }
+        lines.push_back(std::move(l));
+        return true;
+    }
+
+    /* prefixes, when something follows them */
+    for (;;) {
+        const char *n = asm_skip(p,e);
+        unsigned int seg;
+        unsigned char b = 0;
+
+        if (n >= e || !asm_word_char(*n)) break;
+        if (w == "lock") b = lock_byte;
+        else if (w == "rep" || w == "repe" || w == "repz") b = rep_byte[PREFIX_REP_Z];
+        else if (w == "repne" || w == "repnz") b = rep_byte[PREFIX_REP_NZ];
+        else if (w == "repc") b = rep_byte[PREFIX_REP_C];
+        else if (w == "repnc") b = rep_byte[PREFIX_REP_NC];
+        else if (w == "wait" && at.lookup("wait",4) < 0) b = wait_byte;
+        else if (asm_segment(w,seg)) b = seg_byte[seg];
+        else break;
+        if (b == 0) {
+            error(lineno,"no " + w + " prefix on this CPU");
+            return false;
+        }
+        l.prefixes.push_back(b);
+
+        s = p = n;
+        while (p < e && asm_word_char(*p)) p++;
+        w = asm_lower(s,p);
+    }
+
+    if ((l.mnemonic=at.lookup(w.data(),w.size())) < 0) {
+        error(lineno,"unknown instruction '" + w + "'");
+        return false;
+    }
+
+    /* operands, split at commas outside [] and quotes */
+    p = asm_skip(p,e);
+    while (p < e) {
+        const char *c = p;
+        int depth = 0;
+
+        for (q=0;c < e;c++) {
+            if (q != 0) { if (*c == q) q = 0; }
+            else if (*c == '\'' || *c == '"') q = *c;
+            else if (*c == '[' || *c == '(') depth++;
+            else if (*c == ']' || *c == ')') depth--;
+            else if (*c == ',' && depth == 0) break;
+        }
+        l.opnd.push_back(AsmOperand());
+        if (!parse_operand(p,c,l.opnd.back(),lineno)) return false;
+        if (l.opnd.size() > fmt_max_operands) {
+            error(lineno,"too many operands");
+            return false;
+        }
+        p = c < e ? c + 1 : c;
+        if (c < e && asm_skip(p,e) >= e) {
+            error(lineno,"missing operand");
+            return false;
+        }
+    }
+
+    lines.push_back(std::move(l));
+    insns++;
+    return true;
+}
+
+bool asm_fits(const int64_t v,const unsigned int bytes,const bool sign) {
+    if (bytes >= 8u) return true;
+
+    const int64_t lim = (int64_t)1 << (bytes * 8u);
+
+    return v >= -(lim / 2) && v < (sign ? (lim / 2) : lim);
+}
+
+void asm_put(unsigned char *b,unsigned int &n,const uint64_t v,const unsigned int bytes) {
+    for (unsigned int i=0;i < bytes;i++) b[n++] = (unsigned char)(v >> (8u * i));
+}
+
+/* mod/reg/rm, SIB and displacement for a memory operand. an address with a label that has no value yet gets a
+ * full size displacement */
+bool Assembler::ea(const AsmOperand &o,const unsigned int a32,const unsigned int reg,const uint64_t here,unsigned char *b,unsigned int &n,unsigned int &rm) const {
+    int64_t disp;
+    const bool known = eval(o.expr,here,disp);
+    unsigned int mod,dl;
+
+    if (!a32) {
+        /* bx+si bx+di bp+si bp+di si di bp bx */
+        static const signed char pair[8][8] = {
+            { -1, -1, -1, -1, -1, -1, -1, -1 },
+            { -1, -1, -1, -1, -1, -1, -1, -1 },
+            { -1, -1, -1, -1, -1, -1, -1, -1 },
+            { -1, -1, -1, -1, -1, -1,  0,  1 },
+            { -1, -1, -1, -1, -1, -1, -1, -1 },
+            { -1, -1, -1, -1, -1, -1,  2,  3 },
+            { -1, -1, -1,  0, -1,  2, -1, -1 },
+            { -1, -1, -1,  1, -1,  3, -1, -1 }
+        };
+        static const signed char single[8] = { -1, -1, -1, 7, -1, 6, 4, 5 };
+
+        if (o.scale != 0) return false;
+        if (!asm_fits(disp,2,false)) return false;
+        if (o.base < 0) {
+            mod = 0;
+            rm = 6;
+            dl = 2;
+        }
+        else {
+            const int r = o.index >= 0 ? pair[o.base][o.index] : single[o.base];
+
+            if (r < 0) return false;
+            rm = (unsigned int)r;
+            if (!known) dl = 2;
+            else if (disp == 0 && rm != 6) dl = 0;
+            else dl = asm_fits(disp,1,true) ? 1 : 2;
+            mod = dl;
+        }
+        b[n++] = (unsigned char)((mod << 6u) | (reg << 3u) | rm);
+        asm_put(b,n,(uint64_t)disp,dl);
+        return true;
+    }
+
+    int base = o.base,index = o.index;
+    const unsigned int scale = o.scale;
+
+    if (!asm_fits(disp,4,false)) return false;
+    if (index == 4) {
+        if (scale != 0 || base == 4) return false;
+        std::swap(base,index);
+    }
+    if (base < 0 && index < 0) {
+        mod = 0;
+        rm = 5;
+        dl = 4;
+        b[n++] = (unsigned char)((reg << 3u) | rm);
+    }
+    else {
+        if (base < 0) dl = 4;
+        else if (!known) dl = 4;
+        else if (disp == 0 && base != 5) dl = 0;
+        else dl = asm_fits(disp,1,true) ? 1 : 4;
+        mod = base < 0 ? 0u : (dl == 4 ? 2u : dl);
+
+        if (index < 0 && base != 4) {
+            rm = (unsigned int)base;
+            b[n++] = (unsigned char)((mod << 6u) | (reg << 3u) | rm);
+        }
+        else {
+            rm = 4;
+            b[n++] = (unsigned char)((mod << 6u) | (reg << 3u) | rm);
+            b[n++] = (unsigned char)((scale << 6u) | ((index < 0 ? 4u : (unsigned int)index) << 3u) | (base < 0 ? 5u : (unsigned int)base));
+        }
+    }
+    asm_put(b,n,(uint64_t)disp,dl);
+    return true;
+}
+
+bool asm_gpr(const AsmOperand &o,const unsigned int bytes) {
+    return o.type == ASM_OPND_REG && o.reg_class == ASM_REG_GPR && o.reg_bytes == bytes;
+}
+
+bool asm_reg(const AsmOperand &o,const unsigned int c) {
+    return o.type == ASM_OPND_REG && o.reg_class == c;
+}
+
+unsigned int asm_lowest(const unsigned int mask) {
+    unsigned int i = 0;
+
+    while (i < 8 && mask != 0 && !(mask & (1u << i))) i++;
+    return i & 7u;
+}
+
+/* one form at one operand size, false if the operands do not fit it. wraps is set if a negative immediate goes
+ * into an unsigned field, which loses to a sign extended form of the same length */
+bool Assembler::encode(const AsmLine &l,const AsmForm &f,const unsigned int o32,unsigned char *b,unsigned int &n,bool &wraps) const {
+    const size_t i = f.opcode;
+    const AsmEncoding &e = at.enc[i];
+    const auto &d = at.ft.opnd[i];
+    const unsigned int fl = at.ft.flags[i];
+    const unsigned int def32 = l.bits == 32 ? 1u : 0u;
+    const AsmOperand *mem = NULL,*rel = NULL;
+    int reg = -1,rm = -1,opreg = -1,implied = -1;
+    unsigned int a32 = def32,seg = PREFIX_SEG_NONE,k,count = 0,mod = 3;
+    unsigned int imm_len[2] = { 0, 0 },rel_slot = 0;
+    uint64_t imm[2] = { 0, 0 };
+    int64_t v;
+
+    wraps = false;
+    if (f.o32 != asm_o32_any && f.o32 != o32) return false;
+    while (count < fmt_max_operands && d[count] != 0) count++;
+    if (count != l.opnd.size()) return false;
+
+    /* address size from the registers of a memory operand, or from how far a bare offset reaches */
+    for (const auto &o : l.opnd) {
+        if (o.type != ASM_OPND_MEM || o.empty) continue;
+        if (o.addr_bytes != 0) a32 = o.addr_bytes == 4 ? 1u : 0u;
+        else if (!def32 && eval(o.expr,l.addr,v) && !asm_fits(v,2,false)) a32 = 1;
+    }
+    for (k=0;k < 2;k++) {
+        const unsigned int t = at.ft.imm[i][k];
+
+        if (t != 0) imm_len[k] = (t & fmt_imm_offset) ? (a32 ? 4u : 2u) : mem_size_bytes[t & 0xFu][o32];
+    }
+
+    /* two operands can be described on the same field (MOV reg,sreg), then they have to agree */
+    for (k=0;k < count;k++) {
+        const AsmOperand &o = l.opnd[k];
+        const unsigned int kind = d[k] & 0x1Fu,size = (d[k] >> 5u) & 0xFu,arg = d[k] >> 9u;
+        const unsigned int bytes = size < MEM_SIZE_MAX ? mem_size_bytes[size][o32] : 0u;
+
+        switch (kind) {
+            case FMT_REG:
+                if (!asm_gpr(o,bytes) || (reg >= 0 && reg != o.reg)) return false;
+                reg = o.reg;
+                break;
+            case FMT_OPREG:
+                if (!asm_gpr(o,bytes)) return false;
+                opreg = o.reg;
+                break;
+            case FMT_GPR:
+                if (!asm_gpr(o,bytes) || o.reg != arg) return false;
+                break;
+            case FMT_RM:
+            case FMT_MM_RM:
+            case FMT_XMM_RM:
+                if (o.type == ASM_OPND_REG) {
+                    if (kind == FMT_RM ? !asm_gpr(o,bytes) : !asm_reg(o,kind == FMT_MM_RM ? ASM_REG_MM : ASM_REG_XMM)) return false;
+                    if (rm >= 0 || mem != NULL) return false;
+                    rm = o.reg;
+                }
+                else if (o.type == ASM_OPND_MEM && !o.empty) {
+                    if (fl & fmt_flag_far) { if (!o.far || o.size != 0) return false; }
+                    else if (o.far || (o.size != 0 && o.size != bytes)) return false;
+                    if (rm >= 0 || mem != NULL) return false;
+                    mem = &o;
+                    seg = o.seg;
+                }
+                else return false;
+                break;
+            case FMT_SREG:
+            case FMT_CR:
+            case FMT_DR:
+            case FMT_TR:
+            case FMT_MM_REG:
+            case FMT_XMM_REG: {
+                static const unsigned char cls[FMT_MAX] = {
+                    0,0,0,0,0,ASM_REG_SREG,0,ASM_REG_CR,ASM_REG_DR,ASM_REG_TR,0,0,0,ASM_REG_MM,0,0,0,ASM_REG_XMM
+                };
+
+                if (!asm_reg(o,cls[kind]) || (reg >= 0 && reg != o.reg)) return false;
+                reg = o.reg;
+                break;
+            }
+            case FMT_SREGN:
+                if (!asm_reg(o,ASM_REG_SREG) || o.reg != arg) return false;
+                break;
+            case FMT_ST:
+                if (!asm_reg(o,ASM_REG_ST) || o.reg != arg) return false;
+                break;
+            case FMT_MMN:
+                if (!asm_reg(o,ASM_REG_MM) || o.reg != arg) return false;
+                break;
+            case FMT_XMMN:
+                if (!asm_reg(o,ASM_REG_XMM) || o.reg != arg) return false;
+                break;
+            case FMT_ST_RM:
+                if (!asm_reg(o,ASM_REG_ST) || rm >= 0 || mem != NULL) return false;
+                rm = o.reg;
+                break;
+            case FMT_MM_IMPLIED:
+                if (!asm_reg(o,ASM_REG_MM)) return false;
+                implied = o.reg;
+                break;
+            case FMT_CONST:
+                if (o.type != ASM_OPND_IMM || o.size != 0 || !eval(o.expr,l.addr,v) || v != (int64_t)arg) return false;
+                break;
+            case FMT_IMM:
+                if (o.type != ASM_OPND_IMM || o.far || o.jump != ASM_JUMP_ANY || arg > 1u) return false;
+                if (o.size != 0 && o.size != imm_len[arg]) return false;
+                if (!eval(o.expr,l.addr,v)) v = 0;
+                if (!asm_fits(v,imm_len[arg],(at.ft.imm[i][arg] & fmt_imm_signed) != 0)) return false;
+                if (v < 0 && !(at.ft.imm[i][arg] & fmt_imm_signed)) wraps = true;
+                imm[arg] = (uint64_t)v;
+                break;
+            case FMT_REL:
+                if (o.type != ASM_OPND_IMM || o.far || o.size != 0 || arg > 1u) return false;
+                if (o.jump == ASM_JUMP_SHORT && imm_len[arg] != 1u) return false;
+                if (o.jump == ASM_JUMP_NEAR && imm_len[arg] == 1u) return false;
+                rel = &o;
+                rel_slot = arg;
+                break;
+            case FMT_FARPTR: {
+                int64_t sv;
+
+                if (o.type != ASM_OPND_FARPTR || arg > 1u || imm_len[arg] < 3u) return false;
+                if (!eval(o.expr,l.addr,v)) v = 0;
+                if (!eval(o.seg_expr,l.addr,sv)) sv = 0;
+                if (!asm_fits(v,imm_len[arg] - 2u,false) || !asm_fits(sv,2,false)) return false;
+                imm[arg] = ((uint64_t)v & ((((uint64_t)1u) << ((imm_len[arg] - 2u) * 8u)) - 1u)) | ((uint64_t)(sv & 0xFFFF) << ((imm_len[arg] - 2u) * 8u));
+                break;
+            }
+            case FMT_MOFFS:
+                if (o.type != ASM_OPND_MEM || o.empty || o.far || o.addr_bytes != 0 || arg > 1u) return false;
+                if (o.size != 0 && o.size != bytes) return false;
+                if (!eval(o.expr,l.addr,v)) v = 0;
+                if (!asm_fits(v,imm_len[arg],false)) return false;
+                imm[arg] = (uint64_t)v;
+                seg = o.seg;
+                break;
+            case FMT_MEM:
+                if (o.type != ASM_OPND_MEM || o.far || (o.size != 0 && o.size != bytes)) return false;
+                if (arg == MEM_SRC_STACK) {
+                    if (o.base != 4 || o.index >= 0 || !o.expr.labels.empty() || o.expr.value != 0) return false;
+                }
+                else if ((arg == MEM_SRC_SI || arg == MEM_SRC_DI) && !o.empty) {
+                    /* [edi], [di], [es:edi] as opcc_fmt_implied() prints them */
+                    if (o.base != (arg == MEM_SRC_SI ? 6 : 7) || o.index >= 0 || !o.expr.labels.empty() || o.expr.value != 0) return false;
+                    seg = o.seg;
+                }
+                else if (!o.empty) return false;
+                break;
+            case FMT_NAME:
+                if (o.name.empty() || o.name != at.ft.names[arg]) return false;
+                break;
+            default:
+                return false;
+        }
+    }
+
+    if (e.flags & asm_enc_modrm) {
+        if (reg < 0) reg = (int)asm_lowest(e.reg_mask);
+        if (e.reg_mask != 0 && !(e.reg_mask & (1u << reg))) return false;
+        if (mem == NULL) {
+            if (e.flags & asm_enc_mem) return false;
+            if (rm < 0) rm = (int)asm_lowest(e.rm_mask);
+            if (e.rm_mask != 0 && !(e.rm_mask & (1u << rm))) return false;
+        }
+        else if (e.flags & asm_enc_mod3) return false;
+        if (implied >= 0 && implied != (reg ^ 1)) return false;
+    }
+    else if (reg >= 0 || rm >= 0 || mem != NULL || implied >= 0) {
+        return false;
+    }
+    if (e.flags & asm_enc_opreg) {
+        if (opreg < 0 || (e.reg_mask != 0 && !(e.reg_mask & (1u << opreg)))) return false;
+    }
+    else if (opreg >= 0) {
+        return false;
+    }
+
+    n = 0;
+    for (const auto p : l.prefixes) b[n++] = p;
+    if (seg != PREFIX_SEG_NONE) {
+        if (seg_byte[seg] == 0) return false;
+        b[n++] = seg_byte[seg];
+    }
+    if (o32 != def32) {
+        if (opsize_byte == 0 || e.op[0] == opsize_byte) return false;
+        b[n++] = opsize_byte;
+    }
+    if (a32 != def32) {
+        if (addrsize_byte == 0) return false;
+        b[n++] = addrsize_byte;
+    }
+    for (k=0;k < e.op_len;k++) b[n++] = e.op[k];
+    if (e.flags & asm_enc_opreg) b[n-1u] |= (unsigned char)opreg;
+
+    if (e.flags & asm_enc_modrm) {
+        if (mem != NULL) {
+            unsigned int r;
+
+            if (!ea(*mem,a32,(unsigned int)reg,l.addr,b,n,r)) return false;
+            if (e.rm_mask != 0 && !(e.rm_mask & (1u << r))) return false;
+        }
+        else {
+            b[n++] = (unsigned char)((mod << 6u) | ((unsigned int)reg << 3u) | (unsigned int)rm);
+        }
+    }
+    if (e.flags & asm_enc_suffix) b[n++] = e.suffix;
+
+    if (rel != NULL) {
+        /* relative to the end of the instruction, in the IP of the operand size */
+        const uint64_t next = l.addr + n + imm_len[0] + imm_len[1];
+        const unsigned int w = o32 ? 32u : 16u;
+        int64_t t;
+
+        if (!eval(rel->expr,l.addr,t)) t = (int64_t)next;
+        v = (int64_t)(((uint64_t)t - next) & ((((uint64_t)1u) << w) - 1u));
+        if (v >= ((int64_t)1 << (w - 1u))) v -= (int64_t)1 << w;
+        if ((imm_len[rel_slot] * 8u) < w && !asm_fits(v,imm_len[rel_slot],true)) return false;
+        imm[rel_slot] = (uint64_t)v;
+    }
+    for (k=0;k < 2;k++) asm_put(b,n,imm[k],imm_len[k]);
+
+    return n <= asm_insn_max;
+}
+
+bool Assembler::assemble(const char *p,const size_t size) {
+    const char *e = p + size;
+    unsigned int lineno = 1,pass;
+    bool settled = false;
+
+    while (p < e) {
+        const char *nl = (const char*)memchr(p,'\n',(size_t)(e - p));
+
+        if (nl == NULL) nl = e;
+        if (!parse_line(p,nl,lineno)) parse_errors++;
+        p = nl + (nl < e ? 1 : 0);
+        lineno++;
+    }
+    if (parse_errors != 0) {
+        for (const auto &s : errors) fprintf(stderr,"%s\n",s.c_str());
+        return false;
+    }
+
+    for (pass=1;pass <= asm_max_passes && !settled;pass++) {
+        uint64_t addr = org;
+        unsigned char b[asm_insn_max];
+
+        settled = true;
+        errors.clear();
+        out.clear();
+        for (auto &l : lines) {
+            l.addr = addr;
+            if (l.label != asm_no_label) {
+                if (!label_known[l.label] || label_addr[l.label] != (int64_t)addr) settled = false;
+                label_addr[l.label] = (int64_t)addr;
+                label_known[l.label] = true;
+            }
+
+            if (l.data_size != 0) {
+                for (const auto &x : l.data) {
+                    int64_t v;
+                    unsigned int n = 0;
+
+                    if (!eval(x,l.addr,v)) v = 0;
+                    if (!asm_fits(v,l.data_size,false)) error(l.lineno,"value does not fit");
+                    asm_put(b,n,(uint64_t)v,l.data_size);
+                    out.insert(out.end(),b,b+n);
+                }
+                l.len = (unsigned int)(l.data.size() * l.data_size);
+            }
+            else if (l.mnemonic >= 0) {
+                const AsmMnemonic &m = at.mnemonics[(size_t)l.mnemonic];
+                const unsigned int def32 = l.bits == 32 ? 1u : 0u;
+                unsigned char best[asm_insn_max];
+                unsigned int best_len = 0,n;
+                bool best_wraps = false,wraps;
+
+                for (unsigned int r=0;r < 2 && best_len == 0;r++) {
+                    for (uint32_t f=m.first;f < (m.first + m.count);f++) {
+                        if (!encode(l,at.forms[f],def32 ^ r,b,n,wraps)) continue;
+                        if (best_len == 0 || n < best_len || (n == best_len && best_wraps && !wraps)) {
+                            memcpy(best,b,n);
+                            best_len = n;
+                            best_wraps = wraps;
+                        }
+                    }
+                }
+                if (best_len == 0) error(l.lineno,"no form of '" + m.name + "' takes these operands");
+                out.insert(out.end(),best,best+best_len);
+                l.len = best_len;
+            }
+            addr += l.len;
+        }
+    }
+
+    for (size_t i=0;i < label_name.size();i++)
+        if (label_line[i] == 0) error(label_ref[i],"undefined label '" + label_name[i] + "'");
+    if (!settled) error(lines.empty() ? 0 : lines.back().lineno,"code sizes did not settle in " + std::to_string(asm_max_passes) + " passes");
+    for (const auto &s : errors) fprintf(stderr,"%s\n",s.c_str());
+    if (!errors.empty()) return false;
+
+    fprintf(stderr,"%u lines, %zu instructions, %zu bytes, %u passes\n",lineno-1u,insns,out.size(),pass-1u);
+    return true;
+}
+
+bool assemble_file(void) {
+    const uint8_t *p = NULL;
+    size_t size = 0;
+    Assembler as;
+    bool ok;
+
+    if (disasm_mode != 16 && disasm_mode != 32) {
+        fprintf(stderr,"-mode must be 16 or 32\n");
+        return false;
+    }
+    if (!map_input_file(assemblefile,p,size))
+        return false;
+
+    as.build(disasm_mode);
+    as.path = assemblefile;
+    ok = as.assemble((const char*)p,size);
+    if (p) munmap((void*)p,size);
+    if (!ok)
+        return false;
+
+    fwrite(as.out.data(),as.out.size(),1,stdout);
+    fflush(stdout);
+    if (ferror(stdout)) {
+        fprintf(stderr,"Error writing assembler output\n");
+        return false;
+    }
+
+    return true;
+}
+
+/* -emit: header-only C++ instruction emitter for JIT backends, one inline function per form at the -mode code
+ * segment size, built from the assembler tables. the form is picked by overload resolution, so the operand types
+ * carry what the assembler works out from text: r8/r16/r32 and the other register types, fixed registers as
+ * types of their own (al_t derives from r8, so add(p,al,imm8(1)) gets the accumulator form and add(p,bl,imm8(1))
+ * the mod/reg/rm one), memory sized by type and immediates by width and sign. operand constructors and the
+ * mod/reg/rm and SIB math are constexpr and an emitter only stores bytes, so with constant operands it comes down
+ * to a few constant stores. when two forms take the same operand types the first one in the description wins.
+ * OPCC_EMIT_FORMS(X) lists every emitter with sample operands for round trip tests (toy/emitcheck.cpp) */
+const char *emit_gpr_name[3][8] = {
+    { "al", "cl", "dl", "bl", "ah", "ch", "dh", "bh" },
+    { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di" },
+    { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi" }
+};
+
+const char *emit_sreg_name[6] = { "es", "cs", "ss", "ds", "fs", "gs" };
+
+const unsigned int emit_sample_reg = 2;             // reg field operands of the sample calls
+const unsigned int emit_sample_rm = 3;              // rm field
+const unsigned int emit_sample_opreg = 1;           // low bits of the opcode
+
+class EmitForm {
+public:
+    std::string                 name;
+    std::string                 params;             // "uint8_t *&p,r32 a,imm8s b"
+    std::string                 sample;             // "add(p,r32(3),imm8s(-5))"
+    std::string                 signature;          // name and parameter types, to drop forms a earlier one covers
+    std::vector<std::string>    body;
+    unsigned int                length = 0;         // longest output
+};
+
+int emit_gpr_index(const unsigned int bytes) {
+    return bytes == 1u ? 0 : (bytes == 2u ? 1 : (bytes == 4u ? 2 : -1));
+}
+
+std::string emit_gpr_type(const unsigned int bytes) {
+    static const char *t[3] = { "r8", "r16", "r32" };
+    const int i = emit_gpr_index(bytes);
+
+    return i >= 0 ? t[i] : "";
+}
+
+std::string emit_mem_type(const unsigned int size,const unsigned int bytes) {
+    if (size == MEM_SIZE_FPV) return bytes == 4u ? "m16_16" : "m16_32";
+
+    switch (bytes) {
+        case 0:  return "mem";
+        case 1:  return "m8";
+        case 2:  return "m16";
+        case 4:  return "m32";
+        case 6:  return "m48";
+        case 8:  return "m64";
+        case 10: return "m80";
+        case 16: return "m128";
+        default: break;
+    }
+
+    return "mem_n<" + std::to_string(bytes) + ">";
+}
+
+std::string emit_hex(const unsigned int v) {
+    char tmp[16];
+
+    sprintf(tmp,"0x%02x",v);
+    return tmp;
+}
+
+/* one form at one operand size, register or memory variant of the r/m operand. false if it does not make an
+ * emitter: no r/m operand to take the memory variant, or an operand the emitter has no type for */
+bool emit_form(const Assembler &as,const std::string &name,const size_t i,const unsigned int o32,const bool mem,EmitForm &f) {
+    const AsmEncoding &e = as.at.enc[i];
+    const auto &d = as.at.ft.opnd[i];
+    const unsigned int def32 = as.bits == 32 ? 1u : 0u;
+    const std::string mem_sample = def32 ? "ptr(ebx,esi,4,0x44)" : "ptr(bx,si,0x44)";
+    std::string reg,rm,opreg,mp,moffs,imm[2],types;
+    unsigned int imm_len[2] = { 0, 0 },imm_kind[2] = { FMT_NONE, FMT_NONE },k,count = 0,at = 0;
+    unsigned int sreg = emit_sample_reg,srm = emit_sample_rm,sopreg = emit_sample_opreg;
+    bool has_rm = false;
+
+    if (e.reg_mask != 0 && !(e.reg_mask & (1u << sreg))) sreg = asm_lowest(e.reg_mask);
+    if (e.reg_mask != 0 && !(e.reg_mask & (1u << sopreg))) sopreg = asm_lowest(e.reg_mask);
+    if (e.rm_mask != 0 && !(e.rm_mask & (1u << srm))) srm = asm_lowest(e.rm_mask);
+
+    while (count < fmt_max_operands && d[count] != 0) count++;
+    for (k=0;k < count;k++) {
+        const unsigned int kind = d[k] & 0x1Fu;
+
+        if (kind == FMT_RM || kind == FMT_MM_RM || kind == FMT_XMM_RM) has_rm = true;
+    }
+    if (mem && (!has_rm || (e.flags & asm_enc_mod3))) return false;
+    if (!mem && has_rm && (e.flags & asm_enc_mem)) return false;
+    if ((e.flags & asm_enc_mem) && !has_rm) return false;
+
+    for (k=0;k < 2;k++) {
+        const unsigned int t = as.at.ft.imm[i][k];
+
+        if (t != 0) imm_len[k] = (t & fmt_imm_offset) ? (def32 ? 4u : 2u) : mem_size_bytes[t & 0xFu][o32];
+    }
+
+    f.name = name;
+    f.params = "uint8_t *&p";
+    f.sample = name + "(p";
+    for (k=0;k < count;k++) {
+        const unsigned int kind = d[k] & 0x1Fu,size = (d[k] >> 5u) & 0xFu,arg = d[k] >> 9u;
+        const unsigned int bytes = size < MEM_SIZE_MAX ? mem_size_bytes[size][o32] : 0u;
+        const std::string pn(1,(char)('a' + k));
+        std::string t,s;
+        bool named = true;
+
+        switch (kind) {
+            case FMT_REG:
+            case FMT_SREG:
+            case FMT_CR:
+            case FMT_DR:
+            case FMT_TR:
+            case FMT_MM_REG:
+            case FMT_XMM_REG:
+                /* a second operand on the reg field (MOV reg,sreg) is the same register */
+                switch (kind) {
+                    case FMT_REG:   t = emit_gpr_type(bytes); break;
+                    case FMT_SREG:  t = "sreg"; break;
+                    case FMT_CR:    t = "creg"; break;
+                    case FMT_DR:    t = "dreg"; break;
+                    case FMT_TR:    t = "treg"; break;
+                    case FMT_MM_REG: t = "mm"; break;
+                    default:        t = "xmm"; break;
+                }
+                if (t.empty()) return false;
+                if (reg.empty()) reg = pn + ".n";
+                else named = false;
+                s = t + "(" + std::to_string(sreg) + ")";
+                break;
+            case FMT_OPREG:
+                if ((t=emit_gpr_type(bytes)).empty()) return false;
+                if (opreg.empty()) opreg = pn + ".n";
+                else named = false;
+                s = t + "(" + std::to_string(sopreg) + ")";
+                break;
+            case FMT_GPR:
+                if (emit_gpr_index(bytes) < 0 || arg > 7u) return false;
+                s = emit_gpr_name[emit_gpr_index(bytes)][arg];
+                t = s + "_t";
+                named = false;
+                break;
+            case FMT_RM:
+            case FMT_MM_RM:
+            case FMT_XMM_RM:
+                if (!rm.empty() || !mp.empty()) return false;
+                if (mem) {
+                    t = emit_mem_type(size,bytes);
+                    s = t == "mem" ? mem_sample : t + "(" + mem_sample + ")";
+                    mp = pn;
+                }
+                else {
+                    t = kind == FMT_RM ? emit_gpr_type(bytes) : (kind == FMT_MM_RM ? "mm" : "xmm");
+                    if (t.empty()) return false;
+                    s = t + "(" + std::to_string(srm) + ")";
+                    rm = pn + ".n";
+                }
+                break;
+            case FMT_SREGN:
+                if (arg > 5u) return false;
+                s = emit_sreg_name[arg];
+                t = s + "_t";
+                named = false;
+                break;
+            case FMT_ST:
+            case FMT_MMN:
+            case FMT_XMMN:
+                s = std::string(kind == FMT_ST ? "st" : (kind == FMT_MMN ? "mm" : "xmm")) + std::to_string(arg & 7u);
+                t = s + "_t";
+                named = false;
+                break;
+            case FMT_ST_RM:
+                if (!rm.empty() || !mp.empty()) return false;
+                t = "st";
+                s = "st(" + std::to_string(srm) + ")";
+                rm = pn + ".n";
+                break;
+            case FMT_MM_IMPLIED:
+                t = "mm";
+                s = "mm(" + std::to_string(sreg ^ 1u) + ")";
+                named = false;
+                break;
+            case FMT_CONST:
+                t = "imm_const<" + std::to_string(arg) + ">";
+                s = t + "()";
+                named = false;
+                break;
+            case FMT_IMM:
+            case FMT_REL:
+            case FMT_FARPTR:
+            case FMT_MOFFS: {
+                static const char *iv[5] = { "", "0x12", "0x1234", "", "0x12345678" };
+
+                if (arg > 1u || imm_len[arg] == 0) return false;
+                if (kind == FMT_IMM) {
+                    const bool sign = (as.at.ft.imm[i][arg] & fmt_imm_signed) != 0;
+
+                    if (imm_len[arg] != 1u && imm_len[arg] != 2u && imm_len[arg] != 4u) return false;
+                    t = "imm" + std::to_string(imm_len[arg] * 8u) + (sign && imm_len[arg] == 1u ? "s" : "");
+                    s = t + "(" + (sign && imm_len[arg] == 1u ? "-5" : iv[imm_len[arg]]) + ")";
+                }
+                else if (kind == FMT_REL) {
+                    if (imm_len[arg] != 1u && imm_len[arg] != 2u && imm_len[arg] != 4u) return false;
+                    t = "rel" + std::to_string(imm_len[arg] * 8u);
+                    s = t + "(" + iv[imm_len[arg]] + ")";
+                }
+                else if (kind == FMT_FARPTR) {
+                    if (imm_len[arg] != 4u && imm_len[arg] != 6u) return false;
+                    t = imm_len[arg] == 4u ? "far16" : "far32";
+                    s = t + "(0x1234," + iv[imm_len[arg] - 2u] + ")";
+                }
+                else {
+                    t = "moffs";
+                    s = "moffs(0x40)";
+                    moffs = pn;
+                }
+                if (imm[arg].empty()) imm[arg] = pn;
+                else named = false;
+                imm_kind[arg] = kind;
+                break;
+            }
+            case FMT_MEM:
+            case FMT_NAME:
+                /* implied, nothing to pass */
+                continue;
+            default:
+                return false;
+        }
+
+        types += "," + t;
+        f.params += "," + t + (named ? " " + pn : "");
+        f.sample += "," + s;
+    }
+    f.sample += ")";
+    f.signature = name + types;
+
+    if (!mp.empty()) {
+        f.body.push_back("uint8_t *q = detail::mem_prefix(p," + mp + ");");
+        f.length += 2u;
+    }
+    else if (!moffs.empty()) {
+        f.body.push_back("uint8_t *q = detail::seg_prefix(p," + moffs + ".seg);");
+        f.length += 1u;
+    }
+    else {
+        f.body.push_back("uint8_t *q = p;");
+    }
+    f.body.push_back("");
+
+    auto qat = [](const unsigned int n) { return n != 0 ? "q + " + std::to_string(n) : std::string("q"); };
+    auto put = [&](const std::string &x) {
+        f.body.push_back("q[" + std::to_string(at) + "] = " + x + ";");
+        at++;
+        f.length++;
+    };
+
+    if (o32 != def32) {
+        if (as.opsize_byte == 0 || e.op[0] == as.opsize_byte) return false;
+
+        /* where the prefix picks another opcode (MOVMSKPS, MOVMSKPD) it is not an operand size */
+        for (const auto &x : as.at.enc)
+            if (x.op_len == (e.op_len + 1u) && x.op[0] == as.opsize_byte && std::equal(e.op.begin(),e.op.begin() + e.op_len,x.op.begin() + 1))
+                return false;
+        put(emit_hex(as.opsize_byte));
+    }
+    for (k=0;k < e.op_len;k++) {
+        if ((k+1u) == e.op_len && (e.flags & asm_enc_opreg)) {
+            if (opreg.empty()) return false;
+            put("(uint8_t)(" + emit_hex(e.op[k]) + "u | " + opreg + ")");
+        }
+        else {
+            put(emit_hex(e.op[k]));
+        }
+    }
+    if (!(e.flags & asm_enc_opreg) && !opreg.empty()) return false;
+    if (e.flags & asm_enc_modrm) {
+        const std::string r = reg.empty() ? std::to_string(asm_lowest(e.reg_mask)) + "u" : reg;
+
+        if (!mp.empty()) {
+            f.body.push_back("q = detail::ea(" + qat(at) + "," + mp + "," + r + ");");
+            f.length += 6u;
+            at = 0;
+        }
+        else {
+            put("detail::modrm(3u," + r + "," + (rm.empty() ? std::to_string(asm_lowest(e.rm_mask)) + "u" : rm) + ")");
+        }
+    }
+    else if (!reg.empty() || !rm.empty() || !mp.empty()) {
+        return false;
+    }
+    if (e.flags & asm_enc_suffix) put(emit_hex(e.suffix));
+
+    for (k=0;k < 2;k++) {
+        const std::string q = qat(at);
+        const unsigned int l = imm_len[k];
+
+        if (l == 0) continue;
+        if (imm[k].empty()) {
+            for (unsigned int j=0;j < l;j++) put("0");
+            continue;
+        }
+
+        if (imm_kind[k] == FMT_FARPTR) {
+            f.body.push_back("detail::put" + std::to_string((l - 2u) * 8u) + "(" + q + "," + imm[k] + ".off);");
+            f.body.push_back("detail::put16(" + qat(at + l - 2u) + "," + imm[k] + ".seg);");
+        }
+        else {
+            const std::string v = imm[k] + (imm_kind[k] == FMT_MOFFS ? ".ofs" : ".v");
+
+            if (l == 1u) {
+                put("(uint8_t)" + v);
+                continue;
+            }
+            f.body.push_back("detail::put" + std::to_string(l * 8u) + "(" + q + ",(uint32_t)" + v + ");");
+        }
+        at += l;
+        f.length += l;
+    }
+    f.body.push_back("p = " + qat(at) + ";");
+
+    return true;
+}
+
+bool write_emit_file(void) {
+    static const char *reserved[] = {
+        "and", "and_eq", "asm", "bitand", "bitor", "compl", "int", "not", "not_eq", "or", "or_eq", "xor", "xor_eq",
+        "std", "ptr", "ptr_index", "abs16", "abs32", "seg", "segment", "lock", "rep", "repne", "repc", "repnc", "wait",
+        "opsize", "addrsize", "detail", "mem", "moffs", "sreg", "creg", "dreg", "treg", "st", "mm", "xmm", NULL
+    };
+    std::vector<EmitForm> forms;
+    std::map<std::string,size_t> seen;
+    unsigned int max_length = 0;
+    Assembler as;
+    FILE *fp;
+
+    if (disasm_mode != 16 && disasm_mode != 32) {
+        fprintf(stderr,"-mode must be 16 or 32\n");
+        return false;
+    }
+    as.build(disasm_mode);
+
+    const unsigned int def32 = as.bits == 32 ? 1u : 0u;
+
+    for (const auto &m : as.at.mnemonics) {
+        std::string name = m.name;
+
+        for (size_t r=0;reserved[r] != NULL;r++)
+            if (name == reserved[r]) name += "_";
+
+        for (uint32_t fi=m.first;fi < (m.first + m.count);fi++) {
+            const AsmForm &af = as.at.forms[fi];
+
+            for (unsigned int s=0;s < 2;s++) {
+                const unsigned int o32 = af.o32 != asm_o32_any ? af.o32 : (s == 0 ? def32 : (def32 ^ 1u));
+
+                if (af.o32 != asm_o32_any && s != 0) break;
+                for (unsigned int mv=0;mv < 2;mv++) {
+                    EmitForm f;
+
+                    if (!emit_form(as,name,af.opcode,o32,mv != 0,f)) continue;
+                    if (seen.count(f.signature) != 0) continue;
+                    seen[f.signature] = forms.size();
+                    f.sample = std::to_string(af.opcode) + "," + f.sample;
+                    max_length = std::max(max_length,f.length);
+                    forms.push_back(std::move(f));
+                }
+            }
+        }
+    }
+
+    if ((fp=fopen(emitfile.c_str(),"w")) == NULL) {
+        fprintf(stderr,"Unable to write file '%s', %s\n",emitfile.c_str(),strerror(errno));
+        return false;
+    }
+
+    fprintf(fp,"/* generated by opcc from '%s' for -march %s -fpuarch %s. do not edit. */\n",srcfile.c_str(),march.c_str(),fpuarch.c_str());
+    fprintf(fp,"/* instruction emitters for %u-bit code, C++11, no other header needed. one inline function per form:\n",as.bits);
+    fprintf(fp," *\n");
+    fprintf(fp," *   opcc_emit::add(p,ecx,imm8s(-5));               83 /0 ib, p advances past it\n");
+    fprintf(fp," *   opcc_emit::add(p,al,imm8(1));                  04 ib, al_t is the fixed register type\n");
+    fprintf(fp," *   opcc_emit::mov(p,m32(ptr(ebx,esi,4,8)),eax);   memory operands are sized by type\n");
+    fprintf(fp," *\n");
+    fprintf(fp," * registers are r8/r16/r32, sreg, creg, dreg, treg, st, mm and xmm, with a constant (and for the first\n");
+    fprintf(fp," * six kinds a type of its own) per register. memory is ptr() and friends wrapped in m8 .. m128, mem_n<N>\n");
+    fprintf(fp," * for other sizes, m16_16/m16_32 for far pointers, or mem where the size does not matter. immediates are\n");
+    fprintf(fp," * imm8, imm8s (sign extended), imm16 and imm32, branch displacements rel8/16/32 from the end of the\n");
+    fprintf(fp," * instruction, far16/far32 for seg:offset and imm_const<N> for operands the encoding implies. string\n");
+    fprintf(fp," * instructions take the b/w/d suffix and prefixes are functions of their own. operand values are not\n");
+    fprintf(fp," * checked: 16-bit addresses want bx or bp and si or di, esp is no index. */\n");
+    fprintf(fp,"#ifndef OPCC_EMIT_HPP\n");
+    fprintf(fp,"#define OPCC_EMIT_HPP\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"#include <stdint.h>\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"#define OPCC_EMIT_BITS                %u\n",as.bits);
+    fprintf(fp,"#define OPCC_EMIT_OPCODE_COUNT        %zuu /* OPCC_OPCODE_COUNT of the -o header of the same run */\n",opcodes.size());
+    fprintf(fp,"#define OPCC_EMIT_FORM_COUNT          %zuu\n",forms.size());
+    fprintf(fp,"#define OPCC_EMIT_MAX_LENGTH          %uu /* longest output of one emitter, prefix functions not counted */\n",max_length);
+    fprintf(fp,"\n");
+    fprintf(fp,"namespace opcc_emit {\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* registers */\n");
+    {
+        static const char *cls[10] = { "r8", "r16", "r32", "sreg", "creg", "dreg", "treg", "st", "mm", "xmm" };
+
+        for (const auto c : cls)
+            fprintf(fp,"struct %-5s { uint8_t n; constexpr explicit %s(unsigned int v) : n((uint8_t)v) {} };\n",c,c);
+    }
+    fprintf(fp,"\n");
+    for (unsigned int g=0;g < 3;g++) {
+        static const char *cls[3] = { "r8", "r16", "r32" };
+
+        for (unsigned int r=0;r < 8;r++)
+            fprintf(fp,"struct %s_t : %s { constexpr %s_t() : %s(%u) {} };\n",emit_gpr_name[g][r],cls[g],emit_gpr_name[g][r],cls[g],r);
+    }
+    for (unsigned int r=0;r < 6;r++)
+        fprintf(fp,"struct %s_t : sreg { constexpr %s_t() : sreg(%u) {} };\n",emit_sreg_name[r],emit_sreg_name[r],r);
+    for (unsigned int c=0;c < 3;c++) {
+        static const char *cls[3] = { "st", "mm", "xmm" };
+
+        for (unsigned int r=0;r < 8;r++)
+            fprintf(fp,"struct %s%u_t : %s { constexpr %s%u_t() : %s(%u) {} };\n",cls[c],r,cls[c],cls[c],r,cls[c],r);
+    }
+    fprintf(fp,"\n");
+    for (unsigned int g=0;g < 3;g++) {
+        for (unsigned int r=0;r < 8;r++) fprintf(fp,"constexpr %s_t %s{};\n",emit_gpr_name[g][r],emit_gpr_name[g][r]);
+    }
+    for (unsigned int r=0;r < 6;r++) fprintf(fp,"constexpr %s_t %s{};\n",emit_sreg_name[r],emit_sreg_name[r]);
+    for (unsigned int c=0;c < 3;c++) {
+        static const char *cls[3] = { "st", "mm", "xmm" };
+
+        for (unsigned int r=0;r < 8;r++) fprintf(fp,"constexpr %s%u_t %s%u{};\n",cls[c],r,cls[c],r);
+    }
+    for (unsigned int c=0;c < 3;c++) {
+        static const char *cls[3] = { "creg", "dreg", "treg" };
+
+        for (unsigned int r=0;r < 8;r++) fprintf(fp,"constexpr %s %cr%u{%u};\n",cls[c],cls[c][0],r,r);
+    }
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* a memory operand. 32-bit addresses: base and index register, -1 if there is none. 16-bit: base is the\n");
+    fprintf(fp," * rm value of the register pair, -1 for a bare offset */\n");
+    fprintf(fp,"struct mem {\n");
+    fprintf(fp,"    uint8_t     seg;            /* segment override prefix byte, 0 = none */\n");
+    fprintf(fp,"    uint8_t     a32;\n");
+    fprintf(fp,"    int8_t      base;\n");
+    fprintf(fp,"    int8_t      index;\n");
+    fprintf(fp,"    uint8_t     scale;          /* SIB scale field */\n");
+    fprintf(fp,"    int32_t     disp;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    constexpr mem(unsigned int s,unsigned int a,int b,int i,unsigned int sc,int32_t d)\n");
+    fprintf(fp,"        : seg((uint8_t)s),a32((uint8_t)a),base((int8_t)b),index((int8_t)i),scale((uint8_t)sc),disp(d) {}\n");
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"template<unsigned int Bytes> struct mem_n : mem { constexpr explicit mem_n(const mem &m) : mem(m) {} };\n");
+    fprintf(fp,"template<unsigned int Bytes> struct far_n : mem { constexpr explicit far_n(const mem &m) : mem(m) {} };\n");
+    fprintf(fp,"typedef mem_n<1>  m8;\n");
+    fprintf(fp,"typedef mem_n<2>  m16;\n");
+    fprintf(fp,"typedef mem_n<4>  m32;\n");
+    fprintf(fp,"typedef mem_n<6>  m48;\n");
+    fprintf(fp,"typedef mem_n<8>  m64;\n");
+    fprintf(fp,"typedef mem_n<10> m80;\n");
+    fprintf(fp,"typedef mem_n<16> m128;\n");
+    fprintf(fp,"typedef far_n<4>  m16_16;         /* offset:selector */\n");
+    fprintf(fp,"typedef far_n<6>  m16_32;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* offset of a direct memory operand (MOV AL,[moffs]) */\n");
+    fprintf(fp,"struct moffs {\n");
+    fprintf(fp,"    uint8_t     seg;\n");
+    fprintf(fp,"    uint32_t    ofs;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    constexpr explicit moffs(uint32_t o,unsigned int s = 0) : seg((uint8_t)s),ofs(o) {}\n");
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* immediates */\n");
+    fprintf(fp,"struct imm8  { uint8_t v;  constexpr explicit imm8(uint8_t x) : v(x) {} };\n");
+    fprintf(fp,"struct imm8s { int8_t v;   constexpr explicit imm8s(int8_t x) : v(x) {} };\n");
+    fprintf(fp,"struct imm16 { uint16_t v; constexpr explicit imm16(uint16_t x) : v(x) {} };\n");
+    fprintf(fp,"struct imm32 { uint32_t v; constexpr explicit imm32(uint32_t x) : v(x) {} };\n");
+    fprintf(fp,"struct rel8  { int8_t v;   constexpr explicit rel8(int8_t x) : v(x) {} };\n");
+    fprintf(fp,"struct rel16 { int16_t v;  constexpr explicit rel16(int16_t x) : v(x) {} };\n");
+    fprintf(fp,"struct rel32 { int32_t v;  constexpr explicit rel32(int32_t x) : v(x) {} };\n");
+    fprintf(fp,"struct far16 { uint16_t seg,off; constexpr far16(uint16_t s,uint16_t o) : seg(s),off(o) {} };\n");
+    fprintf(fp,"struct far32 { uint16_t seg; uint32_t off; constexpr far32(uint16_t s,uint32_t o) : seg(s),off(o) {} };\n");
+    fprintf(fp,"template<unsigned int N> struct imm_const { constexpr imm_const() {} };\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"namespace detail {\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"constexpr uint8_t modrm(unsigned int mod,unsigned int reg,unsigned int rm) {\n");
+    fprintf(fp,"    return (uint8_t)((mod << 6u) | ((reg & 7u) << 3u) | (rm & 7u));\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"constexpr unsigned int scale_bits(unsigned int s) {\n");
+    fprintf(fp,"    return s == 8u ? 3u : (s == 4u ? 2u : (s == 2u ? 1u : 0u));\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* bx+si bx+di bp+si bp+di, and si di bp bx alone */\n");
+    fprintf(fp,"constexpr int rm16_pair(unsigned int b,unsigned int i) {\n");
+    fprintf(fp,"    return (b == 5u ? 2 : 0) + (i == 7u ? 1 : 0);\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"constexpr int rm16(unsigned int r) {\n");
+    fprintf(fp,"    return r == 6u ? 4 : (r == 7u ? 5 : (r == 5u ? 6 : 7));\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"constexpr uint8_t seg_byte(unsigned int n) {\n");
+    fprintf(fp,"    return");
+    for (unsigned int s=PREFIX_SEG_ES;s < PREFIX_SEG_MAX;s++)
+        fprintf(fp," n == %uu ? %s :",s - PREFIX_SEG_ES,emit_hex(as.seg_byte[s]).c_str());
+    fprintf(fp," 0;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"inline void put16(uint8_t *q,uint32_t v) {\n");
+    fprintf(fp,"    q[0] = (uint8_t)v;\n");
+    fprintf(fp,"    q[1] = (uint8_t)(v >> 8u);\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"inline void put32(uint8_t *q,uint32_t v) {\n");
+    fprintf(fp,"    q[0] = (uint8_t)v;\n");
+    fprintf(fp,"    q[1] = (uint8_t)(v >> 8u);\n");
+    fprintf(fp,"    q[2] = (uint8_t)(v >> 16u);\n");
+    fprintf(fp,"    q[3] = (uint8_t)(v >> 24u);\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"inline uint8_t *seg_prefix(uint8_t *q,uint8_t seg) {\n");
+    fprintf(fp,"    if (seg != 0u) *q++ = seg;\n");
+    fprintf(fp,"    return q;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"inline uint8_t *mem_prefix(uint8_t *q,const mem &m) {\n");
+    fprintf(fp,"    q = seg_prefix(q,m.seg);\n");
+    if (as.addrsize_byte != 0)
+        fprintf(fp,"    if (m.a32 != %uu) *q++ = %s;\n",def32,emit_hex(as.addrsize_byte).c_str());
+    fprintf(fp,"    return q;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* mod/reg/rm, SIB and displacement */\n");
+    fprintf(fp,"inline uint8_t *ea(uint8_t *q,const mem &m,unsigned int reg) {\n");
+    fprintf(fp,"    const bool d8 = m.disp >= -128 && m.disp < 128;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    if (!m.a32) {\n");
+    fprintf(fp,"        if (m.base < 0) {\n");
+    fprintf(fp,"            q[0] = modrm(0u,reg,6u);\n");
+    fprintf(fp,"            put16(q + 1,(uint32_t)m.disp);\n");
+    fprintf(fp,"            return q + 3;\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"        if (m.disp == 0 && m.base != 6) {\n");
+    fprintf(fp,"            q[0] = modrm(0u,reg,(unsigned int)m.base);\n");
+    fprintf(fp,"            return q + 1;\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"        q[0] = modrm(d8 ? 1u : 2u,reg,(unsigned int)m.base);\n");
+    fprintf(fp,"        q[1] = (uint8_t)m.disp;\n");
+    fprintf(fp,"        if (d8) return q + 2;\n");
+    fprintf(fp,"        q[2] = (uint8_t)((uint32_t)m.disp >> 8u);\n");
+    fprintf(fp,"        return q + 3;\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    if (m.base < 0) {\n");
+    fprintf(fp,"        if (m.index < 0) {\n");
+    fprintf(fp,"            q[0] = modrm(0u,reg,5u);\n");
+    fprintf(fp,"            put32(q + 1,(uint32_t)m.disp);\n");
+    fprintf(fp,"            return q + 5;\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"        q[0] = modrm(0u,reg,4u);\n");
+    fprintf(fp,"        q[1] = modrm(m.scale,(unsigned int)m.index,5u);\n");
+    fprintf(fp,"        put32(q + 2,(uint32_t)m.disp);\n");
+    fprintf(fp,"        return q + 6;\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    const unsigned int mod = (m.disp == 0 && m.base != 5) ? 0u : (d8 ? 1u : 2u);\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    if (m.index < 0 && m.base != 4) {\n");
+    fprintf(fp,"        q[0] = modrm(mod,reg,(unsigned int)m.base);\n");
+    fprintf(fp,"        q++;\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"    else {\n");
+    fprintf(fp,"        q[0] = modrm(mod,reg,4u);\n");
+    fprintf(fp,"        q[1] = modrm(m.scale,m.index < 0 ? 4u : (unsigned int)m.index,(unsigned int)m.base);\n");
+    fprintf(fp,"        q += 2;\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"    if (mod == 1u) {\n");
+    fprintf(fp,"        q[0] = (uint8_t)m.disp;\n");
+    fprintf(fp,"        q++;\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"    else if (mod == 2u) {\n");
+    fprintf(fp,"        put32(q,(uint32_t)m.disp);\n");
+    fprintf(fp,"        q += 4;\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"    return q;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"} /* namespace detail */\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* addresses: ptr(ebx), ptr(ebx,esi,4,8), ptr_index(esi,4,8), abs32(0x1000), ptr(bx,si,8), abs16(0x100).\n");
+    fprintf(fp," * seg() adds a segment override */\n");
+    fprintf(fp,"constexpr mem ptr(r32 base,int32_t disp = 0) {\n");
+    fprintf(fp,"    return mem(0u,1u,base.n,-1,0u,disp);\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"constexpr mem ptr(r32 base,r32 index,unsigned int scale,int32_t disp = 0) {\n");
+    fprintf(fp,"    return mem(0u,1u,base.n,index.n,detail::scale_bits(scale),disp);\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"constexpr mem ptr_index(r32 index,unsigned int scale,int32_t disp = 0) {\n");
+    fprintf(fp,"    return mem(0u,1u,-1,index.n,detail::scale_bits(scale),disp);\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"constexpr mem abs32(uint32_t ofs) {\n");
+    fprintf(fp,"    return mem(0u,1u,-1,-1,0u,(int32_t)ofs);\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"constexpr mem ptr(r16 base,int32_t disp = 0) {\n");
+    fprintf(fp,"    return mem(0u,0u,detail::rm16(base.n),-1,0u,disp);\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"constexpr mem ptr(r16 base,r16 index,int32_t disp = 0) {\n");
+    fprintf(fp,"    return mem(0u,0u,(base.n == 3u || base.n == 5u) ? detail::rm16_pair(base.n,index.n) : detail::rm16_pair(index.n,base.n),-1,0u,disp);\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"constexpr mem abs16(uint16_t ofs) {\n");
+    fprintf(fp,"    return mem(0u,0u,-1,-1,0u,ofs);\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"constexpr mem seg(sreg s,const mem &m) {\n");
+    fprintf(fp,"    return mem(detail::seg_byte(s.n),m.a32,m.base,m.index,m.scale,m.disp);\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"constexpr moffs seg(sreg s,const moffs &m) {\n");
+    fprintf(fp,"    return moffs(m.ofs,detail::seg_byte(s.n));\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* prefixes, emitted ahead of the instruction they apply to */\n");
+    {
+        const std::pair<const char*,unsigned char> pfx[] = {
+            { "lock", as.lock_byte },
+            { "rep", as.rep_byte[PREFIX_REP_Z] },
+            { "repne", as.rep_byte[PREFIX_REP_NZ] },
+            { "repc", as.rep_byte[PREFIX_REP_C] },
+            { "repnc", as.rep_byte[PREFIX_REP_NC] },
+            { "wait", as.at.lookup("wait",4) < 0 ? as.wait_byte : (unsigned char)0 },
+            { "opsize", as.opsize_byte },
+            { "addrsize", as.addrsize_byte }
+        };
+
+        for (const auto &x : pfx)
+            if (x.second != 0) fprintf(fp,"inline void %s(uint8_t *&p) { *p++ = %s; }\n",x.first,emit_hex(x.second).c_str());
+        fprintf(fp,"inline void segment(uint8_t *&p,sreg s) { *p++ = detail::seg_byte(s.n); }\n");
+    }
+    fprintf(fp,"\n");
+
+    for (const auto &f : forms) {
+        fprintf(fp,"inline void %s(%s) {\n",f.name.c_str(),f.params.c_str());
+        for (const auto &s : f.body) fprintf(fp,"%s%s\n",s.empty() ? "" : "    ",s.c_str());
+        fprintf(fp,"}\n");
+        fprintf(fp,"\n");
+    }
+
+    fprintf(fp,"} /* namespace opcc_emit */\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"/* every emitter as X(opcode,call) with sample operands, the call writing through a uint8_t *p. for tests, with\n");
+    fprintf(fp," * the opcode index of the -o header the bytes should decode to (or one of the same name) */\n");
+    fprintf(fp,"#define OPCC_EMIT_FORMS(X) \\\n");
+    for (const auto &f : forms) fprintf(fp,"    X(%s) \\\n",f.sample.c_str());
+    fprintf(fp,"\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"#endif /* OPCC_EMIT_HPP */\n");
+
+    if (ferror(fp)) {
+        fprintf(stderr,"Error writing file '%s'\n",emitfile.c_str());
+        fclose(fp);
+        return false;
+    }
+
+    fclose(fp);
+    return true;
+}
+
+class CombinedMarch {
+public:
+    std::string                 name;
+    std::vector<OpcodeSpec>     opcodes;
+    std::vector<DecodeTable>    tables;
+    std::vector<size_t>         remap;              // opcode index -> combined opcode index
+};
+
+class CombinedDecode {
+public:
+    typedef std::pair<unsigned int,uint16_t>    march_entry;    // march, entry in that march's tables
+    typedef std::pair<uint32_t,uint16_t>        alternative;    // CPU mask, entry as in build_decode_tables()
+public:
+    std::vector<CombinedMarch>                  marches;
+    std::vector<OpcodeSpec>                     opcodes;
+    std::vector<uint32_t>                       opcode_cpu;
+    std::vector<DecodeTable>                    tables;         // entries are indexes into alts
+    std::vector<alternative>                    alts;           // lists end with mask 0, alts[0] is the empty list
+    std::map< std::vector<march_entry>, uint16_t >          table_memo;
+    std::map< std::vector<alternative>, uint16_t >          alt_memo;
+public:
+    bool                        merge_opcodes(void);
+    bool                        merge_entry(const std::vector<march_entry> &l,uint16_t &r);
+    bool                        merge_table(const unsigned int kind,const std::vector<march_entry> &l,uint16_t &r);
+};
+
+std::string combined_opcode_key(OpcodeSpec &op) {
+    return std::string(tokentype_str[op.type]) + " " + op.name + " " + op.pretty_string();
+}
+
+bool CombinedDecode::merge_opcodes(void) {
+    std::map<std::string,uint32_t> masks;
+    std::map<std::string,size_t> index;
+
+    for (size_t m=0;m < marches.size();m++) {
+        for (auto &op : marches[m].opcodes) {
+            const std::string key = combined_opcode_key(op);
+
+            if (masks.find(key) == masks.end()) {
+                masks[key] = 0;
+                opcodes.push_back(op);
+            }
+            masks[key] |= 1u << m;
+        }
+    }
 
-        defines["cpulevel"] = 686;
-        defines["cpuid"] = 1;
+    std::sort(opcodes.begin(),opcodes.end(),opcode_sort_func);
+    if (opcodes.size() >= (size_t)decode_entry_opcode)
+        return false;
+
+    for (size_t i=0;i < opcodes.size();i++) {
+        const std::string key = combined_opcode_key(opcodes[i]);
+
+        index[key] = i;
+        opcode_cpu.push_back(masks[key]);
     }
-    else if (march == "pentium-pro") {
-        if (fpuarch.empty())
-            fpuarch = "80687";
 
-        defines["cpulevel"] = 686;
-        defines["cpuid"] = 1;
-        defines["cmov"] = 1;
+    for (auto &cm : marches) {
+        cm.remap.resize(cm.opcodes.size());
+        for (size_t i=0;i < cm.opcodes.size();i++)
+            cm.remap[i] = index[combined_opcode_key(cm.opcodes[i])];
     }
-    else if (march == "pentium-pro-mmx") {
-        if (fpuarch.empty())
-            fpuarch = "80687";
 
-        defines["cpulevel"] = 686;
-        defines["cpuid"] = 1;
-        defines["cmov"] = 1;
-        defines["mmx"] = 1;
+    return true;
+}
+
+bool CombinedDecode::merge_entry(const std::vector<march_entry> &l,uint16_t &r) {
+    std::map< uint32_t, std::pair< uint32_t, std::vector<march_entry> > > groups;  // opcode or table kind -> mask, tables
+    std::vector<alternative> al;
+
+    for (const auto &me : l) {
+        const CombinedMarch &cm = marches[me.first];
+        uint32_t key;
+
+        if (me.second == 0) continue;
+
+        if (me.second >= decode_entry_opcode)
+            key = (uint32_t)decode_entry_opcode + (uint32_t)cm.remap[me.second - decode_entry_opcode];
+        else
+            key = 0x10000u + cm.tables[me.second].kind;
+
+        auto &g = groups[key];
+        g.first |= 1u << me.first;
+        g.second.push_back(me);
     }
-    else if (march == "pentium-2") {
-        if (fpuarch.empty())
-            fpuarch = "80687";
 
-        defines["cpulevel"] = 686;
-        defines["sysenter"] = 1;
-        defines["pentium"] = 2;
-        defines["cpuid"] = 1;
-        defines["cmov"] = 1;
-        defines["mmx"] = 1;
+    for (const auto &g : groups) {
+        uint16_t e;
+
+        if (g.first < 0x10000u) {
+            e = (uint16_t)g.first;
+        }
+        else {
+            if (!merge_table(g.first - 0x10000u,g.second.second,e))
+                return false;
+        }
+
+        al.push_back(alternative(g.second.first,e));
     }
-    else if (march == "pentium-3") {
-        if (fpuarch.empty())
-            fpuarch = "80687";
 
-        defines["cpulevel"] = 686;
-        defines["sysenter"] = 1;
-        defines["pentium"] = 3;
-        defines["cpuid"] = 1;
-        defines["cmov"] = 1;
-        defines["mmx"] = 1;
-        defines["sse"] = 1;
+    if (al.empty()) {
+        r = 0;
+        return true;
     }
-    else if (march == "cyrix-6x86-mmx") {
-        if (fpuarch.empty())
-            fpuarch = "80687";
 
-        defines["cpulevel"] = 686;
-        defines["sysenter"] = 1;
-        defines["cpuid"] = 1;
-        defines["emmi"] = 1;
-        defines["cmov"] = 1;
-        defines["mmx"] = 1;
+    auto mi = alt_memo.find(al);
+    if (mi != alt_memo.end()) {
+        r = mi->second;
+        return true;
     }
-    else if (march == "everything") { /* catch-all for generic decompilers. cover as much as possible without overlapping opcodes. */
-        if (fpuarch.empty())
-            fpuarch = "80687";
 
-        defines["everything"] = 1;
-        defines["cpulevel"] = 686;
-        defines["sysenter"] = 1;
-        defines["syscall"] = 1;
-        defines["3dnow+"] = 1;
-        defines["cpuid"] = 1;
-        defines["3dnow"] = 1;
-        defines["ssse3"] = 1;
-        defines["sse3"] = 1;
-        defines["sse2"] = 1;
-        defines["cmov"] = 1;
-        defines["mmx+"] = 1;
-        defines["sse"] = 1;
-        defines["mmx"] = 1;
+    if ((alts.size() + al.size() + 1) > (size_t)0xFFFF)
+        return false;
+
+    r = (uint16_t)alts.size();
+    for (const auto &a : al) alts.push_back(a);
+    alts.push_back(alternative(0,0));
+    alt_memo[al] = r;
+    return true;
+}
+
+bool CombinedDecode::merge_table(const unsigned int kind,const std::vector<march_entry> &l,uint16_t &r) {
+    auto mi = table_memo.find(l);
+    if (mi != table_memo.end()) {
+        r = mi->second;
+        return true;
     }
-    else {
-        fprintf(stderr,"Unknown march '%s'\n",march.c_str());
-        return 1;
+
+    if (tables.size() >= (size_t)decode_entry_opcode)
+        return false;
+
+    const size_t tn = tables.size();
+    const size_t count = kind == DT_MANDATORY_PREFIX ? (size_t)OpcodeGroupBlock::MP_MAX : (size_t)256;
+
+    tables.resize(tn+1);
+    tables[tn].kind = kind;
+    tables[tn].path = marches[l[0].first].tables[l[0].second].path;
+    tables[tn].entries.resize(count,0);
+    table_memo[l] = (uint16_t)tn;
+
+    for (size_t i=0;i < count;i++) {
+        std::vector<march_entry> el;
+        uint16_t e;
+
+        for (const auto &me : l)
+            el.push_back(march_entry(me.first,marches[me.first].tables[me.second].entries[i]));
+
+        if (!merge_entry(el,e))
+            return false;
+
+        tables[tn].entries[i] = e;
     }
 
-    if (fpuarch == "8087" || fpuarch == "80187") {
-        defines["fpulevel"] = 87;
+    r = (uint16_t)tn;
+    return true;
+}
+
+std::string cpu_define_name(const std::string &m) {
+    std::string r;
+
+    for (const auto c : m) {
+        if (isalnum((unsigned char)c))
+            r += (char)toupper((unsigned char)c);
+        else if (c == '+')
+            r += "P";
+        else
+            r += "_";
     }
-    else if (fpuarch == "80287" || fpuarch == "287") {
-        defines["fpulevel"] = 287;
+
+    return r;
+}
+
+void emit_combined_decode(FILE *fp,const CombinedDecode &cd) {
+    size_t total = 0;
+
+    fprintf(fp,"/* CPUs in this table. decode with the mask of the CPU being emulated */\n");
+    fprintf(fp,"#define OPCC_CPU_COUNT               %zuu\n",cd.marches.size());
+    for (size_t m=0;m < cd.marches.size();m++)
+        fprintf(fp,"#define OPCC_CPU_%-20s 0x%08xu\n",cpu_define_name(cd.marches[m].name).c_str(),1u << m);
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const char *const opcc_cpu_name[OPCC_CPU_COUNT] = {\n");
+    for (size_t m=0;m < cd.marches.size();m++) {
+        fprintf(fp,"    ");
+        emit_c_string(fp,cd.marches[m].name);
+        fprintf(fp,"%s\n",(m+1) < cd.marches.size() ? "," : "");
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* CPUs each opcode exists on */\n");
+    fprintf(fp,"static const uint32_t opcc_opcode_cpu[OPCC_OPCODE_COUNT] = {\n");
+    for (size_t i=0;i < cd.opcodes.size();i++)
+        fprintf(fp,"    0x%08xu%s /* %4zu %s */\n",cd.opcode_cpu[i],(i+1) < cd.opcodes.size() ? "," : " ",i,cd.opcodes[i].name.c_str());
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* decode tables. an entry is the first of a list of alternatives in opcc_decode_alt[], 0 if none.\n");
+    fprintf(fp," * the first alternative whose mask has the CPU bit gives OPCC_DECODE_OPCODE + opcode index\n");
+    fprintf(fp," * or the table to continue in. decoding starts at OPCC_DECODE_ROOT. */\n");
+    fprintf(fp,"#define OPCC_DECODE_OPCODE           0x%04xu\n",decode_entry_opcode);
+    fprintf(fp,"#define OPCC_DECODE_ROOT             1u\n");
+    fprintf(fp,"#define OPCC_DECODE_TABLE_COUNT      %zuu\n",cd.tables.size());
+    fprintf(fp,"#define OPCC_DECODE_ALT_COUNT        %zuu\n",cd.alts.size());
+    for (unsigned int i=1;i < DT_MAX;i++)
+        fprintf(fp,"#define OPCC_DT_%-21s %uu\n",decode_table_kind_str[i],i);
+    fprintf(fp,"\n");
+    fprintf(fp,"#define OPCC_MP_NONE                 %uu\n",(unsigned int)OpcodeGroupBlock::MP_NONE);
+    fprintf(fp,"#define OPCC_MP_66                   %uu\n",(unsigned int)OpcodeGroupBlock::MP_66);
+    fprintf(fp,"#define OPCC_MP_F3                   %uu\n",(unsigned int)OpcodeGroupBlock::MP_F3);
+    fprintf(fp,"#define OPCC_MP_F2                   %uu\n",(unsigned int)OpcodeGroupBlock::MP_F2);
+    fprintf(fp,"\n");
+    fprintf(fp,"typedef struct opcc_decode_table {\n");
+    fprintf(fp,"    uint32_t    base;       /* first entry in opcc_decode_entry[] */\n");
+    fprintf(fp,"    uint8_t     kind;       /* OPCC_DT_* */\n");
+    fprintf(fp,"} opcc_decode_table;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"typedef struct opcc_decode_alt {\n");
+    fprintf(fp,"    uint32_t    cpu;        /* OPCC_CPU_* mask, 0 ends the list */\n");
+    fprintf(fp,"    uint16_t    next;       /* OPCC_DECODE_OPCODE + opcode index, or table */\n");
+    fprintf(fp,"} opcc_decode_alt;\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const opcc_decode_table opcc_decode_tables[OPCC_DECODE_TABLE_COUNT] = {\n");
+    for (size_t t=0;t < cd.tables.size();t++) {
+        fprintf(fp,"    { %6zu, OPCC_DT_%s }%s /* %4zu",total,t == 0 ? "LINEAR" : decode_table_kind_str[cd.tables[t].kind],(t+1) < cd.tables.size() ? "," : " ",t);
+        if (t == 0) fprintf(fp," unused");
+        else if (t == 1) fprintf(fp," root");
+        for (const auto &b : cd.tables[t].path) fprintf(fp," %02x",b);
+        fprintf(fp," */\n");
+        total += cd.tables[t].entries.size();
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const uint16_t opcc_decode_entry[%zu] = {\n",std::max(total,(size_t)1));
+    {
+        size_t idx = 0;
+
+        for (size_t t=0;t < cd.tables.size();t++) {
+            const auto &e = cd.tables[t].entries;
+
+            if (e.empty()) continue;
+            fprintf(fp,"    /* table %zu */\n",t);
+            for (size_t i=0;i < e.size();i += 8) {
+                fprintf(fp,"   ");
+                for (size_t j=i;j < (i+8) && j < e.size();j++) {
+                    idx++;
+                    fprintf(fp," 0x%04x%s",e[j],idx < total ? "," : "");
+                }
+                fprintf(fp,"\n");
+            }
+        }
+
+        if (total == 0)
+            fprintf(fp,"    0\n");
+    }
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"static const opcc_decode_alt opcc_decode_alts[OPCC_DECODE_ALT_COUNT] = {\n");
+    for (size_t i=0;i < cd.alts.size();i++)
+        fprintf(fp,"    { 0x%08xu, 0x%04x }%s /* %zu */\n",cd.alts[i].first,cd.alts[i].second,(i+1) < cd.alts.size() ? "," : " ",i);
+    fprintf(fp,"};\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* pick the alternative for the CPU, 0 if none */\n");
+    fprintf(fp,"static inline unsigned int opcc_decode_select(uint16_t e,uint32_t cpu) {\n");
+    fprintf(fp,"    const opcc_decode_alt *a = &opcc_decode_alts[e];\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    while (a->cpu != 0) {\n");
+    fprintf(fp,"        if (a->cpu & cpu) return a->next;\n");
+    fprintf(fp,"        a++;\n");
+    fprintf(fp,"    }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    return 0;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+
+    fprintf(fp,"/* look up the opcode starting at p, after the prefixes, for the CPU given as an OPCC_CPU_* bit.\n");
+    fprintf(fp," * returns the opcode index and the number of opcode bytes before mod/reg/rm in *len,\n");
+    fprintf(fp," * -1 for an unknown opcode or -2 if more bytes are needed. */\n");
+    fprintf(fp,"static inline int opcc_decode_opcode(const uint8_t *p,size_t avail,unsigned int mp,unsigned int addr32,uint32_t cpu,size_t *len) {\n");
+    fprintf(fp,"    unsigned int t = OPCC_DECODE_ROOT,e;\n");
+    fprintf(fp,"    size_t i = 0;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    do {\n");
+    fprintf(fp,"        const opcc_decode_table *d = &opcc_decode_tables[t];\n");
+    fprintf(fp,"        unsigned int n;\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"        switch (d->kind) {\n");
+    fprintf(fp,"            case OPCC_DT_LINEAR:\n");
+    fprintf(fp,"                if (i >= avail) return -2;\n");
+    fprintf(fp,"                e = opcc_decode_select(opcc_decode_entry[d->base + p[i++]],cpu);\n");
+    fprintf(fp,"                break;\n");
+    fprintf(fp,"            case OPCC_DT_MODREGRM:\n");
+    fprintf(fp,"                if (i >= avail) return -2;\n");
+    fprintf(fp,"                e = opcc_decode_select(opcc_decode_entry[d->base + p[i]],cpu);\n");
+    fprintf(fp,"                break;\n");
+    fprintf(fp,"            case OPCC_DT_MRMLINEAR:\n");
+    fprintf(fp,"                n = opcc_modrm_length(p+i,avail-i,addr32);\n");
+    fprintf(fp,"                if (n == 0 || (i+n) >= avail) return -2;\n");
+    fprintf(fp,"                e = opcc_decode_select(opcc_decode_entry[d->base + p[i+n]],cpu);\n");
+    fprintf(fp,"                break;\n");
+    fprintf(fp,"            case OPCC_DT_MANDATORY_PREFIX:\n");
+    fprintf(fp,"                e = opcc_decode_select(opcc_decode_entry[d->base + mp],cpu);\n");
+    fprintf(fp,"                if (e == 0) e = opcc_decode_select(opcc_decode_entry[d->base + OPCC_MP_NONE],cpu);\n");
+    fprintf(fp,"                break;\n");
+    fprintf(fp,"            default:\n");
+    fprintf(fp,"                return -1;\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"        if (e >= OPCC_DECODE_OPCODE) {\n");
+    fprintf(fp,"            *len = i;\n");
+    fprintf(fp,"            return (int)(e - OPCC_DECODE_OPCODE);\n");
+    fprintf(fp,"        }\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"        t = e;\n");
+    fprintf(fp,"    } while (t != 0);\n");
+    fprintf(fp,"\n");
+    fprintf(fp,"    return -1;\n");
+    fprintf(fp,"}\n");
+    fprintf(fp,"\n");
+}
+
+void reset_parse_state(void) {
+    defines.clear();
+    defines["dialect"] = "intel-x86";
+    opcodes.clear();
+    macros.clear();
+    tokens_macro.clear();
+    tokens_macro_enable = false;
+    tokens_macro_read = 0;
+    tokens_unput.clear();
+    tokens_unput_valid = false;
+    untoke = -1;
+    unknown_opcode = -1;
+    opcode_limit = -1;
+    read_error = false;
+    opcode_groups.reset();
+}
+
+bool write_combined_file(void) {
+    const std::string user_fpuarch = fpuarch;
+    CombinedDecode cd;
+    uint16_t root;
+    FILE *fp;
+
+    {
+        size_t i = 0;
+
+        while (i <= combine.size()) {
+            size_t j = combine.find(',',i);
+            if (j == std::string::npos) j = combine.size();
+
+            CombinedMarch cm;
+            cm.name = combine.substr(i,j-i);
+            if (cm.name.empty()) {
+                fprintf(stderr,"Empty -march in -combine list\n");
+                return false;
+            }
+            cd.marches.push_back(cm);
+            i = j + 1;
+        }
     }
-    else if (fpuarch == "80387" || fpuarch == "387" ||
-             fpuarch == "80487" || fpuarch == "487" ||
-             fpuarch == "80587") {
-        defines["fpulevel"] = 387;
+
+    if (cd.marches.size() > 32) {
+        fprintf(stderr,"-combine supports at most 32 CPUs\n");
+        return false;
     }
-    else if (fpuarch == "80687" ) {
-        defines["fpulevel"] = 687;
+
+    for (auto &cm : cd.marches) {
+        reset_parse_state();
+        march = cm.name;
+        fpuarch = user_fpuarch;
+
+        if (!set_march_defines())
+            return false;
+        if (!load_opcodes())
+            return false;
+        fclose(srcfp);
+        srcfp = NULL;
+
+        if (!build_mandatory_prefix_maps(opcode_groups)) {
+            fprintf(stderr,"Mandatory prefix map error\n");
+            return false;
+        }
+        if (!build_decode_tables(cm.tables)) {
+            fprintf(stderr,"Decode table build error for -march %s\n",cm.name.c_str());
+            return false;
+        }
+
+        cm.opcodes = opcodes;
     }
-    else {
-        fprintf(stderr,"Unknown fpuarch '%s'\n",fpuarch.c_str());
-        return 1;
+
+    if (!cd.merge_opcodes()) {
+        fprintf(stderr,"Too many opcodes to combine\n");
+        return false;
     }
 
-    if ((srcfp=fopen(srcfile.c_str(),"r")) == NULL) {
-        fprintf(stderr,"Unable to open file '%s', %s\n",srcfile.c_str(),strerror(errno));
-        return 1;
+    cd.tables.resize(1);                        // table 0 unused, as in build_decode_tables()
+    cd.alts.push_back(CombinedDecode::alternative(0,0));
+    {
+        std::vector<CombinedDecode::march_entry> l;
+
+        for (size_t m=0;m < cd.marches.size();m++)
+            l.push_back(CombinedDecode::march_entry((unsigned int)m,(uint16_t)1));
+
+        if (!cd.merge_table(DT_LINEAR,l,root) || root != 1) {
+            fprintf(stderr,"Combined decode table build error\n");
+            return false;
+        }
     }
 
-    while (read_opcode_block());
+    /* the emitters below work from the global opcode list */
+    opcodes = cd.opcodes;
+    march = combine;
+    if (user_fpuarch.empty()) fpuarch = "default";
 
-    if (read_error) {
-        fprintf(stderr,"Parse error, exiting\n");
-        return 1;
+    if ((fp=fopen(outfile.c_str(),"w")) == NULL) {
+        fprintf(stderr,"Unable to write file '%s', %s\n",outfile.c_str(),strerror(errno));
+        return false;
     }
 
-    std::sort(opcodes.begin(),opcodes.end(),opcode_sort_func);
+    emit_output_header(fp);
+    emit_opcode_names(fp);
+    emit_ea_tables(fp);
+    emit_combined_decode(fp,cd);
+    emit_tail_length_table(fp);
+    emit_output_footer(fp);
 
-    /* build opcodes into the group table */
-    opcode_groups = std::make_shared<OpcodeGroupBlock>();
-    {
-        auto grref = *opcode_groups;
-        grref.map.resize(256);
-        grref.maptype = OpcodeGroupBlock::LINEAR;
+    if (ferror(fp)) {
+        fprintf(stderr,"Error writing file '%s'\n",outfile.c_str());
+        fclose(fp);
+        return false;
     }
-    for (auto op_i=opcodes.begin();op_i!=opcodes.end();op_i++) {
-        const auto &opcode = *op_i;
 
-        if (opcode.bytes.size() == 0) {
-            fprintf(stderr,"WARNING: opcode '%s' without bytes\n",opcode.name.c_str());
-            continue;
-        }
+    fclose(fp);
+    return true;
+}
 
-        /* bytes[0] must be actual bytes */
-        if (opcode.bytes[0].meaning != 0) {
-            fprintf(stderr,"ERROR: opcode '%s' first entry not a byte value\n",opcode.name.c_str());
-            continue;
-        }
-        {
-            auto i = opcode.bytes.begin();
+int main(int argc,char **argv) {
+    /* setup predefined values */
+    defines["dialect"] = "intel-x86";
 
-            /* must be <byte-range> [<byte-range>] [mrm] [immediate]
-             * exception: AMD 3DNow! 0x0F 0x0F mrm <byte-range> */
-            while (i != opcode.bytes.end() && (*i).meaning == 0) i++;
-            if ((i+0) != opcode.bytes.end() &&
-                    (i+1) != opcode.bytes.end() &&
-                    (*(i+0)).meaning == TOK_MRM &&      // mrm
-                    opcode.mod3 == 0 &&                 // no constraints on mrm
-                    opcode.reg_constraint == 0 &&
-                    opcode.rm_constraint == 0 &&
-                    (*(i+1)).meaning == 0) {            // then byte
-                /* allow */
-                assert((i+0) != opcode.bytes.end());
-                assert((i+1) != opcode.bytes.end());
-                i += 2;
-            }
-            else {
-                if (i != opcode.bytes.end() && (*i).meaning == TOK_MRM) i++;
-                while (i != opcode.bytes.end() && (*i).meaning == TOK_IMMEDIATE) i++;
-            }
+    if (parse_argv(argc,argv))
+        return 1;
 
-            if (i != opcode.bytes.end()) {
-                fprintf(stderr,"ERROR: opcode '%s' unexpected byte entries\n",opcode.name.c_str());
-                continue;
-            }
+    if (!combine.empty()) {
+        if (outfile.empty()) {
+            fprintf(stderr,"-combine requires -o\n");
+            return 1;
         }
 
-        if (!enter_opcode_bytes(opcode,(size_t)(op_i-opcodes.begin()),opcode_groups)) {
-            fprintf(stderr,"Opcode byte to map error\n");
-            continue;
-        }
+        return write_combined_file() ? 0 : 1;
     }
 
+    if (!set_march_defines())
+        return 1;
+
+    if (!load_opcodes())
+        return 1;
+
     if (list_op) {
         printf("Opcodes by byte:\n");
         printf("----------------\n");
@@ -6279,6 +14993,52 @@ int main(int argc,char **argv) {
         fprintf(stderr,"WARNING: Unknown opcode behavior not specified 'unknown opcode ...'\n");
     }
 
+    /* the listing above shows opcodes as described, the decoder wants mandatory prefixes resolved per opcode */
+    if (!build_mandatory_prefix_maps(opcode_groups)) {
+        fprintf(stderr,"Mandatory prefix map error\n");
+        return 1;
+    }
+
+    if (!outfile.empty()) {
+        if (!write_output_file())
+            return 1;
+    }
+
+    if (!blobfile.empty()) {
+        if (!write_blob_file())
+            return 1;
+    }
+
+    if (!interpfile.empty()) {
+        if (!write_interp_file())
+            return 1;
+    }
+
+    if (!recompfile.empty()) {
+        if (!write_recomp_file())
+            return 1;
+    }
+
+    if (!disasmfile.empty()) {
+        if (!disasm_file())
+            return 1;
+    }
+
+    if (!discoverfile.empty()) {
+        if (!discover_file())
+            return 1;
+    }
+
+    if (!assemblefile.empty()) {
+        if (!assemble_file())
+            return 1;
+    }
+
+    if (!emitfile.empty()) {
+        if (!write_emit_file())
+            return 1;
+    }
+
     fclose(srcfp);
     return 0;
 }
@@ -0,0 +1,329 @@
+/* reader for the binary table files written by "opcc -blob file".
+ *
+ * the file is meant to be mapped and used in place. all values are little endian, every
+ * section starts on an 8 byte boundary and is found through the section index that follows
+ * the 64 byte header. the header checksum covers everything past the header, and each index
+ * entry has the checksum of its own section so sections can be verified as they are paged in.
+ * checksums are 32-bit FNV-1a. */
+#ifndef OPCC_BLOB_H
+#define OPCC_BLOB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define OPCC_BLOB_VERSION               1u
+#define OPCC_BLOB_HEADER_SIZE           64u
+#define OPCC_BLOB_FLAG_UNKNOWN_UD       0x00000001u /* unknown opcodes raise #UD */
+
+#define OPCC_BLOB_SEC_DECODE_TABLE      1u  /* opcc_blob_decode_table per table, table 0 unused, root is 1 */
+#define OPCC_BLOB_SEC_DECODE_ENTRY      2u  /* uint16_t per entry: 0 unknown, 0x8000 + opcode index, or table */
+#define OPCC_BLOB_SEC_NAME_INDEX        3u  /* uint32_t per opcode, offset of the name in OPCC_BLOB_SEC_STRINGS */
+#define OPCC_BLOB_SEC_STRINGS           4u  /* NUL terminated strings */
+#define OPCC_BLOB_SEC_TAIL_LENGTH       5u  /* uint8_t[4] per opcode, [OPCC_SIZE_INDEX(o32,a32)] */
+#define OPCC_BLOB_SEC_BRANCH_KIND       6u  /* uint8_t per opcode, OPCC_BRANCH_* */
+#define OPCC_BLOB_SEC_TRAPS             7u  /* uint8_t per opcode, OPCC_TRAP_* */
+#define OPCC_BLOB_SEC_EA16              8u  /* opcc_blob_ea per mod/reg/rm */
+#define OPCC_BLOB_SEC_EA32              9u  /* opcc_blob_ea per mod/reg/rm */
+#define OPCC_BLOB_SEC_EA_SIB            10u /* opcc_blob_ea per [mod][sib], mod 0-2 */
+#define OPCC_BLOB_SEC_PREFIX_CLASS      11u /* uint8_t[256] */
+#define OPCC_BLOB_SEC_PREFIX_STEP       12u /* { uint32_t keep, set } per prefix class */
+
+#define OPCC_BLOB_DECODE_OPCODE         0x8000u
+#define OPCC_BLOB_DT_LINEAR             1u
+#define OPCC_BLOB_DT_MODREGRM           2u
+#define OPCC_BLOB_DT_MRMLINEAR          3u
+#define OPCC_BLOB_DT_MANDATORY_PREFIX   4u
+#define OPCC_BLOB_MP_NONE               0u
+#define OPCC_BLOB_EA_SIB                0x02u
+
+typedef struct opcc_blob_header {
+    uint8_t     magic[8];           /* "OPCCBLOB" */
+    uint16_t    version;            /* OPCC_BLOB_VERSION */
+    uint16_t    header_size;        /* OPCC_BLOB_HEADER_SIZE */
+    uint32_t    flags;              /* OPCC_BLOB_FLAG_* */
+    uint32_t    total_size;
+    uint32_t    checksum;           /* of bytes header_size to total_size */
+    uint32_t    section_count;
+    uint32_t    section_index;      /* offset of the opcc_blob_section array */
+    uint32_t    opcode_count;
+    uint16_t    opcode_limit;       /* maximum instruction length, 0 = no limit */
+    uint16_t    cpulevel;
+    char        march[24];          /* NUL terminated */
+} opcc_blob_header;
+
+typedef struct opcc_blob_section {
+    uint32_t    id;                 /* OPCC_BLOB_SEC_* */
+    uint32_t    offset;
+    uint32_t    size;
+    uint32_t    checksum;
+} opcc_blob_section;
+
+typedef struct opcc_blob_decode_table {
+    uint32_t    base;               /* first entry in OPCC_BLOB_SEC_DECODE_ENTRY */
+    uint8_t     kind;               /* OPCC_BLOB_DT_* */
+    uint8_t     pad[3];
+} opcc_blob_decode_table;
+
+typedef struct opcc_blob_ea {
+    uint8_t     length;
+    uint8_t     disp;
+    uint8_t     base;
+    uint8_t     index;
+    uint8_t     scale;
+    uint8_t     seg;
+    uint8_t     flags;
+} opcc_blob_ea;
+
+typedef struct opcc_blob {
+    const uint8_t                   *base;
+    size_t                          size;
+    const opcc_blob_header          *header;
+    const opcc_blob_section         *index;
+    const opcc_blob_decode_table    *tables;
+    uint32_t                        table_count;
+    const uint16_t                  *entry;
+    uint32_t                        entry_count;
+    const uint32_t                  *name_index;
+    const char                      *strings;
+    uint32_t                        strings_size;
+    const opcc_blob_ea              *ea16;
+    const opcc_blob_ea              *ea32;
+    const opcc_blob_ea              *ea_sib;
+    const uint8_t                   *tail_length;
+    const uint8_t                   *branch_kind;
+    const uint8_t                   *traps;
+    const uint8_t                   *prefix_class;
+    const uint32_t                  *prefix_step;
+    uint32_t                        prefix_step_count;
+} opcc_blob;
+
+static inline uint32_t opcc_blob_checksum(const uint8_t *p,size_t len) {
+    uint32_t h = 0x811C9DC5u;
+    size_t i;
+
+    for (i=0;i < len;i++) {
+        h ^= p[i];
+        h *= 0x01000193u;
+    }
+
+    return h;
+}
+
+static inline const opcc_blob_section *opcc_blob_find(const opcc_blob *b,uint32_t id) {
+    uint32_t i;
+
+    for (i=0;i < b->header->section_count;i++) {
+        if (b->index[i].id == id)
+            return &b->index[i];
+    }
+
+    return NULL;
+}
+
+/* returns the section contents and size, NULL if missing */
+static inline const void *opcc_blob_section_data(const opcc_blob *b,uint32_t id,uint32_t *size) {
+    const opcc_blob_section *s = opcc_blob_find(b,id);
+
+    if (s == NULL) return NULL;
+    if (size != NULL) *size = s->size;
+    return b->base + s->offset;
+}
+
+/* the section contents if it holds at least count elements of elem bytes, else NULL */
+static inline const void *opcc_blob_section_array(const opcc_blob *b,uint32_t id,uint32_t count,uint32_t elem) {
+    uint32_t sz;
+    const void *p = opcc_blob_section_data(b,id,&sz);
+
+    if (p == NULL || (sz / elem) < count) return NULL;
+    return p;
+}
+
+/* 0 if the section checksum matches */
+static inline int opcc_blob_verify_section(const opcc_blob *b,uint32_t id) {
+    const opcc_blob_section *s = opcc_blob_find(b,id);
+
+    if (s == NULL) return -1;
+    return (opcc_blob_checksum(b->base + s->offset,s->size) == s->checksum) ? 0 : -1;
+}
+
+/* set up b for the file image at p, which must be 8 byte aligned (mmap() is).
+ * verify != 0 also checks the whole file checksum. returns 0 on success, -1 if not usable */
+static inline int opcc_blob_open(opcc_blob *b,const void *p,size_t size,int verify) {
+    const opcc_blob_header *h = (const opcc_blob_header*)p;
+    uint32_t i,sz;
+
+    memset(b,0,sizeof(*b));
+    if (p == NULL || ((uintptr_t)p & 7u) != 0 || size < OPCC_BLOB_HEADER_SIZE) return -1;
+    if (memcmp(h->magic,"OPCCBLOB",8) != 0) return -1;
+    /* a big endian host reads the version as 0x0100 and stops here */
+    if (h->version != OPCC_BLOB_VERSION || h->header_size != OPCC_BLOB_HEADER_SIZE) return -1;
+    if (h->total_size > size || h->total_size < OPCC_BLOB_HEADER_SIZE) return -1;
+    if (h->section_index > h->total_size || h->section_count > ((h->total_size - h->section_index) / sizeof(opcc_blob_section))) return -1;
+
+    b->base = (const uint8_t*)p;
+    b->size = h->total_size;
+    b->header = h;
+    b->index = (const opcc_blob_section*)(b->base + h->section_index);
+
+    for (i=0;i < h->section_count;i++) {
+        if ((b->index[i].offset & 7u) != 0 || b->index[i].offset > b->size || b->index[i].size > (b->size - b->index[i].offset))
+            return -1;
+    }
+
+    if (verify && opcc_blob_checksum(b->base + h->header_size,h->total_size - h->header_size) != h->checksum)
+        return -1;
+
+    b->tables = (const opcc_blob_decode_table*)opcc_blob_section_data(b,OPCC_BLOB_SEC_DECODE_TABLE,&sz);
+    b->table_count = sz / sizeof(opcc_blob_decode_table);
+    b->entry = (const uint16_t*)opcc_blob_section_data(b,OPCC_BLOB_SEC_DECODE_ENTRY,&sz);
+    b->entry_count = sz / sizeof(uint16_t);
+    if (b->tables == NULL || b->entry == NULL || b->table_count < 2) return -1;
+    /* base + 255 must not wrap around past the entry bounds check in opcc_blob_decode_opcode() */
+    for (i=1;i < b->table_count;i++) {
+        if (b->tables[i].base > b->entry_count) return -1;
+    }
+
+    /* per opcode sections, sized by opcode_count. divide rather than multiply so a large count cannot wrap */
+    b->name_index = (const uint32_t*)opcc_blob_section_array(b,OPCC_BLOB_SEC_NAME_INDEX,h->opcode_count,4u);
+    b->tail_length = (const uint8_t*)opcc_blob_section_array(b,OPCC_BLOB_SEC_TAIL_LENGTH,h->opcode_count,4u);
+    b->branch_kind = (const uint8_t*)opcc_blob_section_array(b,OPCC_BLOB_SEC_BRANCH_KIND,h->opcode_count,1u);
+    b->traps = (const uint8_t*)opcc_blob_section_array(b,OPCC_BLOB_SEC_TRAPS,h->opcode_count,1u);
+    if (b->name_index == NULL || b->tail_length == NULL || b->branch_kind == NULL || b->traps == NULL) return -1;
+
+    /* names are looked up by offset, the last one must be terminated */
+    b->strings = (const char*)opcc_blob_section_data(b,OPCC_BLOB_SEC_STRINGS,&b->strings_size);
+    if (b->strings == NULL || b->strings_size == 0 || b->strings[b->strings_size-1] != 0) return -1;
+
+    /* opcc_blob_modrm_length() indexes these by mod/reg/rm and [mod][sib] without checking */
+    b->ea16 = (const opcc_blob_ea*)opcc_blob_section_array(b,OPCC_BLOB_SEC_EA16,256u,sizeof(opcc_blob_ea));
+    b->ea32 = (const opcc_blob_ea*)opcc_blob_section_array(b,OPCC_BLOB_SEC_EA32,256u,sizeof(opcc_blob_ea));
+    b->ea_sib = (const opcc_blob_ea*)opcc_blob_section_array(b,OPCC_BLOB_SEC_EA_SIB,3u * 256u,sizeof(opcc_blob_ea));
+    if (b->ea16 == NULL || b->ea32 == NULL || b->ea_sib == NULL) return -1;
+
+    /* every prefix class must have its keep/set step */
+    b->prefix_class = (const uint8_t*)opcc_blob_section_array(b,OPCC_BLOB_SEC_PREFIX_CLASS,256u,1u);
+    b->prefix_step = (const uint32_t*)opcc_blob_section_data(b,OPCC_BLOB_SEC_PREFIX_STEP,&sz);
+    b->prefix_step_count = sz / 8u;
+    if (b->prefix_class == NULL || b->prefix_step == NULL) return -1;
+    for (i=0;i < 256u;i++) {
+        if (b->prefix_class[i] >= b->prefix_step_count) return -1;
+    }
+
+    return 0;
+}
+
+static inline const char *opcc_blob_opcode_name(const opcc_blob *b,unsigned int op) {
+    if (op >= b->header->opcode_count || b->name_index[op] >= b->strings_size) return "";
+    return b->strings + b->name_index[op];
+}
+
+/* length of mod/reg/rm, SIB and displacement, 0 if more bytes are needed */
+static inline unsigned int opcc_blob_modrm_length(const opcc_blob *b,const uint8_t *p,size_t avail,unsigned int addr32) {
+    unsigned int n;
+
+    if (avail < 1) return 0;
+    if (addr32) {
+        n = b->ea32[p[0]].length;
+        if (b->ea32[p[0]].flags & OPCC_BLOB_EA_SIB) {
+            if (avail < 2) return 0;
+            n = b->ea_sib[((p[0] >> 6u) * 256u) + p[1]].length;
+        }
+    }
+    else {
+        n = b->ea16[p[0]].length;
+    }
+
+    return (n <= avail) ? n : 0;
+}
+
+/* same as opcc_decode_opcode() in the generated header: returns the opcode index and the number of
+ * opcode bytes before mod/reg/rm in *len, -1 for an unknown opcode or -2 if more bytes are needed */
+static inline int opcc_blob_decode_opcode(const opcc_blob *b,const uint8_t *p,size_t avail,unsigned int mp,unsigned int addr32,size_t *len) {
+    unsigned int t = 1,e,x;
+    size_t i = 0;
+
+    do {
+        const opcc_blob_decode_table *d;
+        unsigned int n;
+
+        if (t >= b->table_count) return -1;
+        d = &b->tables[t];
+
+        switch (d->kind) {
+            case OPCC_BLOB_DT_LINEAR:
+                if (i >= avail) return -2;
+                x = d->base + p[i++];
+                break;
+            case OPCC_BLOB_DT_MODREGRM:
+                if (i >= avail) return -2;
+                x = d->base + p[i];
+                break;
+            case OPCC_BLOB_DT_MRMLINEAR:
+                n = opcc_blob_modrm_length(b,p+i,avail-i,addr32);
+                if (n == 0 || (i+n) >= avail) return -2;
+                x = d->base + p[i+n];
+                break;
+            case OPCC_BLOB_DT_MANDATORY_PREFIX:
+                x = d->base + mp;
+                if (x < b->entry_count && b->entry[x] == 0) x = d->base + OPCC_BLOB_MP_NONE;
+                break;
+            default:
+                return -1;
+        }
+
+        if (x >= b->entry_count) return -1;
+        e = b->entry[x];
+
+        if (e >= OPCC_BLOB_DECODE_OPCODE) {
+            *len = i;
+            return (int)(e - OPCC_BLOB_DECODE_OPCODE);
+        }
+
+        t = e;
+    } while (t != 0);
+
+    return -1;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* map a table file read only. returns 0 on success, release with opcc_blob_unmap() */
+static inline int opcc_blob_map(opcc_blob *b,const char *path,int verify) {
+    struct stat st;
+    void *p;
+    int fd;
+
+    memset(b,0,sizeof(*b));
+    if ((fd=open(path,O_RDONLY)) < 0) return -1;
+    if (fstat(fd,&st) < 0 || st.st_size < (off_t)OPCC_BLOB_HEADER_SIZE) {
+        close(fd);
+        return -1;
+    }
+
+    p = mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if (p == MAP_FAILED) return -1;
+
+    if (opcc_blob_open(b,p,(size_t)st.st_size,verify) < 0) {
+        munmap(p,(size_t)st.st_size);
+        memset(b,0,sizeof(*b));
+        return -1;
+    }
+
+    /* keep the whole mapping size, total_size may be shorter than the file */
+    b->size = (size_t)st.st_size;
+    return 0;
+}
+
+static inline void opcc_blob_unmap(opcc_blob *b) {
+    if (b->base != NULL) munmap((void*)b->base,b->size);
+    memset(b,0,sizeof(*b));
+}
+#endif
+
+#endif /* OPCC_BLOB_H */
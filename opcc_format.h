@@ -0,0 +1,276 @@
+/* disassembly text formatter, NASM syntax. opcc pastes this file into the -o header after the opcc_fmt_* tables,
+ * and compiles it for -disasm against the tables of its own run, so the two print the same text. it uses only
+ * what the -o header defines: opcc_window_insn, opcc_fmt_opnd/imm/name, opcc_opcode_name, opcc_mem_size_bytes and
+ * the OPCC_* constants. C99 and C++ */
+
+typedef struct opcc_fmt_buf {
+    char        *buf;
+    size_t      size;
+    size_t      n;          /* length so far, may pass size */
+} opcc_fmt_buf;
+
+static inline void opcc_fmt_c(opcc_fmt_buf *b,char c) {
+    if ((b->n + 1u) < b->size) b->buf[b->n] = c;
+    b->n++;
+}
+
+static inline void opcc_fmt_s(opcc_fmt_buf *b,const char *s) {
+    while (*s) opcc_fmt_c(b,*s++);
+}
+
+static inline void opcc_fmt_hex(opcc_fmt_buf *b,uint64_t v) {
+    char tmp[16];
+    unsigned int i = 0;
+
+    opcc_fmt_c(b,'0');
+    opcc_fmt_c(b,'x');
+    do { tmp[i++] = "0123456789abcdef"[v & 0xFu]; v >>= 4u; } while (v != 0u);
+    while (i != 0u) opcc_fmt_c(b,tmp[--i]);
+}
+
+/* +0x10 or -0x10 */
+static inline void opcc_fmt_disp(opcc_fmt_buf *b,int64_t v) {
+    opcc_fmt_c(b,v < 0 ? '-' : '+');
+    opcc_fmt_hex(b,v < 0 ? (0u - (uint64_t)v) : (uint64_t)v);
+}
+
+static inline void opcc_fmt_gpr(opcc_fmt_buf *b,unsigned int size,unsigned int o32,unsigned int n) {
+    static const char r8[8][3] = { "al", "cl", "dl", "bl", "ah", "ch", "dh", "bh" };
+    static const char r16[8][3] = { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di" };
+    const unsigned int bytes = opcc_mem_size_bytes[size][o32];
+
+    n &= 7u;
+    if (bytes == 1u) {
+        opcc_fmt_c(b,r8[n][0]);
+        opcc_fmt_c(b,r8[n][1]);
+        return;
+    }
+    if (bytes == 4u) opcc_fmt_c(b,'e');
+    else if (bytes == 8u) opcc_fmt_c(b,'r');
+    opcc_fmt_c(b,r16[n][0]);
+    opcc_fmt_c(b,r16[n][1]);
+}
+
+/* prefix and register number, st0 mm1 cr3 ... */
+static inline void opcc_fmt_regn(opcc_fmt_buf *b,const char *p,unsigned int n) {
+    opcc_fmt_s(b,p);
+    opcc_fmt_c(b,(char)('0' + (n & 7u)));
+}
+
+static inline void opcc_fmt_sreg(opcc_fmt_buf *b,unsigned int n) {
+    static const char sr[8][3] = { "es", "cs", "ss", "ds", "fs", "gs", "s6", "s7" };
+
+    opcc_fmt_c(b,sr[n & 7u][0]);
+    opcc_fmt_c(b,sr[n & 7u][1]);
+}
+
+static inline void opcc_fmt_size(opcc_fmt_buf *b,unsigned int size,unsigned int o32) {
+    switch (opcc_mem_size_bytes[size][o32]) {
+        case 1:  opcc_fmt_s(b,"byte "); break;
+        case 2:  opcc_fmt_s(b,"word "); break;
+        case 4:  opcc_fmt_s(b,size == OPCC_MEM_SIZE_FPV ? "" : "dword "); break;
+        case 8:  opcc_fmt_s(b,"qword "); break;
+        case 10: opcc_fmt_s(b,"tword "); break;
+        case 16: opcc_fmt_s(b,"oword "); break;
+        default: break;
+    }
+}
+
+static inline void opcc_fmt_seg(opcc_fmt_buf *b,unsigned int seg) {
+    if (seg == OPCC_SEG_NONE) return;
+    opcc_fmt_sreg(b,seg - 1u);
+    opcc_fmt_c(b,':');
+}
+
+/* mod/reg/rm memory operand */
+static inline void opcc_fmt_ea(opcc_fmt_buf *b,const opcc_window_insn *d,unsigned int a32,unsigned int seg) {
+    static const char *const base16[8] = { "bx+si", "bx+di", "bp+si", "bp+di", "si", "di", "bp", "bx" };
+    const unsigned int mod = d->modrm >> 6u,rm = d->modrm & 7u;
+
+    opcc_fmt_c(b,'[');
+    opcc_fmt_seg(b,seg);
+    if (!a32) {
+        if (mod == 0u && rm == 6u) {
+            opcc_fmt_hex(b,(uint16_t)d->disp);
+        }
+        else {
+            opcc_fmt_s(b,base16[rm]);
+            if (d->disp != 0) opcc_fmt_disp(b,d->disp);
+        }
+    }
+    else {
+        unsigned int base = rm,index = 4u,any = 0;
+
+        if (rm == 4u) {
+            base = d->sib & 7u;
+            index = (d->sib >> 3u) & 7u;
+        }
+        if (!(mod == 0u && base == 5u)) {
+            opcc_fmt_gpr(b,OPCC_MEM_SIZE_DW,0,base);
+            any = 1;
+        }
+        if (index != 4u) {
+            if (any) opcc_fmt_c(b,'+');
+            opcc_fmt_gpr(b,OPCC_MEM_SIZE_DW,0,index);
+            if ((d->sib >> 6u) != 0u) {
+                opcc_fmt_c(b,'*');
+                opcc_fmt_c(b,(char)('0' + (1u << (d->sib >> 6u))));
+            }
+            any = 1;
+        }
+        if (!any)
+            opcc_fmt_hex(b,(uint32_t)d->disp);
+        else if (d->disp != 0)
+            opcc_fmt_disp(b,d->disp);
+    }
+    opcc_fmt_c(b,']');
+}
+
+/* memory the opcode addresses through a fixed register, OPCC_MEM_SRC_*. the stack is always SS, SI and DI
+ * (MASKMOVQ) show a segment only when overridden, like opcc_fmt_ea() */
+static inline void opcc_fmt_implied(opcc_fmt_buf *b,unsigned int src,unsigned int a32,unsigned int seg) {
+    opcc_fmt_c(b,'[');
+    if (src == OPCC_MEM_SRC_STACK) {
+        opcc_fmt_s(b,"ss:");
+        opcc_fmt_gpr(b,a32 ? OPCC_MEM_SIZE_DW : OPCC_MEM_SIZE_W,0,4u);
+    }
+    else if (src == OPCC_MEM_SRC_SI || src == OPCC_MEM_SRC_DI) {
+        opcc_fmt_seg(b,seg);
+        opcc_fmt_gpr(b,a32 ? OPCC_MEM_SIZE_DW : OPCC_MEM_SIZE_W,0,src == OPCC_MEM_SRC_SI ? 6u : 7u);
+    }
+    opcc_fmt_c(b,']');
+}
+
+/* immediate i of an opcode: value, and its byte length in *len */
+static inline uint64_t opcc_fmt_immval(const opcc_window_insn *d,unsigned int i,unsigned int o32,unsigned int a32,unsigned int *len) {
+    const uint8_t *im = &opcc_fmt_imm[d->opcode][0];
+    unsigned int ofs = 0,k,l = 0;
+    uint64_t v;
+
+    for (k=0;k <= i && k < 2u;k++) {
+        ofs += l;
+        l = (im[k] & OPCC_FMT_IMM_OFFSET) ? (a32 ? 4u : 2u) : opcc_mem_size_bytes[im[k] & 0xFu][o32];
+    }
+    v = (ofs < 8u) ? (d->imm >> (ofs * 8u)) : 0u;
+    if (l < 8u) v &= (((uint64_t)1u) << (l * 8u)) - 1u;
+    if ((im[i & 1u] & OPCC_FMT_IMM_SIGNED) && l != 0u && l < 8u && (v >> ((l * 8u) - 1u)) != 0u)
+        v |= ~((((uint64_t)1u) << (l * 8u)) - 1u);
+    *len = l;
+    return v;
+}
+
+static inline void opcc_fmt_operand(opcc_fmt_buf *b,const opcc_window_insn *d,unsigned int x,uint32_t ip,unsigned int o32,unsigned int a32) {
+    const unsigned int size = OPCC_FMT_SIZE(x),arg = OPCC_FMT_ARG(x);
+    const unsigned int reg = (d->modrm >> 3u) & 7u,rm = d->modrm & 7u;
+    const unsigned int mem = d->modrm_len != 0u && (d->modrm >> 6u) != 3u;
+    const unsigned int seg = d->prefix & OPCC_PS_SEG_MASK;
+    unsigned int len;
+    uint64_t v;
+
+    switch (OPCC_FMT_KIND(x)) {
+        case OPCC_FMT_REG:      opcc_fmt_gpr(b,size,o32,reg); break;
+        case OPCC_FMT_OPREG:    opcc_fmt_gpr(b,size,o32,d->opbyte); break;
+        case OPCC_FMT_GPR:      opcc_fmt_gpr(b,size,o32,arg); break;
+        case OPCC_FMT_RM:
+        case OPCC_FMT_MM_RM:
+        case OPCC_FMT_XMM_RM:
+            if (mem) {
+                if ((opcc_fmt_imm[d->opcode][2] & OPCC_FMT_FAR)) opcc_fmt_s(b,"far ");
+                else opcc_fmt_size(b,size,o32);
+                opcc_fmt_ea(b,d,a32,seg);
+            }
+            else if (OPCC_FMT_KIND(x) == OPCC_FMT_RM) opcc_fmt_gpr(b,size,o32,rm);
+            else opcc_fmt_regn(b,OPCC_FMT_KIND(x) == OPCC_FMT_MM_RM ? "mm" : "xmm",rm);
+            break;
+        case OPCC_FMT_SREG:     opcc_fmt_sreg(b,reg); break;
+        case OPCC_FMT_SREGN:    opcc_fmt_sreg(b,arg); break;
+        case OPCC_FMT_CR:       opcc_fmt_regn(b,"cr",reg); break;
+        case OPCC_FMT_DR:       opcc_fmt_regn(b,"dr",reg); break;
+        case OPCC_FMT_TR:       opcc_fmt_regn(b,"tr",reg); break;
+        case OPCC_FMT_CONST:    opcc_fmt_hex(b,arg); break;
+        case OPCC_FMT_ST:       opcc_fmt_regn(b,"st",arg); break;
+        case OPCC_FMT_ST_RM:    opcc_fmt_regn(b,"st",rm); break;
+        case OPCC_FMT_MM_REG:   opcc_fmt_regn(b,"mm",reg); break;
+        case OPCC_FMT_MM_IMPLIED: opcc_fmt_regn(b,"mm",reg ^ 1u); break;
+        case OPCC_FMT_MMN:      opcc_fmt_regn(b,"mm",arg); break;
+        case OPCC_FMT_XMM_REG:  opcc_fmt_regn(b,"xmm",reg); break;
+        case OPCC_FMT_XMMN:     opcc_fmt_regn(b,"xmm",arg); break;
+        case OPCC_FMT_IMM:
+            v = opcc_fmt_immval(d,arg,o32,a32,&len);
+            if ((int64_t)v < 0) opcc_fmt_disp(b,(int64_t)v);
+            else opcc_fmt_hex(b,v);
+            break;
+        case OPCC_FMT_REL:
+            v = opcc_fmt_immval(d,arg,o32,a32,&len);
+            v = (uint64_t)ip + d->length + v;
+            opcc_fmt_hex(b,o32 ? (uint32_t)v : (uint16_t)v);
+            break;
+        case OPCC_FMT_FARPTR:
+            v = opcc_fmt_immval(d,arg,o32,a32,&len);
+            opcc_fmt_hex(b,(v >> ((len - 2u) * 8u)) & 0xFFFFu);
+            opcc_fmt_c(b,':');
+            opcc_fmt_hex(b,v & ((((uint64_t)1u) << ((len - 2u) * 8u)) - 1u));
+            break;
+        case OPCC_FMT_MOFFS:
+            opcc_fmt_size(b,size,o32);
+            opcc_fmt_c(b,'[');
+            opcc_fmt_seg(b,seg);
+            opcc_fmt_hex(b,opcc_fmt_immval(d,arg,o32,a32,&len));
+            opcc_fmt_c(b,']');
+            break;
+        case OPCC_FMT_MEM:
+            opcc_fmt_size(b,size,o32);
+            opcc_fmt_implied(b,arg,a32,seg);
+            break;
+        case OPCC_FMT_NAME:     opcc_fmt_s(b,opcc_fmt_name[arg]); break;
+        default:                break;
+    }
+}
+
+/* text of an instruction decoded at ip with the code segment's default size (OPCC_SIZE_INDEX). writes at most
+ * size bytes including the NUL and, like snprintf, returns the full length. no allocation */
+static inline size_t opcc_format_insn(char *buf,size_t size,const opcc_window_insn *d,uint32_t ip,unsigned int size_index) {
+    const unsigned int o32 = ((size_index >> 1u) ^ (d->prefix / OPCC_PS_OPSIZE)) & 1u;
+    const unsigned int a32 = (size_index ^ (d->prefix / OPCC_PS_ADDRSIZE)) & 1u;
+    opcc_fmt_buf b;
+    const char *s;
+    unsigned int i,f;
+
+    b.buf = buf;
+    b.size = size;
+    b.n = 0;
+
+    if (d->opcode < 0 || d->opcode >= OPCC_OPCODE_COUNT) {
+        opcc_fmt_s(&b,"(bad)");
+    }
+    else {
+        f = opcc_fmt_imm[d->opcode][2];
+        /* 9B ahead of the instruction, decoded as a prefix: FWAIT then the instruction */
+        if (d->prefix & OPCC_PS_WAIT) opcc_fmt_s(&b,"wait ");
+        if (d->prefix & OPCC_PS_LOCK) opcc_fmt_s(&b,"lock ");
+        if (f & OPCC_FMT_STRING) {
+            const unsigned int rep = OPCC_PS_REP(d->prefix);
+
+            if (rep == OPCC_REP_Z) opcc_fmt_s(&b,(f & OPCC_FMT_REPE) ? "repe " : "rep ");
+            else if (rep == OPCC_REP_NZ) opcc_fmt_s(&b,"repne ");
+            if ((d->prefix & OPCC_PS_SEG_MASK) != OPCC_SEG_NONE) {
+                opcc_fmt_sreg(&b,(d->prefix & OPCC_PS_SEG_MASK) - 1u);
+                opcc_fmt_c(&b,' ');
+            }
+        }
+        for (s=opcc_opcode_name[d->opcode];*s;s++)
+            opcc_fmt_c(&b,(*s >= 'A' && *s <= 'Z') ? (char)(*s + ('a' - 'A')) : *s);
+        if (f & OPCC_FMT_STRING) {
+            const unsigned int bytes = opcc_mem_size_bytes[f >> 4u][o32];
+
+            opcc_fmt_c(&b,bytes == 1u ? 'b' : (bytes == 2u ? 'w' : 'd'));
+        }
+        for (i=0;i < OPCC_FMT_OPERANDS && opcc_fmt_opnd[d->opcode][i] != 0u;i++) {
+            opcc_fmt_c(&b,i == 0u ? ' ' : ',');
+            opcc_fmt_operand(&b,d,opcc_fmt_opnd[d->opcode][i],ip,o32,a32);
+        }
+    }
+
+    if (size != 0u) buf[(b.n < size) ? b.n : (size - 1u)] = 0;
+    return b.n;
+}
@@ -0,0 +1,235 @@
+/* decode benchmark: table walk decoder vs. the 16 byte window kernel (scalar and, if the CPU has it,
+ * SSSE3 field extraction) vs. batch decode into arrays, plus decode and format as text. reports
+ * nanoseconds, instructions per second and branch mispredicts per instruction (Linux perf events,
+ * if allowed).
+ *
+ * make decbench, then ./decbench [instructions] */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+#include "opcc_gen.h"
+#include "mix.h"
+
+static int perf_fd = -1;
+
+static void perf_open(void) {
+#if defined(__linux__)
+    struct perf_event_attr pe;
+
+    memset(&pe,0,sizeof(pe));
+    pe.type = PERF_TYPE_HARDWARE;
+    pe.size = sizeof(pe);
+    pe.config = PERF_COUNT_HW_BRANCH_MISSES;
+    pe.disabled = 1;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+    perf_fd = (int)syscall(__NR_perf_event_open,&pe,0,-1,-1,0);
+#endif
+}
+
+static void perf_start(void) {
+#if defined(__linux__)
+    if (perf_fd >= 0) {
+        ioctl(perf_fd,PERF_EVENT_IOC_RESET,0);
+        ioctl(perf_fd,PERF_EVENT_IOC_ENABLE,0);
+    }
+#endif
+}
+
+static long long perf_stop(void) {
+    long long n = -1;
+
+#if defined(__linux__)
+    if (perf_fd >= 0) {
+        ioctl(perf_fd,PERF_EVENT_IOC_DISABLE,0);
+        if (read(perf_fd,&n,sizeof(n)) != sizeof(n)) n = -1;
+    }
+#endif
+    return n;
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+/* the table walk decoder plus the usual branchy field extraction */
+static int walk_decode(const uint8_t *p,size_t avail,opcc_window_insn *d) {
+    uint32_t st;
+    size_t i,len;
+    unsigned int t,o32,a32,k;
+    opcc_ea ea;
+    int r;
+
+    r = opcc_decode_o32a32(p,avail,&st,&len);
+    if (r < 0) return r;
+    opcc_decode_head(p,avail,1,&st,&i);
+
+    o32 = (st & OPCC_PS_OPSIZE) ? 0 : 1;
+    a32 = (st & OPCC_PS_ADDRSIZE) ? 0 : 1;
+    t = opcc_tail_length[r][OPCC_SIZE_INDEX(o32,a32)];
+
+    d->length = (uint8_t)len;
+    d->disp = 0;
+    d->imm = 0;
+    d->imm_len = (uint8_t)(t & OPCC_TAIL_LENGTH_MASK);
+    if (t & OPCC_TAIL_MODRM) {
+        int32_t disp = 0;
+
+        opcc_decode_ea(p+i,avail-i,a32,&ea,&disp);
+        d->disp = disp;
+    }
+    for (k=0;k < d->imm_len;k++)
+        d->imm |= (uint64_t)p[len - d->imm_len + k] << (8u * k);
+
+    return r;
+}
+
+static void report(const char *name,double t,long long miss,size_t count) {
+    printf("%-18s %7.2f ns/insn %8.1f M insn/s",name,(t * 1e9) / (double)count,((double)count / t) / 1e6);
+    if (miss >= 0)
+        printf("  %6.3f mispredicts/insn",(double)miss / (double)count);
+    else
+        printf("  mispredicts n/a");
+    printf("\n");
+}
+
+static void run(const char *name,const uint8_t *buf,size_t size,size_t count,int which,uint64_t *sum) {
+    opcc_window_insn d;
+    long long miss;
+    double t0,t1;
+    size_t o = 0;
+    uint64_t s = 0;
+
+    t0 = now();
+    perf_start();
+    while (o < size) {
+        int r = (which == 0) ? walk_decode(buf+o,size-o,&d) : opcc_decode_window(buf+o,3,&d);
+
+        if (r < 0) { o++; continue; }
+        s += (uint64_t)r + (uint64_t)d.disp + d.imm + d.length;
+        o += d.length;
+    }
+    miss = perf_stop();
+    t1 = now();
+
+    report(name,t1 - t0,miss,count);
+    *sum = s;
+}
+
+#define BATCH_MAX 4096
+
+static uint32_t batch_offset[BATCH_MAX];
+static uint8_t batch_length[BATCH_MAX];
+static opcc_batch_opcode_t batch_opcode[BATCH_MAX];
+static int32_t batch_disp[BATCH_MAX];
+static uint64_t batch_imm[BATCH_MAX];
+
+/* decode into arrays, then sum them in a separate pass the way an analysis pass would read them */
+static void run_batch(const uint8_t *buf,size_t size,size_t count,uint64_t *sum) {
+    const opcc_batch b = { BATCH_MAX, batch_offset, batch_length, batch_opcode, NULL, NULL, batch_disp, batch_imm, NULL };
+    size_t o = 0,n,i;
+    long long miss;
+    double t0,t1;
+    uint64_t s = 0;
+
+    t0 = now();
+    perf_start();
+    while (o < size) {
+        n = opcc_decode_batch(buf,size,o,3,&b,&o);
+        if (n == 0) break;
+        for (i=0;i < n;i++) {
+            if (batch_opcode[i] < 0) continue;
+            s += (uint64_t)batch_opcode[i] + (uint64_t)batch_disp[i] + batch_imm[i] + batch_length[i];
+        }
+    }
+    miss = perf_stop();
+    t1 = now();
+
+    report("batch",t1 - t0,miss,count);
+    *sum = s;
+}
+
+/* disassembly: window decode plus opcc_format_insn() into a line buffer */
+static void run_format(const uint8_t *buf,size_t size,size_t count) {
+    opcc_window_insn d;
+    char line[128];
+    long long miss;
+    double t0,t1;
+    size_t o = 0,text = 0;
+
+    t0 = now();
+    perf_start();
+    while (o < size) {
+        if (opcc_decode_window(buf+o,3,&d) < 0) { o++; continue; }
+        text += opcc_format_insn(line,sizeof(line),&d,(uint32_t)o,3);
+        o += d.length;
+    }
+    miss = perf_stop();
+    t1 = now();
+
+    report("decode + format",t1 - t0,miss,count);
+    printf("%-18s %7.1f bytes of text/insn\n","",(double)text / (double)count);
+}
+
+int main(int argc,char **argv) {
+    size_t count = (argc > 1) ? (size_t)strtoul(argv[1],NULL,0) : 2000000;
+    uint64_t s0,s1,s2;
+#if defined(OPCC_WINDOW_SSSE3)
+    uint64_t s3;
+    int ssse3;
+#endif
+    uint8_t *buf;
+    size_t size;
+
+    if ((buf=malloc((count * 12) + 16)) == NULL) return 1;
+    size = mix_generate(buf,count);
+
+    perf_open();
+    opcc_window_init();
+    printf("%zu instructions, %zu bytes\n",count,size);
+    printf("the window kernel still branches once per prefix byte in opcc_decode_head(), mispredicts included\n");
+    if (perf_fd < 0)
+        printf("no perf events (not Linux, or perf_event_paranoid), branch mispredicts are not measured\n");
+#if defined(OPCC_WINDOW_SSSE3)
+    printf("opcc_window_init() chose %s field extraction\n",opcc_window_ssse3 ? "SSSE3" : "scalar");
+#endif
+    run("table walk",buf,size,count,0,&s0);
+#if defined(OPCC_WINDOW_SSSE3)
+    /* single threaded, so the choice can be flipped between runs */
+    ssse3 = opcc_window_ssse3;
+    opcc_window_ssse3 = 0;
+#endif
+    run("window scalar",buf,size,count,1,&s1);
+#if defined(OPCC_WINDOW_SSSE3)
+    opcc_window_ssse3 = ssse3;
+    if (ssse3) {
+        run("window ssse3",buf,size,count,1,&s3);
+        if (s3 != s1) {
+            printf("MISMATCH between window decoders\n");
+            return 1;
+        }
+    }
+#endif
+    run_batch(buf,size,count,&s2);
+    run_format(buf,size,count);
+
+    if (s0 != s1 || s0 != s2) {
+        printf("MISMATCH between decoders\n");
+        return 1;
+    }
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,56 @@
+/* emitter round trip: every form of the -emit header with sample operands, decoded again by the window decoder of
+ * the -o header generated with it. each emitter has to produce one instruction of its own opcode (or one of the
+ * same name, where the description has the same bytes twice) and of exactly the length it wrote. the text of
+ * anything else is printed.
+ *
+ * make emitcheck, then ./emitcheck */
+#include <stdio.h>
+#include <string.h>
+
+#include "opcc_gen.h"
+#include "opcc_emit.hpp"
+
+#if OPCC_EMIT_OPCODE_COUNT != OPCC_OPCODE_COUNT
+#error opcc_emit.hpp and opcc_gen.h are from different runs
+#endif
+
+using namespace opcc_emit;
+
+static unsigned int count = 0,bad = 0;
+
+static void check(int opcode,const uint8_t *s,const uint8_t *e) {
+    const unsigned int size_index = OPCC_EMIT_BITS == 32 ? 3u : 0u;
+    opcc_window_insn d;
+    uint8_t w[32];
+    char line[128];
+    int r;
+
+    memset(w,0,sizeof(w));
+    memcpy(w,s,(size_t)(e - s));
+    r = opcc_decode_window(w,size_index,&d);
+    count++;
+    if (r >= 0 && d.length == (size_t)(e - s)) {
+        const char *a = opcc_opcode_name[opcode],*b = opcc_opcode_name[r];
+
+        if (r == opcode || !strcmp(a,b)) return;
+        /* FCLEX is WAIT then FNCLEX, and decodes that way */
+        if ((d.prefix & OPCC_PS_WAIT) && a[0] == 'F' && b[0] == 'F' && b[1] == 'N' && !strcmp(a+1,b+2)) return;
+    }
+
+    bad++;
+    line[0] = 0;
+    if (r >= 0) opcc_format_insn(line,sizeof(line),&d,0,size_index);
+    printf("%s: %u bytes, decodes as '%s' (%d)\n",opcc_opcode_name[opcode],(unsigned int)(e - s),line,r);
+}
+
+int main(void) {
+    static uint8_t buf[OPCC_EMIT_FORM_COUNT * OPCC_EMIT_MAX_LENGTH];
+    uint8_t *p = buf;
+
+#define X(opcode,call) { uint8_t *s = p; call; check(opcode,s,p); }
+    OPCC_EMIT_FORMS(X)
+#undef X
+
+    printf("%u forms, %u bytes, %u bad\n",count,(unsigned int)(p - buf),bad);
+    return bad != 0 ? 1 : 0;
+}
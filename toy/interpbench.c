@@ -0,0 +1,84 @@
+/* interpreter dispatch benchmark: the opcc -interp skeleton with computed goto vs. the same handlers
+ * under a plain switch, on the decbench instruction mix decoded ahead of time.
+ *
+ * make interpbench, then ./interpbench [instructions] [passes] */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "opcc_gen.h"
+#include "mix.h"
+#include "interpsem.h"
+
+int interp_run_goto(interp_cpu *s,unsigned long steps);
+int interp_run_switch(interp_cpu *s,unsigned long steps);
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+static int run(const char *name,int (*fn)(interp_cpu*,unsigned long),interp_cpu *cpu,const opcc_window_insn *stream,size_t count,unsigned int passes,uint64_t *sum) {
+    double t0,t1;
+    uint64_t s = 0;
+    unsigned int p,i;
+    int r;
+
+    t0 = now();
+    for (p=0;p < passes;p++) {
+        memset(cpu,0,sizeof(*cpu));
+        cpu->stream = stream;
+        if ((r=fn(cpu,(unsigned long)count)) != 0) {
+            printf("%s: stopped with %d at instruction %zu\n",name,r,cpu->pc - 1u);
+            return -1;
+        }
+        for (i=0;i < 8;i++) s += cpu->r[i];
+        s += cpu->taken + cpu->zf;
+    }
+    t1 = now();
+
+    printf("%-18s %7.2f ns/insn %8.1f M insn/s\n",name,((t1 - t0) * 1e9) / ((double)count * passes),
+        (((double)count * passes) / (t1 - t0)) / 1e6);
+    *sum = s;
+    return 0;
+}
+
+int main(int argc,char **argv) {
+    size_t count = (argc > 1) ? (size_t)strtoul(argv[1],NULL,0) : 1000000;
+    unsigned int passes = (argc > 2) ? (unsigned int)strtoul(argv[2],NULL,0) : 10;
+    opcc_window_insn *stream;
+    uint64_t s0 = 0,s1 = 0;
+    size_t size,o = 0,n;
+    interp_cpu *cpu;
+    uint8_t *buf;
+
+    if ((buf=malloc((count * 12) + 16)) == NULL) return 1;
+    if ((stream=malloc(count * sizeof(*stream))) == NULL) return 1;
+    if ((cpu=malloc(sizeof(*cpu))) == NULL) return 1;
+    size = mix_generate(buf,count);
+
+    for (n=0;n < count && o < size;n++) {
+        if (opcc_decode_window(buf+o,3,&stream[n]) < 0) {
+            printf("sample at %zu does not decode\n",o);
+            return 1;
+        }
+        o += stream[n].length;
+    }
+
+    printf("%zu instructions x %u passes\n",count,passes);
+    if (run("computed goto",interp_run_goto,cpu,stream,count,passes,&s0) < 0) return 1;
+    if (run("switch",interp_run_switch,cpu,stream,count,passes,&s1) < 0) return 1;
+    if (s0 != s1) {
+        printf("MISMATCH between dispatchers\n");
+        return 1;
+    }
+
+    free(cpu);
+    free(stream);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,13 @@
+/* the generated interpreter, built once with computed goto and once with -DOPCC_INTERP_SWITCH */
+#include "opcc_gen.h"
+
+#define OPCC_INTERP_SEMANTICS "interpsem.h"
+#include "opcc_interp.h"
+
+#if defined(OPCC_INTERP_SWITCH)
+int interp_run_switch(interp_cpu *s,unsigned long steps) {
+#else
+int interp_run_goto(interp_cpu *s,unsigned long steps) {
+#endif
+    return opcc_interp_run(s,steps);
+}
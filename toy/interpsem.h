@@ -0,0 +1,50 @@
+/* semantics for interpbench: enough of the integer subset to run the decbench instruction mix.
+ * the instruction stream is decoded ahead of time, branches are counted but not taken. */
+#ifndef INTERPSEM_H
+#define INTERPSEM_H
+
+#define MEM_WORDS               4096u
+
+typedef struct interp_cpu {
+    uint32_t                    r[8];
+    uint32_t                    m[MEM_WORDS];
+    uint32_t                    zf;
+    uint32_t                    taken;
+    uint32_t                    other;          /* segment, control, FPU and vector registers land here */
+    const opcc_window_insn     *stream;
+    size_t                      pc;
+} interp_cpu;
+
+#define OPCC_INTERP_STATE               interp_cpu
+#define OPCC_INTERP_DECODE(s,d)         (*(d) = (s)->stream[(s)->pc++], (d)->opcode)
+#define OPCC_INTERP_EA(s,d,a32)         ((s)->r[(d)->modrm & 7u] + (uint32_t)(d)->disp)
+
+#define WORD(a)                         (s->m[((uint32_t)(a) >> 2u) & (MEM_WORDS - 1u)])
+
+#define OPCC_OPND_REG(t,n)              (s->r[(n)])
+#define OPCC_OPND_MEM(t,ea)             WORD(ea)
+#define OPCC_OPND_MEMX(t,src,imm)       WORD(imm)
+#define OPCC_OPND_IMM(t,v)              ((uint32_t)(v))
+#define OPCC_OPND_CONST(n)              ((uint32_t)(n))
+#define OPCC_OPND_FIXED(x)              (s->r[0])
+#define OPCC_OPND_SREG(n)               (s->other)
+#define OPCC_OPND_CR(n)                 (s->other)
+#define OPCC_OPND_DR(n)                 (s->other)
+#define OPCC_OPND_TR(n)                 (s->other)
+#define OPCC_OPND_ST(n)                 (s->other)
+#define OPCC_OPND_MM(n)                 (s->other)
+#define OPCC_OPND_XMM(n)                (s->other)
+
+#define OPCC_SEM_MOV(s,op,dst,src)      ((dst) = (uint32_t)(src))
+#define OPCC_SEM_XOR(s,op,dst,src)      ((dst) ^= (uint32_t)(src), s->zf = ((dst) == 0))
+#define OPCC_SEM_MOVS(s,op,dst,src)     ((dst) = (src))
+#define OPCC_SEM_ADD(s,op,dst,src)      ((dst) += (uint32_t)(src), s->zf = ((dst) == 0))
+#define OPCC_SEM_TEST(s,op,dst,src)     (s->zf = (((dst) & (uint32_t)(src)) == 0))
+#define OPCC_SEM_PUSH(s,op,src)         (s->r[4] -= 4u, WORD(s->r[4]) = (uint32_t)(src))
+#define OPCC_SEM_POP(s,op,dst)          ((dst) = WORD(s->r[4]), s->r[4] += 4u)
+#define OPCC_SEM_CALL(s,op,...)         (s->r[4] -= 4u, WORD(s->r[4]) = (uint32_t)s->pc)
+#define OPCC_SEM_RET(s,op,...)          (s->r[4] += 4u)
+#define OPCC_SEM_JZ(s,op,t)             (s->taken += s->zf)
+#define OPCC_SEM_FLD(s,op,...)          (s->other++)
+
+#endif
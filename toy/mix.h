@@ -0,0 +1,53 @@
+/* synthetic 32-bit instruction stream shared by the toy benchmarks */
+#ifndef MIX_H
+#define MIX_H
+
+/* 32-bit code, roughly the mix of compiled C */
+static const struct sample {
+    unsigned int        weight;
+    unsigned int        len;
+    uint8_t             b[12];
+} samples[] = {
+    { 20, 3, { 0x8B,0x45,0x08 } },                              /* mov eax,[ebp+8] */
+    { 12, 3, { 0x89,0x45,0xFC } },                              /* mov [ebp-4],eax */
+    { 10, 1, { 0x50 } },                                        /* push eax */
+    {  8, 1, { 0x5D } },                                        /* pop ebp */
+    {  8, 2, { 0x74,0x10 } },                                   /* jz +16 */
+    {  6, 2, { 0x03,0xC1 } },                                   /* add eax,ecx */
+    {  6, 5, { 0xE8,0x10,0x20,0x30,0x00 } },                    /* call rel32 */
+    {  5, 2, { 0x85,0xC0 } },                                   /* test eax,eax */
+    {  4, 6, { 0x0F,0x84,0x00,0x01,0x00,0x00 } },               /* jz rel32 */
+    {  4, 3, { 0x83,0xC4,0x10 } },                              /* add esp,16 */
+    {  3, 7, { 0x8B,0x84,0x88,0x00,0x10,0x00,0x00 } },          /* mov eax,[eax+ecx*4+0x1000] */
+    {  3, 1, { 0xC3 } },                                        /* ret */
+    {  3, 5, { 0xB8,0x78,0x56,0x34,0x12 } },                    /* mov eax,imm32 */
+    {  2, 2, { 0x33,0xC0 } },                                   /* xor eax,eax */
+    {  2, 10,{ 0xC7,0x85,0x00,0xFF,0xFF,0xFF,0x01,0x00,0x00,0x00 } }, /* mov dword [ebp-0x100],1 */
+    {  2, 2, { 0xF3,0xA5 } },                                   /* rep movsd */
+    {  1, 3, { 0x66,0x89,0x07 } },                              /* mov [edi],ax */
+    {  1, 3, { 0xD9,0x45,0x08 } },                              /* fld dword [ebp+8] */
+};
+
+#define SAMPLE_COUNT (sizeof(samples) / sizeof(samples[0]))
+
+/* fill buf (count * 12 + 16 bytes) with count instructions drawn from samples[] by weight, padded
+ * with 16 NOPs for window decoders. returns the code size */
+static size_t mix_generate(uint8_t *buf,size_t count) {
+    unsigned int total = 0,i,r;
+    size_t size = 0,n;
+
+    for (i=0;i < SAMPLE_COUNT;i++) total += samples[i].weight;
+
+    srand(1);
+    for (n=0;n < count;n++) {
+        r = (unsigned int)rand() % total;
+        for (i=0;r >= samples[i].weight;i++) r -= samples[i].weight;
+        memcpy(buf+size,samples[i].b,samples[i].len);
+        size += samples[i].len;
+    }
+    memset(buf+size,0x90,16);
+
+    return size;
+}
+
+#endif
@@ -0,0 +1,92 @@
+/* micro-op lowering check: opcodes that only name their operands with dest= and param= must still load what they
+ * read and store what they write. each entry is decoded as 32-bit code and checked twice, once in the micro-op
+ * template (a LOAD or STORE against the memory address) and once in the recompiler block, for a list of fragments
+ * that have to appear in order.
+ *
+ * make recompcheck, then ./recompcheck */
+#include <stdio.h>
+#include <string.h>
+
+#include "opcc_gen.h"
+#include "opcc_recomp.h"
+
+typedef struct lower_check {
+    uint8_t         bytes[15];
+    unsigned int    length;
+    const char      *name;
+    unsigned int    uop;            /* OPCC_UOP_LOAD or OPCC_UOP_STORE of the memory operand */
+    const char      *text[4];       /* in the recompiler block, in order */
+} lower_check;
+
+static const lower_check checks[] = {
+    /* store only: the destination is not mentioned by (writes ...) */
+    { { 0x0f, 0xae, 0x18 },             3, "stmxcsr [eax]",   OPCC_UOP_STORE,
+        { "OPCC_RC_OP_STMXCSR(32,t0);", "OPCC_RC_WR32(a0,t0);" } },
+    { { 0x0f, 0x01, 0x03 },             3, "sgdt [ebx]",      OPCC_UOP_STORE,
+        { "t0 = a0;", "OPCC_RC_OP_SGDT(" } },
+    /* load, then the operation, then the register destination */
+    { { 0x0f, 0x02, 0x03 },             3, "lar eax,[ebx]",   OPCC_UOP_LOAD,
+        { "t1 = OPCC_RC_RD32(a0);", "OPCC_RC_OP_LAR(32,t0,t1);", "OPCC_RC_REG32(0x0u) = t0;" } },
+    { { 0x0f, 0x03, 0x0b },             3, "lsl ecx,[ebx]",   OPCC_UOP_LOAD,
+        { "t1 = OPCC_RC_RD32(a0);", "OPCC_RC_OP_LSL(32,t0,t1);", "OPCC_RC_REG32(0x1u) = t0;" } },
+    /* (addressonly): the address, never the memory */
+    { { 0x0f, 0x01, 0x3b },             3, "invlpg [ebx]",    OPCC_UOP_NOP,
+        { "t0 = a0;", "OPCC_RC_OP_INVLPG(" } },
+};
+
+static int has_mem_uop(const opcc_window_insn *d,const unsigned int op) {
+    const opcc_uop_range *r = &opcc_uop_templates[opcc_uop_template[d->opcode][0]];
+    unsigned int i,found = 0;
+
+    for (i=0;i < r->count;i++) {
+        const opcc_uop *u = &opcc_uops[r->first + i];
+
+        if (u->op == OPCC_UOP_LOAD && u->src == OPCC_UOPR_EA) found |= 1u << OPCC_UOP_LOAD;
+        if (u->op == OPCC_UOP_STORE && u->dst == OPCC_UOPR_EA) found |= 1u << OPCC_UOP_STORE;
+    }
+
+    if (op == OPCC_UOP_NOP) return found == 0;
+    return (found & (1u << op)) != 0;
+}
+
+int main(void) {
+    const size_t count = sizeof(checks) / sizeof(checks[0]);
+    unsigned int bad = 0;
+    size_t i,j;
+
+    for (i=0;i < count;i++) {
+        opcc_window_insn d;
+        uint8_t w[32];
+        char block[1024];
+        const char *p;
+
+        memset(w,0x90,sizeof(w));
+        memcpy(w,checks[i].bytes,checks[i].length);
+        if (opcc_decode_window(w,3,&d) < 0 || d.length != checks[i].length) {
+            bad++;
+            printf("%s: does not decode\n",checks[i].name);
+            continue;
+        }
+
+        if (!has_mem_uop(&d,checks[i].uop)) {
+            bad++;
+            printf("%s: micro-ops do not %s the memory operand\n",checks[i].name,
+                checks[i].uop == OPCC_UOP_LOAD ? "load" : checks[i].uop == OPCC_UOP_STORE ? "store" : "leave alone");
+        }
+
+        opcc_recomp_insn(block,sizeof(block),&d,0x1000,3);
+        for (p=block,j=0;j < 4 && checks[i].text[j] != NULL;j++) {
+            const char *f = strstr(p,checks[i].text[j]);
+
+            if (f == NULL) {
+                bad++;
+                printf("%s: no '%s' in %s\n",checks[i].name,checks[i].text[j],block);
+                break;
+            }
+            p = f + strlen(checks[i].text[j]);
+        }
+    }
+
+    printf("%zu opcodes, %u bad\n",count,bad);
+    return bad != 0 ? 1 : 0;
+}
@@ -0,0 +1,149 @@
+/* decoder check against known encodings: byte strings and lengths as the Intel manuals (and objdump) have them,
+ * 32-bit code, with the mnemonic the description uses. emitcheck only shows that the emitter and the decoder
+ * agree, which they do even where the description has an opcode wrong, so this is the check on the description
+ * itself. instructions the description does not have yet (MOVZX, IMUL r,r/m) are left out.
+ *
+ * make refcheck, then ./refcheck */
+#include <stdio.h>
+#include <string.h>
+
+#include "opcc_gen.h"
+
+typedef struct ref_insn {
+    uint8_t         bytes[15];
+    unsigned int    length;
+    const char      *mnemonic;
+} ref_insn;
+
+static const ref_insn refs[] = {
+    { { 0xc0, 0xe0, 0x05 },                      3, "shl" },
+    { { 0xc1, 0xe0, 0x05 },                      3, "shl" },
+    { { 0x66, 0xc1, 0xe0, 0x05 },                4, "shl" },
+    { { 0xd1, 0xe0 },                            2, "shl" },
+    { { 0xd3, 0xe0 },                            2, "shl" },
+    { { 0x60 },                                  1, "pusha" },
+    { { 0x61 },                                  1, "popa" },
+    { { 0x0f, 0x06 },                            2, "clts" },
+    { { 0x0f, 0x0b },                            2, "ud2" },
+    { { 0x83, 0xc1, 0xfb },                      3, "add" },
+    { { 0x81, 0xc1, 0x78, 0x56, 0x34, 0x12 },    6, "add" },
+    { { 0x05, 0x78, 0x56, 0x34, 0x12 },          5, "add" },
+    { { 0x04, 0x01 },                            2, "add" },
+    { { 0x66, 0x05, 0x34, 0x12 },                4, "add" },
+    { { 0x8b, 0x44, 0xb3, 0x08 },                4, "mov" },
+    { { 0x8b, 0x04, 0x24 },                      3, "mov" },
+    { { 0x8b, 0x45, 0x00 },                      3, "mov" },
+    { { 0x8b, 0x05, 0x78, 0x56, 0x34, 0x12 },    6, "mov" },
+    { { 0x8b, 0x84, 0x24, 0x00, 0x01, 0x00, 0x00 }, 7, "mov" },
+    { { 0x67, 0x8b, 0x00 },                      3, "mov" },
+    { { 0x67, 0x8b, 0x46, 0x08 },                4, "mov" },
+    { { 0xa1, 0x78, 0x56, 0x34, 0x12 },          5, "mov" },
+    { { 0x67, 0xa1, 0x34, 0x12 },                4, "mov" },
+    { { 0xc7, 0x00, 0x78, 0x56, 0x34, 0x12 },    6, "mov" },
+    { { 0x66, 0xc7, 0x00, 0x34, 0x12 },          5, "mov" },
+    { { 0xc6, 0x00, 0x12 },                      3, "mov" },
+    { { 0x8c, 0xd8 },                            2, "mov" },
+    { { 0x8e, 0xd8 },                            2, "mov" },
+    { { 0x0f, 0x20, 0xc0 },                      3, "mov" },
+    { { 0xe8, 0x00, 0x00, 0x00, 0x00 },          5, "call" },
+    { { 0xff, 0xd0 },                            2, "call" },
+    { { 0xff, 0x14, 0x24 },                      3, "call" },
+    { { 0x9a, 0x78, 0x56, 0x34, 0x12, 0x34, 0x12 }, 7, "call" },
+    { { 0xeb, 0xfe },                            2, "jmp" },
+    { { 0xe9, 0x00, 0x00, 0x00, 0x00 },          5, "jmp" },
+    { { 0xff, 0x24, 0x24 },                      3, "jmp" },
+    { { 0xea, 0x78, 0x56, 0x34, 0x12, 0x34, 0x12 }, 7, "jmp" },
+    { { 0x0f, 0x84, 0x00, 0x00, 0x00, 0x00 },    6, "jz" },
+    { { 0x74, 0xfe },                            2, "jz" },
+    { { 0xe3, 0xfe },                            2, "jcxz" },
+    { { 0xe2, 0xfe },                            2, "loop" },
+    { { 0xc3 },                                  1, "ret" },
+    { { 0xc2, 0x08, 0x00 },                      3, "ret" },
+    { { 0xca, 0x08, 0x00 },                      3, "retf" },
+    { { 0xc8, 0x10, 0x00, 0x01 },                4, "enter" },
+    { { 0xc9 },                                  1, "leave" },
+    { { 0x6a, 0x12 },                            2, "push" },
+    { { 0x68, 0x78, 0x56, 0x34, 0x12 },          5, "push" },
+    { { 0xff, 0x30 },                            2, "push" },
+    { { 0x0e },                                  1, "push" },
+    { { 0x8f, 0x00 },                            2, "pop" },
+    { { 0x69, 0xc0, 0x78, 0x56, 0x34, 0x12 },    6, "imul" },
+    { { 0x6b, 0xc0, 0x05 },                      3, "imul" },
+    { { 0xf6, 0xe9 },                            2, "imul" },
+    { { 0xf3, 0xa5 },                            2, "movsd" },
+    { { 0xa4 },                                  1, "movsb" },
+    { { 0xf3, 0xab },                            2, "stosd" },
+    { { 0xf2, 0xae },                            2, "scasb" },
+    { { 0x8d, 0x04, 0x40 },                      3, "lea" },
+    { { 0xcd, 0x21 },                            2, "int" },
+    { { 0xcc },                                  1, "int" },
+    { { 0xd4, 0x0a },                            2, "aam" },
+    { { 0xd5, 0x0a },                            2, "aad" },
+    { { 0x0f, 0xa2 },                            2, "cpuid" },
+    { { 0x0f, 0x31 },                            2, "rdtsc" },
+    { { 0x0f, 0x01, 0x10 },                      3, "lgdt" },
+    { { 0x0f, 0x01, 0xe0 },                      3, "smsw" },
+    { { 0x0f, 0x00, 0xc8 },                      3, "str" },
+    { { 0x0f, 0x02, 0xc1 },                      3, "lar" },
+    { { 0xf0, 0x0f, 0xc7, 0x0e },                4, "cmpxchg8b" },
+    { { 0x0f, 0xc1, 0xc8 },                      3, "xadd" },
+    { { 0x0f, 0xc8 },                            2, "bswap" },
+    { { 0x0f, 0xba, 0xe0, 0x05 },                4, "bt" },
+    { { 0xd9, 0xe8 },                            2, "fld1" },
+    { { 0xdd, 0x04, 0x24 },                      3, "fld" },
+    { { 0xdb, 0x2c, 0x24 },                      3, "fld" },
+    { { 0xd8, 0xc1 },                            2, "fadd" },
+    { { 0xdc, 0xc1 },                            2, "fadd" },
+    { { 0xde, 0xc1 },                            2, "fadd" },
+    { { 0xd9, 0x7c, 0x24, 0xfe },                4, "fstcw" },
+    { { 0x0f, 0x6f, 0xc1 },                      3, "movq" },
+    { { 0x0f, 0x7f, 0x00 },                      3, "movq" },
+    { { 0x0f, 0x71, 0xd0, 0x05 },                4, "psrlw" },
+    { { 0x0f, 0x77 },                            2, "emms" },
+    { { 0x0f, 0x28, 0xc1 },                      3, "movaps" },
+    { { 0xf3, 0x0f, 0x10, 0xc1 },                4, "movss" },
+    { { 0x0f, 0xc6, 0xc1, 0x05 },                4, "shufps" },
+    { { 0x0f, 0x70, 0xc1, 0x05 },                4, "pshufw" },
+    { { 0x0f, 0x18, 0x00 },                      3, "prefetchnta" },
+    { { 0x0f, 0xae, 0x18 },                      3, "stmxcsr" },
+};
+
+/* the mnemonic is the first word of the text after any prefixes */
+static int same_mnemonic(const char *line,const char *m) {
+    const size_t n = strlen(m);
+    const char *s = line;
+
+    while (!strncmp(s,"lock ",5) || !strncmp(s,"rep",3)) {
+        const char *sp = strchr(s,' ');
+
+        if (sp == NULL) break;
+        s = sp + 1;
+    }
+    return !strncmp(s,m,n) && (s[n] == 0 || s[n] == ' ');
+}
+
+int main(void) {
+    const size_t count = sizeof(refs) / sizeof(refs[0]);
+    unsigned int bad = 0;
+    size_t i;
+
+    for (i=0;i < count;i++) {
+        opcc_window_insn d;
+        uint8_t w[32];
+        char line[128];
+        int r;
+
+        memset(w,0x90,sizeof(w));
+        memcpy(w,refs[i].bytes,refs[i].length);
+        r = opcc_decode_window(w,3,&d);
+        line[0] = 0;
+        if (r >= 0) opcc_format_insn(line,sizeof(line),&d,0,3);
+        if (r >= 0 && d.length == refs[i].length && same_mnemonic(line,refs[i].mnemonic)) continue;
+
+        bad++;
+        printf("%s, %u bytes: decodes as '%s', %u bytes\n",refs[i].mnemonic,refs[i].length,line,r >= 0 ? (unsigned int)d.length : 0u);
+    }
+
+    printf("%zu encodings, %u bad\n",count,bad);
+    return bad != 0 ? 1 : 0;
+}